@@ -99,6 +99,9 @@ orc_test_gcc_compile (OrcProgram *p)
   if (strcmp (orc_target_get_name (target), "sse") == 0) {
     flags |= ORC_TARGET_SSE_SHORT_JUMPS;
   }
+  if (strcmp (orc_target_get_name (target), "avx2") == 0) {
+    flags |= ORC_TARGET_AVX_SHORT_JUMPS;
+  }
   if (strcmp (orc_target_get_name (target), "mmx") == 0) {
     flags |= ORC_TARGET_MMX_SHORT_JUMPS;
   }
@@ -537,6 +540,9 @@ float_compare (OrcArray *array1, OrcArray *array2, int i, int j)
   return FALSE;
 }
 
+static OrcTestResult orc_test_compare_output_internal (OrcProgram *program,
+    OrcProgram *reference, int n, int m, int misalignment, int flags);
+
 OrcTestResult
 orc_test_compare_output (OrcProgram *program)
 {
@@ -549,13 +555,42 @@ orc_test_compare_output_backup (OrcProgram *program)
   return orc_test_compare_output_full (program, ORC_TEST_FLAGS_BACKUP);
 }
 
-
 OrcTestResult
 orc_test_compare_output_full (OrcProgram *program, int flags)
+{
+  return orc_test_compare_output_internal (program, program, -1, -1, 0,
+      flags);
+}
+
+/* Compares with the emulator for n and m (m only for 2D programs).  The
+ * first array is misaligned by misalignment elements, each following one
+ * by one more, or by the same with ORC_TEST_FLAGS_SAME_ALIGNMENT.  With
+ * ORC_TEST_FLAGS_COMPILED, the code the program was already compiled to
+ * is run, instead of compiling it for the default target. */
+OrcTestResult
+orc_test_compare_output_n (OrcProgram *program, int n, int m,
+    int misalignment, int flags)
+{
+  return orc_test_compare_output_internal (program, program, n, m,
+      misalignment, flags);
+}
+
+/* Compares program with the emulator running reference, which has the
+ * same sources, destinations and accumulator, with the parameters of
+ * both set to 2 */
+OrcTestResult
+orc_test_compare_output_reference (OrcProgram *program,
+    OrcProgram *reference, int flags)
+{
+  return orc_test_compare_output_internal (program, reference, -1, -1, 0,
+      flags);
+}
+
+static OrcTestResult
+orc_test_compare_output_internal (OrcProgram *program, OrcProgram *reference,
+    int n, int m, int misalignment, int flags)
 {
   OrcExecutor *ex;
-  int n;
-  int m;
   OrcArray *dest_exec[4] = { NULL, NULL, NULL, NULL };
   OrcArray *dest_emul[4] = { NULL, NULL, NULL, NULL };
   OrcArray *src[8] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
@@ -568,11 +603,12 @@ orc_test_compare_output_full (OrcProgram *program, int flags)
   int acc_exec = 0, acc_emul = 0;
   int ret = ORC_TEST_OK;
   int bad = 0;
-  int misalignment;
 
   ORC_DEBUG ("got here");
 
-  {
+  if (flags & ORC_TEST_FLAGS_COMPILED) {
+    if (program->orccode == NULL) return ORC_TEST_INDETERMINATE;
+  } else {
     OrcTarget *target;
     unsigned int flags;
 
@@ -590,10 +626,14 @@ orc_test_compare_output_full (OrcProgram *program, int flags)
       goto out;
     }
   }
+  if (reference->orccode == NULL) {
+    /* the emulator only needs the instructions */
+    orc_program_compile (reference);
+  }
 
   if (program->constant_n > 0) {
     n = program->constant_n;
-  } else {
+  } else if (n < 0) {
     n = 64 + (orc_random(&rand_context)&0xf);
   }
 
@@ -602,7 +642,7 @@ orc_test_compare_output_full (OrcProgram *program, int flags)
   if (program->is_2d) {
     if (program->constant_m > 0) {
       m = program->constant_m;
-    } else {
+    } else if (m < 0) {
       m = 8 + (orc_random(&rand_context)&0xf);
     }
   } else {
@@ -611,7 +651,28 @@ orc_test_compare_output_full (OrcProgram *program, int flags)
   orc_executor_set_m (ex, m);
   ORC_DEBUG("size %d %d", ex->n, ex->params[ORC_VAR_A1]);
 
-  misalignment = 0;
+  for(i=0;i<ORC_N_VARIABLES;i++){
+    OrcVariable *var = program->vars + i;
+
+    if (var->vartype != ORC_VAR_TYPE_PARAM) var = reference->vars + i;
+    if (var->vartype != ORC_VAR_TYPE_PARAM) continue;
+
+    switch (var->param_type) {
+      case ORC_PARAM_TYPE_INT:
+        orc_executor_set_param (ex, i, 2);
+        break;
+      case ORC_PARAM_TYPE_FLOAT:
+        orc_executor_set_param_float (ex, i, 2.0);
+        break;
+      case ORC_PARAM_TYPE_INT64:
+        orc_executor_set_param_int64 (ex, i, 2);
+        break;
+      case ORC_PARAM_TYPE_DOUBLE:
+        orc_executor_set_param_double (ex, i, 2.0);
+        break;
+    }
+  }
+
   for(i=0;i<ORC_N_VARIABLES;i++){
     if (program->vars[i].name == NULL) continue;
 
@@ -619,7 +680,7 @@ orc_test_compare_output_full (OrcProgram *program, int flags)
       src[i-ORC_VAR_S1] = orc_array_new (n, m, program->vars[i].size,
           misalignment, program->vars[i].alignment);
       orc_array_set_random (src[i-ORC_VAR_S1], &rand_context);
-      misalignment++;
+      if (!(flags & ORC_TEST_FLAGS_SAME_ALIGNMENT)) misalignment++;
     } else if (program->vars[i].vartype == ORC_VAR_TYPE_DEST) {
       dest_exec[i-ORC_VAR_D1] = orc_array_new (n, m, program->vars[i].size,
           misalignment, program->vars[i].alignment);
@@ -627,22 +688,7 @@ orc_test_compare_output_full (OrcProgram *program, int flags)
       dest_emul[i-ORC_VAR_D1] = orc_array_new (n, m, program->vars[i].size,
           misalignment, program->vars[i].alignment);
       orc_array_set_pattern (dest_emul[i], ORC_OOB_VALUE);
-      misalignment++;
-    } else if (program->vars[i].vartype == ORC_VAR_TYPE_PARAM) {
-      switch (program->vars[i].param_type) {
-        case ORC_PARAM_TYPE_INT:
-          orc_executor_set_param (ex, i, 2);
-          break;
-        case ORC_PARAM_TYPE_FLOAT:
-          orc_executor_set_param_float (ex, i, 2.0);
-          break;
-        case ORC_PARAM_TYPE_INT64:
-          orc_executor_set_param_int64 (ex, i, 2);
-          break;
-        case ORC_PARAM_TYPE_DOUBLE:
-          orc_executor_set_param_double (ex, i, 2.0);
-          break;
-      }
+      if (!(flags & ORC_TEST_FLAGS_SAME_ALIGNMENT)) misalignment++;
     }
   }
 
@@ -682,7 +728,9 @@ orc_test_compare_output_full (OrcProgram *program, int flags)
       orc_executor_set_stride (ex, i, src[i-ORC_VAR_S1]->stride);
     }
   }
+  orc_executor_set_program (ex, reference);
   orc_executor_emulate (ex);
+  orc_executor_set_program (ex, program);
   for(i=0;i<ORC_N_VARIABLES;i++){
     if (program->vars[i].vartype == ORC_VAR_TYPE_ACCUMULATOR) {
       acc_emul = ex->accumulators[0];
@@ -793,7 +841,9 @@ orc_test_compare_output_full (OrcProgram *program, int flags)
   orc_executor_free (ex);
 
 out:
-  orc_program_reset (program);
+  if (!(flags & ORC_TEST_FLAGS_COMPILED)) {
+    orc_program_reset (program);
+  }
 
   return ret;
 }
@@ -16,6 +16,8 @@ typedef enum {
 #define ORC_TEST_FLAGS_BACKUP (1<<0)
 #define ORC_TEST_FLAGS_FLOAT (1<<1)
 #define ORC_TEST_FLAGS_EMULATE (1<<2)
+#define ORC_TEST_FLAGS_COMPILED (1<<3)
+#define ORC_TEST_FLAGS_SAME_ALIGNMENT (1<<4)
 
 void orc_test_init (void);
 OrcTestResult orc_test_gcc_compile (OrcProgram *p);
@@ -26,6 +28,10 @@ void orc_test_random_bits (void *data, int n_bytes);
 OrcTestResult orc_test_compare_output (OrcProgram *program);
 OrcTestResult orc_test_compare_output_full (OrcProgram *program, int flags);
 OrcTestResult orc_test_compare_output_backup (OrcProgram *program);
+OrcTestResult orc_test_compare_output_n (OrcProgram *program, int n, int m,
+    int misalignment, int flags);
+OrcTestResult orc_test_compare_output_reference (OrcProgram *program,
+    OrcProgram *reference, int flags);
 
 OrcProgram *orc_test_get_program_for_opcode (OrcStaticOpcode *opcode);
 OrcProgram *orc_test_get_program_for_opcode_const (OrcStaticOpcode *opcode);
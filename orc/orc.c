@@ -20,6 +20,8 @@
 void _orc_debug_init(void);
 void _orc_once_init(void);
 void _orc_compiler_init(void);
+void _orc_code_init(void);
+void _orc_code_cache_init(void);
 
 /**
  * orc_init:
@@ -33,14 +35,16 @@ orc_init (void)
 {
   static volatile int inited = FALSE;
 
-  if (!inited) {
+  if (!orc_atomic_int_get (&inited)) {
     orc_global_mutex_lock ();
     if (!inited) {
       ORC_ASSERT(sizeof(OrcExecutor) == sizeof(OrcExecutorAlt));
 
       _orc_debug_init();
       _orc_compiler_init();
+      _orc_code_init();
       orc_opcode_init();
+      _orc_optimize_init();
       orc_c_init();
 #ifdef ENABLE_BACKEND_C64X
       orc_c64x_c_init();
@@ -50,6 +54,10 @@ orc_init (void)
 #endif
 #ifdef ENABLE_BACKEND_SSE
       orc_sse_init();
+      orc_avx_init();
+#endif
+#if defined(ENABLE_BACKEND_MMX) || defined(ENABLE_BACKEND_SSE)
+      _orc_x86_schedule_init();
 #endif
 #ifdef ENABLE_BACKEND_ALTIVEC
       orc_powerpc_init();
@@ -63,8 +71,10 @@ orc_init (void)
 #ifdef ENABLE_BACKEND_MIPS
       orc_mips_init();
 #endif
+      /* after the backends, which detect the CPU */
+      _orc_code_cache_init();
 
-      inited = TRUE;
+      orc_atomic_int_set (&inited, TRUE);
     }
     orc_global_mutex_unlock ();
   }
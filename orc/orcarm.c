@@ -13,6 +13,7 @@
 #include <orc/orcprogram.h>
 #include <orc/orcarm.h>
 #include <orc/orcutils.h>
+#include <orc/orcinternal.h>
 
 #ifdef HAVE_ARM
 #if defined(__APPLE__)
@@ -67,6 +68,7 @@ orc_arm_reg_name (int reg)
 void
 orc_arm_emit (OrcCompiler *compiler, orc_uint32 insn)
 {
+  _orc_compiler_check_code (compiler, 4);
   ORC_WRITE_UINT32_LE (compiler->codeptr, insn);
   compiler->codeptr+=4;
 }
@@ -179,12 +181,11 @@ orc_arm_emit_label (OrcCompiler *compiler, int label)
 void
 orc_arm_add_fixup (OrcCompiler *compiler, int label, int type)
 {
-  ORC_ASSERT (compiler->n_fixups < ORC_N_FIXUPS);
+  OrcFixup *fixup = orc_compiler_new_fixup (compiler);
 
-  compiler->fixups[compiler->n_fixups].ptr = compiler->codeptr;
-  compiler->fixups[compiler->n_fixups].label = label;
-  compiler->fixups[compiler->n_fixups].type = type;
-  compiler->n_fixups++;
+  fixup->ptr = compiler->codeptr;
+  fixup->label = label;
+  fixup->type = type;
 }
 
 void
@@ -192,12 +193,12 @@ orc_arm_do_fixups (OrcCompiler *compiler)
 {
   int i;
   for(i=0;i<compiler->n_fixups;i++){
-    unsigned char *label = compiler->labels[compiler->fixups[i].label];
-    unsigned char *ptr = compiler->fixups[i].ptr;
+    unsigned char *label = compiler->labels[compiler->fixup_table[i].label];
+    unsigned char *ptr = compiler->fixup_table[i].ptr;
     orc_uint32 code;
     int diff;
 
-    if (compiler->fixups[i].type == 0) {
+    if (compiler->fixup_table[i].type == 0) {
       code = ORC_READ_UINT32_LE (ptr);
       diff = code;
       diff = (diff << 8) >> 8;
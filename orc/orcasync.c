@@ -0,0 +1,574 @@
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <orc/orcprogram.h>
+#include <orc/orcdebug.h>
+#include <orc/orconce.h>
+#include <orc/orcinternal.h>
+
+/*
+ * Background compilation
+ *
+ * orc_program_compile_async() only does the cheap part of a compile on
+ * the calling thread, enough for orc_executor_emulate() to run the
+ * program, and queues the rest for a worker thread.  The worker
+ * compiles a private copy of the program, so that executors running the
+ * program in the meantime never see a half compiled state, and then
+ * publishes the result by swapping in the new OrcCode and code_exec.
+ *
+ * Executors may still be emulating from the old OrcCode after the swap,
+ * so it is kept with the job until the program is recompiled, reset or
+ * freed.
+ *
+ * orc_program_compile_many() uses the same workers, one task per worker
+ * that pulls programs off a shared list, and the calling thread joins
+ * in.
+ */
+
+#define ORC_ASYNC_MAX_WORKERS 32
+
+enum {
+  ORC_ASYNC_TASK_QUEUED,
+  ORC_ASYNC_TASK_RUNNING,
+  ORC_ASYNC_TASK_DONE
+};
+
+typedef struct _OrcAsyncTask OrcAsyncTask;
+typedef struct _OrcCompileJob OrcCompileJob;
+typedef struct _OrcCompileBatch OrcCompileBatch;
+
+struct _OrcAsyncTask {
+  void (*run) (OrcAsyncTask *task);
+  void *data;
+  volatile int state;
+
+  OrcAsyncTask *next;
+};
+
+struct _OrcCompileJob {
+  OrcAsyncTask task;
+
+  OrcProgram *program;
+  OrcTarget *target;
+  unsigned int flags;
+
+  OrcCode *old_code;
+  OrcCompileResult result;
+};
+
+struct _OrcCompileBatch {
+  OrcProgram **programs;
+  OrcCompileResult *results;
+  int n_programs;
+  int next;
+
+  OrcAsyncTask tasks[ORC_ASYNC_MAX_WORKERS];
+  int n_tasks;
+};
+
+static void orc_compile_job_run (OrcAsyncTask *task);
+static void orc_compile_batch_run (OrcAsyncTask *task);
+
+#if defined(HAVE_THREAD_PTHREAD)
+
+#include <pthread.h>
+
+#define ORC_ASYNC_THREADS
+
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t async_done_cond = PTHREAD_COND_INITIALIZER;
+
+static void
+orc_async_lock (void)
+{
+  pthread_mutex_lock (&async_mutex);
+}
+
+static void
+orc_async_unlock (void)
+{
+  pthread_mutex_unlock (&async_mutex);
+}
+
+static void
+orc_async_wait_queue (void)
+{
+  pthread_cond_wait (&async_queue_cond, &async_mutex);
+}
+
+static void
+orc_async_signal_queue (void)
+{
+  pthread_cond_signal (&async_queue_cond);
+}
+
+static void
+orc_async_wait_done (void)
+{
+  pthread_cond_wait (&async_done_cond, &async_mutex);
+}
+
+static void
+orc_async_signal_done (void)
+{
+  pthread_cond_broadcast (&async_done_cond);
+}
+
+static void *orc_async_worker (void *data);
+
+static int
+orc_async_get_n_cpus (void)
+{
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+  long n;
+
+  n = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n > 0) return n;
+#endif
+  return 1;
+}
+
+static int
+orc_async_start_worker (void)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  int ret;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+  ret = pthread_create (&thread, &attr, orc_async_worker, NULL);
+  pthread_attr_destroy (&attr);
+
+  return (ret == 0);
+}
+
+#elif defined(HAVE_THREAD_WIN32)
+
+#include <windows.h>
+
+#define ORC_ASYNC_THREADS
+
+static SRWLOCK async_mutex = SRWLOCK_INIT;
+static CONDITION_VARIABLE async_queue_cond = CONDITION_VARIABLE_INIT;
+static CONDITION_VARIABLE async_done_cond = CONDITION_VARIABLE_INIT;
+
+static void
+orc_async_lock (void)
+{
+  AcquireSRWLockExclusive (&async_mutex);
+}
+
+static void
+orc_async_unlock (void)
+{
+  ReleaseSRWLockExclusive (&async_mutex);
+}
+
+static void
+orc_async_wait_queue (void)
+{
+  SleepConditionVariableSRW (&async_queue_cond, &async_mutex, INFINITE, 0);
+}
+
+static void
+orc_async_signal_queue (void)
+{
+  WakeConditionVariable (&async_queue_cond);
+}
+
+static void
+orc_async_wait_done (void)
+{
+  SleepConditionVariableSRW (&async_done_cond, &async_mutex, INFINITE, 0);
+}
+
+static void
+orc_async_signal_done (void)
+{
+  WakeAllConditionVariable (&async_done_cond);
+}
+
+static void *orc_async_worker (void *data);
+
+static int
+orc_async_get_n_cpus (void)
+{
+  SYSTEM_INFO info;
+
+  GetSystemInfo (&info);
+  return info.dwNumberOfProcessors;
+}
+
+static DWORD WINAPI
+orc_async_worker_win32 (LPVOID data)
+{
+  orc_async_worker (data);
+  return 0;
+}
+
+static int
+orc_async_start_worker (void)
+{
+  HANDLE thread;
+
+  thread = CreateThread (NULL, 0, orc_async_worker_win32, NULL, 0, NULL);
+  if (thread == NULL) return FALSE;
+  CloseHandle (thread);
+
+  return TRUE;
+}
+
+#endif
+
+#ifdef ORC_ASYNC_THREADS
+static OrcAsyncTask *orc_async_queue;
+static OrcAsyncTask *orc_async_queue_tail;
+static int orc_async_n_workers;
+static int orc_async_max_workers;
+
+static void *
+orc_async_worker (void *data)
+{
+  OrcAsyncTask *task;
+
+  orc_async_lock ();
+  while (1) {
+    while (orc_async_queue == NULL) {
+      orc_async_wait_queue ();
+    }
+    task = orc_async_queue;
+    orc_async_queue = task->next;
+    if (orc_async_queue == NULL) orc_async_queue_tail = NULL;
+    task->state = ORC_ASYNC_TASK_RUNNING;
+    orc_async_unlock ();
+
+    task->run (task);
+
+    orc_async_lock ();
+    /* pairs with orc_program_compile_finished(), which doesn't lock */
+    orc_atomic_int_set (&task->state, ORC_ASYNC_TASK_DONE);
+    orc_async_signal_done ();
+  }
+
+  return NULL;
+}
+
+/* Must be called with the lock held */
+static int
+orc_async_get_max_workers (void)
+{
+  const char *envvar;
+  int n;
+
+  if (orc_async_max_workers == 0) {
+    envvar = getenv ("ORC_COMPILE_THREADS");
+    if (envvar && envvar[0]) {
+      n = strtol (envvar, NULL, 0);
+    } else {
+      n = orc_async_get_n_cpus ();
+    }
+    orc_async_max_workers = ORC_CLAMP (n, 1, ORC_ASYNC_MAX_WORKERS);
+  }
+  return orc_async_max_workers;
+}
+
+/* Must be called with the lock held.  Returns the number of workers,
+ * which may be less than asked for if starting threads fails. */
+static int
+orc_async_start_workers (int n_workers)
+{
+  n_workers = MIN (n_workers, orc_async_get_max_workers ());
+  while (orc_async_n_workers < n_workers) {
+    if (!orc_async_start_worker ()) {
+      ORC_WARNING ("failed to start compile thread");
+      break;
+    }
+    orc_async_n_workers++;
+  }
+  return orc_async_n_workers;
+}
+
+/* Must be called with the lock held */
+static void
+orc_async_push (OrcAsyncTask *task)
+{
+  task->state = ORC_ASYNC_TASK_QUEUED;
+  task->next = NULL;
+  if (orc_async_queue_tail) {
+    orc_async_queue_tail->next = task;
+  } else {
+    orc_async_queue = task;
+  }
+  orc_async_queue_tail = task;
+  orc_async_signal_queue ();
+}
+
+/* Must be called with the lock held.  Takes a task off the queue if no
+ * worker has started it yet. */
+static void
+orc_async_cancel (OrcAsyncTask *task)
+{
+  OrcAsyncTask **link;
+  OrcAsyncTask *prev = NULL;
+
+  if (task->state != ORC_ASYNC_TASK_QUEUED) return;
+
+  for(link=&orc_async_queue;*link;link=&(*link)->next){
+    if (*link == task) {
+      *link = task->next;
+      if (orc_async_queue_tail == task) orc_async_queue_tail = prev;
+      break;
+    }
+    prev = *link;
+  }
+  orc_atomic_int_set (&task->state, ORC_ASYNC_TASK_DONE);
+}
+#endif
+
+/* Compiles a copy of the program and publishes the result */
+static void
+orc_compile_job_run (OrcAsyncTask *task)
+{
+  OrcCompileJob *job = (OrcCompileJob *)task;
+  OrcProgram *program = job->program;
+  OrcProgram *copy;
+  OrcCompileResult result;
+
+  copy = _orc_program_copy (program);
+  copy->backup_func = program->backup_func;
+
+  result = orc_program_compile_full (copy, job->target, job->flags);
+
+  /* Nothing but executors touches the program while the job is pending,
+   * and those only read orccode and code_exec */
+  program->asm_code = copy->asm_code;
+  program->error_msg = copy->error_msg;
+  if (copy->orccode) {
+    job->old_code = orc_atomic_pointer_exchange (
+        (void * volatile *)&program->orccode, copy->orccode);
+  }
+  orc_atomic_pointer_exchange (&program->code_exec, copy->code_exec);
+  job->result = result;
+
+  ORC_INFO ("published code for program \"%s\"", program->name);
+
+  copy->asm_code = NULL;
+  copy->error_msg = NULL;
+  copy->orccode = NULL;
+  orc_program_free (copy);
+}
+
+/**
+ * orc_program_compile_async:
+ * @program: the OrcProgram to compile
+ *
+ * Compiles an Orc program for the default target in a background
+ * thread.  The program can be run right away: until the compiled code
+ * is ready, it runs the backup function, or is emulated if it has
+ * none.  The compiled code is then used by all following runs,
+ * including those of existing executors.
+ *
+ * The program must not be changed while it is being compiled.
+ * Recompiling, resetting or freeing the program waits for the
+ * background compile to finish.
+ */
+void
+orc_program_compile_async (OrcProgram *program)
+{
+  OrcCompileJob *job;
+  OrcTarget *target;
+  OrcCompileResult result;
+
+  /* Compiling without a target finishes an earlier job and sets up the
+   * OrcCode that the emulator needs, then fails on purpose */
+  result = orc_program_compile_full (program, NULL, 0);
+
+  job = malloc (sizeof(OrcCompileJob));
+  memset (job, 0, sizeof(OrcCompileJob));
+  target = orc_target_get_default ();
+  job->program = program;
+  job->target = target;
+  job->flags = target ? target->get_default_flags () : 0;
+  job->task.run = orc_compile_job_run;
+  job->task.state = ORC_ASYNC_TASK_DONE;
+  program->compile_job = job;
+
+  if (ORC_COMPILE_RESULT_IS_FATAL (result) || program->orccode == NULL) {
+    /* the program has errors, no point in trying */
+    job->result = result;
+    return;
+  }
+  orc_program_reset_error (program);
+  if (program->backup_func) {
+    program->code_exec = program->backup_func;
+  }
+
+#ifdef ORC_ASYNC_THREADS
+  orc_async_lock ();
+  if (orc_async_start_workers (1) > 0) {
+    orc_async_push (&job->task);
+    orc_async_unlock ();
+    return;
+  }
+  orc_async_unlock ();
+#endif
+
+  orc_compile_job_run (&job->task);
+}
+
+/**
+ * orc_program_compile_finished:
+ * @program: the OrcProgram
+ *
+ * Checks whether a compile started with orc_program_compile_async()
+ * has finished, without blocking.
+ *
+ * Returns: TRUE if the compile has finished or there is none
+ */
+orc_bool
+orc_program_compile_finished (OrcProgram *program)
+{
+  OrcCompileJob *job = program->compile_job;
+
+  return (job == NULL ||
+      orc_atomic_int_get (&job->task.state) == ORC_ASYNC_TASK_DONE);
+}
+
+/**
+ * orc_program_compile_wait:
+ * @program: the OrcProgram
+ *
+ * Waits for a compile started with orc_program_compile_async() to
+ * finish.
+ *
+ * Returns: the OrcCompileResult of that compile, or
+ * ORC_COMPILE_RESULT_OK if there is none
+ */
+OrcCompileResult
+orc_program_compile_wait (OrcProgram *program)
+{
+  OrcCompileJob *job = program->compile_job;
+
+  if (job == NULL) return ORC_COMPILE_RESULT_OK;
+
+#ifdef ORC_ASYNC_THREADS
+  orc_async_lock ();
+  while (job->task.state != ORC_ASYNC_TASK_DONE) {
+    orc_async_wait_done ();
+  }
+  orc_async_unlock ();
+#endif
+
+  return job->result;
+}
+
+/* Called before anything that changes the code of the program */
+void
+_orc_async_finish (OrcProgram *program)
+{
+  OrcCompileJob *job = program->compile_job;
+
+  if (job == NULL) return;
+
+  orc_program_compile_wait (program);
+  if (job->old_code) orc_code_free (job->old_code);
+  free (job);
+  program->compile_job = NULL;
+}
+
+/* Compiles programs off the list until there are none left */
+static void
+orc_compile_batch_run (OrcAsyncTask *task)
+{
+  OrcCompileBatch *batch = task->data;
+  OrcCompileResult result;
+  int i;
+
+  while (1) {
+#ifdef ORC_ASYNC_THREADS
+    orc_async_lock ();
+    i = batch->next++;
+    orc_async_unlock ();
+#else
+    i = batch->next++;
+#endif
+    if (i >= batch->n_programs) break;
+
+    result = orc_program_compile (batch->programs[i]);
+    if (batch->results) batch->results[i] = result;
+  }
+}
+
+/**
+ * orc_program_compile_many:
+ * @programs: an array of OrcPrograms
+ * @n_programs: the number of programs
+ * @results: an array of @n_programs results, or NULL
+ *
+ * Compiles the programs for the default target, like calling
+ * orc_program_compile() on each of them, but spread over a pool of
+ * threads with one thread per CPU, or as many as the ORC_COMPILE_THREADS
+ * environment variable says.  The calling thread takes part and
+ * the function returns when all programs are compiled.  If @results
+ * is not NULL, it receives the OrcCompileResult of each program.
+ *
+ * The programs must all be different.
+ */
+void
+orc_program_compile_many (OrcProgram **programs, int n_programs,
+    OrcCompileResult *results)
+{
+  OrcCompileBatch *batch;
+  OrcAsyncTask task;
+#ifdef ORC_ASYNC_THREADS
+  int i;
+#endif
+
+  batch = malloc (sizeof(OrcCompileBatch));
+  memset (batch, 0, sizeof(OrcCompileBatch));
+  batch->programs = programs;
+  batch->results = results;
+  batch->n_programs = n_programs;
+
+#ifdef ORC_ASYNC_THREADS
+  orc_async_lock ();
+  /* the calling thread is one of the compilers */
+  batch->n_tasks = MIN (orc_async_get_max_workers () - 1, n_programs - 1);
+  if (batch->n_tasks > 0) {
+    batch->n_tasks = orc_async_start_workers (batch->n_tasks);
+  }
+  for(i=0;i<batch->n_tasks;i++){
+    batch->tasks[i].run = orc_compile_batch_run;
+    batch->tasks[i].data = batch;
+    orc_async_push (batch->tasks + i);
+  }
+  orc_async_unlock ();
+#endif
+
+  memset (&task, 0, sizeof(task));
+  task.data = batch;
+  orc_compile_batch_run (&task);
+
+#ifdef ORC_ASYNC_THREADS
+  /* Workers that haven't got to the batch yet have nothing left to do */
+  orc_async_lock ();
+  for(i=0;i<batch->n_tasks;i++){
+    orc_async_cancel (batch->tasks + i);
+    while (batch->tasks[i].state != ORC_ASYNC_TASK_DONE) {
+      orc_async_wait_done ();
+    }
+  }
+  orc_async_unlock ();
+#endif
+
+  free (batch);
+}
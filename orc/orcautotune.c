@@ -0,0 +1,235 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#include <orc/orcprogram.h>
+#include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
+
+/*
+ * Autotuning
+ *
+ * With the "autotune" flag in ORC_CODE, a program is compiled with a
+ * few loop shapes: the full vector width or half of it (loop_shift),
+ * each with one or two copies of the loop body per iteration
+ * (unroll_shift).  Each version is timed on made-up data, and the
+ * fastest is kept if it beats the target's own choice by more than
+ * the noise.  Targets that don't look at the shape give the same code
+ * for all of them, and versions that come out the same as an earlier
+ * one aren't timed again.
+ *
+ * The choice is part of the OrcCode, so it goes into the code cache.
+ * With ORC_CACHE_DIR set, it is made once and later processes load
+ * the tuned code from there.
+ */
+
+#define ORC_AUTOTUNE_N 1024
+#define ORC_AUTOTUNE_M 4
+#define ORC_AUTOTUNE_ROUNDS 16
+#define ORC_AUTOTUNE_RUNS 32
+
+/* a shape is kept when it takes less than 90% of the default time */
+#define ORC_AUTOTUNE_MARGIN 0.90
+
+static const OrcTuning orc_autotune_shapes[] = {
+  { 0, 0 },
+  { 0, 1 },
+  { 1, 0 },
+  { 1, 1 }
+};
+#define ORC_AUTOTUNE_N_SHAPES \
+  ((int)(sizeof(orc_autotune_shapes)/sizeof(orc_autotune_shapes[0])))
+
+static const OrcTuning orc_autotune_default = { 0, -1 };
+
+/* the target's own choice, and then each of the shapes */
+#define ORC_AUTOTUNE_N_VERSIONS (ORC_AUTOTUNE_N_SHAPES + 1)
+
+static double
+orc_autotune_get_time (void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_MONOTONIC_CLOCK)
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+#elif defined(HAVE_GETTIMEOFDAY)
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+/* loadoffw and the resampling loads read where their arguments point,
+ * which the made-up data doesn't cover */
+static int
+orc_autotune_can_run (OrcProgram *program)
+{
+  int i;
+
+  for(i=0;i<program->n_insns;i++){
+    unsigned int flags = program->insn_table[i].opcode->flags;
+
+    if ((flags & ORC_STATIC_OPCODE_LOAD) &&
+        (flags & ORC_STATIC_OPCODE_SCALAR) &&
+        !(flags & ORC_STATIC_OPCODE_INVARIANT)) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/* Compiles one version, and takes its code away from the program */
+static OrcCode *
+orc_autotune_compile (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, const OrcTuning *tuning)
+{
+  OrcCompileResult result;
+  OrcCode *code;
+
+  result = _orc_program_compile_tuned (program, target, flags, tuning);
+  code = program->orccode;
+  program->orccode = NULL;
+  program->code_exec = NULL;
+  free (program->asm_code);
+  program->asm_code = NULL;
+  free (program->error_msg);
+  program->error_msg = NULL;
+
+  if (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (result) || code == NULL ||
+      code->code_size == 0) {
+    if (code) orc_code_free (code);
+    return NULL;
+  }
+  return code;
+}
+
+static int
+orc_autotune_same_code (OrcCode *a, OrcCode *b)
+{
+  return a->code_size == b->code_size &&
+    memcmp (a->code, b->code, a->code_size) == 0;
+}
+
+/* Times the loop shapes for the program, which is left without
+ * compiled code.  Returns TRUE and sets *tuning if one of them is
+ * faster than the target's own choice. */
+int
+_orc_compiler_autotune (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, OrcTuning *tuning)
+{
+  OrcCode *codes[ORC_AUTOTUNE_N_VERSIONS];
+  double times[ORC_AUTOTUNE_N_VERSIONS];
+  void *arrays[ORC_N_VARIABLES];
+  OrcExecutor *ex;
+  int n, m;
+  int best;
+  int i, j, k;
+
+  if (!orc_autotune_can_run (program)) return FALSE;
+
+  if (program->constant_n) {
+    n = program->constant_n;
+  } else {
+    n = MAX (ORC_AUTOTUNE_N, program->n_minimum);
+    if (program->n_maximum) n = MIN (n, program->n_maximum);
+    if (program->n_multiple) n -= n % program->n_multiple;
+  }
+  if (n <= 0) return FALSE;
+  m = 1;
+  if (program->is_2d) {
+    m = program->constant_m ? program->constant_m : ORC_AUTOTUNE_M;
+  }
+
+  memset (codes, 0, sizeof(codes));
+  codes[0] = orc_autotune_compile (program, target, flags,
+      &orc_autotune_default);
+  if (codes[0] == NULL) return FALSE;
+  for(i=0;i<ORC_AUTOTUNE_N_SHAPES;i++){
+    codes[i+1] = orc_autotune_compile (program, target, flags,
+        orc_autotune_shapes + i);
+    for(j=0;j<=i && codes[i+1];j++){
+      if (codes[j] && orc_autotune_same_code (codes[i+1], codes[j])) {
+        orc_code_free (codes[i+1]);
+        codes[i+1] = NULL;
+      }
+    }
+  }
+
+  ex = orc_executor_new (program);
+  orc_executor_set_n (ex, n);
+  orc_executor_set_m (ex, m);
+  memset (arrays, 0, sizeof(arrays));
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    int size = program->vars[i].size;
+    orc_uint8 *ptr;
+
+    if (size == 0) continue;
+    /* small positive values, which are also normal floats */
+    ptr = malloc (size * n * m);
+    for(j=0;j<size*n*m;j++){
+      ptr[j] = 0x20 + (j * 37) % 31;
+    }
+    arrays[i] = ptr;
+    ex->params[i] = size * n;
+  }
+
+  /* The versions take turns, so that a slow patch on the machine
+   * doesn't hit one of them only */
+  for(i=0;i<ORC_AUTOTUNE_N_VERSIONS;i++){
+    times[i] = 0;
+  }
+  for(k=0;k<ORC_AUTOTUNE_ROUNDS;k++){
+    for(i=0;i<ORC_AUTOTUNE_N_VERSIONS;i++){
+      double start, t;
+
+      if (codes[i] == NULL) continue;
+      ex->arrays[ORC_VAR_A2] = codes[i];
+      start = orc_autotune_get_time ();
+      for(j=0;j<ORC_AUTOTUNE_RUNS;j++){
+        /* 2D code moves the pointers down the rows */
+        memcpy (ex->arrays + ORC_VAR_D1, arrays + ORC_VAR_D1,
+            (ORC_VAR_S8 - ORC_VAR_D1 + 1) * sizeof(void *));
+        codes[i]->exec (ex);
+      }
+      t = orc_autotune_get_time () - start;
+      if (k == 0 || t < times[i]) times[i] = t;
+    }
+  }
+
+  best = 0;
+  for(i=1;i<ORC_AUTOTUNE_N_VERSIONS;i++){
+    if (codes[i] == NULL) continue;
+    ORC_INFO ("program %s, loop shift -%d, unroll shift %d: %g us",
+        program->name, orc_autotune_shapes[i-1].loop_shift_down,
+        orc_autotune_shapes[i-1].unroll_shift, 1e6 * times[i]);
+    if (times[i] < times[best] &&
+        times[i] < times[0] * ORC_AUTOTUNE_MARGIN) {
+      best = i;
+    }
+  }
+  ORC_INFO ("program %s, target's choice: %g us%s", program->name,
+      1e6 * times[0], best ? "" : ", kept");
+
+  orc_executor_free (ex);
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    free (arrays[i]);
+  }
+  for(i=0;i<ORC_AUTOTUNE_N_VERSIONS;i++){
+    if (codes[i]) orc_code_free (codes[i]);
+  }
+
+  if (best == 0) return FALSE;
+  *tuning = orc_autotune_shapes[best-1];
+  return TRUE;
+}
+
@@ -0,0 +1,158 @@
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include <orc/orcprogram.h>
+#include <orc/orcdebug.h>
+#include <orc/orcmmx.h>
+#include <orc/orcavx.h>
+#include <orc/orcx86insn.h>
+
+/**
+ * SECTION:orcavx
+ * @title: AVX
+ * @short_description: code generation for AVX2
+ */
+
+/* The AVX2 target runs the SSE rules on 256-bit registers, using the
+ * VEX encoding.  The VEX forms don't fault on unaligned memory
+ * operands, and the stack only keeps 16-byte alignment for the spill
+ * slots, so full vectors always move with vmovdqu. */
+
+
+const char *
+orc_x86_get_regname_avx(int i)
+{
+  static const char *x86_regs[] = {
+    "ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7",
+    "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15"
+  };
+
+  if (i>=X86_XMM0 && i<X86_XMM0 + 16) return x86_regs[i - X86_XMM0];
+  if (i>=X86_MM0 && i<X86_MM0 + 8) return "ERROR_MMX";
+  switch (i) {
+    case 0:
+      return "UNALLOCATED";
+    case 1:
+      return "direct";
+    default:
+      return "ERROR";
+  }
+}
+
+
+void
+orc_x86_emit_mov_memoffset_avx (OrcCompiler *compiler, int size, int offset,
+    int reg1, int reg2, int is_aligned)
+{
+  switch (size) {
+    case 4:
+      orc_sse_emit_movd_load_memoffset (compiler, offset, reg1, reg2);
+      break;
+    case 8:
+      orc_sse_emit_movq_load_memoffset (compiler, offset, reg1, reg2);
+      break;
+    case 16:
+      orc_sse_emit_movdqu_load_memoffset (compiler, offset, reg1, reg2);
+      break;
+    case 32:
+      orc_avx_emit_movdqu_load_memoffset (compiler, offset, reg1, reg2);
+      break;
+    default:
+      ORC_COMPILER_ERROR(compiler, "bad size");
+      break;
+  }
+}
+
+void
+orc_x86_emit_mov_memindex_avx (OrcCompiler *compiler, int size, int offset,
+    int reg1, int regindex, int shift, int reg2, int is_aligned)
+{
+  switch (size) {
+    case 4:
+      orc_sse_emit_movd_load_memindex (compiler, offset,
+          reg1, regindex, shift, reg2);
+      break;
+    case 8:
+      orc_sse_emit_movq_load_memindex (compiler, offset,
+          reg1, regindex, shift, reg2);
+      break;
+    case 16:
+      orc_sse_emit_movdqu_load_memindex (compiler, offset,
+          reg1, regindex, shift, reg2);
+      break;
+    case 32:
+      orc_avx_emit_movdqu_load_memindex (compiler, offset,
+          reg1, regindex, shift, reg2);
+      break;
+    default:
+      ORC_COMPILER_ERROR(compiler, "bad size");
+      break;
+  }
+}
+
+void
+orc_x86_emit_mov_avx_memoffset (OrcCompiler *compiler, int size, int reg1, int offset,
+    int reg2, int aligned, int uncached)
+{
+  switch (size) {
+    case 4:
+      orc_sse_emit_movd_store_memoffset (compiler, offset, reg1, reg2);
+      break;
+    case 8:
+      orc_sse_emit_movq_store_memoffset (compiler, offset, reg1, reg2);
+      break;
+    case 16:
+      orc_sse_emit_movdqu_store_memoffset (compiler, offset, reg1, reg2);
+      break;
+    case 32:
+      orc_avx_emit_movdqu_store_memoffset (compiler, offset, reg1, reg2);
+      break;
+    default:
+      ORC_COMPILER_ERROR(compiler, "bad size");
+      break;
+  }
+
+}
+
+void
+orc_avx_set_mxcsr (OrcCompiler *compiler)
+{
+  orc_sse_set_mxcsr (compiler);
+}
+
+void
+orc_avx_restore_mxcsr (OrcCompiler *compiler)
+{
+  orc_sse_restore_mxcsr (compiler);
+}
+
+/* Programs with opcodes that have no 256-bit rule are compiled by the
+ * sse target instead.  Called at the end of the compiler init. */
+void
+orc_avx_use_fallback (OrcCompiler *compiler)
+{
+  OrcTarget *target;
+  int i;
+
+  for(i=0;i<compiler->n_insns;i++){
+    OrcStaticOpcode *opcode = compiler->insn_table[i].opcode;
+
+    if (orc_target_get_rule (compiler->target, opcode,
+          compiler->target_flags) != NULL) continue;
+
+    target = orc_target_get_by_name ("sse");
+    if (target == NULL) return;
+    ORC_INFO("no avx2 rule for %s, using the sse target", opcode->name);
+    compiler->target = target;
+    compiler->use_vex = FALSE;
+    target->compiler_init (compiler);
+    return;
+  }
+}
+
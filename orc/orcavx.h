@@ -0,0 +1,37 @@
+
+#ifndef _ORC_AVX_H_
+#define _ORC_AVX_H_
+
+#include <orc/orcx86.h>
+#include <orc/orcx86insn.h>
+#include <orc/orcsse.h>
+
+ORC_BEGIN_DECLS
+
+#ifdef ORC_ENABLE_UNSTABLE_API
+
+#define ORC_AVX_SHUF(a,b,c,d) ((((a)&3)<<6)|(((b)&3)<<4)|(((c)&3)<<2)|(((d)&3)<<0))
+
+const char * orc_x86_get_regname_avx(int i);
+void orc_x86_emit_mov_memoffset_avx (OrcCompiler *compiler, int size, int offset,
+    int reg1, int reg2, int is_aligned);
+void orc_x86_emit_mov_memindex_avx (OrcCompiler *compiler, int size, int offset,
+    int reg1, int regindex, int shift, int reg2, int is_aligned);
+void orc_x86_emit_mov_avx_memoffset (OrcCompiler *compiler, int size, int reg1, int offset,
+    int reg2, int aligned, int uncached);
+
+void orc_avx_set_mxcsr (OrcCompiler *compiler);
+void orc_avx_restore_mxcsr (OrcCompiler *compiler);
+
+void orc_avx_load_constant (OrcCompiler *compiler, int reg, int size,
+    orc_uint64 value);
+void orc_avx_use_fallback (OrcCompiler *compiler);
+
+#endif
+
+unsigned int orc_avx_get_cpu_flags (void);
+
+ORC_END_DECLS
+
+#endif
+
@@ -5,6 +5,7 @@
 
 #include <orc/orc.h>
 #include <orc/orcbytecode.h>
+#include <orc/orcinternal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -153,7 +154,7 @@ orc_bytecode_from_program (OrcProgram *p)
   }
 
   for(i=0;i<p->n_insns;i++){
-    OrcInstruction *insn = p->insns + i;
+    OrcInstruction *insn = p->insn_table + i;
 
     if (insn->flags) {
       bytecode_append_code (bytecode, ORC_BC_INSTRUCTION_FLAGS);
@@ -489,7 +490,7 @@ orc_bytecode_parse_function (OrcProgram *program, const orc_uint8 *bytecode)
     } else {
       OrcInstruction *insn;
 
-      insn = program->insns + program->n_insns;
+      insn = _orc_program_next_insn (program);
 
       insn->opcode = opcode_set->opcodes + (bc - 32);
       if (insn->opcode->dest_size[0] != 0) {
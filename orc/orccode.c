@@ -7,6 +7,7 @@
 
 #include <orc/orcprogram.h>
 #include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
 
 
 OrcCode *
@@ -21,6 +22,11 @@ orc_code_new (void)
 void
 orc_code_free (OrcCode *code)
 {
+  if (code->cache_entry && _orc_code_cache_unref (code)) {
+    /* still used by other programs */
+    return;
+  }
+
   if (code->insns) {
     free (code->insns);
     code->insns = NULL;
@@ -40,6 +40,22 @@ struct _OrcCode {
   int is_2d;
   int constant_n;
   int constant_m;
+
+  /* set if the code is shared through the code cache */
+  void *cache_entry;
+
+  /* for producing the assembly listing on request */
+  OrcTarget *target;
+  unsigned int target_flags;
+
+  /* the loop shape picked by ORC_CODE=autotune, see OrcCompiler */
+  int is_tuned;
+  int tune_loop_shift_down;
+  int tune_unroll_shift;
+
+  /* instructions left after the optimizer, which the emulator doesn't
+   * run */
+  int n_compiled_insns;
 };
 
 
@@ -51,6 +67,20 @@ void orc_code_free (OrcCode *code);
 #ifdef ORC_ENABLE_UNSTABLE_API
 
 void orc_code_chunk_free (OrcCodeChunk *chunk);
+void orc_code_get_memory_usage (int *n_regions, long *region_bytes,
+    long *chunk_bytes);
+
+void orc_code_set_region_size (int size);
+int orc_code_get_region_size (void);
+void orc_code_set_huge_pages (orc_bool enable);
+void orc_code_set_release_delay (int msec);
+void orc_code_release_unused (void);
+orc_bool orc_code_compact (OrcProgram **programs, int n_programs);
+
+void orc_code_cache_get_stats (unsigned long *n_hits,
+    unsigned long *n_misses, int *n_entries);
+void orc_code_cache_get_disk_stats (unsigned long *n_hits,
+    unsigned long *n_misses);
 
 #endif
 
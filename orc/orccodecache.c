@@ -0,0 +1,757 @@
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <orc/orcprogram.h>
+#include <orc/orcbytecode.h>
+#include <orc/orcdebug.h>
+#include <orc/orconce.h>
+#include <orc/orcinternal.h>
+#include <orc/orclock.h>
+
+/**
+ * SECTION:orccodecache
+ * @title: Code Cache
+ * @short_description: Sharing compiled code between identical programs
+ *
+ * Programs that compile to the same bytecode, for the same target and
+ * target flags, share one #OrcCode.  The first compile does the work,
+ * later ones only take a reference.  The shared code is freed when the
+ * last program using it is freed or recompiled.
+ *
+ * The cache can be turned off with the "-cache" flag in the ORC_CODE
+ * environment variable.
+ *
+ * If the ORC_CACHE_DIR environment variable is set, compiled code is
+ * also saved in that directory, and loaded from there instead of
+ * compiling when another process compiles the same program.  Entries
+ * are only used by the same version of Orc, on the same kind of CPU,
+ * for the same target and target flags, and with the same flags in
+ * ORC_CODE.  So code tuned with the "autotune" flag is kept apart from
+ * code that isn't, and the tuning is only done once.
+ *
+ * Neither cache is used if the "debug" or "randomize" flags are set.
+ */
+
+#define ORC_CODE_CACHE_N_BUCKETS 256
+
+#define ORC_CODE_CACHE_MAGIC "orc-code-cache\n"
+#define ORC_CODE_CACHE_FORMAT 4
+
+typedef struct _OrcCodeCacheEntry OrcCodeCacheEntry;
+
+struct _OrcCodeCacheEntry {
+  OrcCodeCacheEntry *next;
+
+  orc_uint32 hash;
+  orc_uint8 *bytecode;
+  int length;
+  OrcTarget *target;
+  unsigned int flags;
+
+  OrcCode *code;
+  char *asm_code;
+  int refcount;
+};
+
+/* The following are protected by orc_code_cache_lock */
+static OrcLock orc_code_cache_lock = ORC_LOCK_INIT;
+static OrcCodeCacheEntry *orc_code_cache[ORC_CODE_CACHE_N_BUCKETS];
+static int orc_code_cache_n_entries;
+static unsigned long orc_code_cache_n_hits;
+static unsigned long orc_code_cache_n_misses;
+
+static unsigned long orc_code_cache_n_disk_hits;
+static unsigned long orc_code_cache_n_disk_misses;
+
+static int orc_code_cache_disabled;
+static char *orc_code_cache_dir;
+static char *orc_code_cache_config;
+
+void
+_orc_code_cache_init (void)
+{
+  const char *envvar;
+  char *flags;
+
+  orc_code_cache_disabled = orc_compiler_flag_check ("-cache");
+
+  envvar = getenv ("ORC_CACHE_DIR");
+  if (envvar && envvar[0]) {
+    orc_code_cache_dir = strdup (envvar);
+#ifdef HAVE_UNISTD_H
+    mkdir (orc_code_cache_dir, 0700);
+#endif
+  }
+
+  if (_orc_compiler_flag_debug || _orc_compiler_flag_randomize) {
+    orc_code_cache_disabled = TRUE;
+    free (orc_code_cache_dir);
+    orc_code_cache_dir = NULL;
+  }
+
+  /* Code generation depends on the CPU features, which are part of the
+   * target flags, on the cache sizes, and on the ORC_CODE flags, which
+   * turn passes off or tune the code */
+  flags = _orc_compiler_get_flags ();
+  orc_code_cache_config = malloc (strlen (_orc_cpu_name) + strlen (flags) +
+      100);
+  sprintf (orc_code_cache_config, "%s %d.%d.%d %d/%d/%d %s", _orc_cpu_name,
+      _orc_cpu_family, _orc_cpu_model, _orc_cpu_stepping,
+      _orc_data_cache_size_level1, _orc_data_cache_size_level2,
+      _orc_data_cache_size_level3, flags);
+  free (flags);
+}
+
+static orc_uint32
+orc_code_cache_hash_bytes (orc_uint32 hash, const void *data, int length)
+{
+  const orc_uint8 *ptr = data;
+  int i;
+
+  for(i=0;i<length;i++){
+    hash = (hash ^ ptr[i]) * 16777619U;
+  }
+  return hash;
+}
+
+static orc_uint32
+orc_code_cache_hash (const orc_uint8 *data, int length, OrcTarget *target,
+    unsigned int flags)
+{
+  orc_uint32 hash = 2166136261U;
+
+  hash = orc_code_cache_hash_bytes (hash, data, length);
+  hash = orc_code_cache_hash_bytes (hash, target->name, strlen (target->name));
+  hash = orc_code_cache_hash_bytes (hash, &flags, sizeof(flags));
+
+  return hash;
+}
+
+/* bytecode_append_int() can only encode values up to 65534 */
+static int
+orc_code_cache_fits (int value)
+{
+  return value >= 0 && value < 65535;
+}
+
+/* The bytecode only describes opcodes from the "sys" opcode set, and
+ * sizes, lengths and alignments that fit its int encoding */
+static int
+orc_code_cache_can_cache (OrcProgram *program, OrcTarget *target)
+{
+  OrcOpcodeSet *opcode_set;
+  int i;
+
+  if (orc_code_cache_disabled && orc_code_cache_dir == NULL) return FALSE;
+  if (target == NULL || !target->executable) return FALSE;
+  if (_orc_compiler_flag_emulate || _orc_compiler_flag_backup) return FALSE;
+
+  if (!orc_code_cache_fits (program->constant_n) ||
+      !orc_code_cache_fits (program->constant_m) ||
+      !orc_code_cache_fits (program->n_multiple) ||
+      !orc_code_cache_fits (program->n_minimum) ||
+      !orc_code_cache_fits (program->n_maximum)) {
+    return FALSE;
+  }
+  for(i=0;i<ORC_N_VARIABLES;i++){
+    if (!orc_code_cache_fits (program->vars[i].size) ||
+        !orc_code_cache_fits (program->vars[i].alignment)) {
+      return FALSE;
+    }
+  }
+
+  opcode_set = orc_opcode_set_get ("sys");
+  for(i=0;i<program->n_insns;i++){
+    OrcStaticOpcode *opcode = program->insn_table[i].opcode;
+
+    if (opcode < opcode_set->opcodes ||
+        opcode >= opcode_set->opcodes + opcode_set->n_opcodes) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/* Must be called with orc_code_cache_lock held */
+static OrcCodeCacheEntry *
+orc_code_cache_find (OrcBytecode *bytecode, orc_uint32 hash,
+    OrcTarget *target, unsigned int flags)
+{
+  OrcCodeCacheEntry *entry;
+
+  for(entry = orc_code_cache[hash % ORC_CODE_CACHE_N_BUCKETS]; entry;
+      entry = entry->next) {
+    if (entry->hash == hash && entry->target == target &&
+        entry->flags == flags && entry->length == bytecode->length &&
+        memcmp (entry->bytecode, bytecode->bytecode, bytecode->length) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static void orc_code_cache_add (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, OrcBytecode *key);
+
+
+/* On-disk cache.  Files hold a header that has to match exactly,
+ * followed by the emulation data and machine code of the OrcCode, and
+ * a checksum over everything. */
+
+typedef struct _OrcCodeCacheBuffer OrcCodeCacheBuffer;
+
+struct _OrcCodeCacheBuffer {
+  orc_uint8 *data;
+  int length;
+  int alloc_len;
+
+  /* for reading */
+  int offset;
+  int error;
+};
+
+static void
+orc_code_cache_buffer_append (OrcCodeCacheBuffer *buffer, const void *data,
+    int length)
+{
+  if (buffer->length + length > buffer->alloc_len) {
+    buffer->alloc_len = (buffer->length + length) * 2;
+    buffer->data = realloc (buffer->data, buffer->alloc_len);
+  }
+  memcpy (buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
+
+static void
+orc_code_cache_buffer_append_int (OrcCodeCacheBuffer *buffer, int value)
+{
+  orc_int32 x = value;
+
+  orc_code_cache_buffer_append (buffer, &x, sizeof(x));
+}
+
+static void
+orc_code_cache_buffer_append_string (OrcCodeCacheBuffer *buffer,
+    const char *s)
+{
+  int length = strlen (s);
+
+  orc_code_cache_buffer_append_int (buffer, length);
+  orc_code_cache_buffer_append (buffer, s, length);
+}
+
+static const void *
+orc_code_cache_buffer_get (OrcCodeCacheBuffer *buffer, int length)
+{
+  const void *ptr;
+
+  if (buffer->error || length < 0 ||
+      length > buffer->length - buffer->offset) {
+    buffer->error = TRUE;
+    return NULL;
+  }
+  ptr = buffer->data + buffer->offset;
+  buffer->offset += length;
+  return ptr;
+}
+
+static int
+orc_code_cache_buffer_get_int (OrcCodeCacheBuffer *buffer)
+{
+  const void *ptr;
+  orc_int32 x;
+
+  ptr = orc_code_cache_buffer_get (buffer, sizeof(x));
+  if (ptr == NULL) return 0;
+  memcpy (&x, ptr, sizeof(x));
+  return x;
+}
+
+/* Reads a string into str, which has room for size bytes */
+static void
+orc_code_cache_buffer_get_string (OrcCodeCacheBuffer *buffer, char *str,
+    int size)
+{
+  const void *ptr;
+  int length;
+
+  str[0] = 0;
+  length = orc_code_cache_buffer_get_int (buffer);
+  if (length >= size) {
+    buffer->error = TRUE;
+    return;
+  }
+  ptr = orc_code_cache_buffer_get (buffer, length);
+  if (ptr == NULL) return;
+  memcpy (str, ptr, length);
+  str[length] = 0;
+}
+
+static void
+orc_code_cache_append_header (OrcCodeCacheBuffer *buffer,
+    OrcBytecode *bytecode, OrcTarget *target, unsigned int flags)
+{
+  orc_code_cache_buffer_append (buffer, ORC_CODE_CACHE_MAGIC,
+      strlen (ORC_CODE_CACHE_MAGIC));
+  orc_code_cache_buffer_append_int (buffer, ORC_CODE_CACHE_FORMAT);
+  orc_code_cache_buffer_append_string (buffer, VERSION);
+  orc_code_cache_buffer_append_int (buffer, sizeof(void *));
+  orc_code_cache_buffer_append_string (buffer, target->name);
+  orc_code_cache_buffer_append_int (buffer, flags);
+  orc_code_cache_buffer_append_string (buffer, orc_code_cache_config);
+  orc_code_cache_buffer_append_int (buffer, bytecode->length);
+  orc_code_cache_buffer_append (buffer, bytecode->bytecode,
+      bytecode->length);
+}
+
+static char *
+orc_code_cache_get_filename (OrcBytecode *bytecode, OrcTarget *target,
+    unsigned int flags)
+{
+  orc_uint32 hash1, hash2;
+  char *filename;
+
+  hash1 = orc_code_cache_hash (bytecode->bytecode, bytecode->length,
+      target, flags);
+  hash1 = orc_code_cache_hash_bytes (hash1, orc_code_cache_config,
+      strlen (orc_code_cache_config));
+  hash2 = orc_code_cache_hash_bytes (hash1 ^ 0x9e3779b9U,
+      bytecode->bytecode, bytecode->length);
+
+  filename = malloc (strlen (orc_code_cache_dir) + 32);
+  sprintf (filename, "%s/%08x%08x.orccode", orc_code_cache_dir,
+      hash1, hash2);
+  return filename;
+}
+
+static void
+orc_code_cache_save (OrcCode *code, OrcBytecode *bytecode,
+    OrcTarget *target, unsigned int flags)
+{
+  OrcCodeCacheBuffer buffer;
+  orc_uint32 checksum;
+  char *filename;
+  char *tmpname;
+  FILE *file;
+  int ret;
+  int i;
+
+  if (code->code_size == 0) return;
+
+  memset (&buffer, 0, sizeof(buffer));
+  orc_code_cache_append_header (&buffer, bytecode, target, flags);
+
+  orc_code_cache_buffer_append_int (&buffer, code->result);
+  orc_code_cache_buffer_append_int (&buffer, code->is_2d);
+  orc_code_cache_buffer_append_int (&buffer, code->constant_n);
+  orc_code_cache_buffer_append_int (&buffer, code->constant_m);
+  orc_code_cache_buffer_append_int (&buffer, code->is_tuned);
+  orc_code_cache_buffer_append_int (&buffer, code->tune_loop_shift_down);
+  orc_code_cache_buffer_append_int (&buffer, code->tune_unroll_shift);
+  orc_code_cache_buffer_append_int (&buffer, code->n_compiled_insns);
+
+  /* opcodes are stored by name, the rest of the instruction as is */
+  orc_code_cache_buffer_append_int (&buffer, code->n_insns);
+  for(i=0;i<code->n_insns;i++){
+    OrcInstruction *insn = code->insns + i;
+
+    orc_code_cache_buffer_append_string (&buffer, insn->opcode->name);
+    orc_code_cache_buffer_append (&buffer, insn->dest_args,
+        sizeof(insn->dest_args));
+    orc_code_cache_buffer_append (&buffer, insn->src_args,
+        sizeof(insn->src_args));
+    orc_code_cache_buffer_append_int (&buffer, insn->flags);
+  }
+  orc_code_cache_buffer_append (&buffer, code->vars,
+      sizeof(OrcCodeVariable) * ORC_N_COMPILER_VARIABLES);
+
+  orc_code_cache_buffer_append_int (&buffer, code->code_size);
+  orc_code_cache_buffer_append (&buffer, code->code, code->code_size);
+
+  checksum = orc_code_cache_hash_bytes (2166136261U, buffer.data,
+      buffer.length);
+  orc_code_cache_buffer_append (&buffer, &checksum, sizeof(checksum));
+
+  /* Write to a temporary file and rename, so that other processes
+   * never see a partial file.  The code pointer keeps threads compiling
+   * the same program apart. */
+  filename = orc_code_cache_get_filename (bytecode, target, flags);
+  tmpname = malloc (strlen (filename) + 64);
+#ifdef HAVE_UNISTD_H
+  sprintf (tmpname, "%s.%d.%p.tmp", filename, (int)getpid (), (void *)code);
+#else
+  sprintf (tmpname, "%s.%p.tmp", filename, (void *)code);
+#endif
+
+  file = fopen (tmpname, "wb");
+  if (file == NULL) {
+    ORC_INFO ("failed to create %s", tmpname);
+  } else {
+    ret = fwrite (buffer.data, buffer.length, 1, file);
+    if (fclose (file) != 0) ret = 0;
+    if (ret != 1 || rename (tmpname, filename) != 0) {
+      ORC_INFO ("failed to write %s", filename);
+      remove (tmpname);
+    }
+  }
+
+  free (tmpname);
+  free (filename);
+  free (buffer.data);
+}
+
+static int
+orc_code_cache_read_file (const char *filename, OrcCodeCacheBuffer *buffer)
+{
+  FILE *file;
+  long size;
+  int ret;
+
+  memset (buffer, 0, sizeof(*buffer));
+
+  file = fopen (filename, "rb");
+  if (file == NULL) return FALSE;
+
+  ret = fseek (file, 0, SEEK_END);
+  size = ftell (file);
+  if (ret < 0 || size < (long)sizeof(orc_uint32) || size > 16*1024*1024) {
+    fclose (file);
+    return FALSE;
+  }
+  fseek (file, 0, SEEK_SET);
+
+  buffer->data = malloc (size);
+  buffer->length = size;
+  ret = fread (buffer->data, size, 1, file);
+  fclose (file);
+  if (ret != 1) {
+    free (buffer->data);
+    buffer->data = NULL;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static OrcCode *
+orc_code_cache_load (OrcBytecode *bytecode, OrcTarget *target,
+    unsigned int flags)
+{
+  OrcCodeCacheBuffer buffer;
+  OrcCodeCacheBuffer header;
+  OrcCode *code = NULL;
+  orc_uint32 checksum;
+  const void *ptr;
+  char *filename;
+  int match;
+  int i;
+
+  filename = orc_code_cache_get_filename (bytecode, target, flags);
+  if (!orc_code_cache_read_file (filename, &buffer)) {
+    free (filename);
+    return NULL;
+  }
+
+  /* The checksum catches truncated and corrupted files */
+  buffer.length -= sizeof(checksum);
+  memcpy (&checksum, buffer.data + buffer.length, sizeof(checksum));
+  if (checksum != orc_code_cache_hash_bytes (2166136261U, buffer.data,
+        buffer.length)) {
+    goto invalid;
+  }
+
+  /* The header has to match exactly, which also rules out hash
+   * collisions and files from other versions or CPUs */
+  memset (&header, 0, sizeof(header));
+  orc_code_cache_append_header (&header, bytecode, target, flags);
+  ptr = orc_code_cache_buffer_get (&buffer, header.length);
+  match = (ptr && memcmp (ptr, header.data, header.length) == 0);
+  free (header.data);
+  if (!match) goto invalid;
+
+  code = orc_code_new ();
+  code->target = target;
+  code->target_flags = flags;
+  code->result = orc_code_cache_buffer_get_int (&buffer);
+  code->is_2d = orc_code_cache_buffer_get_int (&buffer);
+  code->constant_n = orc_code_cache_buffer_get_int (&buffer);
+  code->constant_m = orc_code_cache_buffer_get_int (&buffer);
+  code->is_tuned = orc_code_cache_buffer_get_int (&buffer);
+  code->tune_loop_shift_down = orc_code_cache_buffer_get_int (&buffer);
+  code->tune_unroll_shift = orc_code_cache_buffer_get_int (&buffer);
+  code->n_compiled_insns = orc_code_cache_buffer_get_int (&buffer);
+
+  code->n_insns = orc_code_cache_buffer_get_int (&buffer);
+  /* each instruction takes more than one byte of the file */
+  if (code->n_insns < 0 || code->n_insns > buffer.length) goto invalid;
+  code->insns = malloc (sizeof(OrcInstruction) * (code->n_insns + 1));
+  memset (code->insns, 0, sizeof(OrcInstruction) * (code->n_insns + 1));
+  for(i=0;i<code->n_insns;i++){
+    OrcInstruction *insn = code->insns + i;
+    char name[40];
+
+    orc_code_cache_buffer_get_string (&buffer, name, sizeof(name));
+    if (buffer.error) goto invalid;
+    insn->opcode = orc_opcode_find_by_name (name);
+    if (insn->opcode == NULL) goto invalid;
+
+    ptr = orc_code_cache_buffer_get (&buffer, sizeof(insn->dest_args));
+    if (ptr) memcpy (insn->dest_args, ptr, sizeof(insn->dest_args));
+    ptr = orc_code_cache_buffer_get (&buffer, sizeof(insn->src_args));
+    if (ptr) memcpy (insn->src_args, ptr, sizeof(insn->src_args));
+    insn->flags = orc_code_cache_buffer_get_int (&buffer);
+  }
+
+  ptr = orc_code_cache_buffer_get (&buffer,
+      sizeof(OrcCodeVariable) * ORC_N_COMPILER_VARIABLES);
+  if (ptr == NULL) goto invalid;
+  code->vars = malloc (sizeof(OrcCodeVariable) * ORC_N_COMPILER_VARIABLES);
+  memcpy (code->vars, ptr,
+      sizeof(OrcCodeVariable) * ORC_N_COMPILER_VARIABLES);
+
+  i = orc_code_cache_buffer_get_int (&buffer);
+  ptr = orc_code_cache_buffer_get (&buffer, i);
+  if (ptr == NULL || i <= 0 || buffer.offset != buffer.length) goto invalid;
+
+  orc_code_allocate_codemem (code, i);
+  memcpy (code->code, ptr, i);
+  if (target->flush_cache) {
+    target->flush_cache (code);
+  }
+
+  free (buffer.data);
+  free (filename);
+  return code;
+
+invalid:
+  ORC_WARNING ("ignoring invalid code cache file %s", filename);
+  if (code) orc_code_free (code);
+  free (buffer.data);
+  free (filename);
+  return NULL;
+}
+
+/* Looks up compiled code for the program.  On a hit, the program gets a
+ * reference to the cached code, and TRUE is returned.  On a miss,
+ * *key is set to the bytecode to pass to _orc_code_cache_insert() once
+ * the program is compiled, or NULL if the program can't be cached. */
+int
+_orc_code_cache_lookup (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, OrcBytecode **key)
+{
+  OrcCodeCacheEntry *entry;
+  OrcBytecode *bytecode;
+  orc_uint32 hash;
+
+  *key = NULL;
+  if (!orc_code_cache_can_cache (program, target)) return FALSE;
+
+  bytecode = orc_bytecode_from_program (program);
+  hash = orc_code_cache_hash (bytecode->bytecode, bytecode->length,
+      target, flags);
+
+  entry = NULL;
+  if (!orc_code_cache_disabled) {
+    ORC_LOCK (&orc_code_cache_lock);
+    entry = orc_code_cache_find (bytecode, hash, target, flags);
+    if (entry) {
+      entry->refcount++;
+      orc_code_cache_n_hits++;
+    } else {
+      orc_code_cache_n_misses++;
+    }
+    ORC_UNLOCK (&orc_code_cache_lock);
+  }
+
+  if (entry) {
+    orc_bytecode_free (bytecode);
+
+    ORC_INFO ("using cached code for program \"%s\"", program->name);
+    program->orccode = entry->code;
+    program->code_exec = entry->code->exec;
+    if (entry->asm_code) {
+      program->asm_code = strdup (entry->asm_code);
+    }
+    return TRUE;
+  }
+
+  if (orc_code_cache_dir) {
+    OrcCode *code;
+
+    code = orc_code_cache_load (bytecode, target, flags);
+    ORC_LOCK (&orc_code_cache_lock);
+    if (code) {
+      orc_code_cache_n_disk_hits++;
+    } else {
+      orc_code_cache_n_disk_misses++;
+    }
+    ORC_UNLOCK (&orc_code_cache_lock);
+
+    if (code) {
+      ORC_INFO ("using code for program \"%s\" from %s", program->name,
+          orc_code_cache_dir);
+      program->orccode = code;
+      program->code_exec = code->exec;
+      if (!orc_code_cache_disabled) {
+        orc_code_cache_add (program, target, flags, bytecode);
+      } else {
+        orc_bytecode_free (bytecode);
+      }
+      return TRUE;
+    }
+  }
+
+  *key = bytecode;
+  return FALSE;
+}
+
+/* Adds the program's code to the in-memory cache, and frees the key.
+ * If another thread got there first, the program's code is replaced by
+ * the cached one. */
+static void
+orc_code_cache_add (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, OrcBytecode *key)
+{
+  OrcCodeCacheEntry *entry;
+  OrcCode *code = program->orccode;
+  orc_uint32 hash;
+
+  hash = orc_code_cache_hash (key->bytecode, key->length, target, flags);
+
+  ORC_LOCK (&orc_code_cache_lock);
+  entry = orc_code_cache_find (key, hash, target, flags);
+  if (entry) {
+    entry->refcount++;
+    program->orccode = entry->code;
+    program->code_exec = entry->code->exec;
+  } else {
+    entry = malloc (sizeof(OrcCodeCacheEntry));
+    memset (entry, 0, sizeof(OrcCodeCacheEntry));
+    entry->hash = hash;
+    entry->bytecode = key->bytecode;
+    entry->length = key->length;
+    entry->target = target;
+    entry->flags = flags;
+    entry->code = code;
+    if (program->asm_code) entry->asm_code = strdup (program->asm_code);
+    entry->refcount = 1;
+    code->cache_entry = entry;
+
+    entry->next = orc_code_cache[hash % ORC_CODE_CACHE_N_BUCKETS];
+    orc_code_cache[hash % ORC_CODE_CACHE_N_BUCKETS] = entry;
+    orc_code_cache_n_entries++;
+
+    /* the entry owns the bytecode now */
+    key->bytecode = NULL;
+    code = NULL;
+  }
+  ORC_UNLOCK (&orc_code_cache_lock);
+
+  orc_bytecode_free (key);
+
+  if (code) orc_code_free (code);
+}
+
+/* Adds the freshly compiled code of the program to the caches */
+void
+_orc_code_cache_insert (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, OrcBytecode *key)
+{
+  if (orc_code_cache_dir) {
+    orc_code_cache_save (program->orccode, key, target, flags);
+  }
+
+  if (orc_code_cache_disabled) {
+    orc_bytecode_free (key);
+    return;
+  }
+  orc_code_cache_add (program, target, flags, key);
+}
+
+/* Drops a reference to cached code.  Returns TRUE if the code is still
+ * in use and must not be freed. */
+int
+_orc_code_cache_unref (OrcCode *code)
+{
+  OrcCodeCacheEntry *entry = code->cache_entry;
+  OrcCodeCacheEntry **prev;
+
+  ORC_LOCK (&orc_code_cache_lock);
+  entry->refcount--;
+  if (entry->refcount > 0) {
+    ORC_UNLOCK (&orc_code_cache_lock);
+    return TRUE;
+  }
+
+  prev = &orc_code_cache[entry->hash % ORC_CODE_CACHE_N_BUCKETS];
+  while (*prev != entry) prev = &(*prev)->next;
+  *prev = entry->next;
+  orc_code_cache_n_entries--;
+  ORC_UNLOCK (&orc_code_cache_lock);
+
+  code->cache_entry = NULL;
+  free (entry->bytecode);
+  free (entry->asm_code);
+  free (entry);
+  return FALSE;
+}
+
+int
+_orc_code_cache_is_shared (OrcCode *code)
+{
+  OrcCodeCacheEntry *entry = code->cache_entry;
+
+  return entry && entry->refcount > 1;
+}
+
+/**
+ * orc_code_cache_get_stats:
+ * @n_hits: location for the number of compiles that used cached code,
+ *   or NULL
+ * @n_misses: location for the number of compiles that had to generate
+ *   code, or NULL
+ * @n_entries: location for the number of distinct programs currently
+ *   in the cache, or NULL
+ *
+ * Reports how well the compiled code cache is doing.  Compiles that
+ * can't use the cache are not counted.
+ */
+void
+orc_code_cache_get_stats (unsigned long *n_hits, unsigned long *n_misses,
+    int *n_entries)
+{
+  ORC_LOCK (&orc_code_cache_lock);
+  if (n_hits) *n_hits = orc_code_cache_n_hits;
+  if (n_misses) *n_misses = orc_code_cache_n_misses;
+  if (n_entries) *n_entries = orc_code_cache_n_entries;
+  ORC_UNLOCK (&orc_code_cache_lock);
+}
+
+/**
+ * orc_code_cache_get_disk_stats:
+ * @n_hits: location for the number of compiles that loaded code from
+ *   ORC_CACHE_DIR, or NULL
+ * @n_misses: location for the number of compiles that found nothing
+ *   usable in ORC_CACHE_DIR, or NULL
+ *
+ * Reports how well the on-disk code cache is doing.  Both are 0 if
+ * ORC_CACHE_DIR is not set.
+ */
+void
+orc_code_cache_get_disk_stats (unsigned long *n_hits,
+    unsigned long *n_misses)
+{
+  ORC_LOCK (&orc_code_cache_lock);
+  if (n_hits) *n_hits = orc_code_cache_n_disk_hits;
+  if (n_misses) *n_misses = orc_code_cache_n_disk_misses;
+  ORC_UNLOCK (&orc_code_cache_lock);
+}
+
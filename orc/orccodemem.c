@@ -14,140 +14,739 @@
 #ifdef HAVE_CODEMEM_MMAP
 #include <sys/mman.h>
 #endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 #ifdef HAVE_CODEMEM_VIRTUALALLOC
 #include <windows.h>
 #endif
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
 
 #include <orc/orcprogram.h>
 #include <orc/orcdebug.h>
+#include <orc/orconce.h>
+#include <orc/orcinternal.h>
+#include <orc/orclock.h>
 
 
 #define SIZE 65536
 
+/* Huge page size assumed when aligning regions for huge page backing */
+#define ORC_CODE_HUGE_PAGE_SIZE (2*1024*1024)
+
+#if defined(HAVE_CODEMEM_MMAP) && \
+  (defined(HAVE_MEMFD_CREATE) || defined(SYS_memfd_create))
+#define ORC_CODE_USE_MEMFD
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#endif
+
+/* Code memory is handed out in size classes from 64 bytes to
+ * ORC_CODE_SPAN_SIZE.  Regions are cut into spans of ORC_CODE_SPAN_SIZE
+ * bytes, and each span in use holds chunks of a single size class,
+ * tracked by a bitmap of slots.  Larger requests get a region of
+ * their own, which is unmapped again when the chunk is freed. */
+#define ORC_CODE_SPAN_SIZE 8192
+#define ORC_CODE_N_CLASSES 15
+#define ORC_CODE_MAX_SLOTS (ORC_CODE_SPAN_SIZE/64)
+
+#define ORC_CODE_CLASS_FREE (-1)
+#define ORC_CODE_CLASS_LARGE ORC_CODE_N_CLASSES
+#define ORC_CODE_CLASS_LARGE_TAIL (ORC_CODE_N_CLASSES+1)
+
+#define ORC_CODE_MAGAZINE_SIZE 16
+#define ORC_CODE_MAGAZINE_REFILL 4
+
 typedef struct _OrcCodeRegion OrcCodeRegion;
+typedef struct _OrcCodeSpan OrcCodeSpan;
+typedef struct _OrcCodeMagazine OrcCodeMagazine;
+
+struct _OrcCodeSpan {
+  OrcCodeRegion *region;
+  int index;
+
+  /* ORC_CODE_CLASS_FREE, a size class, or one of the large classes */
+  int size_class;
+  /* number of spans in a large run */
+  int n_spans;
+
+  int n_slots;
+  int n_used;
+  orc_uint32 slot_bitmap[ORC_CODE_MAX_SLOTS/32];
+  OrcCodeChunk *chunks;
+
+  /* link in orc_code_partial_spans or orc_code_free_spans */
+  OrcCodeSpan *next;
+  OrcCodeSpan *prev;
+};
+
+static const int orc_code_class_sizes[ORC_CODE_N_CLASSES] = {
+  64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096,
+  6144, 8192
+};
 
 struct _OrcCodeRegion {
   orc_uint8 *write_ptr;
   orc_uint8 *exec_ptr;
   int size;
+  int index;
 
-  OrcCodeChunk *chunks;
+  int n_spans;
+  int n_free_spans;
+  orc_uint32 *span_bitmap;
+  OrcCodeSpan *spans;
+
+  /* all spans are free, since empty_time */
+  int empty;
+  double empty_time;
 };
 
 struct _OrcCodeChunk {
   /*< private >*/
-  struct _OrcCodeChunk *next;
-  struct _OrcCodeChunk *prev;
   struct _OrcCodeRegion *region;
-  int used;
+  struct _OrcCodeSpan *span;
 
   int offset;
   int size;
+
+  /* link in orc_code_free_list */
+  struct _OrcCodeChunk *free_next;
+};
+
+/* Per-thread cache of chunks that are marked used in their span, but
+ * not owned by any OrcCode.  Only the owning thread touches it. */
+struct _OrcCodeMagazine {
+  int n_chunks;
+  OrcCodeChunk *chunks[ORC_CODE_MAGAZINE_SIZE];
 };
 
 
-void orc_code_region_allocate_codemem (OrcCodeRegion *region);
+void orc_code_region_allocate_codemem (OrcCodeRegion *region, int size);
+void orc_code_region_free_codemem (OrcCodeRegion *region);
 
+/* The following are protected by orc_code_lock */
+static OrcLock orc_code_lock = ORC_LOCK_INIT;
 static OrcCodeRegion **orc_code_regions;
 static int orc_code_n_regions;
+static OrcCodeSpan *orc_code_partial_spans[ORC_CODE_N_CLASSES];
+static OrcCodeSpan *orc_code_free_spans;
+static int orc_code_region_size = SIZE;
+static int orc_code_huge_pages = FALSE;
+static int orc_code_release_delay = 0;
+static int orc_code_n_empty_regions;
+#ifdef ORC_CODE_USE_MEMFD
+static int orc_code_use_memfd = TRUE;
+#endif
+
+/* Chunks freed while the freeing thread's magazine was full.  Pushed
+ * without locking, and taken as a whole by the next allocating thread
+ * that misses in its magazine. */
+static OrcCodeChunk * volatile orc_code_free_list;
+
+static int orc_code_magazine_slot = -1;
+
+static void orc_code_magazine_destroy (void *data);
+
+static int
+orc_code_round_region_size (int size)
+{
+  if (size < ORC_CODE_SPAN_SIZE) return ORC_CODE_SPAN_SIZE;
+  if (size > 0x40000000) return 0x40000000;
+  return (size + ORC_CODE_SPAN_SIZE - 1) & ~(ORC_CODE_SPAN_SIZE - 1);
+}
+
+void
+_orc_code_init (void)
+{
+  const char *envvar;
+
+  orc_code_magazine_slot = orc_thread_local_new (orc_code_magazine_destroy);
+
+  orc_code_huge_pages = orc_compiler_flag_check ("hugepages");
+#ifdef ORC_CODE_USE_MEMFD
+  orc_code_use_memfd = !orc_compiler_flag_check ("-memfd");
+#endif
+  if (orc_code_huge_pages) {
+    orc_code_region_size = ORC_CODE_HUGE_PAGE_SIZE;
+  }
+
+  envvar = getenv ("ORC_CODE_REGION_SIZE");
+  if (envvar != NULL) {
+    char *end = NULL;
+    long size;
+
+    size = strtol (envvar, &end, 0);
+    if (end > envvar) {
+      if (*end == 'k' || *end == 'K') size *= 1024;
+      if (*end == 'm' || *end == 'M') size *= 1024*1024;
+      orc_code_region_size = orc_code_round_region_size (size);
+    }
+  }
+}
+
+/**
+ * orc_code_set_region_size:
+ * @size: size in bytes
+ *
+ * Sets the size of the executable memory regions that compiled code is
+ * allocated from.  The size is rounded up to a multiple of 8192 bytes.
+ * Larger regions mean fewer mappings and less iTLB pressure when many
+ * programs are compiled, at the cost of more memory mapped up front.
+ * Only regions created after this call are affected.
+ *
+ * The default is 64 kB, or 2 MB if huge pages are enabled using the
+ * "hugepages" flag in ORC_CODE.  The ORC_CODE_REGION_SIZE environment
+ * variable overrides the default, and accepts k and M suffixes.
+ */
+void
+orc_code_set_region_size (int size)
+{
+  ORC_LOCK (&orc_code_lock);
+  orc_code_region_size = orc_code_round_region_size (size);
+  ORC_UNLOCK (&orc_code_lock);
+}
+
+/**
+ * orc_code_get_region_size:
+ *
+ * Returns: the size of newly created executable memory regions
+ */
+int
+orc_code_get_region_size (void)
+{
+  return orc_code_region_size;
+}
+
+/**
+ * orc_code_set_huge_pages:
+ * @enable: whether to use huge pages
+ *
+ * Requests that executable memory regions of at least 2 MB be backed
+ * by huge pages.  Explicit huge pages (MAP_HUGETLB) are tried first
+ * where a private mapping is used, then transparent huge pages.  If
+ * neither is available, normal pages are used.  Only regions created
+ * after this call are affected.
+ */
+void
+orc_code_set_huge_pages (orc_bool enable)
+{
+  ORC_LOCK (&orc_code_lock);
+  orc_code_huge_pages = enable;
+  ORC_UNLOCK (&orc_code_lock);
+}
+
+/**
+ * orc_code_set_release_delay:
+ * @msec: delay in milliseconds, or -1
+ *
+ * Executable memory regions in which all code has been freed are
+ * returned to the operating system.  One empty region is kept around
+ * so that alternately compiling and freeing programs does not map and
+ * unmap memory every time.  This sets how long other empty regions
+ * are kept before being released, in case they are needed again.  A
+ * delay of 0, the default, releases them immediately.  A delay of -1
+ * never releases regions, except when orc_code_release_unused() is
+ * called.
+ */
+void
+orc_code_set_release_delay (int msec)
+{
+  ORC_LOCK (&orc_code_lock);
+  orc_code_release_delay = msec;
+  ORC_UNLOCK (&orc_code_lock);
+}
+
 
+static int
+orc_code_find_first_zero (const orc_uint32 *bitmap, int n_bits)
+{
+  int i;
+
+  for(i=0;i<n_bits;i+=32){
+    orc_uint32 bits = ~bitmap[i>>5];
+    if (bits) {
+#if defined(__GNUC__) && ORC_GNUC_PREREQ(3,4)
+      i += __builtin_ctz (bits);
+#else
+      while (!(bits & 1)) {
+        bits >>= 1;
+        i++;
+      }
+#endif
+      return (i < n_bits) ? i : -1;
+    }
+  }
+  return -1;
+}
+
+#define BITMAP_SET(bitmap,i) ((bitmap)[(i)>>5] |= (1U<<((i)&31)))
+#define BITMAP_CLEAR(bitmap,i) ((bitmap)[(i)>>5] &= ~(1U<<((i)&31)))
+#define BITMAP_TEST(bitmap,i) ((bitmap)[(i)>>5] & (1U<<((i)&31)))
+
+static void
+orc_code_span_list_add (OrcCodeSpan **list, OrcCodeSpan *span)
+{
+  span->prev = NULL;
+  span->next = *list;
+  if (*list) (*list)->prev = span;
+  *list = span;
+}
 
+static void
+orc_code_span_list_remove (OrcCodeSpan **list, OrcCodeSpan *span)
+{
+  if (span->prev) {
+    span->prev->next = span->next;
+  } else {
+    *list = span->next;
+  }
+  if (span->next) span->next->prev = span->prev;
+  span->next = NULL;
+  span->prev = NULL;
+}
+
+static int
+orc_code_get_size_class (int size)
+{
+  int size_class = 0;
+
+  if (size > ORC_CODE_SPAN_SIZE) return ORC_CODE_CLASS_LARGE;
+
+  while (orc_code_class_sizes[size_class] < size) size_class++;
+  return size_class;
+}
+
+/* Must be called with orc_code_lock held.  If add_spans is TRUE,
+ * the spans of the new region are made available to the size classes. */
 OrcCodeRegion *
-orc_code_region_new (void)
+orc_code_region_new (int size, int add_spans)
 {
   OrcCodeRegion *region;
-  OrcCodeChunk *chunk;
+  int i;
 
   region = malloc(sizeof(OrcCodeRegion));
   memset (region, 0, sizeof(OrcCodeRegion));
 
-  orc_code_region_allocate_codemem (region);
+  orc_code_region_allocate_codemem (region, size);
+  if (region->size == 0) {
+    free (region);
+    return NULL;
+  }
 
-  chunk = malloc(sizeof(OrcCodeChunk));
-  memset (chunk, 0, sizeof(OrcCodeChunk));
+  region->n_spans = region->size / ORC_CODE_SPAN_SIZE;
+  region->n_free_spans = region->n_spans;
+  region->span_bitmap = malloc (sizeof(orc_uint32) * ((region->n_spans + 31)/32));
+  memset (region->span_bitmap, 0,
+      sizeof(orc_uint32) * ((region->n_spans + 31)/32));
+  region->spans = malloc (sizeof(OrcCodeSpan) * region->n_spans);
+  memset (region->spans, 0, sizeof(OrcCodeSpan) * region->n_spans);
 
-  chunk->offset = 0;
-  chunk->used = FALSE;
-  chunk->region = region;
-  chunk->size = region->size;
+  for(i=region->n_spans-1;i>=0;i--){
+    OrcCodeSpan *span = region->spans + i;
 
-  region->chunks = chunk;
+    span->region = region;
+    span->index = i;
+    span->size_class = ORC_CODE_CLASS_FREE;
+    if (add_spans) {
+      orc_code_span_list_add (&orc_code_free_spans, span);
+    }
+  }
+
+  orc_code_regions = realloc (orc_code_regions,
+      sizeof(void *)*(orc_code_n_regions+1));
+  orc_code_regions[orc_code_n_regions] = region;
+  region->index = orc_code_n_regions;
+  orc_code_n_regions++;
 
   return region;
 }
 
-OrcCodeChunk *
-orc_code_chunk_split (OrcCodeChunk *chunk, int size)
+/* Must be called with orc_code_lock held.  The region must not be
+ * holding any spans on the free list. */
+static void
+orc_code_region_free (OrcCodeRegion *region)
+{
+  orc_code_n_regions--;
+  orc_code_regions[region->index] = orc_code_regions[orc_code_n_regions];
+  orc_code_regions[region->index]->index = region->index;
+
+  orc_code_region_free_codemem (region);
+  free (region->span_bitmap);
+  free (region->spans);
+  free (region);
+}
+
+static double
+orc_code_get_time (void)
 {
-  OrcCodeChunk *newchunk;
+#ifdef HAVE_GETTIMEOFDAY
+  struct timeval tv;
 
-  newchunk = malloc(sizeof(OrcCodeChunk));
-  memset (newchunk, 0, sizeof(OrcCodeChunk));
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+/* Must be called with orc_code_lock held.  Releases empty regions
+ * that have been empty for longer than the release delay, keeping one
+ * of them unless force is TRUE. */
+static void
+orc_code_release_empty_regions (int force)
+{
+  double now;
+  int keep = !force;
+  int i, j;
+
+  if (orc_code_n_empty_regions == 0) return;
+  if (!force && orc_code_release_delay < 0) return;
+
+  now = orc_code_get_time ();
+  for(i=orc_code_n_regions-1;i>=0;i--){
+    OrcCodeRegion *region = orc_code_regions[i];
+
+    if (!region->empty) continue;
+    if (keep) {
+      keep = FALSE;
+      continue;
+    }
+    if (!force && now - region->empty_time < 0.001 * orc_code_release_delay) {
+      continue;
+    }
+
+    for(j=0;j<region->n_spans;j++){
+      orc_code_span_list_remove (&orc_code_free_spans, region->spans + j);
+    }
+    orc_code_n_empty_regions--;
+    orc_code_region_free (region);
+  }
+}
+
+static void
+orc_code_span_init (OrcCodeSpan *span, int size_class, int n_spans)
+{
+  OrcCodeRegion *region = span->region;
+  int chunk_size;
+  int i;
+
+  if (region->empty) {
+    region->empty = FALSE;
+    orc_code_n_empty_regions--;
+  }
 
-  newchunk->region = chunk->region;
-  newchunk->offset = chunk->offset + size;
-  newchunk->size = chunk->size - size;
-  newchunk->next = chunk->next;
-  newchunk->prev = chunk;
+  span->size_class = size_class;
+  span->n_spans = n_spans;
+  span->n_used = 0;
+  memset (span->slot_bitmap, 0, sizeof(span->slot_bitmap));
 
-  chunk->size = size;
-  if (chunk->next) {
-    chunk->next->prev = newchunk;
+  if (size_class == ORC_CODE_CLASS_LARGE) {
+    chunk_size = n_spans * ORC_CODE_SPAN_SIZE;
+    span->n_slots = 1;
+  } else {
+    chunk_size = orc_code_class_sizes[size_class];
+    span->n_slots = ORC_CODE_SPAN_SIZE / chunk_size;
   }
-  chunk->next = newchunk;
 
-  return newchunk;
+  span->chunks = malloc (sizeof(OrcCodeChunk) * span->n_slots);
+  for(i=0;i<span->n_slots;i++){
+    OrcCodeChunk *chunk = span->chunks + i;
+
+    chunk->region = region;
+    chunk->span = span;
+    chunk->offset = span->index * ORC_CODE_SPAN_SIZE + i * chunk_size;
+    chunk->size = chunk_size;
+    chunk->free_next = NULL;
+  }
+
+  for(i=0;i<n_spans;i++){
+    BITMAP_SET (region->span_bitmap, span->index + i);
+    if (i > 0) {
+      region->spans[span->index + i].size_class = ORC_CODE_CLASS_LARGE_TAIL;
+    }
+  }
+  region->n_free_spans -= n_spans;
 }
 
-void
-orc_code_chunk_merge (OrcCodeChunk *chunk)
+static void
+orc_code_span_fini (OrcCodeSpan *span)
+{
+  OrcCodeRegion *region = span->region;
+  int n_spans = span->n_spans;
+  int i;
+
+  free (span->chunks);
+  span->chunks = NULL;
+
+  if (span->size_class == ORC_CODE_CLASS_LARGE) {
+    orc_code_region_free (region);
+    return;
+  }
+
+  for(i=n_spans-1;i>=0;i--){
+    OrcCodeSpan *s = region->spans + span->index + i;
+
+    BITMAP_CLEAR (region->span_bitmap, s->index);
+    s->size_class = ORC_CODE_CLASS_FREE;
+    s->n_spans = 0;
+    orc_code_span_list_add (&orc_code_free_spans, s);
+  }
+  region->n_free_spans += n_spans;
+
+  if (region->n_free_spans == region->n_spans) {
+    region->empty = TRUE;
+    region->empty_time = orc_code_get_time ();
+    orc_code_n_empty_regions++;
+    orc_code_release_empty_regions (FALSE);
+  }
+}
+
+/* Must be called with orc_code_lock held */
+static OrcCodeSpan *
+orc_code_get_free_span (void)
+{
+  OrcCodeSpan *span;
+
+  if (orc_code_free_spans == NULL) {
+    if (orc_code_region_new (orc_code_region_size, TRUE) == NULL) {
+      return NULL;
+    }
+  }
+
+  span = orc_code_free_spans;
+  orc_code_span_list_remove (&orc_code_free_spans, span);
+  return span;
+}
+
+/* Must be called with orc_code_lock held */
+static OrcCodeChunk *
+orc_code_span_take_slot (OrcCodeSpan *span)
+{
+  int slot;
+
+  slot = orc_code_find_first_zero (span->slot_bitmap, span->n_slots);
+  ORC_ASSERT (slot >= 0);
+
+  BITMAP_SET (span->slot_bitmap, slot);
+  span->n_used++;
+  if (span->n_used == span->n_slots &&
+      span->size_class != ORC_CODE_CLASS_LARGE) {
+    orc_code_span_list_remove (
+        &orc_code_partial_spans[span->size_class], span);
+  }
+
+  return span->chunks + slot;
+}
+
+/* Must be called with orc_code_lock held */
+static void
+orc_code_chunk_release (OrcCodeChunk *chunk)
+{
+  OrcCodeSpan *span = chunk->span;
+  int slot = chunk - span->chunks;
+
+  ORC_ASSERT (BITMAP_TEST (span->slot_bitmap, slot));
+
+  BITMAP_CLEAR (span->slot_bitmap, slot);
+  span->n_used--;
+
+  if (span->size_class == ORC_CODE_CLASS_LARGE) {
+    orc_code_span_fini (span);
+    return;
+  }
+
+  if (span->n_used == span->n_slots - 1) {
+    orc_code_span_list_add (&orc_code_partial_spans[span->size_class], span);
+  }
+  if (span->n_used == 0) {
+    orc_code_span_list_remove (
+        &orc_code_partial_spans[span->size_class], span);
+    orc_code_span_fini (span);
+  }
+
+  /* catch regions whose release delay ran out */
+  if (orc_code_n_empty_regions > 1 && orc_code_release_delay > 0) {
+    orc_code_release_empty_regions (FALSE);
+  }
+}
+
+/* Must be called with orc_code_lock held */
+static OrcCodeChunk *
+orc_code_get_chunk_locked (int size_class, int n_spans)
+{
+  OrcCodeSpan *span;
+
+  if (size_class == ORC_CODE_CLASS_LARGE) {
+    OrcCodeRegion *region;
+
+    region = orc_code_region_new (n_spans * ORC_CODE_SPAN_SIZE, FALSE);
+    if (region == NULL) return NULL;
+    span = region->spans;
+    orc_code_span_init (span, ORC_CODE_CLASS_LARGE, region->n_spans);
+    return orc_code_span_take_slot (span);
+  }
+
+  span = orc_code_partial_spans[size_class];
+  if (span == NULL) {
+    span = orc_code_get_free_span ();
+    if (span == NULL) return NULL;
+    orc_code_span_init (span, size_class, 1);
+    orc_code_span_list_add (&orc_code_partial_spans[size_class], span);
+  }
+
+  return orc_code_span_take_slot (span);
+}
+
+static OrcCodeMagazine *
+orc_code_get_magazine (void)
+{
+  OrcCodeMagazine *magazine;
+
+  if (orc_code_magazine_slot < 0) return NULL;
+
+  magazine = orc_thread_local_get (orc_code_magazine_slot);
+  if (magazine == NULL) {
+    magazine = malloc (sizeof(OrcCodeMagazine));
+    memset (magazine, 0, sizeof(OrcCodeMagazine));
+    orc_thread_local_set (orc_code_magazine_slot, magazine);
+  }
+  return magazine;
+}
+
+static void
+orc_code_free_list_push (OrcCodeChunk *chunk)
+{
+  OrcCodeChunk *head;
+
+  do {
+    head = orc_code_free_list;
+    chunk->free_next = head;
+  } while (!orc_atomic_pointer_compare_and_exchange (
+        (void * volatile *)&orc_code_free_list, head, chunk));
+}
+
+static void
+orc_code_magazine_destroy (void *data)
+{
+  OrcCodeMagazine *magazine = data;
+  int i;
+
+  for(i=0;i<magazine->n_chunks;i++){
+    orc_code_free_list_push (magazine->chunks[i]);
+  }
+  free (magazine);
+}
+
+static OrcCodeChunk *
+orc_code_magazine_take (OrcCodeMagazine *magazine, int size)
+{
+  OrcCodeChunk *chunk;
+  int i;
+
+  for(i=magazine->n_chunks-1;i>=0;i--){
+    chunk = magazine->chunks[i];
+    if (chunk->size == size) {
+      magazine->n_chunks--;
+      magazine->chunks[i] = magazine->chunks[magazine->n_chunks];
+      return chunk;
+    }
+  }
+  return NULL;
+}
+
+/* Moves everything on the global free list into the magazine.  Chunks
+ * that don't fit are handed back to their spans. */
+static void
+orc_code_magazine_refill (OrcCodeMagazine *magazine)
 {
-  OrcCodeChunk *chunk2 = chunk->next;
+  OrcCodeChunk *list;
+  OrcCodeChunk *chunk;
+  OrcCodeChunk *overflow = NULL;
 
-  chunk->next = chunk2->next;
-  if (chunk2->next) {
-    chunk2->next->prev = chunk;
+  list = orc_atomic_pointer_exchange (
+      (void * volatile *)&orc_code_free_list, NULL);
+
+  while (list) {
+    chunk = list;
+    list = chunk->free_next;
+
+    if (magazine && chunk->span->size_class != ORC_CODE_CLASS_LARGE &&
+        magazine->n_chunks < ORC_CODE_MAGAZINE_SIZE) {
+      chunk->free_next = NULL;
+      magazine->chunks[magazine->n_chunks] = chunk;
+      magazine->n_chunks++;
+    } else {
+      chunk->free_next = overflow;
+      overflow = chunk;
+    }
   }
-  chunk->size += chunk2->size;
 
-  free(chunk2);
+  if (overflow == NULL) return;
+
+  ORC_LOCK (&orc_code_lock);
+  while (overflow) {
+    chunk = overflow;
+    overflow = chunk->free_next;
+    chunk->free_next = NULL;
+    orc_code_chunk_release (chunk);
+  }
+  ORC_UNLOCK (&orc_code_lock);
 }
 
 OrcCodeChunk *
 orc_code_region_get_free_chunk (int size)
 {
-  int i;
-  OrcCodeRegion *region;
   OrcCodeChunk *chunk;
+  OrcCodeMagazine *magazine = NULL;
+  int size_class;
+  int n_spans = 0;
+  int n;
 
-  orc_global_mutex_lock ();
-  for(i=0;i<orc_code_n_regions;i++){
-    region = orc_code_regions[i];
-    for(chunk = region->chunks; chunk; chunk = chunk->next) {
-      if (!chunk->used && size <= chunk->size) {
-        orc_global_mutex_unlock ();
-        return chunk;
-      }
+  size_class = orc_code_get_size_class (size);
+  if (size_class == ORC_CODE_CLASS_LARGE) {
+    n_spans = (size + ORC_CODE_SPAN_SIZE - 1) / ORC_CODE_SPAN_SIZE;
+  } else {
+    magazine = orc_code_get_magazine ();
+  }
+
+  if (magazine) {
+    chunk = orc_code_magazine_take (magazine,
+        orc_code_class_sizes[size_class]);
+    if (chunk) return chunk;
+  }
+
+  if (orc_code_free_list) {
+    orc_code_magazine_refill (magazine);
+    if (magazine) {
+      chunk = orc_code_magazine_take (magazine,
+          orc_code_class_sizes[size_class]);
+      if (chunk) return chunk;
     }
   }
 
-  orc_code_regions = realloc (orc_code_regions,
-      sizeof(void *)*(orc_code_n_regions+1));
-  orc_code_regions[orc_code_n_regions] = orc_code_region_new ();
-  region = orc_code_regions[orc_code_n_regions];
-  orc_code_n_regions++;
+  ORC_LOCK (&orc_code_lock);
+  chunk = orc_code_get_chunk_locked (size_class, n_spans);
+  if (chunk && magazine) {
+    /* Take a few spares of the same size while we hold the lock */
+    for(n=0;n<ORC_CODE_MAGAZINE_REFILL;n++){
+      OrcCodeSpan *span = orc_code_partial_spans[size_class];
 
-  for(chunk = region->chunks; chunk; chunk = chunk->next) {
-    if (!chunk->used && size <= chunk->size){
-      orc_global_mutex_unlock ();
-      return chunk;
+      if (span == NULL) break;
+      if (magazine->n_chunks >= ORC_CODE_MAGAZINE_SIZE) break;
+      magazine->chunks[magazine->n_chunks] = orc_code_span_take_slot (span);
+      magazine->n_chunks++;
     }
   }
-  orc_global_mutex_unlock ();
+  ORC_UNLOCK (&orc_code_lock);
 
-  ORC_ASSERT(0);
+  if (chunk == NULL) {
+    ORC_ERROR ("failed to allocate %d bytes of code memory", size);
+  }
 
-  return NULL;
+  return chunk;
 }
 
 void
@@ -155,17 +754,11 @@ orc_code_allocate_codemem (OrcCode *code, int size)
 {
   OrcCodeRegion *region;
   OrcCodeChunk *chunk;
-  int aligned_size = (size + 15) & (~15);
 
-  chunk = orc_code_region_get_free_chunk (aligned_size);
+  chunk = orc_code_region_get_free_chunk (size);
+  ORC_ASSERT (chunk != NULL);
   region = chunk->region;
 
-  if (chunk->size > aligned_size) {
-    orc_code_chunk_split (chunk, aligned_size);
-  }
-
-  chunk->used = TRUE;
-
   code->chunk = chunk;
   code->code = ORC_PTR_OFFSET(region->write_ptr, chunk->offset);
   code->exec = ORC_PTR_OFFSET(region->exec_ptr, chunk->offset);
@@ -176,24 +769,362 @@ orc_code_allocate_codemem (OrcCode *code, int size)
 void
 orc_code_chunk_free (OrcCodeChunk *chunk)
 {
+  OrcCodeMagazine *magazine;
+
   if (_orc_compiler_flag_debug) {
     /* If debug is turned on, don't free code */
     return;
   }
 
-  chunk->used = FALSE;
-  if (chunk->next && !chunk->next->used) {
-    orc_code_chunk_merge (chunk);
+  if (chunk->span->size_class != ORC_CODE_CLASS_LARGE) {
+    magazine = orc_code_get_magazine ();
+    if (magazine && magazine->n_chunks < ORC_CODE_MAGAZINE_SIZE) {
+      magazine->chunks[magazine->n_chunks] = chunk;
+      magazine->n_chunks++;
+      return;
+    }
+  }
+
+  orc_code_free_list_push (chunk);
+}
+
+/**
+ * orc_code_release_unused:
+ *
+ * Returns all executable memory regions that hold no code to the
+ * operating system, regardless of the release delay.  Freed code
+ * cached by the calling thread and on the global free list is handed
+ * back first.  Code cached by other threads is not.
+ */
+void
+orc_code_release_unused (void)
+{
+  OrcCodeMagazine *magazine;
+  int i;
+
+  orc_code_magazine_refill (NULL);
+
+  magazine = orc_code_get_magazine ();
+
+  ORC_LOCK (&orc_code_lock);
+  if (magazine) {
+    for(i=0;i<magazine->n_chunks;i++){
+      orc_code_chunk_release (magazine->chunks[i]);
+    }
+    magazine->n_chunks = 0;
+  }
+  orc_code_release_empty_regions (TRUE);
+  ORC_UNLOCK (&orc_code_lock);
+}
+
+static int
+orc_code_compare_size (const void *a, const void *b)
+{
+  const OrcProgram *pa = *(OrcProgram * const *)a;
+  const OrcProgram *pb = *(OrcProgram * const *)b;
+
+  return pa->orccode->code_size - pb->orccode->code_size;
+}
+
+/**
+ * orc_code_compact:
+ * @programs: array of compiled programs
+ * @n_programs: number of programs
+ *
+ * Moves the compiled code of the given programs next to each other,
+ * into a newly allocated region, so that code that is used together
+ * shares cache lines and pages.  Code memory that becomes unused is
+ * released as usual.  Programs without compiled code, and programs
+ * larger than 8192 bytes, or shared with other programs through the
+ * code cache, are left where they are.
+ *
+ * Code generated by Orc is position-independent, so it is simply
+ * copied.  The caller must make sure that none of the programs is
+ * executing, and that no executor set up for them before this call is
+ * used afterwards without calling orc_executor_set_program() again.
+ * The programs must have been compiled for the default target.
+ *
+ * Returns: TRUE if the code was moved
+ */
+orc_bool
+orc_code_compact (OrcProgram **programs, int n_programs)
+{
+  OrcProgram **sorted;
+  OrcCodeRegion *region;
+  OrcCodeSpan *span = NULL;
+  OrcTarget *target;
+  int n = 0;
+  int n_spans = 0;
+  int n_in_span = 0;
+  int size_class;
+  int i;
+
+  sorted = malloc (sizeof(OrcProgram *) * (n_programs + 1));
+  for(i=0;i<n_programs;i++){
+    OrcCode *code = programs[i]->orccode;
+
+    if (code == NULL || code->chunk == NULL) continue;
+    if (programs[i]->code_exec != code->exec) continue;
+    /* other programs would keep pointing at the old copy */
+    if (_orc_code_cache_is_shared (code)) continue;
+    if (orc_code_get_size_class (code->code_size) == ORC_CODE_CLASS_LARGE) {
+      continue;
+    }
+    sorted[n] = programs[i];
+    n++;
+  }
+  if (n == 0) {
+    free (sorted);
+    return FALSE;
+  }
+
+  /* Group by size class, and count the spans needed */
+  qsort (sorted, n, sizeof(OrcProgram *), orc_code_compare_size);
+  size_class = -1;
+  for(i=0;i<n;i++){
+    int c = orc_code_get_size_class (sorted[i]->orccode->code_size);
+    int n_slots = ORC_CODE_SPAN_SIZE / orc_code_class_sizes[c];
+
+    if (c != size_class || n_in_span == n_slots) {
+      size_class = c;
+      n_in_span = 0;
+      n_spans++;
+    }
+    n_in_span++;
+  }
+
+  target = orc_target_get_default ();
+
+  ORC_LOCK (&orc_code_lock);
+  region = orc_code_region_new (n_spans * ORC_CODE_SPAN_SIZE, FALSE);
+  if (region == NULL) {
+    ORC_UNLOCK (&orc_code_lock);
+    free (sorted);
+    return FALSE;
   }
-  if (chunk->prev && !chunk->prev->used) {
-    orc_code_chunk_merge (chunk->prev);
+
+  n_spans = 0;
+  for(i=0;i<n;i++){
+    OrcCode *code = sorted[i]->orccode;
+    OrcCodeChunk *old_chunk = code->chunk;
+    OrcCodeChunk *chunk;
+    int c = orc_code_get_size_class (code->code_size);
+
+    if (span == NULL || span->size_class != c ||
+        span->n_used == span->n_slots) {
+      span = region->spans + n_spans;
+      n_spans++;
+      orc_code_span_init (span, c, 1);
+      orc_code_span_list_add (&orc_code_partial_spans[c], span);
+    }
+    chunk = orc_code_span_take_slot (span);
+
+    memcpy (ORC_PTR_OFFSET(region->write_ptr, chunk->offset), code->code,
+        code->code_size);
+    code->chunk = chunk;
+    code->code = ORC_PTR_OFFSET(region->write_ptr, chunk->offset);
+    code->exec = ORC_PTR_OFFSET(region->exec_ptr, chunk->offset);
+    if (target && target->flush_cache) {
+      target->flush_cache (code);
+    }
+    sorted[i]->code_exec = code->exec;
+
+    orc_code_chunk_release (old_chunk);
   }
+  for(i=n_spans;i<region->n_spans;i++){
+    orc_code_span_list_add (&orc_code_free_spans, region->spans + i);
+  }
+  ORC_UNLOCK (&orc_code_lock);
+
+  free (sorted);
+  return TRUE;
+}
+
+/**
+ * orc_code_get_memory_usage:
+ * @n_regions: location for the number of code regions, or NULL
+ * @region_bytes: location for the total size of all code regions, or NULL
+ * @chunk_bytes: location for the number of bytes in allocated chunks,
+ *   or NULL
+ *
+ * Reports how much executable memory is currently mapped for compiled
+ * code, and how much of it is handed out.  Chunks held in per-thread
+ * caches count as allocated.
+ */
+void
+orc_code_get_memory_usage (int *n_regions, long *region_bytes,
+    long *chunk_bytes)
+{
+  long region_total = 0;
+  long chunk_total = 0;
+  int i, j;
+
+  ORC_LOCK (&orc_code_lock);
+  for(i=0;i<orc_code_n_regions;i++){
+    OrcCodeRegion *region = orc_code_regions[i];
+
+    region_total += region->size;
+    for(j=0;j<region->n_spans;j++){
+      OrcCodeSpan *span = region->spans + j;
+
+      if (span->size_class == ORC_CODE_CLASS_FREE ||
+          span->size_class == ORC_CODE_CLASS_LARGE_TAIL) continue;
+      chunk_total += (long)span->n_used * span->chunks[0].size;
+    }
+  }
+  if (n_regions) *n_regions = orc_code_n_regions;
+  ORC_UNLOCK (&orc_code_lock);
+
+  if (region_bytes) *region_bytes = region_total;
+  if (chunk_bytes) *chunk_bytes = chunk_total;
 }
 
 #ifdef HAVE_CODEMEM_MMAP
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static int
+orc_code_use_huge_pages (int size)
+{
+  return orc_code_huge_pages && (size % ORC_CODE_HUGE_PAGE_SIZE) == 0;
+}
+
+/* Reserves an address range of the given size that is aligned to the
+ * huge page size, so that huge pages can be used for all of it.  The
+ * range is mapped PROT_NONE, to be replaced using MAP_FIXED. */
+static void *
+orc_code_reserve_aligned (int size)
+{
+  orc_uint8 *ptr;
+  orc_uint8 *aligned;
+  size_t head, tail;
+
+  ptr = mmap (NULL, size + ORC_CODE_HUGE_PAGE_SIZE, PROT_NONE,
+      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) return NULL;
+
+  aligned = (orc_uint8 *)(((orc_intptr)ptr + ORC_CODE_HUGE_PAGE_SIZE - 1) &
+      ~(orc_intptr)(ORC_CODE_HUGE_PAGE_SIZE - 1));
+  head = aligned - ptr;
+  tail = ORC_CODE_HUGE_PAGE_SIZE - head;
+  if (head) munmap (ptr, head);
+  if (tail) munmap (aligned + size, tail);
+
+  return aligned;
+}
+
+static void
+orc_code_advise_huge_pages (void *ptr, int size)
+{
+#ifdef MADV_HUGEPAGE
+  if (madvise (ptr, size, MADV_HUGEPAGE) < 0) {
+    ORC_INFO ("transparent huge pages not available for code memory");
+  }
+#endif
+}
+
+static void *
+orc_code_map (int size, int prot, int flags, int fd)
+{
+  void *ptr;
+
+  if (orc_code_use_huge_pages (size)) {
+    void *addr = orc_code_reserve_aligned (size);
+
+    if (addr) {
+      ptr = mmap (addr, size, prot, flags|MAP_FIXED, fd, 0);
+      if (ptr != MAP_FAILED) {
+        orc_code_advise_huge_pages (ptr, size);
+        return ptr;
+      }
+      munmap (addr, size);
+    }
+  }
+
+  return mmap (NULL, size, prot, flags, fd, 0);
+}
+
+/* Maps the file twice, once writable and once executable */
+static int
+orc_code_region_map_fd (OrcCodeRegion *region, int fd, int size)
+{
+  /* Huge pages for the shared mapping only work if the file is on a
+   * tmpfs with shmem huge pages enabled, or on hugetlbfs, but the exec
+   * mapping is the one that matters for the iTLB. */
+  region->exec_ptr = orc_code_map (size, PROT_READ|PROT_EXEC,
+      MAP_SHARED, fd);
+  if (region->exec_ptr == MAP_FAILED) {
+    ORC_WARNING("failed to create exec map");
+    return FALSE;
+  }
+  region->write_ptr = mmap (NULL, size, PROT_READ|PROT_WRITE,
+      MAP_SHARED, fd, 0);
+  if (region->write_ptr == MAP_FAILED) {
+    ORC_WARNING ("failed to create write map");
+    munmap (region->exec_ptr, size);
+    return FALSE;
+  }
+  region->size = size;
+
+  return TRUE;
+}
+
+#ifdef ORC_CODE_USE_MEMFD
+static int
+orc_code_memfd_create (unsigned int flags)
+{
+#ifdef HAVE_MEMFD_CREATE
+  return memfd_create ("orcexec", flags);
+#else
+  return syscall (SYS_memfd_create, "orcexec", flags);
+#endif
+}
+
+/* Like the dual map, but backed by an anonymous memory file, so no
+ * file system is touched. */
+int
+orc_code_region_allocate_codemem_memfd (OrcCodeRegion *region, int size)
+{
+  int fd = -1;
+  int n;
+
+#ifdef MFD_HUGETLB
+  if (orc_code_use_huge_pages (size)) {
+    fd = orc_code_memfd_create (MFD_CLOEXEC | MFD_HUGETLB);
+    if (fd != -1 && ftruncate (fd, size) < 0) {
+      close (fd);
+      fd = -1;
+    }
+    if (fd == -1) {
+      ORC_INFO ("no huge pages reserved, falling back to normal pages");
+    }
+  }
+#endif
+  if (fd == -1) {
+    fd = orc_code_memfd_create (MFD_CLOEXEC);
+    if (fd == -1) {
+      ORC_INFO ("memfd_create not available");
+      return FALSE;
+    }
+    n = ftruncate (fd, size);
+    if (n < 0) {
+      ORC_WARNING("failed to expand memfd to size");
+      close (fd);
+      return FALSE;
+    }
+  }
+
+  n = orc_code_region_map_fd (region, fd, size);
+  close (fd);
+  return n;
+}
+#endif
+
 int
 orc_code_region_allocate_codemem_dual_map (OrcCodeRegion *region,
-    const char *dir, int force_unlink)
+    const char *dir, int force_unlink, int size)
 {
   int fd;
   int n;
@@ -216,98 +1147,117 @@ orc_code_region_allocate_codemem_dual_map (OrcCodeRegion *region,
   }
   free (filename);
 
-  n = ftruncate (fd, SIZE);
+  n = ftruncate (fd, size);
   if (n < 0) {
     ORC_WARNING("failed to expand file to size");
     close (fd);
     return FALSE;
   }
 
-  region->exec_ptr = mmap (NULL, SIZE, PROT_READ|PROT_EXEC,
-      MAP_SHARED, fd, 0);
-  if (region->exec_ptr == MAP_FAILED) {
-    ORC_WARNING("failed to create exec map");
-    close (fd);
-    return FALSE;
-  }
-  region->write_ptr = mmap (NULL, SIZE, PROT_READ|PROT_WRITE,
-      MAP_SHARED, fd, 0);
-  if (region->write_ptr == MAP_FAILED) {
-    ORC_WARNING ("failed to create write map");
-    munmap (region->exec_ptr, SIZE);
-    close (fd);
-    return FALSE;
-  }
-  region->size = SIZE;
-
+  n = orc_code_region_map_fd (region, fd, size);
   close (fd);
-  return TRUE;
+  return n;
 }
 
-#ifndef MAP_ANONYMOUS
-#define MAP_ANONYMOUS MAP_ANON
-#endif
-
 int
-orc_code_region_allocate_codemem_anon_map (OrcCodeRegion *region)
+orc_code_region_allocate_codemem_anon_map (OrcCodeRegion *region,
+    int size)
 {
-  region->exec_ptr = mmap (NULL, SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
-      MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  region->exec_ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (orc_code_use_huge_pages (size)) {
+    region->exec_ptr = mmap (NULL, size, PROT_READ|PROT_WRITE|PROT_EXEC,
+        MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+    if (region->exec_ptr == MAP_FAILED) {
+      ORC_INFO ("no huge pages reserved, falling back to normal pages");
+    }
+  }
+#endif
+  if (region->exec_ptr == MAP_FAILED) {
+    region->exec_ptr = orc_code_map (size, PROT_READ|PROT_WRITE|PROT_EXEC,
+        MAP_PRIVATE|MAP_ANONYMOUS, -1);
+  }
   if (region->exec_ptr == MAP_FAILED) {
     ORC_WARNING("failed to create write/exec map");
     return FALSE;
   }
   region->write_ptr = region->exec_ptr;
-  region->size = SIZE;
+  region->size = size;
   return TRUE;
 }
 
 void
-orc_code_region_allocate_codemem (OrcCodeRegion *region)
+orc_code_region_allocate_codemem (OrcCodeRegion *region, int size)
 {
   const char *tmpdir;
 
+#ifdef ORC_CODE_USE_MEMFD
+  if (orc_code_use_memfd && orc_code_region_allocate_codemem_memfd (region,
+        size)) return;
+#endif
+
   tmpdir = getenv ("XDG_RUNTIME_DIR");
   if (tmpdir && orc_code_region_allocate_codemem_dual_map (region,
-        tmpdir, FALSE)) return;
+        tmpdir, FALSE, size)) return;
 
   tmpdir = getenv ("HOME");
   if (tmpdir && orc_code_region_allocate_codemem_dual_map (region,
-        tmpdir, FALSE)) return;
+        tmpdir, FALSE, size)) return;
 
   tmpdir = getenv ("TMPDIR");
   if (tmpdir && orc_code_region_allocate_codemem_dual_map (region,
-        tmpdir, FALSE)) return;
+        tmpdir, FALSE, size)) return;
 
   if (orc_code_region_allocate_codemem_dual_map (region,
-        "/tmp", FALSE)) return;
+        "/tmp", FALSE, size)) return;
 
-  if (orc_code_region_allocate_codemem_anon_map (region)) return;
+  if (orc_code_region_allocate_codemem_anon_map (region, size)) return;
   
   ORC_ERROR("Failed to create write and exec mmap regions.  This "
       "is probably because SELinux execmem check is enabled (good) "
       "and $TMPDIR and $HOME are mounted noexec (bad).");
 }
 
+void
+orc_code_region_free_codemem (OrcCodeRegion *region)
+{
+  if (region->write_ptr != region->exec_ptr) {
+    munmap (region->write_ptr, region->size);
+  }
+  munmap (region->exec_ptr, region->size);
+}
+
 #endif
 
 #ifdef HAVE_CODEMEM_VIRTUALALLOC
 void
-orc_code_region_allocate_codemem (OrcCodeRegion *region)
+orc_code_region_allocate_codemem (OrcCodeRegion *region, int size)
 {
-  region->write_ptr = VirtualAlloc(NULL, SIZE, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+  region->write_ptr = VirtualAlloc(NULL, size, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
   region->exec_ptr = region->write_ptr;
-  region->size = SIZE;
+  region->size = size;
+}
+
+void
+orc_code_region_free_codemem (OrcCodeRegion *region)
+{
+  VirtualFree (region->write_ptr, 0, MEM_RELEASE);
 }
 #endif
 
 #ifdef HAVE_CODEMEM_MALLOC
 void
-orc_code_region_allocate_codemem (OrcCodeRegion *region)
+orc_code_region_allocate_codemem (OrcCodeRegion *region, int size)
 {
-  region->write_ptr = malloc(SIZE);
+  region->write_ptr = malloc(size);
   region->exec_ptr = region->write_ptr;
-  region->size = SIZE;
+  region->size = size;
+}
+
+void
+orc_code_region_free_codemem (OrcCodeRegion *region)
+{
+  free (region->write_ptr);
 }
 #endif
 
@@ -5,9 +5,12 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stddef.h>
 
 #include <orc/orcprogram.h>
 #include <orc/orcdebug.h>
+#include <orc/orconce.h>
+#include <orc/orcinternal.h>
 
 #ifdef HAVE_VALGRIND_VALGRIND_H
 #include <valgrind/valgrind.h>
@@ -40,12 +43,53 @@ void orc_compiler_rewrite_vars2 (OrcCompiler *compiler);
 int orc_compiler_dup_temporary (OrcCompiler *compiler, int var, int j);
 int orc_compiler_new_temporary (OrcCompiler *compiler, int size);
 void orc_compiler_check_sizes (OrcCompiler *compiler);
+static OrcCompileResult orc_program_compile_internal (OrcProgram *program,
+    OrcTarget *target, unsigned int flags, int listing,
+    const OrcTuning *tuning);
+
+#define ORC_COMPILER_ARENA_SIZE 4096
+#define ORC_COMPILER_CODE_SIZE 65536
+
+typedef struct _OrcCompilerArenaBlock OrcCompilerArenaBlock;
+typedef struct _OrcCompilerContext OrcCompilerContext;
+
+struct _OrcCompilerArenaBlock {
+  OrcCompilerArenaBlock *next;
+  double data[1];
+};
+
+/* Scratch state of a compile.  Each thread keeps one context between
+ * compiles, so that compiling doesn't allocate the compiler, the code
+ * buffer and the x86 instruction buffer every time.  Names of temporary
+ * variables and other data that only lives during a compile come from
+ * an arena that is emptied when the compile finishes. */
+struct _OrcCompilerContext {
+  OrcCompiler compiler; /* first, so that a compiler is its context */
+  int in_use;
+  unsigned int n_compiles;
+
+  unsigned char *code;
+  int code_size;
+  void *output_insns;
+  int n_output_insns_alloc;
+
+  char *arena_ptr;
+  int arena_left;
+  OrcCompilerArenaBlock *arena_blocks;
+  double arena[ORC_COMPILER_ARENA_SIZE / sizeof(double)];
+};
+
+static int orc_compiler_context_slot = -1;
+
+static void orc_compiler_context_destroy (void *data);
 
 static char **_orc_compiler_flag_list;
 int _orc_compiler_flag_backup;
 int _orc_compiler_flag_emulate;
 int _orc_compiler_flag_debug;
 int _orc_compiler_flag_randomize;
+int _orc_compiler_flag_autotune;
+int _orc_compiler_flag_nolisting;
 
 void
 _orc_compiler_init (void)
@@ -61,6 +105,306 @@ _orc_compiler_init (void)
   _orc_compiler_flag_emulate = orc_compiler_flag_check ("emulate");
   _orc_compiler_flag_debug = orc_compiler_flag_check ("debug");
   _orc_compiler_flag_randomize = orc_compiler_flag_check ("randomize");
+  _orc_compiler_flag_autotune = orc_compiler_flag_check ("autotune");
+  _orc_compiler_flag_nolisting = orc_compiler_flag_check ("nolisting");
+
+  orc_compiler_context_slot =
+    orc_thread_local_new (orc_compiler_context_destroy);
+}
+
+static void
+orc_compiler_arena_reset (OrcCompilerContext *context)
+{
+  OrcCompilerArenaBlock *block;
+
+  while (context->arena_blocks) {
+    block = context->arena_blocks;
+    context->arena_blocks = block->next;
+    free (block);
+  }
+  context->arena_ptr = (char *)context->arena;
+  context->arena_left = sizeof(context->arena);
+}
+
+/* Allocates memory that stays valid until the end of the compile.  It
+ * is never freed by the caller. */
+void *
+_orc_compiler_arena_alloc (OrcCompiler *compiler, int size)
+{
+  OrcCompilerContext *context = (OrcCompilerContext *)compiler;
+  OrcCompilerArenaBlock *block;
+  void *ptr;
+
+  size = (size + sizeof(double) - 1) & ~(sizeof(double) - 1);
+  if (size > context->arena_left) {
+    int block_size = MAX (size, ORC_COMPILER_ARENA_SIZE);
+
+    block = malloc (offsetof (OrcCompilerArenaBlock, data) + block_size);
+    block->next = context->arena_blocks;
+    context->arena_blocks = block;
+    context->arena_ptr = (char *)block->data;
+    context->arena_left = block_size;
+  }
+
+  ptr = context->arena_ptr;
+  context->arena_ptr += size;
+  context->arena_left -= size;
+  return ptr;
+}
+
+/* Returns a copy of a table with room for at least n entries, or the
+ * table itself if it is large enough.  The copy lives in the arena, so
+ * it goes away with the old one when the compile finishes. */
+static void *
+orc_compiler_grow_table (OrcCompiler *compiler, void *table, int *n_alloc,
+    int n, int size)
+{
+  void *new_table;
+  int n_new = *n_alloc;
+
+  if (n <= n_new) return table;
+  while (n_new < n) n_new *= 2;
+
+  new_table = _orc_compiler_arena_alloc (compiler, n_new * size);
+  memcpy (new_table, table, *n_alloc * size);
+  memset ((unsigned char *)new_table + *n_alloc * size, 0,
+      (n_new - *n_alloc) * size);
+  *n_alloc = n_new;
+
+  return new_table;
+}
+
+/* Makes the code buffer at least size bytes long.  The code already
+ * in it is kept, but codeptr has to be reset by the caller.  Returns
+ * FALSE, and fails the compile, if there is no memory for it. */
+int
+_orc_compiler_grow_code (OrcCompiler *compiler, int size)
+{
+  unsigned char *code;
+  int code_size = compiler->code_size;
+
+  if (size <= code_size) return TRUE;
+
+  while (code_size < size) code_size *= 2;
+  code = realloc (compiler->code, code_size);
+  if (code == NULL) {
+    orc_compiler_error (compiler, "no memory for %d bytes of code",
+        code_size);
+    return FALSE;
+  }
+  compiler->code = code;
+  compiler->code_size = code_size;
+
+  return TRUE;
+}
+
+/* For the targets that write their code directly, and can't move it
+ * to a larger buffer: checks that size more bytes fit in the code
+ * buffer.  If they don't, the compile fails, and the code starts over
+ * at the beginning of the buffer, so the rest of the compile still
+ * writes inside it.  The last 4 bytes are kept free, so a fixup at
+ * codeptr is always inside the buffer too. */
+void
+_orc_compiler_check_code (OrcCompiler *compiler, int size)
+{
+  if (compiler->codeptr + size + 4 <= compiler->code + compiler->code_size) {
+    return;
+  }
+
+  orc_compiler_error (compiler, "code doesn't fit in %d bytes",
+      compiler->code_size);
+  compiler->codeptr = compiler->code;
+}
+
+/**
+ * orc_compiler_new_insn:
+ * @compiler: an OrcCompiler object
+ *
+ * Appends a cleared instruction to the instructions of the compiler.
+ * Pointers to earlier instructions are no longer valid afterwards.
+ *
+ * Returns: the new instruction
+ */
+OrcInstruction *
+orc_compiler_new_insn (OrcCompiler *compiler)
+{
+  OrcInstruction *insn;
+
+  compiler->insn_table = orc_compiler_grow_table (compiler,
+      compiler->insn_table, &compiler->n_insns_alloc,
+      compiler->n_insns + 1, sizeof(OrcInstruction));
+  insn = compiler->insn_table + compiler->n_insns;
+  memset (insn, 0, sizeof(OrcInstruction));
+  compiler->n_insns++;
+
+  return insn;
+}
+
+/**
+ * orc_compiler_new_fixup:
+ * @compiler: an OrcCompiler object
+ *
+ * Appends a cleared fixup to the fixups of the compiler.
+ * Pointers to earlier fixups are no longer valid afterwards.
+ *
+ * Returns: the new fixup
+ */
+OrcFixup *
+orc_compiler_new_fixup (OrcCompiler *compiler)
+{
+  OrcFixup *fixup;
+
+  compiler->fixup_table = orc_compiler_grow_table (compiler,
+      compiler->fixup_table, &compiler->n_fixups_alloc,
+      compiler->n_fixups + 1, sizeof(OrcFixup));
+  fixup = compiler->fixup_table + compiler->n_fixups;
+  memset (fixup, 0, sizeof(OrcFixup));
+  compiler->n_fixups++;
+
+  return fixup;
+}
+
+/**
+ * orc_compiler_new_constant:
+ * @compiler: an OrcCompiler object
+ *
+ * Appends a cleared constant to the constants of the compiler.
+ * Pointers to earlier constants are no longer valid afterwards.
+ *
+ * Returns: the new constant
+ */
+OrcConstant *
+orc_compiler_new_constant (OrcCompiler *compiler)
+{
+  OrcConstant *constant;
+
+  compiler->constant_table = orc_compiler_grow_table (compiler,
+      compiler->constant_table, &compiler->n_constants_alloc,
+      compiler->n_constants + 1, sizeof(OrcConstant));
+  constant = compiler->constant_table + compiler->n_constants;
+  memset (constant, 0, sizeof(OrcConstant));
+  compiler->n_constants++;
+
+  return constant;
+}
+
+static OrcCompilerContext *
+orc_compiler_context_new (void)
+{
+  OrcCompilerContext *context;
+
+  context = malloc (sizeof(OrcCompilerContext));
+  memset (context, 0, offsetof (OrcCompilerContext, arena));
+  context->code = malloc (ORC_COMPILER_CODE_SIZE);
+  context->code_size = ORC_COMPILER_CODE_SIZE;
+  orc_compiler_arena_reset (context);
+
+  return context;
+}
+
+static void
+orc_compiler_context_destroy (void *data)
+{
+  OrcCompilerContext *context = data;
+
+  orc_compiler_arena_reset (context);
+  free (context->code);
+  free (context->output_insns);
+  free (context);
+}
+
+/* Takes this thread's context, or a new one if it is already in use
+ * or there is no thread-local storage. */
+static OrcCompiler *
+orc_compiler_context_get (void)
+{
+  OrcCompilerContext *context = NULL;
+
+  if (orc_compiler_context_slot >= 0) {
+    context = orc_thread_local_get (orc_compiler_context_slot);
+    if (context == NULL) {
+      context = orc_compiler_context_new ();
+      orc_thread_local_set (orc_compiler_context_slot, context);
+    }
+  }
+  if (context == NULL || context->in_use) {
+    context = orc_compiler_context_new ();
+  }
+  context->in_use = TRUE;
+  context->n_compiles++;
+
+  memset (&context->compiler, 0, sizeof(OrcCompiler));
+  context->compiler.code = context->code;
+  context->compiler.code_size = context->code_size;
+  context->compiler.output_insns = context->output_insns;
+  context->compiler.n_output_insns_alloc = context->n_output_insns_alloc;
+  context->compiler.insn_table = context->compiler.insns;
+  context->compiler.n_insns_alloc = ORC_N_INSNS;
+  context->compiler.fixup_table = context->compiler.fixups;
+  context->compiler.n_fixups_alloc = ORC_N_FIXUPS;
+  context->compiler.constant_table = context->compiler.constants;
+  context->compiler.n_constants_alloc = ORC_N_CONSTANTS;
+
+  return &context->compiler;
+}
+
+static void
+orc_compiler_context_release (OrcCompiler *compiler)
+{
+  OrcCompilerContext *context = (OrcCompilerContext *)compiler;
+
+  /* the code and instruction buffers may have grown */
+  context->code = compiler->code;
+  context->code_size = compiler->code_size;
+  context->output_insns = compiler->output_insns;
+  context->n_output_insns_alloc = compiler->n_output_insns_alloc;
+  orc_compiler_arena_reset (context);
+  context->in_use = FALSE;
+
+  if (orc_compiler_context_slot < 0 ||
+      orc_thread_local_get (orc_compiler_context_slot) != context) {
+    orc_compiler_context_destroy (context);
+  }
+}
+
+static int
+orc_compiler_flag_compare (const void *a, const void *b)
+{
+  return strcmp (*(const char * const *)a, *(const char * const *)b);
+}
+
+/* Returns the flags in ORC_CODE, sorted, and separated by commas, to be
+ * freed by the caller.  Most of them change how code is generated, so
+ * code cached with one set of flags is only used with the same set. */
+char *
+_orc_compiler_get_flags (void)
+{
+  char **list;
+  char *s;
+  int length = 1;
+  int n;
+  int i;
+
+  if (_orc_compiler_flag_list == NULL) return strdup ("");
+
+  for(n=0;_orc_compiler_flag_list[n];n++){
+    length += strlen (_orc_compiler_flag_list[n]) + 1;
+  }
+  list = malloc (sizeof(char *) * (n + 1));
+  memcpy (list, _orc_compiler_flag_list, sizeof(char *) * (n + 1));
+  qsort (list, n, sizeof(char *), orc_compiler_flag_compare);
+
+  s = malloc (length);
+  s[0] = 0;
+  for(i=0;i<n;i++){
+    if (list[i][0] == 0) continue;
+    if (i > 0 && strcmp (list[i], list[i-1]) == 0) continue;
+    if (s[0]) strcat (s, ",");
+    strcat (s, list[i]);
+  }
+  free (list);
+
+  return s;
 }
 
 int
@@ -93,7 +437,8 @@ orc_compiler_allocate_register (OrcCompiler *compiler, int data_reg)
   roff = 0;
   if (_orc_compiler_flag_randomize) {
     /* for testing */
-    roff = rand()&0x1f;
+    compiler->random_state = compiler->random_state * 1103515245 + 12345;
+    roff = (compiler->random_state >> 16)&0x1f;
   }
 
   for(i=0;i<32;i++){
@@ -116,15 +461,124 @@ orc_compiler_allocate_register (OrcCompiler *compiler, int data_reg)
     }
   }
 
+  if (data_reg && compiler->spill_reserve > 0) {
+    /* the caller puts the variable on the stack */
+    return 0;
+  }
   if (data_reg || !compiler->allow_gp_on_stack) {
     orc_compiler_error (compiler, "register overflow for %s reg",
         data_reg ? "vector" : "gp");
     compiler->result = ORC_COMPILE_RESULT_UNKNOWN_COMPILE;
+    if (data_reg) compiler->out_of_registers = TRUE;
   }
 
   return 0;
 }
 
+/* Gives var, which is first used by instruction j, a vector register.
+ * When the allocation is redone with spilling and the registers run
+ * out, the variable whose live range ends last goes to the stack, as
+ * in linear scan allocation: either var, or a temporary holding a
+ * register that var then takes over.  Values computed before the loop
+ * count as live until its end.  A variable is spilled for its whole
+ * live range, so the code for the instructions before j doesn't
+ * change. */
+static void
+orc_compiler_allocate_vector (OrcCompiler *compiler, int var, int j)
+{
+  OrcVariable *vars = compiler->vars;
+  int victim = var;
+  int victim_end;
+  int end;
+  int i;
+
+  vars[var].alloc = orc_compiler_allocate_register (compiler, TRUE);
+  if (vars[var].alloc || compiler->error) return;
+
+  victim_end = (vars[var].first_use == -1) ? compiler->n_insns :
+    vars[var].last_use;
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    if (i == var || vars[i].alloc == 0 ||
+        vars[i].vartype != ORC_VAR_TYPE_TEMP) continue;
+    if (vars[i].first_use == -1) {
+      end = compiler->n_insns;
+    } else if (vars[i].first_use < j && vars[i].last_use > j) {
+      end = vars[i].last_use;
+    } else {
+      continue;
+    }
+    if (end > victim_end) {
+      victim = i;
+      victim_end = end;
+    }
+  }
+
+  if (victim != var) {
+    vars[var].alloc = vars[victim].alloc;
+    vars[victim].alloc = 0;
+  }
+  compiler->spill_slot[victim] = ++compiler->n_spill_slots;
+  ORC_DEBUG("spilled %s to slot %d", vars[victim].name,
+      compiler->n_spill_slots - 1);
+}
+
+/* Gets the compiler ready to redo the register allocation and the code
+ * generation after it ran out of vector registers, now with spilling
+ * and one more register kept free for the spilled variables and the
+ * temporaries of the rules.  Returns FALSE if that can't help. */
+static int
+orc_compiler_retry_with_spilling (OrcCompiler *compiler)
+{
+  int offset = compiler->target->data_register_offset;
+  int n_regs = 0;
+  int i;
+
+  if (!compiler->allow_spill || !compiler->out_of_registers) return FALSE;
+
+  for(i=0;i<32;i++){
+    if (compiler->valid_regs[offset + i]) n_regs++;
+  }
+  if (compiler->spill_reserve == 0) {
+    compiler->spill_reserve = 2;
+  } else {
+    compiler->spill_reserve++;
+  }
+  if (compiler->spill_reserve >= n_regs) return FALSE;
+
+  ORC_INFO("out of vector registers (%s), spilling with %d kept free",
+      compiler->error_msg, compiler->spill_reserve);
+
+  free (compiler->error_msg);
+  compiler->error_msg = NULL;
+  compiler->error = FALSE;
+  compiler->result = ORC_COMPILE_RESULT_OK;
+  compiler->out_of_registers = FALSE;
+
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    OrcVariable *var = compiler->vars + i;
+
+    var->alloc = 0;
+    var->ptr_register = 0;
+    var->ptr_offset = 0;
+    var->mask_alloc = 0;
+    var->aligned_data = 0;
+  }
+  memset (compiler->alloc_regs, 0, sizeof(compiler->alloc_regs));
+  memset (compiler->used_regs, 0, sizeof(compiler->used_regs));
+  memset (compiler->spill_slot, 0, sizeof(compiler->spill_slot));
+  compiler->n_spill_slots = 0;
+  compiler->loop_counter = ORC_REG_INVALID;
+
+  compiler->n_constants = 0;
+  compiler->n_output_insns = 0;
+  compiler->min_temp_reg = 0;
+  compiler->max_used_temp_reg = 0;
+  compiler->asm_code_len = 0;
+  if (compiler->asm_code) compiler->asm_code[0] = 0;
+
+  return TRUE;
+}
+
 /**
  * orc_program_compile:
  * @program: the OrcProgram to compile
@@ -185,11 +639,66 @@ orc_program_compile_for_target (OrcProgram *program, OrcTarget *target)
 OrcCompileResult
 orc_program_compile_full (OrcProgram *program, OrcTarget *target,
     unsigned int flags)
+{
+  return orc_program_compile_internal (program, target, flags, FALSE, NULL);
+}
+
+/* Compiles with the given loop shape, without the code cache.  Used by
+ * _orc_compiler_autotune() to try the shapes. */
+OrcCompileResult
+_orc_program_compile_tuned (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, const OrcTuning *tuning)
+{
+  return orc_program_compile_internal (program, target, flags, FALSE,
+      tuning);
+}
+
+/* Formatting the assembly listing takes most of the time of a compile
+ * for an executable target.  With the "nolisting" flag in ORC_CODE it
+ * is left out, and only produced when orc_program_get_asm_code() asks
+ * for it, by compiling a copy of the program again with the listing
+ * turned on. */
+void
+_orc_compiler_make_asm_code (OrcProgram *program)
+{
+  OrcProgram *copy;
+  OrcCode *code;
+  OrcTuning tuning;
+
+  _orc_async_finish (program);
+
+  code = program->orccode;
+  if (program->asm_code || code == NULL || code->target == NULL) return;
+
+  copy = _orc_program_copy (program);
+
+  tuning.loop_shift_down = code->tune_loop_shift_down;
+  tuning.unroll_shift = code->tune_unroll_shift;
+  orc_program_compile_internal (copy, code->target, code->target_flags, TRUE,
+      code->is_tuned ? &tuning : NULL);
+
+  program->asm_code = copy->asm_code;
+  copy->asm_code = NULL;
+  orc_program_free (copy);
+}
+
+static OrcCompileResult
+orc_program_compile_internal (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, int listing, const OrcTuning *tuning)
 {
   OrcCompiler *compiler;
   int i;
   OrcCompileResult result;
   const char *error_msg;
+  OrcBytecode *cache_key;
+  OrcCode *old_code;
+  int loop_shift;
+  int unroll_shift;
+  OrcTuning tuned;
+  OrcInstruction *emulate_insns = NULL;
+  int n_emulate_insns;
+
+  _orc_async_finish (program);
 
   ORC_INFO("initializing compiler for program \"%s\"", program->name);
   error_msg = orc_program_get_error (program);
@@ -199,18 +708,33 @@ orc_program_compile_full (OrcProgram *program, OrcTarget *target,
     return ORC_COMPILE_RESULT_UNKNOWN_PARSE;
   }
 
-  if (program->orccode) {
-    orc_code_free (program->orccode);
-    program->orccode = NULL;
-  }
+  old_code = program->orccode;
+  program->orccode = NULL;
 
   if (program->asm_code) {
     free (program->asm_code);
     program->asm_code = NULL;
   }
 
-  compiler = malloc (sizeof(OrcCompiler));
-  memset (compiler, 0, sizeof(OrcCompiler));
+  /* Look up before freeing the old code, so that recompiling a program
+   * doesn't drop its own cache entry */
+  cache_key = NULL;
+  if (!listing && tuning == NULL &&
+      _orc_code_cache_lookup (program, target, flags, &cache_key)) {
+    if (old_code) orc_code_free (old_code);
+    return program->orccode->result;
+  }
+  if (old_code) orc_code_free (old_code);
+
+  /* Done before taking the compiler context, which the compiles of the
+   * loop shapes need */
+  if (!listing && tuning == NULL && _orc_compiler_flag_autotune &&
+      target && target->executable &&
+      _orc_compiler_autotune (program, target, flags, &tuned)) {
+    tuning = &tuned;
+  }
+
+  compiler = orc_compiler_context_get ();
 
   if (program->backup_func) {
     program->code_exec = program->backup_func;
@@ -221,8 +745,20 @@ orc_program_compile_full (OrcProgram *program, OrcTarget *target,
   compiler->program = program;
   compiler->target = target;
   compiler->target_flags = flags;
+  if (tuning && tuning->unroll_shift >= 0) {
+    compiler->is_tuned = TRUE;
+    compiler->tune_loop_shift_down = tuning->loop_shift_down;
+    compiler->tune_unroll_shift = tuning->unroll_shift;
+  }
+  if (!listing && _orc_compiler_flag_nolisting &&
+      target && target->executable) {
+    compiler->defer_asm_code = TRUE;
+  }
+  /* not rand(), which has global state shared with other threads */
+  compiler->random_state = (unsigned int)(size_t)compiler +
+    ((OrcCompilerContext *)compiler)->n_compiles;
 
-  {
+  if (orc_debug_get_level () >= ORC_DEBUG_LOG) {
     ORC_LOG("variables");
     for(i=0;i<ORC_N_VARIABLES;i++){
       if (program->vars[i].size > 0) {
@@ -236,15 +772,18 @@ orc_program_compile_full (OrcProgram *program, OrcTarget *target,
     ORC_LOG("instructions");
     for(i=0;i<program->n_insns;i++){
       ORC_LOG("%d: %s %d %d %d %d", i,
-          program->insns[i].opcode->name,
-          program->insns[i].dest_args[0],
-          program->insns[i].dest_args[1],
-          program->insns[i].src_args[0],
-          program->insns[i].src_args[1]);
+          program->insn_table[i].opcode->name,
+          program->insn_table[i].dest_args[0],
+          program->insn_table[i].dest_args[1],
+          program->insn_table[i].src_args[0],
+          program->insn_table[i].src_args[1]);
     }
   }
 
-  memcpy (compiler->insns, program->insns,
+  compiler->insn_table = orc_compiler_grow_table (compiler,
+      compiler->insn_table, &compiler->n_insns_alloc, program->n_insns,
+      sizeof(OrcInstruction));
+  memcpy (compiler->insn_table, program->insn_table,
       program->n_insns * sizeof(OrcInstruction));
   compiler->n_insns = program->n_insns;
 
@@ -269,6 +808,16 @@ orc_program_compile_full (OrcProgram *program, OrcTarget *target,
   orc_compiler_rewrite_insns (compiler);
   if (compiler->error) goto error;
 
+  /* The emulator runs the instructions as written, so that a wrong
+   * rewrite in the optimizer shows up as a difference between the
+   * emulated and the compiled code */
+  n_emulate_insns = compiler->n_insns;
+  emulate_insns = malloc (sizeof(OrcInstruction) * n_emulate_insns);
+  memcpy (emulate_insns, compiler->insn_table,
+      sizeof(OrcInstruction) * n_emulate_insns);
+
+  _orc_compiler_optimize (compiler);
+
   orc_compiler_rewrite_vars (compiler);
   if (compiler->error) goto error;
 
@@ -289,11 +838,11 @@ orc_program_compile_full (OrcProgram *program, OrcTarget *target,
     ORC_ERROR("instructions");
     for(i=0;i<compiler->n_insns;i++){
       ORC_ERROR("%d: %s %d %d %d %d", i,
-          compiler->insns[i].opcode->name,
-          compiler->insns[i].dest_args[0],
-          compiler->insns[i].dest_args[1],
-          compiler->insns[i].src_args[0],
-          compiler->insns[i].src_args[1]);
+          compiler->insn_table[i].opcode->name,
+          compiler->insn_table[i].dest_args[0],
+          compiler->insn_table[i].dest_args[1],
+          compiler->insn_table[i].src_args[0],
+          compiler->insn_table[i].src_args[1]);
     }
   }
 #endif
@@ -308,11 +857,14 @@ orc_program_compile_full (OrcProgram *program, OrcTarget *target,
   program->orccode->constant_n = program->constant_n;
   program->orccode->constant_m = program->constant_m;
   program->orccode->exec = program->code_exec;
+  program->orccode->is_tuned = compiler->is_tuned;
+  program->orccode->tune_loop_shift_down = compiler->tune_loop_shift_down;
+  program->orccode->tune_unroll_shift = compiler->tune_unroll_shift;
 
-  program->orccode->n_insns = compiler->n_insns;
-  program->orccode->insns = malloc(sizeof(OrcInstruction) * compiler->n_insns);
-  memcpy (program->orccode->insns, compiler->insns,
-      sizeof(OrcInstruction) * compiler->n_insns);
+  program->orccode->n_insns = n_emulate_insns;
+  program->orccode->insns = emulate_insns;
+  emulate_insns = NULL;
+  program->orccode->n_compiled_insns = compiler->n_insns;
 
   program->orccode->vars = malloc (sizeof(OrcCodeVariable) * ORC_N_COMPILER_VARIABLES);
   memset (program->orccode->vars, 0,
@@ -337,24 +889,26 @@ orc_program_compile_full (OrcProgram *program, OrcTarget *target,
     goto error;
   }
 
-  if (compiler->target) {
-    orc_compiler_global_reg_alloc (compiler);
-
-    orc_compiler_rewrite_vars2 (compiler);
-  }
-  if (compiler->error) goto error;
-
   orc_compiler_assign_rules (compiler);
   if (compiler->error) goto error;
 
-  ORC_INFO("allocating code memory");
-  compiler->code = malloc(65536);
-  compiler->codeptr = compiler->code;
-
-  if (compiler->error) goto error;
-
   ORC_INFO("compiling for target \"%s\"", compiler->target->name);
-  compiler->target->compile (compiler);
+  loop_shift = compiler->loop_shift;
+  unroll_shift = compiler->unroll_shift;
+  while (TRUE) {
+    orc_compiler_global_reg_alloc (compiler);
+    orc_compiler_rewrite_vars2 (compiler);
+
+    if (!compiler->error) {
+      compiler->codeptr = compiler->code;
+      compiler->target->compile (compiler);
+    }
+    if (!compiler->error || !orc_compiler_retry_with_spilling (compiler)) {
+      break;
+    }
+    compiler->loop_shift = loop_shift;
+    compiler->unroll_shift = unroll_shift;
+  }
   if (compiler->error) {
     compiler->result = ORC_COMPILE_RESULT_UNKNOWN_COMPILE;
     goto error;
@@ -377,16 +931,16 @@ orc_program_compile_full (OrcProgram *program, OrcTarget *target,
   program->code_exec = program->orccode->exec;
 
   program->asm_code = compiler->asm_code;
+  program->orccode->target = target;
+  program->orccode->target_flags = flags;
 
   result = compiler->result;
-  for (i=0;i<compiler->n_dup_vars;i++){
-    free(compiler->vars[ORC_VAR_T1 + compiler->n_temp_vars + i].name);
-    compiler->vars[ORC_VAR_T1 + compiler->n_temp_vars + i].name = NULL;
-  }
-  free (compiler->code);
-  compiler->code = NULL;
-  if (compiler->output_insns) free (compiler->output_insns);
-  free (compiler);
+  program->orccode->result = result;
+  if (cache_key) {
+    _orc_code_cache_insert (program, target, flags, cache_key);
+    cache_key = NULL;
+  }
+  orc_compiler_context_release (compiler);
   ORC_INFO("finished compiling (success)");
 
   return result;
@@ -409,14 +963,9 @@ error:
     free (compiler->asm_code);
     compiler->asm_code = NULL;
   }
-  for (i=0;i<compiler->n_dup_vars;i++){
-    free(compiler->vars[ORC_VAR_T1 + compiler->n_temp_vars + i].name);
-    compiler->vars[ORC_VAR_T1 + compiler->n_temp_vars + i].name = NULL;
-  }
-  free (compiler->code);
-  compiler->code = NULL;
-  if (compiler->output_insns) free (compiler->output_insns);
-  free (compiler);
+  orc_compiler_context_release (compiler);
+  if (cache_key) orc_bytecode_free (cache_key);
+  free (emulate_insns);
   ORC_INFO("finished compiling (fail)");
   return result;
 }
@@ -429,7 +978,7 @@ orc_compiler_check_sizes (OrcCompiler *compiler)
   int max_size = 1;
 
   for(i=0;i<compiler->n_insns;i++) {
-    OrcInstruction *insn = compiler->insns + i;
+    OrcInstruction *insn = compiler->insn_table + i;
     OrcStaticOpcode *opcode = insn->opcode;
     int multiplier = 1;
 
@@ -540,20 +1089,51 @@ get_store_opcode_for_size (int size)
   return NULL;
 }
 
+/* Returns a temporary for a load or store added by
+ * orc_compiler_rewrite_insns().  Once the variables run out, one that
+ * the earlier instructions are done with is used again. */
+static int
+orc_compiler_get_load_temporary (OrcCompiler *compiler, int size,
+    int *done, int *n_done)
+{
+  int i;
+
+  if (ORC_VAR_T1 + compiler->n_temp_vars + compiler->n_dup_vars <
+      ORC_N_COMPILER_VARIABLES) {
+    return orc_compiler_new_temporary (compiler, size);
+  }
+
+  for(i=*n_done-1;i>=0;i--){
+    int var = done[i];
+
+    if (compiler->vars[var].size == size) {
+      (*n_done)--;
+      done[i] = done[*n_done];
+      return var;
+    }
+  }
+
+  return orc_compiler_new_temporary (compiler, size);
+}
+
 void
 orc_compiler_rewrite_insns (OrcCompiler *compiler)
 {
   int i;
   int j;
+  int x;
   OrcStaticOpcode *opcode;
   OrcProgram *program = compiler->program;
+  int done[ORC_N_COMPILER_VARIABLES];
+  int n_done = 0;
 
   compiler->n_insns = 0;
   for(j=0;j<program->n_insns;j++){
     OrcInstruction insn;
     OrcInstruction *xinsn;
+    int first = compiler->n_insns;
 
-    memcpy (&insn, program->insns + j, sizeof(OrcInstruction));
+    memcpy (&insn, program->insn_table + j, sizeof(OrcInstruction));
     opcode = insn.opcode;
 
     if (!(opcode->flags & ORC_STATIC_OPCODE_LOAD)) {
@@ -570,16 +1150,15 @@ orc_compiler_rewrite_insns (OrcCompiler *compiler)
         if (var->vartype == ORC_VAR_TYPE_SRC ||
             var->vartype == ORC_VAR_TYPE_DEST) {
           OrcInstruction *cinsn;
-          
-          cinsn = compiler->insns + compiler->n_insns;
-          compiler->n_insns++;
+
+          cinsn = orc_compiler_new_insn (compiler);
 
           cinsn->flags = insn.flags;
           cinsn->flags |= ORC_INSN_FLAG_ADDED;
           cinsn->flags &= ~(ORC_INSTRUCTION_FLAG_X2|ORC_INSTRUCTION_FLAG_X4);
           cinsn->opcode = get_load_opcode_for_size (var->size);
-          cinsn->dest_args[0] = orc_compiler_new_temporary (compiler,
-              var->size);
+          cinsn->dest_args[0] = orc_compiler_get_load_temporary (compiler,
+              var->size, done, &n_done);
           cinsn->src_args[0] = insn.src_args[i];
           insn.src_args[i] = cinsn->dest_args[0];
         } else if (var->vartype == ORC_VAR_TYPE_CONST ||
@@ -608,8 +1187,7 @@ orc_compiler_rewrite_insns (OrcCompiler *compiler)
             insn.src_args[i] = loaded;
             continue;
           }
-          cinsn = compiler->insns + compiler->n_insns;
-          compiler->n_insns++;
+          cinsn = orc_compiler_new_insn (compiler);
 
           cinsn->flags = insn.flags;
           cinsn->flags |= ORC_INSN_FLAG_ADDED;
@@ -628,9 +1206,9 @@ orc_compiler_rewrite_insns (OrcCompiler *compiler)
       }
     }
 
-    xinsn = compiler->insns + compiler->n_insns;
+    x = compiler->n_insns;
+    xinsn = orc_compiler_new_insn (compiler);
     memcpy (xinsn, &insn, sizeof(OrcInstruction));
-    compiler->n_insns++;
 
     if (!(opcode->flags & ORC_STATIC_OPCODE_STORE)) {
       for(i=0;i<ORC_STATIC_OPCODE_N_DEST;i++){
@@ -641,21 +1219,38 @@ orc_compiler_rewrite_insns (OrcCompiler *compiler)
         var = compiler->vars + insn.dest_args[i];
         if (var->vartype == ORC_VAR_TYPE_DEST) {
           OrcInstruction *cinsn;
-          
-          cinsn = compiler->insns + compiler->n_insns;
-          compiler->n_insns++;
+
+          cinsn = orc_compiler_new_insn (compiler);
+          /* adding an instruction can move the table */
+          xinsn = compiler->insn_table + x;
 
           cinsn->flags = xinsn->flags;
           cinsn->flags |= ORC_INSN_FLAG_ADDED;
           cinsn->flags &= ~(ORC_INSTRUCTION_FLAG_X2|ORC_INSTRUCTION_FLAG_X4);
           cinsn->opcode = get_store_opcode_for_size (var->size);
-          cinsn->src_args[0] = orc_compiler_new_temporary (compiler, var->size);
+          cinsn->src_args[0] = orc_compiler_get_load_temporary (compiler,
+              var->size, done, &n_done);
           cinsn->dest_args[0] = xinsn->dest_args[i];
           xinsn->dest_args[i] = cinsn->src_args[0];
         }
       }
     }
 
+    if (compiler->error) return;
+
+    /* the temporaries of the loads and stores added for this
+     * instruction aren't used by any later one */
+    for(i=first;i<compiler->n_insns;i++){
+      OrcInstruction *cinsn = compiler->insn_table + i;
+
+      if (i < x) {
+        if (compiler->vars[cinsn->dest_args[0]].has_parameter) continue;
+        done[n_done++] = cinsn->dest_args[0];
+      } else if (i > x) {
+        done[n_done++] = cinsn->src_args[0];
+      }
+    }
+
   }
 }
 
@@ -665,7 +1260,7 @@ orc_compiler_assign_rules (OrcCompiler *compiler)
   int i;
 
   for(i=0;i<compiler->n_insns;i++) {
-    OrcInstruction *insn = compiler->insns + i;
+    OrcInstruction *insn = compiler->insn_table + i;
 
     insn->rule = orc_target_get_rule (compiler->target, insn->opcode,
         compiler->target_flags);
@@ -702,13 +1297,13 @@ orc_compiler_get_temp_reg (OrcCompiler *compiler)
     }
   }
   for(j=0;j<compiler->n_constants;j++){
-    if (compiler->constants[j].alloc_reg) {
-      compiler->alloc_regs[compiler->constants[j].alloc_reg] = 1;
+    if (compiler->constant_table[j].alloc_reg) {
+      compiler->alloc_regs[compiler->constant_table[j].alloc_reg] = 1;
     }
   }
 
   ORC_DEBUG("at insn %d %s", compiler->insn_index,
-      compiler->insns[compiler->insn_index].opcode->name);
+      compiler->insn_table[compiler->insn_index].opcode->name);
 
   for(j=compiler->min_temp_reg;j<ORC_VEC_REG_BASE+32;j++){
     if (compiler->valid_regs[j] && !compiler->alloc_regs[j]) {
@@ -720,10 +1315,34 @@ orc_compiler_get_temp_reg (OrcCompiler *compiler)
 
   orc_compiler_error (compiler, "no temporary register available");
   compiler->result = ORC_COMPILE_RESULT_UNKNOWN_COMPILE;
+  compiler->out_of_registers = TRUE;
 
   return 0;
 }
 
+/* Checks whether instruction j can write var without a new variable.
+ * The rules don't expect the destination to share a register with a
+ * source other than the first, and a value computed once outside the
+ * loop must not be overwritten inside it. */
+static int
+orc_compiler_can_rewrite_temporary (OrcCompiler *compiler, int j, int var)
+{
+  OrcInstruction *insn = compiler->insn_table + j;
+  OrcStaticOpcode *opcode = insn->opcode;
+  OrcInstruction *first = compiler->insn_table + compiler->vars[var].first_use;
+  int k;
+
+  if (opcode->flags & ORC_STATIC_OPCODE_INVARIANT) return FALSE;
+  if (first->opcode->flags & ORC_STATIC_OPCODE_INVARIANT) return FALSE;
+
+  for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+    if (opcode->src_size[k] == 0) continue;
+    if (insn->src_args[k] != var) continue;
+    if (k > 0 || opcode->dest_size[1] != 0) return FALSE;
+  }
+  return TRUE;
+}
+
 void
 orc_compiler_rewrite_vars (OrcCompiler *compiler)
 {
@@ -739,7 +1358,7 @@ orc_compiler_rewrite_vars (OrcCompiler *compiler)
     compiler->vars[j].last_use = -1;
   }
   for(j=0;j<compiler->n_insns;j++){
-    insn = compiler->insns + j;
+    insn = compiler->insn_table + j;
     opcode = insn->opcode;
 
     /* set up args */
@@ -823,12 +1442,23 @@ orc_compiler_rewrite_vars (OrcCompiler *compiler)
         }
 #endif
         if (compiler->vars[var].vartype == ORC_VAR_TYPE_TEMP) {
-          actual_var = orc_compiler_dup_temporary (compiler, var, j);
-          compiler->vars[var].replaced = TRUE;
-          compiler->vars[var].replacement = actual_var;
-          insn->dest_args[k] = actual_var;
-          compiler->vars[actual_var].used = TRUE;
-          compiler->vars[actual_var].first_use = j;
+          int dup = orc_compiler_dup_temporary (compiler, var, j);
+
+          if (dup == -1) {
+            /* Out of variables, so the current one is written again,
+             * which only makes its live range longer */
+            if (!orc_compiler_can_rewrite_temporary (compiler, j,
+                  actual_var)) {
+              orc_compiler_error (compiler, "too many temporary variables");
+            }
+          } else {
+            actual_var = dup;
+            compiler->vars[var].replaced = TRUE;
+            compiler->vars[var].replacement = actual_var;
+            insn->dest_args[k] = actual_var;
+            compiler->vars[actual_var].used = TRUE;
+            compiler->vars[actual_var].first_use = j;
+          }
         }
       }
       compiler->vars[actual_var].last_use = j;
@@ -840,8 +1470,21 @@ void
 orc_compiler_global_reg_alloc (OrcCompiler *compiler)
 {
   int i;
+  int n;
   OrcVariable *var;
 
+  /* when spilling, the last registers are left for loading spilled
+   * variables and for the temporaries of the rules */
+  n = compiler->spill_reserve;
+  for(i=31;i>=0 && n>0;i--){
+    int reg = compiler->target->data_register_offset + i;
+
+    if (compiler->valid_regs[reg]) {
+      compiler->alloc_regs[reg]++;
+      n--;
+    }
+  }
+
   for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
     var = compiler->vars + i;
     if (var->name == NULL) continue;
@@ -868,6 +1511,9 @@ orc_compiler_global_reg_alloc (OrcCompiler *compiler)
         var->first_use = -1;
         var->last_use = -1;
         var->alloc = orc_compiler_allocate_register (compiler, TRUE);
+        if (var->alloc == 0 && !compiler->error) {
+          orc_compiler_error (compiler, "register overflow for vector reg");
+        }
         break;
       case ORC_VAR_TYPE_TEMP:
         break;
@@ -881,15 +1527,18 @@ orc_compiler_global_reg_alloc (OrcCompiler *compiler)
   }
 
   for(i=0;i<compiler->n_insns;i++){
-    OrcInstruction *insn = compiler->insns + i;
+    OrcInstruction *insn = compiler->insn_table + i;
     OrcStaticOpcode *opcode = insn->opcode;
 
-    if (opcode->flags & ORC_STATIC_OPCODE_INVARIANT) {
+    /* instructions moved out of the loop by an earlier allocation
+     * that ran out of registers are already flagged */
+    if ((opcode->flags & ORC_STATIC_OPCODE_INVARIANT) ||
+        (insn->flags & ORC_INSN_FLAG_INVARIANT)) {
       var = compiler->vars + insn->dest_args[0];
 
       var->first_use = -1;
       var->last_use = -1;
-      var->alloc = orc_compiler_allocate_register (compiler, TRUE);
+      orc_compiler_allocate_vector (compiler, insn->dest_args[0], -1);
       insn->flags |= ORC_INSN_FLAG_INVARIANT;
     }
 
@@ -898,6 +1547,10 @@ orc_compiler_global_reg_alloc (OrcCompiler *compiler)
     }
   }
 
+  if (!compiler->error && compiler->spill_reserve == 0) {
+    _orc_compiler_hoist_invariants (compiler);
+  }
+
   if (compiler->alloc_loop_counter && !compiler->error) {
     compiler->loop_counter = orc_compiler_allocate_register (compiler, FALSE);
     /* FIXME massive hack */
@@ -911,9 +1564,19 @@ orc_compiler_global_reg_alloc (OrcCompiler *compiler)
 void
 orc_compiler_rewrite_vars2 (OrcCompiler *compiler)
 {
+  int live_vars[ORC_N_COMPILER_VARIABLES];
+  int n_live_vars = 0;
   int i;
   int j;
-  int k;
+  int l;
+
+  /* the variables that get registers, so the per-instruction loops
+   * below don't have to go through all of them */
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    if (compiler->vars[i].name == NULL) continue;
+    if (compiler->vars[i].last_use == -1) continue;
+    live_vars[n_live_vars++] = i;
+  }
 
   for(j=0;j<compiler->n_insns;j++){
 #if 1
@@ -922,51 +1585,56 @@ orc_compiler_rewrite_vars2 (OrcCompiler *compiler)
      *  - src1 must be last_use
      *  - only one dest
      */
-    if (compiler->insns[j].flags & ORC_INSN_FLAG_INVARIANT) continue;
+    if (compiler->insn_table[j].flags & ORC_INSN_FLAG_INVARIANT) continue;
 
-    if (!(compiler->insns[j].opcode->flags & ORC_STATIC_OPCODE_ACCUMULATOR)) {
-      int src1 = compiler->insns[j].src_args[0];
+    if (!(compiler->insn_table[j].opcode->flags & ORC_STATIC_OPCODE_ACCUMULATOR)) {
+      int src1 = compiler->insn_table[j].src_args[0];
       int dest;
 
-      if (compiler->insns[j].opcode->dest_size[1] == 0)
-        dest = compiler->insns[j].dest_args[0];
+      if (compiler->insn_table[j].opcode->dest_size[1] == 0)
+        dest = compiler->insn_table[j].dest_args[0];
       else
-        dest = compiler->insns[j].dest_args[1];
+        dest = compiler->insn_table[j].dest_args[1];
 
-      if (compiler->vars[src1].last_use == j) {
+      /* a temporary that is written more than once already has a
+       * register */
+      if (compiler->vars[src1].last_use == j &&
+          !(compiler->vars[dest].vartype == ORC_VAR_TYPE_TEMP &&
+            compiler->vars[dest].first_use != j)) {
         if (compiler->vars[src1].first_use == j) {
-          k = orc_compiler_allocate_register (compiler, TRUE);
-          compiler->vars[src1].alloc = k;
+          orc_compiler_allocate_vector (compiler, src1, j);
+        }
+        /* not if src1 is spilled */
+        if (compiler->vars[src1].alloc) {
+          compiler->alloc_regs[compiler->vars[src1].alloc]++;
+          compiler->vars[dest].alloc = compiler->vars[src1].alloc;
         }
-        compiler->alloc_regs[compiler->vars[src1].alloc]++;
-        compiler->vars[dest].alloc = compiler->vars[src1].alloc;
       }
     }
 #endif
 
     if (0) {
       /* immediate operand, don't load */
-      int src2 = compiler->insns[j].src_args[1];
+      int src2 = compiler->insn_table[j].src_args[1];
       compiler->vars[src2].alloc = 1;
     } else {
-      int src2 = compiler->insns[j].src_args[1];
+      int src2 = compiler->insn_table[j].src_args[1];
       if (src2 != -1 && compiler->vars[src2].alloc == 1) {
         compiler->vars[src2].alloc = 0;
       }
     }
 
-    for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
-      if (compiler->vars[i].name == NULL) continue;
-      if (compiler->vars[i].last_use == -1) continue;
+    for(l=0;l<n_live_vars;l++){
+      i = live_vars[l];
       if (compiler->vars[i].first_use == j) {
         if (compiler->vars[i].alloc) continue;
-        k = orc_compiler_allocate_register (compiler, TRUE);
-        compiler->vars[i].alloc = k;
+        if (compiler->spill_slot[i]) continue;
+        orc_compiler_allocate_vector (compiler, i, j);
       }
     }
-    for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
-      if (compiler->vars[i].name == NULL) continue;
-      if (compiler->vars[i].last_use == j) {
+    for(l=0;l<n_live_vars;l++){
+      i = live_vars[l];
+      if (compiler->vars[i].last_use == j && compiler->vars[i].alloc) {
         compiler->alloc_regs[compiler->vars[i].alloc]--;
       }
     }
@@ -979,9 +1647,12 @@ orc_compiler_dup_temporary (OrcCompiler *compiler, int var, int j)
 {
   int i = ORC_VAR_T1 + compiler->n_temp_vars + compiler->n_dup_vars;
 
+  if (i >= ORC_N_COMPILER_VARIABLES) return -1;
+
   compiler->vars[i].vartype = ORC_VAR_TYPE_TEMP;
   compiler->vars[i].size = compiler->vars[var].size;
-  compiler->vars[i].name = malloc (strlen(compiler->vars[var].name) + 10);
+  compiler->vars[i].name = _orc_compiler_arena_alloc (compiler,
+      strlen(compiler->vars[var].name) + 10);
   sprintf(compiler->vars[i].name, "%s.dup%d", compiler->vars[var].name, j);
   compiler->n_dup_vars++;
 
@@ -993,9 +1664,14 @@ orc_compiler_new_temporary (OrcCompiler *compiler, int size)
 {
   int i = ORC_VAR_T1 + compiler->n_temp_vars + compiler->n_dup_vars;
 
+  if (i >= ORC_N_COMPILER_VARIABLES) {
+    orc_compiler_error (compiler, "too many temporary variables");
+    return ORC_N_COMPILER_VARIABLES - 1;
+  }
+
   compiler->vars[i].vartype = ORC_VAR_TYPE_TEMP;
   compiler->vars[i].size = size;
-  compiler->vars[i].name = malloc (10);
+  compiler->vars[i].name = _orc_compiler_arena_alloc (compiler, 10);
   sprintf(compiler->vars[i].name, "tmp%d", i);
   compiler->n_dup_vars++;
 
@@ -1026,17 +1702,28 @@ orc_compiler_dump_asm (OrcCompiler *compiler)
 void
 orc_compiler_append_code (OrcCompiler *p, const char *fmt, ...)
 {
-  char tmp[200];
   va_list varargs;
   int n;
 
+  /* nothing emitted during the analysis pass is kept */
+  if (p->analysis_pass || p->defer_asm_code) return;
+
+  /* Lines are at most 199 characters.  The buffer grows by doubling,
+   * since a program's listing has thousands of lines. */
+  if (p->asm_code_alloc - p->asm_code_len < 200) {
+    p->asm_code_alloc = p->asm_code_alloc ? 2 * p->asm_code_alloc : 4096;
+    p->asm_code = realloc (p->asm_code, p->asm_code_alloc);
+  }
+
   va_start (varargs, fmt);
-  vsnprintf(tmp, 200 - 1, fmt, varargs);
+  n = vsnprintf(p->asm_code + p->asm_code_len, 200 - 1, fmt, varargs);
   va_end (varargs);
 
-  n = strlen (tmp);
-  p->asm_code = realloc (p->asm_code, p->asm_code_len + n + 1);
-  memcpy (p->asm_code + p->asm_code_len, tmp, n + 1);
+  if (n < 0) {
+    p->asm_code[p->asm_code_len] = 0;
+    return;
+  }
+  if (n > 200 - 2) n = 200 - 2;
   p->asm_code_len += n;
 }
 
@@ -1087,23 +1774,23 @@ orc_compiler_get_constant (OrcCompiler *compiler, int size, int value)
   }
 
   for(i=0;i<compiler->n_constants;i++){
-    if (compiler->constants[i].is_long == FALSE &&
-        compiler->constants[i].value == v) {
+    if (compiler->constant_table[i].is_long == FALSE &&
+        compiler->constant_table[i].value == v) {
       break;
     }
   }
   if (i == compiler->n_constants) {
-    compiler->n_constants++;
-    compiler->constants[i].value = v;
-    compiler->constants[i].alloc_reg = 0;
-    compiler->constants[i].use_count = 0;
-    compiler->constants[i].is_long = FALSE;
+    orc_compiler_new_constant (compiler);
+    compiler->constant_table[i].value = v;
+    compiler->constant_table[i].alloc_reg = 0;
+    compiler->constant_table[i].use_count = 0;
+    compiler->constant_table[i].is_long = FALSE;
   }
 
-  compiler->constants[i].use_count++;
+  compiler->constant_table[i].use_count++;
 
-  if (compiler->constants[i].alloc_reg != 0) {;
-    return compiler->constants[i].alloc_reg;
+  if (compiler->constant_table[i].alloc_reg != 0) {;
+    return compiler->constant_table[i].alloc_reg;
   }
   tmp = orc_compiler_get_temp_reg (compiler);
   orc_compiler_load_constant (compiler, tmp, size, value);
@@ -1120,7 +1807,7 @@ orc_compiler_get_constant_long (OrcCompiler *compiler,
   if (tmp == ORC_REG_INVALID) {
     tmp = orc_compiler_get_temp_reg (compiler);
     orc_compiler_load_constant_long (compiler, tmp,
-        &compiler->constants[compiler->n_constants - 1]);
+        &compiler->constant_table[compiler->n_constants - 1]);
   }
   return tmp;
 }
@@ -1132,29 +1819,29 @@ orc_compiler_try_get_constant_long (OrcCompiler *compiler,
   int i;
 
   for(i=0;i<compiler->n_constants;i++){
-    if (compiler->constants[i].is_long == TRUE &&
-        compiler->constants[i].full_value[0] == a &&
-        compiler->constants[i].full_value[1] == b &&
-        compiler->constants[i].full_value[2] == c &&
-        compiler->constants[i].full_value[3] == d) {
+    if (compiler->constant_table[i].is_long == TRUE &&
+        compiler->constant_table[i].full_value[0] == a &&
+        compiler->constant_table[i].full_value[1] == b &&
+        compiler->constant_table[i].full_value[2] == c &&
+        compiler->constant_table[i].full_value[3] == d) {
       break;
     }
   }
   if (i == compiler->n_constants) {
-    compiler->n_constants++;
-    compiler->constants[i].full_value[0] = a;
-    compiler->constants[i].full_value[1] = b;
-    compiler->constants[i].full_value[2] = c;
-    compiler->constants[i].full_value[3] = d;
-    compiler->constants[i].is_long = TRUE;
-    compiler->constants[i].alloc_reg = 0;
-    compiler->constants[i].use_count = 0;
+    orc_compiler_new_constant (compiler);
+    compiler->constant_table[i].full_value[0] = a;
+    compiler->constant_table[i].full_value[1] = b;
+    compiler->constant_table[i].full_value[2] = c;
+    compiler->constant_table[i].full_value[3] = d;
+    compiler->constant_table[i].is_long = TRUE;
+    compiler->constant_table[i].alloc_reg = 0;
+    compiler->constant_table[i].use_count = 0;
   }
 
-  compiler->constants[i].use_count++;
+  compiler->constant_table[i].use_count++;
 
-  if (compiler->constants[i].alloc_reg != 0) {;
-    return compiler->constants[i].alloc_reg;
+  if (compiler->constant_table[i].alloc_reg != 0) {;
+    return compiler->constant_table[i].alloc_reg;
   }
   return ORC_REG_INVALID;
 }
@@ -1182,8 +1869,8 @@ orc_compiler_get_constant_reg (OrcCompiler *compiler)
     }
   }
   for(j=0;j<compiler->n_constants;j++){
-    if (compiler->constants[j].alloc_reg) {
-      compiler->alloc_regs[compiler->constants[j].alloc_reg] = 1;
+    if (compiler->constant_table[j].alloc_reg) {
+      compiler->alloc_regs[compiler->constant_table[j].alloc_reg] = 1;
     }
   }
   if (compiler->max_used_temp_reg < compiler->min_temp_reg)
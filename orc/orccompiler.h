@@ -137,6 +137,42 @@ struct _OrcCompiler {
   void *output_insns;
   int n_output_insns;
   int n_output_insns_alloc;
+
+  unsigned int random_state; /* for ORC_CODE=randomize */
+
+  int asm_code_alloc;
+  int analysis_pass; /* rules only collect constants and temporaries */
+  int defer_asm_code; /* listing is left to orc_program_get_asm_code() */
+
+  /* The tables in use.  They start out as the fixed arrays above and
+   * move to larger allocations when a program needs more entries. */
+  OrcInstruction *insn_table;
+  int n_insns_alloc;
+  OrcFixup *fixup_table;
+  int n_fixups_alloc;
+  OrcConstant *constant_table;
+  int n_constants_alloc;
+
+  int code_size; /* allocated size of code */
+
+  /* Vector variables that don't get a register live in a stack area
+   * that the prologue sets up.  The allocation is only redone with
+   * spilling when a compile runs out of registers. */
+  int allow_spill; /* the target can load and store spilled variables */
+  int spill_reserve; /* vector registers kept free for the reloads */
+  int out_of_registers;
+  int spill_slot_size;
+  int n_spill_slots;
+  int spill_slot[ORC_N_COMPILER_VARIABLES]; /* slot + 1, or 0 */
+
+  /* Loop shape tried or picked by ORC_CODE=autotune.  When is_tuned is
+   * set, targets that support it use these instead of their own
+   * choice. */
+  int is_tuned;
+  int tune_loop_shift_down; /* subtracted from the target's loop_shift */
+  int tune_unroll_shift;
+
+  int use_vex; /* x86: vector instructions use the VEX encoding */
 };
 
 
@@ -158,10 +194,16 @@ void orc_compiler_append_code (OrcCompiler *p, const char *fmt, ...)
 
 int orc_compiler_flag_check (const char *flag);
 
+OrcInstruction * orc_compiler_new_insn (OrcCompiler *compiler);
+OrcFixup * orc_compiler_new_fixup (OrcCompiler *compiler);
+OrcConstant * orc_compiler_new_constant (OrcCompiler *compiler);
+
 extern int _orc_compiler_flag_backup;
 extern int _orc_compiler_flag_emulate;
 extern int _orc_compiler_flag_debug;
 extern int _orc_compiler_flag_randomize;
+extern int _orc_compiler_flag_autotune;
+extern int _orc_compiler_flag_nolisting;
 
 #endif
 
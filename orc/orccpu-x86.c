@@ -30,6 +30,7 @@
 #endif
 #include <orc/orcdebug.h>
 #include <orc/orcsse.h>
+#include <orc/orcavx.h>
 #include <orc/orcmmx.h>
 #include <orc/orcprogram.h>
 #include <orc/orcutils.h>
@@ -47,6 +48,7 @@
 
 orc_uint32 orc_x86_vendor;
 int orc_x86_sse_flags;
+int orc_x86_avx_flags;
 int orc_x86_mmx_flags;
 int orc_x86_microarchitecture;
 
@@ -80,6 +82,17 @@ get_cpuid_ecx (orc_uint32 op, orc_uint32 init_ecx, orc_uint32 *a, orc_uint32 *b,
   *d = 0;
 #endif
 }
+
+/* The state components the OS saves, from XCR0 */
+static orc_uint32
+get_xcr0 (void)
+{
+#if _MSC_FULL_VER >= 160040219
+  return (orc_uint32)_xgetbv(0);
+#else
+  return 0;
+#endif
+}
 #elif defined(__GNUC__) || defined (__SUNPRO_C)
 
 static void
@@ -109,6 +122,20 @@ get_cpuid (orc_uint32 op, orc_uint32 *a, orc_uint32 *b,
   get_cpuid_ecx (op, 0, a, b, c, d);
 }
 
+/* The state components the OS saves, from XCR0.  Only called when
+ * cpuid has the OSXSAVE bit, so xgetbv is there. */
+static orc_uint32
+get_xcr0 (void)
+{
+  orc_uint32 eax, edx;
+
+  /* xgetbv, which older assemblers don't know */
+  __asm__ (".byte 0x0f, 0x01, 0xd0\n"
+      : "=a" (eax), "=d" (edx) : "c" (0));
+
+  return eax;
+}
+
 #else
 
 /* FIXME generate a get_cpuid() function at runtime. */
@@ -202,6 +229,7 @@ handle_cache_descriptor (unsigned int desc)
 }
 
 static void orc_sse_detect_cpuid_intel (orc_uint32 level);
+static void orc_x86_cpuid_handle_avx_flags (orc_uint32 level);
 static void orc_sse_detect_cpuid_amd (orc_uint32 level);
 static void orc_sse_detect_cpuid_generic (orc_uint32 level);
 
@@ -266,6 +294,16 @@ orc_x86_detect_cpuid (void)
     orc_x86_sse_flags &= ~ORC_TARGET_SSE_SSE5;
   }
 
+  /* the AVX target uses the same bits for the SSE flags */
+  orc_x86_avx_flags |= orc_x86_sse_flags;
+  orc_x86_cpuid_handle_avx_flags (level);
+  if (orc_compiler_flag_check ("-avx")) {
+    orc_x86_avx_flags &= ~(ORC_TARGET_AVX_AVX|ORC_TARGET_AVX_AVX2);
+  }
+  if (orc_compiler_flag_check ("-avx2")) {
+    orc_x86_avx_flags &= ~ORC_TARGET_AVX_AVX2;
+  }
+
 }
 
 char orc_x86_processor_string[49];
@@ -324,6 +362,27 @@ orc_x86_cpuid_handle_standard_flags (void)
   }
 }
 
+/* AVX also needs the OS to save the upper halves of the registers */
+static void
+orc_x86_cpuid_handle_avx_flags (orc_uint32 level)
+{
+  orc_uint32 eax, ebx, ecx, edx;
+
+  get_cpuid (0x00000001, &eax, &ebx, &ecx, &edx);
+
+  if (!(ecx & (1<<27)) || !(ecx & (1<<28))) return;
+  if ((get_xcr0 () & 0x6) != 0x6) return;
+  orc_x86_avx_flags |= ORC_TARGET_AVX_AVX;
+
+  if (level >= 7) {
+    get_cpuid_ecx (0x00000007, 0, &eax, &ebx, &ecx, &edx);
+
+    if (ebx & (1<<5)) {
+      orc_x86_avx_flags |= ORC_TARGET_AVX_AVX2;
+    }
+  }
+}
+
 static void
 orc_x86_cpuid_handle_family_model_stepping (void)
 {
@@ -555,6 +614,13 @@ orc_sse_get_cpu_flags(void)
   return orc_x86_sse_flags;
 }
 
+unsigned int
+orc_avx_get_cpu_flags(void)
+{
+  orc_x86_detect_cpuid ();
+  return orc_x86_avx_flags;
+}
+
 unsigned int
 orc_mmx_get_cpu_flags(void)
 {
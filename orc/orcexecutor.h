@@ -57,6 +57,10 @@ struct _OrcExecutor {
   /* m is stored in params[ORC_VAR_A1] */
   /* m_index is stored in params[ORC_VAR_A2] */
   /* elapsed time is stored in params[ORC_VAR_A3] */
+  /* the saved MXCSR is stored in params[ORC_VAR_A4] and
+   * params[ORC_VAR_C1] */
+  /* 2D code running in column strips keeps the columns left in
+   * params[ORC_VAR_C2] and the strip width in params[ORC_VAR_C3] */
   /* high half of params is stored in params[ORC_VAR_T1..] */
 };
 
@@ -0,0 +1,334 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <orc/orcprogram.h>
+#include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
+
+/*
+ * Program fusion
+ *
+ * orc_program_fuse() joins two programs that run back to back over
+ * the same n (and m) into one, where a destination array of the first
+ * feeds a source array of the second.  The linked destination becomes
+ * a temporary, so the intermediate values stay in registers instead of
+ * going through memory.  The instructions of the first program come
+ * before those of the second, which is the same computation because
+ * every element only depends on the elements with the same index.
+ *
+ * The other variables are copied over, keeping their names where
+ * possible.  A variable of the consumer whose name is taken gets a
+ * "_N" suffix.  Constants with the same size and value are shared.
+ */
+
+static int
+orc_fuse_gcd (int a, int b)
+{
+  while (b) {
+    int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static int
+orc_fuse_combine_n (int a, int b, int *value)
+{
+  if (a && b && a != b) return FALSE;
+  *value = a ? a : b;
+  return TRUE;
+}
+
+/* Finds a name for a variable of the consumer that isn't used in the
+ * fused program yet */
+static char *
+orc_fuse_var_name (OrcProgram *fused, const char *name)
+{
+  char *s;
+  int i;
+
+  s = malloc (strlen (name) + 12);
+  strcpy (s, name);
+  for(i=1;orc_program_find_var_by_name (fused, s) >= 0;i++){
+    sprintf(s, "%s_%d", name, i);
+  }
+  return s;
+}
+
+/* Copies variable @var of @program into @fused, and returns its index
+ * there, or -1 when there is no room for it */
+static int
+orc_fuse_add_var (OrcProgram *fused, OrcProgram *program, int var)
+{
+  OrcVariable *src = program->vars + var;
+  OrcVariable *dest;
+  int *n_vars;
+  int first;
+  int max;
+  int i;
+
+  switch (src->vartype) {
+    case ORC_VAR_TYPE_SRC:
+      n_vars = &fused->n_src_vars;
+      first = ORC_VAR_S1;
+      max = ORC_MAX_SRC_VARS;
+      break;
+    case ORC_VAR_TYPE_DEST:
+      n_vars = &fused->n_dest_vars;
+      first = ORC_VAR_D1;
+      max = ORC_MAX_DEST_VARS;
+      break;
+    case ORC_VAR_TYPE_CONST:
+      for(i=0;i<fused->n_const_vars;i++){
+        dest = fused->vars + ORC_VAR_C1 + i;
+        if (dest->size == src->size && dest->value.i == src->value.i) {
+          return ORC_VAR_C1 + i;
+        }
+      }
+      n_vars = &fused->n_const_vars;
+      first = ORC_VAR_C1;
+      max = ORC_MAX_CONST_VARS;
+      break;
+    case ORC_VAR_TYPE_PARAM:
+      n_vars = &fused->n_param_vars;
+      first = ORC_VAR_P1;
+      max = ORC_MAX_PARAM_VARS;
+      break;
+    case ORC_VAR_TYPE_ACCUMULATOR:
+      n_vars = &fused->n_accum_vars;
+      first = ORC_VAR_A1;
+      max = ORC_MAX_ACCUM_VARS;
+      break;
+    case ORC_VAR_TYPE_TEMP:
+      n_vars = &fused->n_temp_vars;
+      first = ORC_VAR_T1;
+      max = ORC_MAX_TEMP_VARS;
+      break;
+    default:
+      return -1;
+  }
+  if (*n_vars >= max) return -1;
+
+  i = first + *n_vars;
+  dest = fused->vars + i;
+  dest->vartype = src->vartype;
+  dest->size = src->size;
+  dest->name = orc_fuse_var_name (fused, src->name);
+  if (src->type_name) dest->type_name = strdup (src->type_name);
+  dest->alignment = src->alignment;
+  dest->is_aligned = src->is_aligned;
+  dest->value = src->value;
+  dest->param_type = src->param_type;
+  (*n_vars)++;
+
+  return i;
+}
+
+/* Copies the instructions of @program, with the variables renumbered
+ * by @map.  Loads from and stores to the linked array become copies. */
+static int
+orc_fuse_add_insns (OrcProgram *fused, OrcProgram *program, const int *map,
+    int linked)
+{
+  int i, k;
+
+  for(i=0;i<program->n_insns;i++){
+    OrcInstruction *insn = program->insn_table + i;
+    OrcInstruction *new_insn;
+    OrcStaticOpcode *opcode = insn->opcode;
+    int uses_linked = FALSE;
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+      if (opcode->dest_size[k] && insn->dest_args[k] == linked) {
+        uses_linked = TRUE;
+      }
+    }
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      if (opcode->src_size[k] && insn->src_args[k] == linked) {
+        uses_linked = TRUE;
+      }
+    }
+    if (uses_linked &&
+        (opcode->flags & (ORC_STATIC_OPCODE_LOAD|ORC_STATIC_OPCODE_STORE))) {
+      char name[8];
+
+      /* loadoffw, loadupib and friends read other elements */
+      if (opcode->flags & (ORC_STATIC_OPCODE_SCALAR|ORC_STATIC_OPCODE_ITERATOR)) {
+        ORC_WARNING ("can't fuse %s, %s reads other elements of %s",
+            program->name, opcode->name, program->vars[linked].name);
+        return FALSE;
+      }
+      sprintf(name, "copy%c", opcode->name[strlen (opcode->name) - 1]);
+      opcode = orc_opcode_find_by_name (name);
+    }
+
+    new_insn = _orc_program_next_insn (fused);
+    memset (new_insn, 0, sizeof(OrcInstruction));
+    new_insn->opcode = opcode;
+    new_insn->flags = insn->flags;
+    new_insn->line = insn->line;
+    for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+      if (opcode->dest_size[k]) {
+        new_insn->dest_args[k] = map[insn->dest_args[k]];
+      }
+    }
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      if (opcode->src_size[k]) {
+        new_insn->src_args[k] = map[insn->src_args[k]];
+      }
+    }
+    fused->n_insns++;
+  }
+
+  return TRUE;
+}
+
+/**
+ * orc_program_fuse:
+ * @producer: the program that runs first
+ * @consumer: the program that runs second
+ * @dest_name: name of the destination of @producer that is linked
+ * @src_name: name of the source of @consumer that is linked
+ *
+ * Creates a program that does the work of @producer followed by
+ * @consumer, where @consumer reads the array that @producer writes to
+ * @dest_name as its source @src_name.  The linked array is not part of
+ * the new program: its values are passed on in a temporary variable.
+ * The other variables keep their names, except for those of @consumer
+ * that clash with a name in @producer, which get a "_N" suffix.  Use
+ * orc_program_find_var_by_name() to find them in the new program.
+ *
+ * The programs can't be fused if the variables don't fit into the
+ * limits of a single program, if the linked variables have different
+ * sizes, if @consumer reads other elements of the linked source than
+ * the current one (for example with loadoffw), or if the programs
+ * don't agree on being 2D or on a constant n or m.  In that case NULL
+ * is returned.
+ *
+ * The result can be fused again, to chain more than two programs.
+ * Both programs are left unchanged.
+ *
+ * Returns: a new OrcProgram, or NULL
+ */
+OrcProgram *
+orc_program_fuse (OrcProgram *producer, OrcProgram *consumer,
+    const char *dest_name, const char *src_name)
+{
+  OrcProgram *fused;
+  int producer_map[ORC_N_VARIABLES];
+  int consumer_map[ORC_N_VARIABLES];
+  int dest;
+  int src;
+  int i, k;
+
+  dest = orc_program_find_var_by_name (producer, dest_name);
+  src = orc_program_find_var_by_name (consumer, src_name);
+  if (dest < 0 || producer->vars[dest].vartype != ORC_VAR_TYPE_DEST) {
+    ORC_WARNING ("can't fuse, %s is not a destination of %s", dest_name,
+        producer->name);
+    return NULL;
+  }
+  if (src < 0 || consumer->vars[src].vartype != ORC_VAR_TYPE_SRC) {
+    ORC_WARNING ("can't fuse, %s is not a source of %s", src_name,
+        consumer->name);
+    return NULL;
+  }
+  if (producer->vars[dest].size != consumer->vars[src].size) {
+    ORC_WARNING ("can't fuse, %s and %s have different sizes", dest_name,
+        src_name);
+    return NULL;
+  }
+  if (producer->is_2d != consumer->is_2d) {
+    ORC_WARNING ("can't fuse a 2D program with a 1D program");
+    return NULL;
+  }
+
+  /* a destination that is read back in the producer isn't only an
+   * output */
+  for(i=0;i<producer->n_insns;i++){
+    OrcInstruction *insn = producer->insn_table + i;
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      if (insn->opcode->src_size[k] && insn->src_args[k] == dest) {
+        ORC_WARNING ("can't fuse, %s reads %s", producer->name, dest_name);
+        return NULL;
+      }
+    }
+  }
+
+  fused = orc_program_new ();
+  if (!orc_fuse_combine_n (producer->constant_n, consumer->constant_n,
+        &fused->constant_n) ||
+      !orc_fuse_combine_n (producer->constant_m, consumer->constant_m,
+        &fused->constant_m)) {
+    ORC_WARNING ("can't fuse, the programs have different constant sizes");
+    goto fail;
+  }
+  fused->is_2d = producer->is_2d;
+  fused->n_minimum = MAX (producer->n_minimum, consumer->n_minimum);
+  fused->n_maximum = producer->n_maximum;
+  if (consumer->n_maximum &&
+      (fused->n_maximum == 0 || consumer->n_maximum < fused->n_maximum)) {
+    fused->n_maximum = consumer->n_maximum;
+  }
+  fused->n_multiple = producer->n_multiple;
+  if (consumer->n_multiple) {
+    if (fused->n_multiple) {
+      fused->n_multiple = fused->n_multiple / orc_fuse_gcd (fused->n_multiple,
+          consumer->n_multiple) * consumer->n_multiple;
+    } else {
+      fused->n_multiple = consumer->n_multiple;
+    }
+  }
+
+  if (producer->name && consumer->name) {
+    free (fused->name);
+    fused->name = malloc (strlen (producer->name) +
+        strlen (consumer->name) + 2);
+    sprintf(fused->name, "%s_%s", producer->name, consumer->name);
+  }
+
+  for(i=0;i<ORC_N_VARIABLES;i++){
+    producer_map[i] = -1;
+    consumer_map[i] = -1;
+  }
+  for(i=0;i<ORC_N_VARIABLES;i++){
+    if (producer->vars[i].size == 0 || i == dest) continue;
+    producer_map[i] = orc_fuse_add_var (fused, producer, i);
+    if (producer_map[i] < 0) goto overflow;
+  }
+  for(i=0;i<ORC_N_VARIABLES;i++){
+    if (consumer->vars[i].size == 0 || i == src) continue;
+    consumer_map[i] = orc_fuse_add_var (fused, consumer, i);
+    if (consumer_map[i] < 0) goto overflow;
+  }
+
+  /* the linked array, now a temporary named after the source */
+  if (fused->n_temp_vars >= ORC_MAX_TEMP_VARS) goto overflow;
+  k = ORC_VAR_T1 + fused->n_temp_vars;
+  fused->vars[k].vartype = ORC_VAR_TYPE_TEMP;
+  fused->vars[k].size = consumer->vars[src].size;
+  fused->vars[k].name = orc_fuse_var_name (fused, src_name);
+  fused->n_temp_vars++;
+  producer_map[dest] = k;
+  consumer_map[src] = k;
+
+  if (!orc_fuse_add_insns (fused, producer, producer_map, dest) ||
+      !orc_fuse_add_insns (fused, consumer, consumer_map, src)) {
+    goto fail;
+  }
+
+  return fused;
+
+overflow:
+  ORC_WARNING ("can't fuse %s and %s, too many variables", producer->name,
+      consumer->name);
+fail:
+  orc_program_free (fused);
+  return NULL;
+}
+
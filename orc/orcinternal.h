@@ -4,6 +4,7 @@
 
 #include <orc/orcutils.h>
 #include <orc/orclimits.h>
+#include <orc/orcbytecode.h>
 
 ORC_BEGIN_DECLS
 
@@ -11,6 +12,7 @@ ORC_BEGIN_DECLS
 
 void orc_mmx_init (void);
 void orc_sse_init (void);
+void orc_avx_init (void);
 void orc_arm_init (void);
 void orc_powerpc_init (void);
 void orc_c_init (void);
@@ -26,6 +28,47 @@ extern int _orc_cpu_family;
 extern int _orc_cpu_model;
 extern int _orc_cpu_stepping;
 extern const char *_orc_cpu_name;
+extern int orc_x86_microarchitecture;
+
+int _orc_code_cache_lookup (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, OrcBytecode **key);
+void _orc_code_cache_insert (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, OrcBytecode *key);
+int _orc_code_cache_unref (OrcCode *code);
+int _orc_code_cache_is_shared (OrcCode *code);
+
+void _orc_async_finish (OrcProgram *program);
+
+/* A loop shape for ORC_CODE=autotune.  An unroll_shift of -1 leaves
+ * the shape to the target. */
+typedef struct _OrcTuning OrcTuning;
+struct _OrcTuning {
+  int loop_shift_down;
+  int unroll_shift;
+};
+
+void _orc_compiler_make_asm_code (OrcProgram *program);
+OrcCompileResult _orc_program_compile_tuned (OrcProgram *program,
+    OrcTarget *target, unsigned int flags, const OrcTuning *tuning);
+int _orc_compiler_autotune (OrcProgram *program, OrcTarget *target,
+    unsigned int flags, OrcTuning *tuning);
+char * _orc_compiler_get_flags (void);
+void * _orc_compiler_arena_alloc (OrcCompiler *compiler, int size);
+int _orc_compiler_grow_code (OrcCompiler *compiler, int size);
+void _orc_compiler_check_code (OrcCompiler *compiler, int size);
+int orc_compiler_allocate_register (OrcCompiler *compiler, int data_reg);
+
+void _orc_optimize_init (void);
+void _orc_compiler_optimize (OrcCompiler *compiler);
+void _orc_compiler_hoist_invariants (OrcCompiler *compiler);
+
+void _orc_x86_schedule_init (void);
+void _orc_x86_schedule_insns (OrcCompiler *compiler);
+void _orc_x86_peephole (OrcCompiler *compiler);
+
+OrcInstruction * _orc_program_next_insn (OrcProgram *program);
+OrcProgram * _orc_program_copy (OrcProgram *program);
+void _orc_program_free_specializations (OrcProgram *program);
 
 #endif
 
@@ -14,6 +14,7 @@ ORC_BEGIN_DECLS
 #define ORC_N_FIXUPS 100
 #define ORC_N_CONSTANTS 20
 #define ORC_N_LABELS 40
+#define ORC_N_SPECIALIZATIONS 8
 #define ORC_N_COMPILER_VARIABLES (ORC_N_VARIABLES+32)
 
 #define ORC_GP_REG_BASE 32
@@ -26,6 +27,7 @@ ORC_BEGIN_DECLS
 #define ORC_OPCODE_N_ARGS 4
 #define ORC_N_TARGETS 10
 #define ORC_N_RULE_SETS 10
+#define ORC_N_OPCODE_SETS 16
 
 #define ORC_MAX_VAR_SIZE 8
 
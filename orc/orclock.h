@@ -0,0 +1,39 @@
+
+#ifndef _ORC_LOCK_H_
+#define _ORC_LOCK_H_
+
+/* Statically initialized locks for state inside the library.  This
+ * header depends on config.h and is not installed. */
+
+#if defined(HAVE_THREAD_PTHREAD)
+
+#include <pthread.h>
+
+typedef pthread_mutex_t OrcLock;
+
+#define ORC_LOCK_INIT PTHREAD_MUTEX_INITIALIZER
+#define ORC_LOCK(lock) pthread_mutex_lock (lock)
+#define ORC_UNLOCK(lock) pthread_mutex_unlock (lock)
+
+#elif defined(HAVE_THREAD_WIN32)
+
+#include <windows.h>
+
+typedef SRWLOCK OrcLock;
+
+#define ORC_LOCK_INIT SRWLOCK_INIT
+#define ORC_LOCK(lock) AcquireSRWLockExclusive (lock)
+#define ORC_UNLOCK(lock) ReleaseSRWLockExclusive (lock)
+
+#else
+
+typedef int OrcLock;
+
+#define ORC_LOCK_INIT 0
+#define ORC_LOCK(lock) do { (void)(lock); } while (0)
+#define ORC_UNLOCK(lock) do { (void)(lock); } while (0)
+
+#endif
+
+#endif
+
@@ -29,6 +29,7 @@
 
 #include <orc/orcmips.h>
 #include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
 
 #define MIPS_IMMEDIATE_INSTRUCTION(opcode,rs,rt,immediate) \
     (((opcode) & 0x3f) << 26 \
@@ -82,6 +83,7 @@ orc_mips_reg_name (int reg)
 void
 orc_mips_emit (OrcCompiler *compiler, orc_uint32 insn)
 {
+  _orc_compiler_check_code (compiler, 4);
   ORC_WRITE_UINT32_LE (compiler->codeptr, insn);
   compiler->codeptr+=4;
 }
@@ -97,12 +99,11 @@ orc_mips_emit_label (OrcCompiler *compiler, unsigned int label)
 void
 orc_mips_add_fixup (OrcCompiler *compiler, int label, int type)
 {
-  ORC_ASSERT (compiler->n_fixups < ORC_N_FIXUPS);
+  OrcFixup *fixup = orc_compiler_new_fixup (compiler);
 
-  compiler->fixups[compiler->n_fixups].ptr = compiler->codeptr;
-  compiler->fixups[compiler->n_fixups].label = label;
-  compiler->fixups[compiler->n_fixups].type = type;
-  compiler->n_fixups++;
+  fixup->ptr = compiler->codeptr;
+  fixup->label = label;
+  fixup->type = type;
 }
 
 void
@@ -113,11 +114,11 @@ orc_mips_do_fixups (OrcCompiler *compiler)
     /* Type 0 of fixup is a branch label that could not be resolved at first
      * pass. We compute the offset, which should be the 16 least significant
      * bits of the instruction. */
-    unsigned char *label = compiler->labels[compiler->fixups[i].label];
-    unsigned char *ptr = compiler->fixups[i].ptr;
+    unsigned char *label = compiler->labels[compiler->fixup_table[i].label];
+    unsigned char *ptr = compiler->fixup_table[i].ptr;
     orc_uint32 code;
     int offset;
-    ORC_ASSERT (compiler->fixups[i].type == 0);
+    ORC_ASSERT (compiler->fixup_table[i].type == 0);
     offset = (label - (ptr + 4)) >> 2;
     code = ORC_READ_UINT32_LE (ptr);
     code |= offset & 0xffff;
@@ -123,4 +123,337 @@ orc_once_mutex_unlock (void)
 
 #endif
 
+/* atomic operations */
+
+#if defined(__GNUC__) && ORC_GNUC_PREREQ(4,1)
+
+int
+orc_atomic_pointer_compare_and_exchange (void * volatile *ptr,
+    void *oldval, void *newval)
+{
+  return __sync_bool_compare_and_swap (ptr, oldval, newval);
+}
+
+void *
+orc_atomic_pointer_exchange (void * volatile *ptr, void *newval)
+{
+  void *oldval;
+
+  do {
+    oldval = *ptr;
+  } while (!__sync_bool_compare_and_swap (ptr, oldval, newval));
+
+  return oldval;
+}
+
+/* Loads have acquire and stores release semantics, so that data
+ * written before a pointer or count is published is visible to a
+ * thread that reads it. */
+
+void *
+orc_atomic_pointer_get (void * volatile *ptr)
+{
+#if ORC_GNUC_PREREQ(4,7)
+  return __atomic_load_n (ptr, __ATOMIC_ACQUIRE);
+#else
+  void *value = *ptr;
+  __sync_synchronize ();
+  return value;
+#endif
+}
+
+void
+orc_atomic_pointer_set (void * volatile *ptr, void *newval)
+{
+#if ORC_GNUC_PREREQ(4,7)
+  __atomic_store_n (ptr, newval, __ATOMIC_RELEASE);
+#else
+  __sync_synchronize ();
+  *ptr = newval;
+#endif
+}
+
+int
+orc_atomic_int_get (volatile int *ptr)
+{
+#if ORC_GNUC_PREREQ(4,7)
+  return __atomic_load_n (ptr, __ATOMIC_ACQUIRE);
+#else
+  int value = *ptr;
+  __sync_synchronize ();
+  return value;
+#endif
+}
+
+void
+orc_atomic_int_set (volatile int *ptr, int newval)
+{
+#if ORC_GNUC_PREREQ(4,7)
+  __atomic_store_n (ptr, newval, __ATOMIC_RELEASE);
+#else
+  __sync_synchronize ();
+  *ptr = newval;
+#endif
+}
+
+#elif defined(HAVE_THREAD_WIN32)
+
+int
+orc_atomic_pointer_compare_and_exchange (void * volatile *ptr,
+    void *oldval, void *newval)
+{
+  return InterlockedCompareExchangePointer ((PVOID volatile *)ptr,
+      newval, oldval) == oldval;
+}
+
+void *
+orc_atomic_pointer_exchange (void * volatile *ptr, void *newval)
+{
+  return InterlockedExchangePointer ((PVOID volatile *)ptr, newval);
+}
+
+void *
+orc_atomic_pointer_get (void * volatile *ptr)
+{
+  return InterlockedCompareExchangePointer ((PVOID volatile *)ptr,
+      NULL, NULL);
+}
+
+void
+orc_atomic_pointer_set (void * volatile *ptr, void *newval)
+{
+  InterlockedExchangePointer ((PVOID volatile *)ptr, newval);
+}
+
+int
+orc_atomic_int_get (volatile int *ptr)
+{
+  return InterlockedCompareExchange ((LONG volatile *)ptr, 0, 0);
+}
+
+void
+orc_atomic_int_set (volatile int *ptr, int newval)
+{
+  InterlockedExchange ((LONG volatile *)ptr, newval);
+}
+
+#elif defined(HAVE_THREAD_PTHREAD)
+
+static pthread_mutex_t atomic_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int
+orc_atomic_pointer_compare_and_exchange (void * volatile *ptr,
+    void *oldval, void *newval)
+{
+  int ret = FALSE;
+
+  pthread_mutex_lock (&atomic_mutex);
+  if (*ptr == oldval) {
+    *ptr = newval;
+    ret = TRUE;
+  }
+  pthread_mutex_unlock (&atomic_mutex);
+
+  return ret;
+}
+
+void *
+orc_atomic_pointer_exchange (void * volatile *ptr, void *newval)
+{
+  void *oldval;
+
+  pthread_mutex_lock (&atomic_mutex);
+  oldval = *ptr;
+  *ptr = newval;
+  pthread_mutex_unlock (&atomic_mutex);
+
+  return oldval;
+}
+
+void *
+orc_atomic_pointer_get (void * volatile *ptr)
+{
+  void *value;
+
+  pthread_mutex_lock (&atomic_mutex);
+  value = *ptr;
+  pthread_mutex_unlock (&atomic_mutex);
+
+  return value;
+}
+
+void
+orc_atomic_pointer_set (void * volatile *ptr, void *newval)
+{
+  pthread_mutex_lock (&atomic_mutex);
+  *ptr = newval;
+  pthread_mutex_unlock (&atomic_mutex);
+}
+
+int
+orc_atomic_int_get (volatile int *ptr)
+{
+  int value;
+
+  pthread_mutex_lock (&atomic_mutex);
+  value = *ptr;
+  pthread_mutex_unlock (&atomic_mutex);
+
+  return value;
+}
+
+void
+orc_atomic_int_set (volatile int *ptr, int newval)
+{
+  pthread_mutex_lock (&atomic_mutex);
+  *ptr = newval;
+  pthread_mutex_unlock (&atomic_mutex);
+}
+
+#else
+
+int
+orc_atomic_pointer_compare_and_exchange (void * volatile *ptr,
+    void *oldval, void *newval)
+{
+  if (*ptr != oldval) return FALSE;
+  *ptr = newval;
+  return TRUE;
+}
+
+void *
+orc_atomic_pointer_exchange (void * volatile *ptr, void *newval)
+{
+  void *oldval = *ptr;
+  *ptr = newval;
+  return oldval;
+}
+
+void *
+orc_atomic_pointer_get (void * volatile *ptr)
+{
+  return *ptr;
+}
+
+void
+orc_atomic_pointer_set (void * volatile *ptr, void *newval)
+{
+  *ptr = newval;
+}
+
+int
+orc_atomic_int_get (volatile int *ptr)
+{
+  return *ptr;
+}
+
+void
+orc_atomic_int_set (volatile int *ptr, int newval)
+{
+  *ptr = newval;
+}
+
+#endif
+
+/* thread-local storage */
+
+#if defined(HAVE_THREAD_PTHREAD)
+
+static pthread_mutex_t thread_local_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t thread_local_keys[ORC_N_THREAD_LOCALS];
+static int n_thread_locals;
+
+int
+orc_thread_local_new (OrcThreadLocalDestroyFunc destroy)
+{
+  int slot = -1;
+
+  pthread_mutex_lock (&thread_local_mutex);
+  if (n_thread_locals < ORC_N_THREAD_LOCALS &&
+      pthread_key_create (&thread_local_keys[n_thread_locals],
+        destroy) == 0) {
+    slot = n_thread_locals;
+    n_thread_locals++;
+  }
+  pthread_mutex_unlock (&thread_local_mutex);
+
+  return slot;
+}
+
+void *
+orc_thread_local_get (int slot)
+{
+  return pthread_getspecific (thread_local_keys[slot]);
+}
+
+void
+orc_thread_local_set (int slot, void *value)
+{
+  pthread_setspecific (thread_local_keys[slot], value);
+}
+
+#elif defined(HAVE_THREAD_WIN32)
+
+/* Windows TLS slots have no destructor, so whatever is stored in
+ * a slot is leaked when the thread exits. */
+static DWORD thread_local_keys[ORC_N_THREAD_LOCALS];
+static volatile LONG n_thread_locals;
+
+int
+orc_thread_local_new (OrcThreadLocalDestroyFunc destroy)
+{
+  DWORD key;
+  LONG slot;
+
+  key = TlsAlloc ();
+  if (key == TLS_OUT_OF_INDEXES) return -1;
+
+  slot = InterlockedIncrement (&n_thread_locals) - 1;
+  if (slot >= ORC_N_THREAD_LOCALS) {
+    TlsFree (key);
+    return -1;
+  }
+  thread_local_keys[slot] = key;
+
+  return slot;
+}
+
+void *
+orc_thread_local_get (int slot)
+{
+  return TlsGetValue (thread_local_keys[slot]);
+}
+
+void
+orc_thread_local_set (int slot, void *value)
+{
+  TlsSetValue (thread_local_keys[slot], value);
+}
+
+#else
+
+static void *thread_local_values[ORC_N_THREAD_LOCALS];
+static int n_thread_locals;
+
+int
+orc_thread_local_new (OrcThreadLocalDestroyFunc destroy)
+{
+  if (n_thread_locals >= ORC_N_THREAD_LOCALS) return -1;
+  return n_thread_locals++;
+}
+
+void *
+orc_thread_local_get (int slot)
+{
+  return thread_local_values[slot];
+}
+
+void
+orc_thread_local_set (int slot, void *value)
+{
+  thread_local_values[slot] = value;
+}
+
+#endif
+
 
@@ -18,6 +18,26 @@ struct _OrcOnce {
 void orc_once_mutex_lock (void);
 void orc_once_mutex_unlock (void);
 
+#ifdef ORC_ENABLE_UNSTABLE_API
+
+#define ORC_N_THREAD_LOCALS 8
+
+typedef void (*OrcThreadLocalDestroyFunc) (void *value);
+
+int orc_atomic_pointer_compare_and_exchange (void * volatile *ptr,
+    void *oldval, void *newval);
+void * orc_atomic_pointer_exchange (void * volatile *ptr, void *newval);
+void * orc_atomic_pointer_get (void * volatile *ptr);
+void orc_atomic_pointer_set (void * volatile *ptr, void *newval);
+int orc_atomic_int_get (volatile int *ptr);
+void orc_atomic_int_set (volatile int *ptr, int newval);
+
+int orc_thread_local_new (OrcThreadLocalDestroyFunc destroy);
+void * orc_thread_local_get (int slot);
+void orc_thread_local_set (int slot, void *value);
+
+#endif
+
 ORC_END_DECLS
 
 #endif
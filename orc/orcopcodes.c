@@ -8,6 +8,8 @@
 
 #include <orc/orcprogram.h>
 #include <orc/orcdebug.h>
+#include <orc/orconce.h>
+#include <orc/orclock.h>
 
 /**
  * SECTION:orcopcode
@@ -16,13 +18,22 @@
  */
 
 
-static OrcOpcodeSet *opcode_sets;
-static int n_opcode_sets;
+/* Opcode sets, targets and rule sets are registered from orc_init(),
+ * and are then read without locking by any number of compiling threads.
+ * Registering fills in an entry and then publishes it by storing the
+ * new count (or pointer) with release semantics.  Readers load the count
+ * with acquire semantics, so every entry they look at is complete.
+ * Entries never move, so pointers to them stay valid.  Registering is
+ * serialized by registry_lock. */
+static OrcLock registry_lock = ORC_LOCK_INIT;
+
+static OrcOpcodeSet opcode_sets[ORC_N_OPCODE_SETS];
+static volatile int n_opcode_sets;
 
 static OrcTarget *targets[ORC_N_TARGETS];
-static int n_targets;
+static volatile int n_targets;
 
-static OrcTarget *default_target;
+static OrcTarget * volatile default_target;
 
 #define ORC_SB_MAX 127
 #define ORC_SB_MIN (-1-ORC_SB_MAX)
@@ -48,22 +59,31 @@ static OrcTarget *default_target;
 void
 orc_target_register (OrcTarget *target)
 {
+  ORC_LOCK (&registry_lock);
+  if (n_targets == ORC_N_TARGETS) {
+    ORC_ERROR("too many targets, can't register %s", target->name);
+    ORC_UNLOCK (&registry_lock);
+    return;
+  }
   targets[n_targets] = target;
-  n_targets++;
+  orc_atomic_int_set (&n_targets, n_targets + 1);
 
   if (target->executable) {
-    default_target = target;
+    orc_atomic_pointer_set ((void * volatile *)&default_target, target);
   }
+  ORC_UNLOCK (&registry_lock);
 }
 
 OrcTarget *
 orc_target_get_by_name (const char *name)
 {
+  int n;
   int i;
 
-  if (name == NULL) return default_target;
+  if (name == NULL) return orc_target_get_default ();
 
-  for(i=0;i<n_targets;i++){
+  n = orc_atomic_int_get (&n_targets);
+  for(i=0;i<n;i++){
     if (strcmp (name, targets[i]->name) == 0) {
       return targets[i];
     }
@@ -75,7 +95,7 @@ orc_target_get_by_name (const char *name)
 OrcTarget *
 orc_target_get_default (void)
 {
-  return default_target;
+  return orc_atomic_pointer_get ((void * volatile *)&default_target);
 }
 
 const char *
@@ -158,17 +178,29 @@ orc_rule_set_new (OrcOpcodeSet *opcode_set, OrcTarget *target,
 {
   OrcRuleSet *rule_set;
 
+  ORC_LOCK (&registry_lock);
+  if (target->n_rule_sets == ORC_N_RULE_SETS) {
+    ORC_UNLOCK (&registry_lock);
+    ORC_ERROR("too many rule sets for target %s", target->name);
+    ORC_ASSERT(0);
+    return NULL;
+  }
+
   rule_set = target->rule_sets + target->n_rule_sets;
-  target->n_rule_sets++;
 
   memset (rule_set, 0, sizeof(OrcRuleSet));
 
   rule_set->opcode_major = opcode_set->opcode_major;
   rule_set->required_target_flags = required_flags;
 
+  /* rules are added later by orc_rule_register(), which publishes
+   * each one by setting its emit function last */
   rule_set->rules = malloc (sizeof(OrcRule) * opcode_set->n_opcodes);
   memset (rule_set->rules, 0, sizeof(OrcRule) * opcode_set->n_opcodes);
 
+  orc_atomic_int_set (&target->n_rule_sets, target->n_rule_sets + 1);
+  ORC_UNLOCK (&registry_lock);
+
   return rule_set;
 }
 
@@ -177,22 +209,26 @@ orc_target_get_rule (OrcTarget *target, OrcStaticOpcode *opcode,
     unsigned int target_flags)
 {
   OrcRule *rule;
+  int n_sets;
+  int n_rule_sets;
   int i;
   int j;
   int k;
 
-  for(k=0;k<n_opcode_sets;k++){
+  n_sets = orc_atomic_int_get (&n_opcode_sets);
+  n_rule_sets = orc_atomic_int_get (&target->n_rule_sets);
+  for(k=0;k<n_sets;k++){
     j = opcode - opcode_sets[k].opcodes;
 
     if (j < 0 || j >= opcode_sets[k].n_opcodes) continue;
     if (opcode_sets[k].opcodes + j != opcode) continue;
 
-    for(i=target->n_rule_sets-1;i>=0;i--){
+    for(i=n_rule_sets-1;i>=0;i--){
       if (target->rule_sets[i].opcode_major != opcode_sets[k].opcode_major) continue;
       if (target->rule_sets[i].required_target_flags & (~target_flags)) continue;
 
       rule = target->rule_sets[i].rules + j;
-      if (rule->emit) return rule;
+      if (orc_atomic_pointer_get ((void * volatile *)&rule->emit)) return rule;
     }
   }
 
@@ -210,26 +246,34 @@ orc_opcode_register_static (OrcStaticOpcode *sopcode, char *prefix)
     n++;
   }
 
+  ORC_LOCK (&registry_lock);
   major = n_opcode_sets;
+  if (major == ORC_N_OPCODE_SETS) {
+    ORC_UNLOCK (&registry_lock);
+    ORC_ERROR("too many opcode sets, can't register %s", prefix);
+    return -1;
+  }
 
-  n_opcode_sets++;
-  opcode_sets = realloc (opcode_sets, sizeof(OrcOpcodeSet)*n_opcode_sets);
-  
   memset (opcode_sets + major, 0, sizeof(OrcOpcodeSet));
   strncpy(opcode_sets[major].prefix, prefix, sizeof(opcode_sets[major].prefix)-1);
   opcode_sets[major].n_opcodes = n;
   opcode_sets[major].opcodes = sopcode;
   opcode_sets[major].opcode_major = major;
 
+  orc_atomic_int_set (&n_opcode_sets, major + 1);
+  ORC_UNLOCK (&registry_lock);
+
   return major;
 }
 
 OrcOpcodeSet *
 orc_opcode_set_get (const char *name)
 {
+  int n;
   int i;
 
-  for(i=0;i<n_opcode_sets;i++){
+  n = orc_atomic_int_get (&n_opcode_sets);
+  for(i=0;i<n;i++){
     if (strcmp (opcode_sets[i].prefix, name) == 0) {
       return opcode_sets + i;
     }
@@ -261,10 +305,12 @@ orc_opcode_set_find_by_name (OrcOpcodeSet *opcode_set, const char *name)
 OrcStaticOpcode *
 orc_opcode_find_by_name (const char *name)
 {
+  int n;
   int i;
   int j;
 
-  for(i=0;i<n_opcode_sets;i++){
+  n = orc_atomic_int_get (&n_opcode_sets);
+  for(i=0;i<n;i++){
     j = orc_opcode_set_find_by_name (opcode_sets + i, name);
     if (j >= 0) {
       return &opcode_sets[i].opcodes[j];
@@ -0,0 +1,958 @@
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <orc/orcprogram.h>
+#include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
+
+/*
+ * Optimization passes
+ *
+ * The passes work on the instruction list made by
+ * orc_compiler_rewrite_insns(), where every load and store is an
+ * instruction of its own, before orc_compiler_rewrite_vars() splits
+ * the temporaries into live ranges.  The loop body is a single basic
+ * block, and a temporary can't be read before it is written in the same
+ * iteration, so nothing has to be tracked from one iteration to the
+ * next.
+ *
+ * A pass marks the instructions it removes, or changes them in place,
+ * and returns how many there are.  Instead of removing an instruction
+ * that computes a value that is already in a temporary, the later reads
+ * are changed to read that temporary.  Only temporaries that are
+ * written once are replaced or used as replacements, so a replacement
+ * holds the same value for the rest of the loop body.
+ *
+ * Source arrays are taken to not overlap the destination arrays, as
+ * everywhere else in Orc, so a store only makes the earlier loads of
+ * the same destination out of date.
+ *
+ * Loop-invariant code motion runs later, from
+ * orc_compiler_global_reg_alloc(), because it needs to know how many
+ * registers the target has left.
+ *
+ * Each pass can be turned off with its name in ORC_CODE, for example
+ * ORC_CODE=-cse, and all of them with ORC_CODE=-opt.
+ */
+
+typedef struct _OrcOptimizePass OrcOptimizePass;
+typedef struct _OrcOptimizeValue OrcOptimizeValue;
+typedef struct _OrcOptimizeRule OrcOptimizeRule;
+typedef union _OrcOptimizeElement OrcOptimizeElement;
+
+struct _OrcOptimizePass {
+  const char *name;
+  int (*run) (OrcCompiler *compiler, unsigned char *removed);
+  int disabled;
+};
+
+struct _OrcOptimizeValue {
+  OrcStaticOpcode *opcode;
+  unsigned int flags;
+  int src_values[ORC_STATIC_OPCODE_N_SRC];
+  int var;
+  int next;
+};
+
+/* One element of a source or destination of an emulated opcode */
+union _OrcOptimizeElement {
+  orc_int64 x8;
+  orc_int32 x4;
+  orc_int16 x2;
+  orc_int8 x1;
+};
+
+/* How the simplifier treats an opcode with a constant source */
+enum {
+  /* x op 0 = 0 op x = x */
+  ORC_OPTIMIZE_ZERO,
+  /* x op 0 = x */
+  ORC_OPTIMIZE_RIGHT_ZERO,
+  /* x op 1 = 1 op x = x, x op 0 = 0 op x = 0, and with a shift
+   * opcode in other, x op 2^k = 2^k op x = x << k */
+  ORC_OPTIMIZE_ONE,
+  /* x op ~0 = ~0 op x = x, x op 0 = 0 op x = 0 */
+  ORC_OPTIMIZE_AND,
+  /* x op 0 = 0 op x = x, x op ~0 = ~0 op x = ~0 */
+  ORC_OPTIMIZE_OR,
+  /* op (other (x)) = x, where op undoes other */
+  ORC_OPTIMIZE_INVERSE
+};
+
+struct _OrcOptimizeRule {
+  const char *name;
+  int rule;
+  const char *other;
+  OrcStaticOpcode *opcode;
+  OrcStaticOpcode *other_opcode;
+};
+
+static int orc_optimize_simplify (OrcCompiler *compiler,
+    unsigned char *removed);
+static int orc_optimize_loads (OrcCompiler *compiler, unsigned char *removed);
+static int orc_optimize_cse (OrcCompiler *compiler, unsigned char *removed);
+static int orc_optimize_dce (OrcCompiler *compiler, unsigned char *removed);
+
+static OrcOptimizePass orc_optimize_passes[] = {
+  { "simplify", orc_optimize_simplify },
+  { "rle", orc_optimize_loads },
+  { "cse", orc_optimize_cse },
+  { "dce", orc_optimize_dce },
+};
+
+#define ORC_OPTIMIZE_N_PASSES \
+  (int)(sizeof(orc_optimize_passes) / sizeof(orc_optimize_passes[0]))
+
+/* Integer opcodes only, since the float rules of the targets don't
+ * always match the emulator, and x + 0.0 is not x for x = -0.0.  The
+ * entries for an opcode are next to each other. */
+static OrcOptimizeRule orc_optimize_rules[] = {
+  { "addb", ORC_OPTIMIZE_ZERO },
+  { "addssb", ORC_OPTIMIZE_ZERO },
+  { "addusb", ORC_OPTIMIZE_ZERO },
+  { "xorb", ORC_OPTIMIZE_ZERO },
+  { "subb", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "subssb", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "subusb", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shlb", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shrsb", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shrub", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "mullb", ORC_OPTIMIZE_ONE, "shlb" },
+  { "andb", ORC_OPTIMIZE_AND },
+  { "orb", ORC_OPTIMIZE_OR },
+
+  { "addw", ORC_OPTIMIZE_ZERO },
+  { "addssw", ORC_OPTIMIZE_ZERO },
+  { "addusw", ORC_OPTIMIZE_ZERO },
+  { "xorw", ORC_OPTIMIZE_ZERO },
+  { "subw", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "subssw", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "subusw", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shlw", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shrsw", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shruw", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "mullw", ORC_OPTIMIZE_ONE, "shlw" },
+  { "andw", ORC_OPTIMIZE_AND },
+  { "orw", ORC_OPTIMIZE_OR },
+
+  { "addl", ORC_OPTIMIZE_ZERO },
+  { "addssl", ORC_OPTIMIZE_ZERO },
+  { "addusl", ORC_OPTIMIZE_ZERO },
+  { "xorl", ORC_OPTIMIZE_ZERO },
+  { "subl", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "subssl", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "subusl", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shll", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shrsl", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shrul", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "mulll", ORC_OPTIMIZE_ONE, "shll" },
+  { "andl", ORC_OPTIMIZE_AND },
+  { "orl", ORC_OPTIMIZE_OR },
+
+  { "addq", ORC_OPTIMIZE_ZERO },
+  { "xorq", ORC_OPTIMIZE_ZERO },
+  { "subq", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shlq", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shrsq", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "shruq", ORC_OPTIMIZE_RIGHT_ZERO },
+  { "andq", ORC_OPTIMIZE_AND },
+  { "orq", ORC_OPTIMIZE_OR },
+
+  { "convwb", ORC_OPTIMIZE_INVERSE, "convsbw" },
+  { "convwb", ORC_OPTIMIZE_INVERSE, "convubw" },
+  { "convlw", ORC_OPTIMIZE_INVERSE, "convswl" },
+  { "convlw", ORC_OPTIMIZE_INVERSE, "convuwl" },
+  { "convql", ORC_OPTIMIZE_INVERSE, "convslq" },
+  { "convql", ORC_OPTIMIZE_INVERSE, "convulq" },
+  { "swapw", ORC_OPTIMIZE_INVERSE, "swapw" },
+  { "swapl", ORC_OPTIMIZE_INVERSE, "swapl" },
+  { "swapq", ORC_OPTIMIZE_INVERSE, "swapq" },
+  { "swapwl", ORC_OPTIMIZE_INVERSE, "swapwl" },
+  { "swaplq", ORC_OPTIMIZE_INVERSE, "swaplq" },
+};
+
+#define ORC_OPTIMIZE_N_RULES \
+  (int)(sizeof(orc_optimize_rules) / sizeof(orc_optimize_rules[0]))
+
+/* For each opcode of the "sys" set, one more than the index of its
+ * first entry in orc_optimize_rules, or 0 */
+static unsigned char *orc_optimize_opcode_rules;
+static OrcOpcodeSet *orc_optimize_opcode_set;
+static OrcStaticOpcode *orc_optimize_copy_opcodes[4];
+static OrcStaticOpcode *orc_optimize_loadp_opcodes[4];
+static int orc_optimize_licm_disabled;
+
+/* Called from orc_init() after the opcodes are registered */
+void
+_orc_optimize_init (void)
+{
+  static const char *copy_names[] = { "copyb", "copyw", "copyl", "copyq" };
+  static const char *loadp_names[] = { "loadpb", "loadpw", "loadpl", "loadpq" };
+  OrcOpcodeSet *opcode_set;
+  char flag[20];
+  int all;
+  int i;
+
+  all = orc_compiler_flag_check ("-opt");
+  for(i=0;i<ORC_OPTIMIZE_N_PASSES;i++){
+    sprintf(flag, "-%s", orc_optimize_passes[i].name);
+    orc_optimize_passes[i].disabled = all || orc_compiler_flag_check (flag);
+  }
+  orc_optimize_licm_disabled = all || orc_compiler_flag_check ("-licm");
+
+  for(i=0;i<4;i++){
+    orc_optimize_copy_opcodes[i] = orc_opcode_find_by_name (copy_names[i]);
+    orc_optimize_loadp_opcodes[i] = orc_opcode_find_by_name (loadp_names[i]);
+  }
+
+  opcode_set = orc_opcode_set_get ("sys");
+  orc_optimize_opcode_rules = calloc (opcode_set->n_opcodes, 1);
+  for(i=ORC_OPTIMIZE_N_RULES-1;i>=0;i--){
+    OrcOptimizeRule *rule = orc_optimize_rules + i;
+
+    rule->opcode = orc_opcode_find_by_name (rule->name);
+    if (rule->other) {
+      rule->other_opcode = orc_opcode_find_by_name (rule->other);
+    }
+    orc_optimize_opcode_rules[rule->opcode - opcode_set->opcodes] = i + 1;
+  }
+  orc_optimize_opcode_set = opcode_set;
+}
+
+static OrcOptimizeRule *
+orc_optimize_get_rule (OrcStaticOpcode *opcode)
+{
+  OrcOpcodeSet *opcode_set = orc_optimize_opcode_set;
+  int i;
+
+  if (opcode < opcode_set->opcodes ||
+      opcode >= opcode_set->opcodes + opcode_set->n_opcodes) return NULL;
+
+  i = orc_optimize_opcode_rules[opcode - opcode_set->opcodes];
+  if (i == 0) return NULL;
+  return orc_optimize_rules + i - 1;
+}
+
+static int
+orc_optimize_size_index (int size)
+{
+  switch (size) {
+    case 1:
+      return 0;
+    case 2:
+      return 1;
+    case 4:
+      return 2;
+    default:
+      return 3;
+  }
+}
+
+/* loadb, loadw, loadl and loadq, which only read the current element */
+static int
+orc_optimize_is_load (OrcStaticOpcode *opcode)
+{
+  return (opcode->flags & ORC_STATIC_OPCODE_LOAD) &&
+    !(opcode->flags & (ORC_STATIC_OPCODE_ITERATOR |
+          ORC_STATIC_OPCODE_INVARIANT)) &&
+    opcode->src_size[1] == 0;
+}
+
+/* Opcodes whose only effect is writing their destinations.  Other
+ * loads have rules that keep state in the source variable. */
+static int
+orc_optimize_is_pure (OrcStaticOpcode *opcode)
+{
+  if (opcode->flags & ORC_STATIC_OPCODE_LOAD) {
+    return (opcode->flags & ORC_STATIC_OPCODE_INVARIANT) ||
+      orc_optimize_is_load (opcode);
+  }
+  return !(opcode->flags & (ORC_STATIC_OPCODE_STORE |
+        ORC_STATIC_OPCODE_ACCUMULATOR | ORC_STATIC_OPCODE_ITERATOR));
+}
+
+/* Reading a temporary before it is written is an error that
+ * orc_compiler_rewrite_vars() reports, so such programs are left
+ * alone. */
+static int
+orc_optimize_check_temps (OrcCompiler *compiler)
+{
+  unsigned char written[ORC_N_COMPILER_VARIABLES];
+  int j;
+  int k;
+
+  memset (written, 0, sizeof(written));
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+    OrcStaticOpcode *opcode = insn->opcode;
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      int var = insn->src_args[k];
+
+      if (opcode->src_size[k] == 0) continue;
+      if (compiler->vars[var].vartype == ORC_VAR_TYPE_TEMP &&
+          !written[var]) {
+        return FALSE;
+      }
+    }
+    for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+      if (opcode->dest_size[k] == 0) continue;
+      written[insn->dest_args[k]] = TRUE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Local value numbering.  Every write gives the variable a new value
+ * number, and an instruction that applies the same opcode to the same
+ * values as an earlier one is removed.  With loads set, this handles
+ * the loads, otherwise the other pure opcodes and copies. */
+static int
+orc_optimize_value_numbering (OrcCompiler *compiler, unsigned char *removed,
+    int loads)
+{
+  int value[ORC_N_COMPILER_VARIABLES];
+  int replace[ORC_N_COMPILER_VARIABLES];
+  int n_writes[ORC_N_COMPILER_VARIABLES];
+  OrcOptimizeValue *values;
+  int *hash;
+  int hash_mask;
+  int n_values = 0;
+  int next_value = ORC_N_COMPILER_VARIABLES;
+  int n_removed = 0;
+  int i;
+  int j;
+  int k;
+
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    value[i] = i;
+    replace[i] = i;
+    n_writes[i] = 0;
+  }
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+      if (insn->opcode->dest_size[k] == 0) continue;
+      n_writes[insn->dest_args[k]]++;
+    }
+  }
+
+  hash_mask = 63;
+  while (hash_mask < compiler->n_insns) hash_mask = hash_mask * 2 + 1;
+  hash = _orc_compiler_arena_alloc (compiler, (hash_mask + 1) * sizeof(int));
+  memset (hash, 0xff, (hash_mask + 1) * sizeof(int));
+  values = _orc_compiler_arena_alloc (compiler,
+      compiler->n_insns * sizeof(OrcOptimizeValue));
+
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+    OrcStaticOpcode *opcode = insn->opcode;
+    OrcOptimizeValue *v;
+    unsigned int h;
+    int dest;
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      if (opcode->src_size[k] == 0) continue;
+      insn->src_args[k] = replace[insn->src_args[k]];
+    }
+
+    dest = insn->dest_args[0];
+    if (loads) {
+      if (!orc_optimize_is_load (opcode)) goto next;
+    } else {
+      if (!orc_optimize_is_pure (opcode) ||
+          (opcode->flags & ORC_STATIC_OPCODE_LOAD) ||
+          opcode->dest_size[1] != 0) goto next;
+    }
+    if (compiler->vars[dest].vartype != ORC_VAR_TYPE_TEMP ||
+        n_writes[dest] != 1) goto next;
+
+    if (!loads && (opcode->flags & ORC_STATIC_OPCODE_COPY)) {
+      int src = insn->src_args[0];
+
+      if (compiler->vars[src].vartype == ORC_VAR_TYPE_TEMP &&
+          n_writes[src] == 1 && !compiler->vars[src].has_parameter &&
+          compiler->vars[src].size == compiler->vars[dest].size) {
+        replace[dest] = src;
+        removed[j] = TRUE;
+        n_removed++;
+        continue;
+      }
+    }
+
+    h = (unsigned int)(size_t)opcode ^ insn->flags;
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      if (opcode->src_size[k] == 0) continue;
+      h = h * 31 + value[insn->src_args[k]];
+    }
+    h &= hash_mask;
+
+    for(i=hash[h];i>=0;i=values[i].next){
+      v = values + i;
+      if (v->opcode != opcode || v->flags != insn->flags) continue;
+      for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+        if (opcode->src_size[k] == 0) continue;
+        if (v->src_values[k] != value[insn->src_args[k]]) break;
+      }
+      if (k == ORC_STATIC_OPCODE_N_SRC) break;
+    }
+    if (i >= 0) {
+      replace[dest] = values[i].var;
+      removed[j] = TRUE;
+      n_removed++;
+      continue;
+    }
+
+    v = values + n_values;
+    v->opcode = opcode;
+    v->flags = insn->flags;
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      v->src_values[k] = (opcode->src_size[k] == 0) ? 0 :
+        value[insn->src_args[k]];
+    }
+    v->var = dest;
+    v->next = hash[h];
+    hash[h] = n_values;
+    n_values++;
+
+next:
+    for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+      if (opcode->dest_size[k] == 0) continue;
+      value[insn->dest_args[k]] = next_value++;
+    }
+  }
+
+  return n_removed;
+}
+
+/* Returns the low size bytes of value, sign extended */
+static orc_int64
+orc_optimize_truncate (orc_int64 value, int size)
+{
+  switch (size) {
+    case 1:
+      return (orc_int8)value;
+    case 2:
+      return (orc_int16)value;
+    case 4:
+      return (orc_int32)value;
+    default:
+      return value;
+  }
+}
+
+/* Gets the value of a constant, or of a temporary loaded from one */
+static int
+orc_optimize_get_constant (OrcCompiler *compiler, int var, orc_int64 *value)
+{
+  OrcVariable *v = compiler->vars + var;
+
+  if (v->vartype == ORC_VAR_TYPE_TEMP && v->has_parameter) {
+    v = compiler->vars + v->parameter;
+  }
+  if (v->vartype != ORC_VAR_TYPE_CONST) return FALSE;
+
+  *value = v->value.i;
+  return TRUE;
+}
+
+/* Returns a constant variable with the value, or -1 if all of them are
+ * in use */
+static int
+orc_optimize_get_constant_var (OrcCompiler *compiler, int size,
+    orc_int64 value)
+{
+  int free_var = -1;
+  int i;
+
+  for(i=ORC_VAR_C1;i<ORC_VAR_P1;i++){
+    OrcVariable *var = compiler->vars + i;
+
+    if (var->size == 0) {
+      if (free_var == -1) free_var = i;
+      continue;
+    }
+    if (var->vartype == ORC_VAR_TYPE_CONST && var->size == size &&
+        orc_optimize_truncate (var->value.i, size) == value) {
+      return i;
+    }
+  }
+  if (free_var == -1) return -1;
+
+  compiler->vars[free_var].vartype = ORC_VAR_TYPE_CONST;
+  compiler->vars[free_var].size = size;
+  compiler->vars[free_var].value.i = value;
+  compiler->vars[free_var].name = _orc_compiler_arena_alloc (compiler, 10);
+  sprintf(compiler->vars[free_var].name, "const%d", free_var);
+
+  return free_var;
+}
+
+/* Turns instruction into a load of a constant.  The destination must
+ * be a temporary that is written once, since the load is moved out of
+ * the loop. */
+static int
+orc_optimize_make_constant (OrcCompiler *compiler, OrcInstruction *insn,
+    orc_int64 value)
+{
+  OrcVariable *dest = compiler->vars + insn->dest_args[0];
+  int var;
+
+  var = orc_optimize_get_constant_var (compiler, dest->size,
+      orc_optimize_truncate (value, dest->size));
+  if (var == -1) return FALSE;
+
+  insn->opcode = orc_optimize_loadp_opcodes[orc_optimize_size_index (dest->size)];
+  insn->flags |= ORC_INSN_FLAG_ADDED;
+  memset (insn->src_args, 0, sizeof(insn->src_args));
+  insn->src_args[0] = var;
+  dest->flags |= ORC_VAR_FLAG_VOLATILE_WORKAROUND;
+  dest->has_parameter = TRUE;
+  dest->parameter = var;
+
+  return TRUE;
+}
+
+static void
+orc_optimize_make_copy (OrcCompiler *compiler, OrcInstruction *insn, int src)
+{
+  OrcVariable *dest = compiler->vars + insn->dest_args[0];
+
+  insn->opcode = orc_optimize_copy_opcodes[orc_optimize_size_index (dest->size)];
+  memset (insn->src_args, 0, sizeof(insn->src_args));
+  insn->src_args[0] = src;
+}
+
+/* Turns a multiplication by a power of two into a shift by a
+ * constant, which the targets do with an immediate, if the target has
+ * a rule for the shift */
+static int
+orc_optimize_make_shift (OrcCompiler *compiler, OrcInstruction *insn,
+    OrcStaticOpcode *shift_opcode, int src, orc_int64 value)
+{
+  orc_uint64 bits = value;
+  int size = insn->opcode->dest_size[0];
+  int shift;
+  int var;
+
+  if (size < 8) bits &= (ORC_UINT64_C(1) << (size * 8)) - 1;
+  if (bits < 2 || (bits & (bits - 1)) != 0) return FALSE;
+  for(shift=0;(ORC_UINT64_C(1) << shift) != bits;shift++);
+
+  if (compiler->target == NULL ||
+      orc_target_get_rule (compiler->target, shift_opcode,
+        compiler->target_flags) == NULL) return FALSE;
+
+  var = orc_optimize_get_constant_var (compiler, shift_opcode->src_size[1],
+      shift);
+  if (var == -1) return FALSE;
+
+  insn->opcode = shift_opcode;
+  insn->src_args[0] = src;
+  insn->src_args[1] = var;
+  return TRUE;
+}
+
+/* Computes an instruction with constant sources with the emulation
+ * function of its opcode */
+static int
+orc_optimize_fold (OrcCompiler *compiler, OrcInstruction *insn)
+{
+  OrcStaticOpcode *opcode = insn->opcode;
+  OrcOpcodeExecutor ex;
+  OrcOptimizeElement src[ORC_STATIC_OPCODE_N_SRC];
+  OrcOptimizeElement dest;
+  orc_int64 value;
+  int k;
+
+  memset (&ex, 0, sizeof(ex));
+  for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+    if (opcode->src_size[k] == 0) continue;
+    if (!orc_optimize_get_constant (compiler, insn->src_args[k], &value)) {
+      return FALSE;
+    }
+
+    /* scalar sources are read as 64 bits, see orc_executor_emulate() */
+    src[k].x8 = value;
+    if (k == 0 || !(opcode->flags & ORC_STATIC_OPCODE_SCALAR)) {
+      switch (opcode->src_size[k]) {
+        case 1:
+          src[k].x1 = value;
+          break;
+        case 2:
+          src[k].x2 = value;
+          break;
+        case 4:
+          src[k].x4 = value;
+          break;
+        default:
+          break;
+      }
+    }
+    ex.src_ptrs[k] = src + k;
+  }
+  dest.x8 = 0;
+  ex.dest_ptrs[0] = &dest;
+
+  opcode->emulateN (&ex, 0, 1);
+
+  switch (opcode->dest_size[0]) {
+    case 1:
+      value = dest.x1;
+      break;
+    case 2:
+      value = dest.x2;
+      break;
+    case 4:
+      value = dest.x4;
+      break;
+    default:
+      value = dest.x8;
+      break;
+  }
+
+  return orc_optimize_make_constant (compiler, insn, value);
+}
+
+/* Constant folding and algebraic simplification.  Instructions whose
+ * sources are all constants become loads of a new constant.  With one
+ * constant source, the identities in orc_optimize_rules turn them into
+ * copies or constants, and so do opcodes that undo the conversion that
+ * computed their source, and multiplications by a power of two become
+ * shifts.  The copies are removed by the next passes where possible. */
+static int
+orc_optimize_simplify (OrcCompiler *compiler, unsigned char *removed)
+{
+  int n_writes[ORC_N_COMPILER_VARIABLES];
+  int def[ORC_N_COMPILER_VARIABLES];
+  int n_changed = 0;
+  int j;
+  int k;
+
+  memset (n_writes, 0, sizeof(n_writes));
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+      if (insn->opcode->dest_size[k] == 0) continue;
+      n_writes[insn->dest_args[k]]++;
+      def[insn->dest_args[k]] = j;
+    }
+  }
+
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+    OrcStaticOpcode *opcode = insn->opcode;
+    OrcOptimizeRule *rule;
+    orc_int64 value;
+    int dest = insn->dest_args[0];
+    int size = opcode->dest_size[0];
+    int single;
+
+    if (!orc_optimize_is_pure (opcode) ||
+        (opcode->flags & (ORC_STATIC_OPCODE_LOAD | ORC_STATIC_OPCODE_FLOAT)) ||
+        (insn->flags & (ORC_INSTRUCTION_FLAG_X2 | ORC_INSTRUCTION_FLAG_X4)) ||
+        opcode->dest_size[1] != 0 ||
+        compiler->vars[dest].vartype != ORC_VAR_TYPE_TEMP) continue;
+    single = (n_writes[dest] == 1);
+
+    if (single && orc_optimize_fold (compiler, insn)) {
+      n_changed++;
+      continue;
+    }
+
+    rule = orc_optimize_get_rule (opcode);
+    if (rule == NULL) continue;
+
+    if (rule->rule == ORC_OPTIMIZE_INVERSE) {
+      int src = insn->src_args[0];
+      OrcInstruction *src_insn;
+
+      if (compiler->vars[src].vartype != ORC_VAR_TYPE_TEMP ||
+          n_writes[src] != 1) continue;
+      src_insn = compiler->insn_table + def[src];
+      if (src_insn->flags &
+          (ORC_INSTRUCTION_FLAG_X2 | ORC_INSTRUCTION_FLAG_X4)) continue;
+
+      /* the source of the conversion must still hold the same value */
+      src = src_insn->src_args[0];
+      if (compiler->vars[src].vartype != ORC_VAR_TYPE_TEMP ||
+          n_writes[src] != 1) continue;
+
+      for(;rule < orc_optimize_rules + ORC_OPTIMIZE_N_RULES &&
+          rule->opcode == opcode;rule++){
+        if (rule->other_opcode == src_insn->opcode) {
+          orc_optimize_make_copy (compiler, insn, src);
+          n_changed++;
+          break;
+        }
+      }
+      continue;
+    }
+
+    for(k=1;k>=0;k--){
+      int other = insn->src_args[1 - k];
+
+      if (k == 0 && rule->rule == ORC_OPTIMIZE_RIGHT_ZERO) break;
+      if (!orc_optimize_get_constant (compiler, insn->src_args[k], &value)) {
+        continue;
+      }
+      /* a scalar source is used whole, a vector one by element */
+      if (k == 0 || !(opcode->flags & ORC_STATIC_OPCODE_SCALAR)) {
+        value = orc_optimize_truncate (value, size);
+      }
+
+      if ((value == 0 && (rule->rule == ORC_OPTIMIZE_ZERO ||
+              rule->rule == ORC_OPTIMIZE_RIGHT_ZERO ||
+              rule->rule == ORC_OPTIMIZE_OR)) ||
+          (value == 1 && rule->rule == ORC_OPTIMIZE_ONE) ||
+          (value == -1 && rule->rule == ORC_OPTIMIZE_AND)) {
+        orc_optimize_make_copy (compiler, insn, other);
+        n_changed++;
+        break;
+      }
+      if (single &&
+          ((value == 0 && (rule->rule == ORC_OPTIMIZE_ONE ||
+                rule->rule == ORC_OPTIMIZE_AND)) ||
+           (value == -1 && rule->rule == ORC_OPTIMIZE_OR)) &&
+          orc_optimize_make_constant (compiler, insn, value)) {
+        n_changed++;
+        break;
+      }
+      if (rule->rule == ORC_OPTIMIZE_ONE && rule->other_opcode &&
+          orc_optimize_make_shift (compiler, insn, rule->other_opcode,
+            other, value)) {
+        n_changed++;
+        break;
+      }
+    }
+  }
+
+  return n_changed;
+}
+
+/* Removes repeated loads of the same element of an array */
+static int
+orc_optimize_loads (OrcCompiler *compiler, unsigned char *removed)
+{
+  return orc_optimize_value_numbering (compiler, removed, TRUE);
+}
+
+/* Removes repeated computations and copies between temporaries */
+static int
+orc_optimize_cse (OrcCompiler *compiler, unsigned char *removed)
+{
+  return orc_optimize_value_numbering (compiler, removed, FALSE);
+}
+
+/* Removes pure instructions that only write temporaries that aren't
+ * read later in the loop body */
+static int
+orc_optimize_dce (OrcCompiler *compiler, unsigned char *removed)
+{
+  unsigned char live[ORC_N_COMPILER_VARIABLES];
+  int n_removed = 0;
+  int j;
+  int k;
+
+  memset (live, 0, sizeof(live));
+  for(j=compiler->n_insns-1;j>=0;j--){
+    OrcInstruction *insn = compiler->insn_table + j;
+    OrcStaticOpcode *opcode = insn->opcode;
+
+    if (orc_optimize_is_pure (opcode)) {
+      for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+        int var = insn->dest_args[k];
+
+        if (opcode->dest_size[k] == 0) continue;
+        if (compiler->vars[var].vartype != ORC_VAR_TYPE_TEMP ||
+            live[var]) break;
+      }
+      if (k == ORC_STATIC_OPCODE_N_DEST) {
+        removed[j] = TRUE;
+        n_removed++;
+        continue;
+      }
+    }
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+      if (opcode->dest_size[k] == 0) continue;
+      live[insn->dest_args[k]] = FALSE;
+    }
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      if (opcode->src_size[k] == 0) continue;
+      live[insn->src_args[k]] = TRUE;
+    }
+  }
+
+  return n_removed;
+}
+
+static void
+orc_optimize_remove_insns (OrcCompiler *compiler,
+    const unsigned char *removed)
+{
+  int i;
+  int n = 0;
+
+  for(i=0;i<compiler->n_insns;i++){
+    if (removed[i]) continue;
+    if (n != i) {
+      memcpy (compiler->insn_table + n, compiler->insn_table + i,
+          sizeof(OrcInstruction));
+    }
+    n++;
+  }
+  compiler->n_insns = n;
+}
+
+/* Runs the optimization passes over the instructions of a compile */
+void
+_orc_compiler_optimize (OrcCompiler *compiler)
+{
+  unsigned char *removed;
+  int n_changed;
+  int i;
+
+  if (compiler->n_insns == 0) return;
+  if (!orc_optimize_check_temps (compiler)) return;
+
+  removed = _orc_compiler_arena_alloc (compiler, compiler->n_insns);
+  for(i=0;i<ORC_OPTIMIZE_N_PASSES;i++){
+    OrcOptimizePass *pass = orc_optimize_passes + i;
+
+    if (pass->disabled) continue;
+
+    memset (removed, 0, compiler->n_insns);
+    n_changed = pass->run (compiler, removed);
+    if (n_changed > 0) {
+      ORC_INFO("pass %s changed %d instructions", pass->name, n_changed);
+      orc_optimize_remove_insns (compiler, removed);
+    }
+  }
+}
+
+
+/* Registers kept free for the temporaries the rules use */
+#define ORC_OPTIMIZE_SPARE_REGS 3
+
+/* The most temporaries that are live at the same time in the loop,
+ * not counting the ones that are computed before it */
+static int
+orc_optimize_register_pressure (OrcCompiler *compiler)
+{
+  int *delta;
+  int n_live = 0;
+  int max_live = 0;
+  int i;
+  int j;
+
+  delta = _orc_compiler_arena_alloc (compiler,
+      (compiler->n_insns + 1) * sizeof(int));
+  memset (delta, 0, (compiler->n_insns + 1) * sizeof(int));
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    OrcVariable *var = compiler->vars + i;
+
+    if (var->name == NULL || var->vartype != ORC_VAR_TYPE_TEMP) continue;
+    if (var->first_use < 0 || var->last_use < 0) continue;
+    delta[var->first_use]++;
+    delta[var->last_use + 1]--;
+  }
+  for(j=0;j<compiler->n_insns;j++){
+    n_live += delta[j];
+    if (n_live > max_live) max_live = n_live;
+  }
+
+  return max_live;
+}
+
+/* Loop-invariant code motion.  An instruction whose sources are all
+ * constants, parameters or results of invariant instructions gives the
+ * same result in every iteration, so it gets ORC_INSN_FLAG_INVARIANT,
+ * like the loadp instructions, and the targets emit it once before the
+ * loop.  Its result keeps a register for the whole loop, so this stops
+ * when the registers left would not be enough for the loop body. */
+void
+_orc_compiler_hoist_invariants (OrcCompiler *compiler)
+{
+  unsigned char invariant[ORC_N_COMPILER_VARIABLES];
+  int n_writes[ORC_N_COMPILER_VARIABLES];
+  int offset = compiler->target->data_register_offset;
+  int n_free = 0;
+  int n_needed;
+  int n_hoisted = 0;
+  int i;
+  int j;
+  int k;
+
+  if (orc_optimize_licm_disabled) return;
+
+  memset (invariant, 0, sizeof(invariant));
+  memset (n_writes, 0, sizeof(n_writes));
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    if (compiler->vars[i].vartype == ORC_VAR_TYPE_CONST ||
+        compiler->vars[i].vartype == ORC_VAR_TYPE_PARAM) {
+      invariant[i] = TRUE;
+    }
+  }
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+      if (insn->opcode->dest_size[k] == 0) continue;
+      n_writes[insn->dest_args[k]]++;
+    }
+    if (insn->flags & ORC_INSN_FLAG_INVARIANT) {
+      invariant[insn->dest_args[0]] = TRUE;
+    }
+  }
+
+  for(i=0;i<32;i++){
+    if (compiler->valid_regs[offset + i] &&
+        compiler->alloc_regs[offset + i] == 0) {
+      n_free++;
+    }
+  }
+  n_needed = orc_optimize_register_pressure (compiler) +
+    ORC_OPTIMIZE_SPARE_REGS;
+
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+    OrcStaticOpcode *opcode = insn->opcode;
+    OrcVariable *var;
+    int dest = insn->dest_args[0];
+
+    if (insn->flags & ORC_INSN_FLAG_INVARIANT) continue;
+    if (!orc_optimize_is_pure (opcode) ||
+        (opcode->flags & ORC_STATIC_OPCODE_LOAD) ||
+        opcode->dest_size[1] != 0) continue;
+    if (compiler->vars[dest].vartype != ORC_VAR_TYPE_TEMP ||
+        n_writes[dest] != 1) continue;
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      if (opcode->src_size[k] == 0) continue;
+      if (!invariant[insn->src_args[k]]) break;
+    }
+    if (k < ORC_STATIC_OPCODE_N_SRC) continue;
+
+    if (n_free - n_hoisted <= n_needed) break;
+
+    var = compiler->vars + dest;
+    var->first_use = -1;
+    var->last_use = -1;
+    var->alloc = orc_compiler_allocate_register (compiler, TRUE);
+    insn->flags |= ORC_INSN_FLAG_INVARIANT;
+    invariant[dest] = TRUE;
+    n_hoisted++;
+  }
+
+  if (n_hoisted > 0) {
+    ORC_INFO("hoisted %d instructions out of the loop", n_hoisted);
+  }
+}
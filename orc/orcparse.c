@@ -479,7 +479,7 @@ orc_parse_sanity_check (OrcParser *parser, OrcProgram *program)
   }
 
   for(i=0;i<program->n_insns;i++){
-    OrcInstruction *insn = program->insns + i;
+    OrcInstruction *insn = program->insn_table + i;
     OrcStaticOpcode *opcode = insn->opcode;
 
     for(j=0;j<ORC_STATIC_OPCODE_N_DEST;j++){
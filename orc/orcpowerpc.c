@@ -10,6 +10,7 @@
 #include <orc/orcpowerpc.h>
 #include <orc/orcprogram.h>
 #include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
 
 /**
  * SECTION:orcpowerpc
@@ -58,6 +59,7 @@ powerpc_regnum (int i)
 void
 powerpc_emit(OrcCompiler *compiler, unsigned int insn)
 {
+  _orc_compiler_check_code (compiler, 4);
   *compiler->codeptr++ = (insn>>24);
   *compiler->codeptr++ = (insn>>16);
   *compiler->codeptr++ = (insn>>8);
@@ -394,12 +396,12 @@ powerpc_do_fixups (OrcCompiler *compiler)
   unsigned int insn;
 
   for(i=0;i<compiler->n_fixups;i++){
-    unsigned char *label = compiler->labels[compiler->fixups[i].label];
-    unsigned char *ptr = compiler->fixups[i].ptr;
+    unsigned char *label = compiler->labels[compiler->fixup_table[i].label];
+    unsigned char *ptr = compiler->fixup_table[i].ptr;
 
     insn = *(unsigned int *)ptr;
 
-    switch (compiler->fixups[i].type) {
+    switch (compiler->fixup_table[i].type) {
     case 0:
       *(unsigned int *)ptr = (insn&0xffff0000) | ((insn + (label-ptr))&0xffff);
       break;
@@ -443,9 +445,9 @@ static void
 powerpc_load_constant (OrcCompiler *p, int i, int reg)
 {
   int j;
-  int value = p->constants[i].value;
+  int value = p->constant_table[i].value;
 
-  switch (p->constants[i].type) {
+  switch (p->constant_table[i].type) {
     case ORC_CONST_ZERO:
       powerpc_emit_VX_2(p, "vxor", 0x100004c4, reg, reg, reg);
       return;
@@ -480,10 +482,10 @@ powerpc_load_constant (OrcCompiler *p, int i, int reg)
       break;
   }
 
-  switch (p->constants[i].type) {
+  switch (p->constant_table[i].type) {
     case ORC_CONST_ZERO:
       for(j=0;j<4;j++){
-        p->constants[i].full_value[j] = 0;
+        p->constant_table[i].full_value[j] = 0;
       }
       break;
     case ORC_CONST_SPLAT_B:
@@ -491,19 +493,19 @@ powerpc_load_constant (OrcCompiler *p, int i, int reg)
       value |= (value<<8);
       value |= (value<<16);
       for(j=0;j<4;j++){
-        p->constants[i].full_value[j] = value;
+        p->constant_table[i].full_value[j] = value;
       }
       break;
     case ORC_CONST_SPLAT_W:
       value &= 0xffff;
       value |= (value<<16);
       for(j=0;j<4;j++){
-        p->constants[i].full_value[j] = value;
+        p->constant_table[i].full_value[j] = value;
       }
       break;
     case ORC_CONST_SPLAT_L:
       for(j=0;j<4;j++){
-        p->constants[i].full_value[j] = value;
+        p->constant_table[i].full_value[j] = value;
       }
       break;
     default:
@@ -511,10 +513,10 @@ powerpc_load_constant (OrcCompiler *p, int i, int reg)
   }
 
   powerpc_load_long_constant (p, reg,
-    p->constants[i].full_value[0],
-    p->constants[i].full_value[1],
-    p->constants[i].full_value[2],
-    p->constants[i].full_value[3]);
+    p->constant_table[i].full_value[0],
+    p->constant_table[i].full_value[1],
+    p->constant_table[i].full_value[2],
+    p->constant_table[i].full_value[3]);
 }
 
 void
@@ -590,19 +592,19 @@ powerpc_get_constant (OrcCompiler *p, int type, int value)
   int i;
 
   for(i=0;i<p->n_constants;i++){
-    if (p->constants[i].type == type &&
-        p->constants[i].value == value) {
-      if (p->constants[i].alloc_reg != 0) {
-        return p->constants[i].alloc_reg;
+    if (p->constant_table[i].type == type &&
+        p->constant_table[i].value == value) {
+      if (p->constant_table[i].alloc_reg != 0) {
+        return p->constant_table[i].alloc_reg;
       }
       break;
     }
   }
   if (i == p->n_constants) {
-    p->n_constants++;
-    p->constants[i].type = type;
-    p->constants[i].value = value;
-    p->constants[i].alloc_reg = 0;
+    orc_compiler_new_constant (p);
+    p->constant_table[i].type = type;
+    p->constant_table[i].value = value;
+    p->constant_table[i].alloc_reg = 0;
   }
 
   powerpc_load_constant (p, i, reg);
@@ -619,23 +621,23 @@ powerpc_get_constant_full (OrcCompiler *p, int value0, int value1,
 
   for(i=0;i<p->n_constants;i++){
 #if 0
-    if (p->constants[i].type == type &&
-        p->constants[i].value == value) {
-      if (p->constants[i].alloc_reg != 0) {
-        return p->constants[i].alloc_reg;
+    if (p->constant_table[i].type == type &&
+        p->constant_table[i].value == value) {
+      if (p->constant_table[i].alloc_reg != 0) {
+        return p->constant_table[i].alloc_reg;
       }
       break;
     }
 #endif
   }
   if (i == p->n_constants) {
-    p->n_constants++;
-    p->constants[i].type = ORC_CONST_FULL;
-    p->constants[i].full_value[0] = value0;
-    p->constants[i].full_value[1] = value1;
-    p->constants[i].full_value[2] = value2;
-    p->constants[i].full_value[3] = value3;
-    p->constants[i].alloc_reg = 0;
+    orc_compiler_new_constant (p);
+    p->constant_table[i].type = ORC_CONST_FULL;
+    p->constant_table[i].full_value[0] = value0;
+    p->constant_table[i].full_value[1] = value1;
+    p->constant_table[i].full_value[2] = value2;
+    p->constant_table[i].full_value[3] = value3;
+    p->constant_table[i].alloc_reg = 0;
   }
 
   powerpc_load_constant (p, i, reg);
@@ -652,13 +654,11 @@ void powerpc_emit_ret (OrcCompiler *compiler)
 void
 powerpc_add_fixup (OrcCompiler *compiler, int type, unsigned char *ptr, int label)
 {
-  compiler->fixups[compiler->n_fixups].ptr = ptr;
-  compiler->fixups[compiler->n_fixups].label = label;
-  compiler->fixups[compiler->n_fixups].type = type;
-  compiler->n_fixups++;
-  if (compiler->n_fixups >= ORC_N_FIXUPS) {
-    ORC_ERROR("too many fixups");
-  }
+  OrcFixup *fixup = orc_compiler_new_fixup (compiler);
+
+  fixup->ptr = ptr;
+  fixup->label = label;
+  fixup->type = type;
 }
 
 void
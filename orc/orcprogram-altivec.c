@@ -174,7 +174,7 @@ orc_program_has_float (OrcCompiler *compiler)
 {
   int j;
   for(j=0;j<compiler->n_insns;j++){
-    OrcInstruction *insn = compiler->insns + j;
+    OrcInstruction *insn = compiler->insn_table + j;
     OrcStaticOpcode *opcode = insn->opcode;
     if (opcode->flags & ORC_STATIC_OPCODE_FLOAT) return TRUE;
   }
@@ -251,7 +251,7 @@ orc_compiler_powerpc_assemble (OrcCompiler *compiler)
   powerpc_emit_label (compiler, label_loop_start);
 
   for(j=0;j<compiler->n_insns;j++){
-    insn = compiler->insns + j;
+    insn = compiler->insn_table + j;
     opcode = insn->opcode;
 
     compiler->insn_index = j;
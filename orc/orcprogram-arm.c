@@ -181,7 +181,7 @@ orc_arm_load_constants_outer (OrcCompiler *compiler)
   }
 
   for(i=0;i<compiler->n_insns;i++){
-    OrcInstruction *insn = compiler->insns + i;
+    OrcInstruction *insn = compiler->insn_table + i;
     OrcStaticOpcode *opcode = insn->opcode;
     OrcRule *rule;
 
@@ -371,7 +371,7 @@ orc_arm_emit_loop (OrcCompiler *compiler)
   OrcRule *rule;
 
   for(j=0;j<compiler->n_insns;j++){
-    insn = compiler->insns + j;
+    insn = compiler->insn_table + j;
     opcode = insn->opcode;
 
     if (insn->flags & ORC_INSN_FLAG_INVARIANT) continue;
@@ -0,0 +1,1566 @@
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include <orc/orcprogram.h>
+#include <orc/orcx86.h>
+#include <orc/orcavx.h>
+#include <orc/orcutils.h>
+#include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
+#include <orc/orccpu.h>
+
+#define AVX 1
+#define SIZE 65536
+
+#define ORC_AVX_ALIGNED_DEST_CUTOFF 64
+
+void orc_avx_emit_loop (OrcCompiler *compiler, int offset, int update);
+
+void orc_compiler_avx_init (OrcCompiler *compiler);
+unsigned int orc_compiler_avx_get_default_flags (void);
+void orc_compiler_avx_assemble (OrcCompiler *compiler);
+void orc_compiler_avx_register_rules (OrcTarget *target);
+void orc_avx_emit_invariants (OrcCompiler *compiler);
+
+
+void orc_compiler_rewrite_vars (OrcCompiler *compiler);
+void orc_compiler_dump (OrcCompiler *compiler);
+void avx_load_constant (OrcCompiler *compiler, int reg, int size, int value);
+void avx_load_constant_long (OrcCompiler *compiler, int reg,
+    OrcConstant *constant);
+static const char * avx_get_flag_name (int shift);
+
+static OrcTarget avx_target = {
+  "avx2",
+#if defined(HAVE_I386) || defined(HAVE_AMD64)
+  TRUE,
+#else
+  FALSE,
+#endif
+  ORC_VEC_REG_BASE,
+  orc_compiler_avx_get_default_flags,
+  orc_compiler_avx_init,
+  orc_compiler_avx_assemble,
+  { { 0 } },
+  0,
+  NULL,
+  avx_load_constant,
+  avx_get_flag_name,
+  NULL,
+  avx_load_constant_long
+};
+
+
+extern int orc_x86_avx_flags;
+extern int orc_x86_mmx_flags;
+
+static int orc_avx_tiling_disabled;
+static int orc_avx_versions_enabled;
+
+void
+orc_avx_init (void)
+{
+#if defined(HAVE_AMD64) || defined(HAVE_I386)
+  /* initializes cache information */
+  orc_avx_get_cpu_flags ();
+#endif
+
+#if defined(HAVE_I386)
+#ifndef MMX
+  if (!(orc_x86_avx_flags & ORC_TARGET_AVX_SSE2)) {
+    avx_target.executable = FALSE;
+  }
+#else
+  if (!(orc_x86_mmx_flags & ORC_TARGET_MMX_MMX)) {
+    mmx_target.executable = FALSE;
+  }
+#endif
+#endif
+#ifdef AVX
+  if (!(orc_x86_avx_flags & ORC_TARGET_AVX_AVX2)) {
+    avx_target.executable = FALSE;
+  }
+#endif
+
+  orc_target_register (&avx_target);
+
+  orc_compiler_avx_register_rules (&avx_target);
+
+  orc_avx_tiling_disabled = orc_compiler_flag_check ("-tile");
+  orc_avx_versions_enabled = orc_compiler_flag_check ("versions");
+}
+
+unsigned int
+orc_compiler_avx_get_default_flags (void)
+{
+  unsigned int flags = 0;
+
+#ifdef __amd64__
+  flags |= ORC_TARGET_AVX_64BIT;
+#endif
+  if (_orc_compiler_flag_debug) {
+    flags |= ORC_TARGET_AVX_FRAME_POINTER;
+  }
+  
+#if defined(HAVE_AMD64) || defined(HAVE_I386)
+#ifndef MMX
+  flags |= orc_x86_avx_flags;
+#else
+  flags |= orc_x86_mmx_flags;
+#endif
+#else
+#ifndef MMX
+  flags |= ORC_TARGET_AVX_SSE2;
+  flags |= ORC_TARGET_AVX_SSE3;
+  flags |= ORC_TARGET_AVX_SSSE3;
+#else
+  flags |= ORC_TARGET_MMX_MMX;
+  flags |= ORC_TARGET_MMX_3DNOW;
+#endif
+#endif
+
+  return flags;
+}
+
+static const char *
+avx_get_flag_name (int shift)
+{
+  static const char *flags[] = {
+#if defined(AVX)
+    "sse2", "sse3", "ssse3", "sse41", "sse42", "sse4a", "sse5",
+    "frame_pointer", "short_jumps", "64bit", "avx", "avx2"
+#elif !defined(MMX)
+    "sse2", "sse3", "ssse3", "sse41", "sse42", "sse4a", "sse5",
+    "frame_pointer", "short_jumps", "64bit"
+#else
+    "mmx", "mmxext", "3dnow", "3dnowext", "ssse3", "sse41", "",
+    "frame_pointer", "short_jumps", "64bit"
+#endif
+  };
+
+  if (shift >= 0 && shift < sizeof(flags)/sizeof(flags[0])) {
+    return flags[shift];
+  }
+
+  return NULL;
+}
+
+void
+orc_compiler_avx_init (OrcCompiler *compiler)
+{
+  int i;
+
+  if (compiler->target_flags & ORC_TARGET_AVX_64BIT) {
+    compiler->is_64bit = TRUE;
+  }
+  if (compiler->target_flags & ORC_TARGET_AVX_FRAME_POINTER) {
+    compiler->use_frame_pointer = TRUE;
+  }
+  if (!(compiler->target_flags & ORC_TARGET_AVX_SHORT_JUMPS)) {
+    compiler->long_jumps = TRUE;
+  }
+  
+
+  if (compiler->is_64bit) {
+    for(i=ORC_GP_REG_BASE;i<ORC_GP_REG_BASE+16;i++){
+      compiler->valid_regs[i] = 1;
+    }
+    compiler->valid_regs[X86_ESP] = 0;
+#ifndef MMX
+    for(i=X86_XMM0;i<X86_XMM0+16;i++){
+      compiler->valid_regs[i] = 1;
+    }
+#else
+    for(i=X86_XMM0;i<X86_XMM0+8;i++){
+      compiler->valid_regs[i] = 1;
+    }
+#endif
+    compiler->save_regs[X86_EBX] = 1;
+    compiler->save_regs[X86_EBP] = 1;
+    compiler->save_regs[X86_R12] = 1;
+    compiler->save_regs[X86_R13] = 1;
+    compiler->save_regs[X86_R14] = 1;
+    compiler->save_regs[X86_R15] = 1;
+#ifdef HAVE_OS_WIN32
+    compiler->save_regs[X86_EDI] = 1;
+    compiler->save_regs[X86_ESI] = 1;
+    for(i=X86_XMM0+6;i<X86_XMM0+16;i++){
+      compiler->save_regs[i] = 1;
+    }
+#endif
+  } else {
+    for(i=ORC_GP_REG_BASE;i<ORC_GP_REG_BASE+8;i++){
+      compiler->valid_regs[i] = 1;
+    }
+    compiler->valid_regs[X86_ESP] = 0;
+    if (compiler->use_frame_pointer) {
+      compiler->valid_regs[X86_EBP] = 0;
+    }
+    for(i=X86_XMM0;i<X86_XMM0+8;i++){
+      compiler->valid_regs[i] = 1;
+    }
+    compiler->save_regs[X86_EBX] = 1;
+    compiler->save_regs[X86_EDI] = 1;
+    compiler->save_regs[X86_EBP] = 1;
+  }
+  for(i=0;i<128;i++){
+    compiler->alloc_regs[i] = 0;
+    compiler->used_regs[i] = 0;
+  }
+
+  if (compiler->is_64bit) {
+#ifdef HAVE_OS_WIN32
+    compiler->exec_reg = X86_ECX;
+    compiler->gp_tmpreg = X86_EDX;
+#else
+    compiler->exec_reg = X86_EDI;
+    compiler->gp_tmpreg = X86_ECX;
+#endif
+  } else {
+    compiler->gp_tmpreg = X86_ECX;
+    if (compiler->use_frame_pointer) {
+      compiler->exec_reg = X86_EBX;
+    } else {
+      compiler->exec_reg = X86_EBP;
+    }
+  }
+  compiler->valid_regs[compiler->gp_tmpreg] = 0;
+  compiler->valid_regs[compiler->exec_reg] = 0;
+
+  switch (compiler->max_var_size) {
+    case 1:
+      compiler->loop_shift = 4;
+      break;
+    case 2:
+      compiler->loop_shift = 3;
+      break;
+    case 4:
+      compiler->loop_shift = 2;
+      break;
+    case 8:
+      compiler->loop_shift = 1;
+      break;
+    default:
+      ORC_ERROR("unhandled max var size %d", compiler->max_var_size);
+      break;
+  }
+#ifdef MMX
+  compiler->loop_shift--;
+#endif
+#ifdef AVX
+  compiler->loop_shift++;
+#endif
+
+  /* This limit is arbitrary, but some large functions run slightly
+     slower when unrolled (ginger Core2 6,15,6), and only some small
+     functions run faster when unrolled.  Most are the same speed. */
+  if (compiler->n_insns <= 10) {
+    compiler->unroll_shift = 1;
+  }
+  /* ORC_CODE=autotune measures instead */
+  if (compiler->is_tuned) {
+    compiler->unroll_shift = compiler->tune_unroll_shift;
+    compiler->loop_shift -= compiler->tune_loop_shift_down;
+    if (compiler->loop_shift < 0) compiler->loop_shift = 0;
+  }
+  if (!compiler->long_jumps) {
+    compiler->unroll_shift = 0;
+  }
+  if (compiler->loop_shift == 0) {
+    /* FIXME something is broken with loop_shift=0, unroll_shift=1 */
+    compiler->unroll_shift = 0;
+  }
+  compiler->alloc_loop_counter = TRUE;
+  compiler->allow_gp_on_stack = TRUE;
+  compiler->allow_spill = TRUE;
+#if defined(AVX)
+  compiler->spill_slot_size = 32;
+#elif !defined(MMX)
+  compiler->spill_slot_size = 16;
+#else
+  compiler->spill_slot_size = 8;
+#endif
+
+  {
+    for(i=0;i<compiler->n_insns;i++){
+      OrcInstruction *insn = compiler->insn_table + i;
+      OrcStaticOpcode *opcode = insn->opcode;
+
+      if (strcmp (opcode->name, "ldreslinb") == 0 ||
+          strcmp (opcode->name, "ldreslinl") == 0 ||
+          strcmp (opcode->name, "ldresnearb") == 0 ||
+          strcmp (opcode->name, "ldresnearl") == 0) {
+        compiler->vars[insn->src_args[0]].need_offset_reg = TRUE;
+      }
+    }
+  }
+
+#ifdef AVX
+  compiler->use_vex = TRUE;
+  orc_avx_use_fallback (compiler);
+#endif
+}
+
+void
+avx_save_accumulators (OrcCompiler *compiler)
+{
+  int i;
+  int src;
+  int tmp;
+
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    OrcVariable *var = compiler->vars + i;
+
+    if (var->name == NULL) continue;
+    switch (var->vartype) {
+      case ORC_VAR_TYPE_ACCUMULATOR:
+        src = var->alloc;
+        tmp = orc_compiler_get_temp_reg (compiler);
+
+#ifdef AVX
+        orc_avx_emit_vpermq (compiler, ORC_AVX_SHUF(3,2,3,2), src, tmp);
+        if (var->size == 2) {
+          orc_avx_emit_paddw (compiler, tmp, src);
+        } else {
+          orc_avx_emit_paddd (compiler, tmp, src);
+        }
+#endif
+#ifndef MMX
+        orc_avx_emit_pshufd (compiler, ORC_AVX_SHUF(3,2,3,2), src, tmp);
+#else
+        orc_mmx_emit_pshufw (compiler, ORC_MMX_SHUF(3,2,3,2), src, tmp);
+#endif
+
+        if (var->size == 2) {
+          orc_avx_emit_paddw (compiler, tmp, src);
+        } else {
+          orc_avx_emit_paddd (compiler, tmp, src);
+        }
+
+#ifndef MMX
+        orc_avx_emit_pshufd (compiler, ORC_AVX_SHUF(1,1,1,1), src, tmp);
+
+        if (var->size == 2) {
+          orc_avx_emit_paddw (compiler, tmp, src);
+        } else {
+          orc_avx_emit_paddd (compiler, tmp, src);
+        }
+#endif
+
+        if (var->size == 2) {
+#ifndef MMX
+          orc_avx_emit_pshuflw (compiler, ORC_AVX_SHUF(1,1,1,1), src, tmp);
+#else
+          orc_mmx_emit_pshufw (compiler, ORC_MMX_SHUF(1,1,1,1), src, tmp);
+#endif
+
+          orc_avx_emit_paddw (compiler, tmp, src);
+        }
+
+        if (var->size == 2) {
+          orc_avx_emit_movd_store_register (compiler, src, compiler->gp_tmpreg);
+          orc_x86_emit_and_imm_reg (compiler, 4, 0xffff, compiler->gp_tmpreg);
+          orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+              (int)ORC_STRUCT_OFFSET(OrcExecutor, accumulators[i-ORC_VAR_A1]),
+              compiler->exec_reg);
+        } else {
+          orc_x86_emit_mov_avx_memoffset (compiler, 4, src,
+              (int)ORC_STRUCT_OFFSET(OrcExecutor, accumulators[i-ORC_VAR_A1]),
+              compiler->exec_reg,
+              var->is_aligned, var->is_uncached);
+        }
+
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+void
+avx_load_constant (OrcCompiler *compiler, int reg, int size, int value)
+{
+  orc_avx_load_constant (compiler, reg, size, value);
+}
+
+void
+orc_avx_load_constant (OrcCompiler *compiler, int reg, int size, orc_uint64 value)
+{
+  int i;
+
+  if (size == 8) {
+    int offset = ORC_STRUCT_OFFSET(OrcExecutor,arrays[ORC_VAR_T1]);
+
+    /* FIXME how ugly and slow! */
+    orc_x86_emit_mov_imm_reg (compiler, 4, value>>0,
+        compiler->gp_tmpreg);
+    orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+        offset + 0, compiler->exec_reg);
+
+    orc_x86_emit_mov_imm_reg (compiler, 4, value>>32,
+        compiler->gp_tmpreg);
+    orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+        offset + 4, compiler->exec_reg);
+
+    orc_x86_emit_mov_memoffset_avx (compiler, 8, offset, compiler->exec_reg,
+        reg, FALSE);
+#ifndef MMX
+    orc_avx_emit_pshufd (compiler, ORC_AVX_SHUF(1,0,1,0), reg, reg);
+#endif
+#ifdef AVX
+    orc_avx_emit_vpermq (compiler, ORC_AVX_SHUF(1,0,1,0), reg, reg);
+#endif
+    return;
+  }
+
+  if (size == 1) {
+    value &= 0xff;
+    value |= (value << 8);
+    value |= (value << 16);
+  }
+  if (size == 2) {
+    value &= 0xffff;
+    value |= (value << 16);
+  }
+
+  ORC_ASM_CODE(compiler, "# loading constant %d 0x%08x\n", (int)value, (int)value);
+  if (value == 0) {
+    orc_avx_emit_pxor(compiler, reg, reg);
+    return;
+  }
+  if (value == 0xffffffff) {
+    orc_avx_emit_pcmpeqb (compiler, reg, reg);
+    return;
+  }
+  if (compiler->target_flags & ORC_TARGET_AVX_SSSE3) {
+    if (value == 0x01010101) {
+      orc_avx_emit_pcmpeqb (compiler, reg, reg);
+      orc_avx_emit_pabsb (compiler, reg, reg);
+      return;
+    }
+  }
+
+  for(i=1;i<32;i++){
+    orc_uint32 v;
+    v = (0xffffffff<<i);
+    if (value == v) {
+      orc_avx_emit_pcmpeqb (compiler, reg, reg);
+      orc_avx_emit_pslld_imm (compiler, i, reg);
+      return;
+    }
+    v = (0xffffffff>>i);
+    if (value == v) {
+      orc_avx_emit_pcmpeqb (compiler, reg, reg);
+      orc_avx_emit_psrld_imm (compiler, i, reg);
+      return;
+    }
+  }
+  for(i=1;i<16;i++){
+    orc_uint32 v;
+    v = (0xffff & (0xffff<<i)) | (0xffff0000 & (0xffff0000<<i));
+    if (value == v) {
+      orc_avx_emit_pcmpeqb (compiler, reg, reg);
+      orc_avx_emit_psllw_imm (compiler, i, reg);
+      return;
+    }
+    v = (0xffff & (0xffff>>i)) | (0xffff0000 & (0xffff0000>>i));
+    if (value == v) {
+      orc_avx_emit_pcmpeqb (compiler, reg, reg);
+      orc_avx_emit_psrlw_imm (compiler, i, reg);
+      return;
+    }
+  }
+
+  orc_x86_emit_mov_imm_reg (compiler, 4, value, compiler->gp_tmpreg);
+  orc_avx_emit_movd_load_register (compiler, compiler->gp_tmpreg, reg);
+#ifndef MMX
+  orc_avx_emit_pshufd (compiler, ORC_AVX_SHUF(0,0,0,0), reg, reg);
+#ifdef AVX
+  orc_avx_emit_vpermq (compiler, ORC_AVX_SHUF(1,0,1,0), reg, reg);
+#endif
+#else
+  orc_mmx_emit_pshufw (compiler, ORC_MMX_SHUF(1,0,1,0), reg, reg);
+#endif
+}
+
+void
+avx_load_constant_long (OrcCompiler *compiler, int reg,
+    OrcConstant *constant)
+{
+  int i;
+  int offset = ORC_STRUCT_OFFSET(OrcExecutor,arrays[ORC_VAR_T1]);
+
+  /* FIXME this is slower than it could be */
+
+  ORC_ASM_CODE(compiler, "# loading constant %08x %08x %08x %08x\n",
+      constant->full_value[0], constant->full_value[1],
+      constant->full_value[2], constant->full_value[3]);
+
+  for(i=0;i<4;i++){
+    orc_x86_emit_mov_imm_reg (compiler, 4, constant->full_value[i],
+        compiler->gp_tmpreg);
+    orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+        offset + 4*i, compiler->exec_reg);
+  }
+  orc_x86_emit_mov_memoffset_avx (compiler, 16, offset, compiler->exec_reg,
+      reg, FALSE);
+#ifdef AVX
+  orc_avx_emit_vpermq (compiler, ORC_AVX_SHUF(1,0,1,0), reg, reg);
+#endif
+
+}
+
+void
+avx_load_constants_outer (OrcCompiler *compiler)
+{
+  int i;
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    if (compiler->vars[i].name == NULL) continue;
+    switch (compiler->vars[i].vartype) {
+      case ORC_VAR_TYPE_CONST:
+        break;
+      case ORC_VAR_TYPE_PARAM:
+        break;
+      case ORC_VAR_TYPE_SRC:
+      case ORC_VAR_TYPE_DEST:
+        break;
+      case ORC_VAR_TYPE_ACCUMULATOR:
+        orc_avx_emit_pxor (compiler,
+            compiler->vars[i].alloc, compiler->vars[i].alloc);
+        break;
+      case ORC_VAR_TYPE_TEMP:
+        break;
+      default:
+        orc_compiler_error(compiler,"bad vartype");
+        break;
+    }
+  }
+
+  orc_avx_emit_invariants (compiler);
+
+  /* FIXME move to a better place */
+  for(i=0;i<compiler->n_constants;i++){
+    compiler->constant_table[i].alloc_reg =
+      orc_compiler_get_constant_reg (compiler);
+  }
+
+  for(i=0;i<compiler->n_constants;i++){
+    if (compiler->constant_table[i].alloc_reg) {
+      if (compiler->constant_table[i].is_long) {
+        avx_load_constant_long (compiler, compiler->constant_table[i].alloc_reg,
+            compiler->constant_table + i);
+      } else {
+        avx_load_constant (compiler, compiler->constant_table[i].alloc_reg,
+            4, compiler->constant_table[i].value);
+      }
+    }
+  }
+
+  {
+    for(i=0;i<compiler->n_insns;i++){
+      OrcInstruction *insn = compiler->insn_table + i;
+      OrcStaticOpcode *opcode = insn->opcode;
+
+      if (strcmp (opcode->name, "ldreslinb") == 0 ||
+          strcmp (opcode->name, "ldreslinl") == 0 ||
+          strcmp (opcode->name, "ldresnearb") == 0 ||
+          strcmp (opcode->name, "ldresnearl") == 0) {
+        if (compiler->vars[insn->src_args[1]].vartype == ORC_VAR_TYPE_PARAM) {
+          orc_x86_emit_mov_memoffset_reg (compiler, 4,
+              (int)ORC_STRUCT_OFFSET(OrcExecutor, params[insn->src_args[1]]),
+              compiler->exec_reg,
+              compiler->vars[insn->src_args[0]].ptr_offset);
+        } else {
+          orc_x86_emit_mov_imm_reg (compiler, 4,
+              compiler->vars[insn->src_args[1]].value.i,
+              compiler->vars[insn->src_args[0]].ptr_offset);
+        }
+      }
+    }
+  }
+}
+
+void
+avx_load_constants_inner (OrcCompiler *compiler)
+{
+  int i;
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    if (compiler->vars[i].name == NULL) continue;
+    switch (compiler->vars[i].vartype) {
+      case ORC_VAR_TYPE_CONST:
+        break;
+      case ORC_VAR_TYPE_PARAM:
+        break;
+      case ORC_VAR_TYPE_SRC:
+      case ORC_VAR_TYPE_DEST:
+        if (compiler->vars[i].ptr_register) {
+          orc_x86_emit_mov_memoffset_reg (compiler, compiler->is_64bit ? 8 : 4,
+              (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg,
+              compiler->vars[i].ptr_register);
+        }
+        break;
+      case ORC_VAR_TYPE_ACCUMULATOR:
+        break;
+      case ORC_VAR_TYPE_TEMP:
+        break;
+      default:
+        orc_compiler_error(compiler,"bad vartype");
+        break;
+    }
+  }
+}
+
+void
+avx_add_strides (OrcCompiler *compiler)
+{
+  int i;
+
+  for(i=0;i<ORC_N_COMPILER_VARIABLES;i++){
+    if (compiler->vars[i].name == NULL) continue;
+    switch (compiler->vars[i].vartype) {
+      case ORC_VAR_TYPE_CONST:
+        break;
+      case ORC_VAR_TYPE_PARAM:
+        break;
+      case ORC_VAR_TYPE_SRC:
+      case ORC_VAR_TYPE_DEST:
+        orc_x86_emit_mov_memoffset_reg (compiler, 4,
+            (int)ORC_STRUCT_OFFSET(OrcExecutor, params[i]), compiler->exec_reg,
+            compiler->gp_tmpreg);
+        orc_x86_emit_add_reg_memoffset (compiler, compiler->is_64bit ? 8 : 4,
+            compiler->gp_tmpreg,
+            (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg);
+
+        if (compiler->vars[i].ptr_register == 0) {
+          orc_compiler_error (compiler, "unimplemented: stride on pointer stored in memory");
+        }
+        break;
+      case ORC_VAR_TYPE_ACCUMULATOR:
+        break;
+      case ORC_VAR_TYPE_TEMP:
+        break;
+      default:
+        orc_compiler_error(compiler,"bad vartype");
+        break;
+    }
+  }
+}
+
+#if defined(AVX)
+#define AVX_VECTOR_SIZE 32
+#elif !defined(MMX)
+#define AVX_VECTOR_SIZE 16
+#else
+#define AVX_VECTOR_SIZE 8
+#endif
+
+static int
+get_align_var (OrcCompiler *compiler)
+{
+  int i;
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    if (compiler->vars[i].size == 0) continue;
+    if ((compiler->vars[i].size << compiler->loop_shift) >= AVX_VECTOR_SIZE) {
+      return i;
+    }
+  }
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    if (compiler->vars[i].size == 0) continue;
+    if ((compiler->vars[i].size << compiler->loop_shift) >= 8) {
+      return i;
+    }
+  }
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    if (compiler->vars[i].size == 0) continue;
+    return i;
+  }
+
+  orc_compiler_error(compiler, "could not find alignment variable");
+
+  return -1;
+}
+
+static int
+get_shift (int size)
+{
+  switch (size) {
+    case 1:
+      return 0;
+    case 2:
+      return 1;
+    case 4:
+      return 2;
+    case 8:
+      return 3;
+    default:
+      ORC_ERROR("bad size %d", size);
+  }
+  return -1;
+}
+
+
+static void
+orc_emit_split_3_regions (OrcCompiler *compiler, int n_offset)
+{
+  int align_var;
+  int align_shift;
+  int var_size_shift;
+
+  align_var = get_align_var (compiler);
+  if (align_var < 0)
+    return;
+  var_size_shift = get_shift (compiler->vars[align_var].size);
+  align_shift = var_size_shift + compiler->loop_shift;
+
+  /* determine how many iterations until align array is aligned (n1) */
+  orc_x86_emit_mov_imm_reg (compiler, 4, AVX_VECTOR_SIZE, X86_EAX);
+  orc_x86_emit_sub_memoffset_reg (compiler, 4,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[align_var]),
+      compiler->exec_reg, X86_EAX);
+  orc_x86_emit_and_imm_reg (compiler, 4, (1<<align_shift) - 1, X86_EAX);
+  orc_x86_emit_sar_imm_reg (compiler, 4, var_size_shift, X86_EAX);
+
+  /* check if n1 is greater than n. */
+  orc_x86_emit_cmp_reg_memoffset (compiler, 4, X86_EAX, n_offset,
+      compiler->exec_reg);
+
+  orc_x86_emit_jle (compiler, 6);
+
+  /* If so, we have a standard 3-region split. */
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter1), compiler->exec_reg);
+    
+  /* Calculate n2 */
+  orc_x86_emit_mov_memoffset_reg (compiler, 4, n_offset, compiler->exec_reg,
+      compiler->gp_tmpreg);
+  orc_x86_emit_sub_reg_reg (compiler, 4, X86_EAX, compiler->gp_tmpreg);
+
+  orc_x86_emit_mov_reg_reg (compiler, 4, compiler->gp_tmpreg, X86_EAX);
+
+  orc_x86_emit_sar_imm_reg (compiler, 4,
+      compiler->loop_shift + compiler->unroll_shift,
+      compiler->gp_tmpreg);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2), compiler->exec_reg);
+
+  /* Calculate n3 */
+  orc_x86_emit_and_imm_reg (compiler, 4,
+      (1<<(compiler->loop_shift + compiler->unroll_shift))-1, X86_EAX);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter3), compiler->exec_reg);
+
+  orc_x86_emit_jmp (compiler, 7);
+
+  /* else, iterations are all unaligned: n1=n, n2=0, n3=0 */
+  orc_x86_emit_label (compiler, 6);
+
+  orc_x86_emit_mov_memoffset_reg (compiler, 4, n_offset, compiler->exec_reg,
+      X86_EAX);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter1), compiler->exec_reg);
+  orc_x86_emit_mov_imm_reg (compiler, 4, 0, X86_EAX);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2), compiler->exec_reg);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter3), compiler->exec_reg);
+
+  orc_x86_emit_label (compiler, 7);
+}
+
+static void
+orc_emit_split_2_regions (OrcCompiler *compiler, int n_offset)
+{
+  int align_var;
+  int align_shift ORC_GNUC_UNUSED;
+  int var_size_shift;
+
+  align_var = get_align_var (compiler);
+  if (align_var < 0)
+    return;
+  var_size_shift = get_shift (compiler->vars[align_var].size);
+  align_shift = var_size_shift + compiler->loop_shift;
+
+  /* Calculate n2 */
+  orc_x86_emit_mov_memoffset_reg (compiler, 4, n_offset, compiler->exec_reg,
+      compiler->gp_tmpreg);
+  orc_x86_emit_mov_reg_reg (compiler, 4, compiler->gp_tmpreg, X86_EAX);
+  orc_x86_emit_sar_imm_reg (compiler, 4,
+      compiler->loop_shift + compiler->unroll_shift,
+      compiler->gp_tmpreg);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2), compiler->exec_reg);
+
+  /* Calculate n3 */
+  orc_x86_emit_and_imm_reg (compiler, 4,
+      (1<<(compiler->loop_shift + compiler->unroll_shift))-1, X86_EAX);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter3), compiler->exec_reg);
+}
+
+#ifndef MMX
+static int
+orc_program_has_float (OrcCompiler *compiler)
+{
+  int j;
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+    OrcStaticOpcode *opcode = insn->opcode;
+    if (opcode->flags & ORC_STATIC_OPCODE_FLOAT) return TRUE;
+  }
+  return FALSE;
+}
+#endif
+
+/* The labels have to fit in ORC_N_LABELS.  The steps go up to a loop
+ * shift of 5, so LABEL_STEP_DOWN() uses 8 to 13 and LABEL_STEP_UP() 14
+ * to 18.  6 and 7 are used by orc_emit_split_3_regions(). */
+#define LABEL_REGION1_SKIP 1
+#define LABEL_INNER_LOOP_START 2
+#define LABEL_REGION2_SKIP 3
+#define LABEL_OUTER_LOOP 4
+#define LABEL_OUTER_LOOP_SKIP 5
+#define LABEL_STEP_DOWN(x) (8+(x))
+#define LABEL_STEP_UP(x) (14+(x))
+#define LABEL_TILE_LOOP 22
+#define LABEL_TILE_LAST 23
+#define LABEL_VERSIONS_END 24
+#define LABEL_VERSION_ALIGNED 25
+#define LABEL_VERSION_SHORT 37
+/* added to the region labels for the loop of the aligned version, which
+ * has no first region, so it uses 19 to 21 and 26 to 31, and to
+ * LABEL_STEP_DOWN() for the short version, which uses 32 to 36 */
+#define LABELS_ALIGNED 18
+#define LABELS_SHORT 24
+
+/* 2D programs that read more than one source array can run over the
+ * frame in column strips, each strip from the top row to the bottom
+ * row.  The sources are often neighbouring rows of the same picture,
+ * and when a strip is narrow enough for its rows to stay in the L2
+ * cache, the next row finds them there instead of in memory.  The
+ * strips are sized for L2 and not L1: narrow strips start a new page
+ * on every row, which costs more in lost hardware prefetching than L1
+ * hits save.  Rows that already fit are run as one strip.  Returns the
+ * strip width in elements, or 0 to run over whole rows. */
+static int
+avx_get_tile_width (OrcCompiler *compiler)
+{
+  int level2;
+  int row_size = 0;
+  int n_src = 0;
+  int width;
+  int i;
+
+  if (orc_avx_tiling_disabled) return 0;
+  if (!compiler->program->is_2d || compiler->program->constant_m > 0 ||
+      compiler->program->constant_n > 0) return 0;
+  /* upsampling and resampling sources don't move with the strip */
+  if (compiler->has_iterator_opcode) return 0;
+
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    if (compiler->vars[i].size == 0) continue;
+    if (compiler->vars[i].need_offset_reg) return 0;
+    if (compiler->vars[i].vartype == ORC_VAR_TYPE_SRC) n_src++;
+    row_size += compiler->vars[i].size;
+  }
+  if (n_src < 2) return 0;
+
+  orc_get_data_cache_sizes (NULL, &level2, NULL);
+  /* a multiple of 64 keeps the alignment of every array */
+  width = (level2 / 2 / row_size) & ~63;
+  if (width < 256) return 0;
+
+  return width;
+}
+
+/* The columns that are left are kept in params[ORC_VAR_C2] and the
+ * width of the current strip, which is the n of its rows, in
+ * params[ORC_VAR_C3].  Leaves m in EAX, like the code before it. */
+static void
+avx_emit_tile_start (OrcCompiler *compiler, int tile_width)
+{
+  orc_x86_emit_mov_memoffset_reg (compiler, 4,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,n), compiler->exec_reg,
+      compiler->gp_tmpreg);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C2]),
+      compiler->exec_reg);
+
+  orc_x86_emit_label (compiler, LABEL_TILE_LOOP);
+  orc_x86_emit_mov_memoffset_reg (compiler, 4,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C2]),
+      compiler->exec_reg, compiler->gp_tmpreg);
+  orc_x86_emit_cmp_imm_reg (compiler, 4, tile_width, compiler->gp_tmpreg);
+  orc_x86_emit_jle (compiler, LABEL_TILE_LAST);
+  orc_x86_emit_mov_imm_reg (compiler, 4, tile_width, compiler->gp_tmpreg);
+  orc_x86_emit_label (compiler, LABEL_TILE_LAST);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C3]),
+      compiler->exec_reg);
+  orc_x86_emit_sub_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C2]),
+      compiler->exec_reg);
+
+  /* m, for the row counter */
+  orc_x86_emit_mov_memoffset_reg (compiler, 4,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_A1]),
+      compiler->exec_reg, X86_EAX);
+}
+
+/* Moves the arrays from the bottom of the strip back up to the top of
+ * the next one.  This undoes avx_add_strides() the same way it was
+ * done, on the low half of the pointers. */
+static void
+avx_emit_tile_end (OrcCompiler *compiler, int tile_width)
+{
+  int i;
+
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    if (compiler->vars[i].size == 0) continue;
+
+    orc_x86_emit_mov_memoffset_reg (compiler, 4,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, params[i]), compiler->exec_reg,
+        compiler->gp_tmpreg);
+    orc_x86_emit_imul_memoffset_reg (compiler, 4,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_A1]),
+        compiler->exec_reg, compiler->gp_tmpreg);
+    orc_x86_emit_sub_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg);
+    orc_x86_emit_add_imm_memoffset (compiler, compiler->is_64bit ? 8 : 4,
+        tile_width * compiler->vars[i].size,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg);
+  }
+
+  orc_x86_emit_cmp_imm_memoffset (compiler, 4, 0,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C2]),
+      compiler->exec_reg);
+  orc_x86_emit_jne (compiler, LABEL_TILE_LOOP);
+}
+
+
+/* The loop over a length that isn't known when compiling, in up to
+ * three regions: smaller steps until the alignment variable is
+ * aligned, the unrolled loop over whole vectors, and smaller steps
+ * for what is left.  The counters are set up by one of the split
+ * functions.  label_base is added to the labels, so that the regions
+ * can be emitted more than once. */
+static void
+avx_emit_regions (OrcCompiler *compiler, int align_var, int emit_region1,
+    int label_base)
+{
+  int ui, ui_max;
+  int emit_region3 = TRUE;
+
+  if (compiler->loop_shift == 0) {
+    emit_region1 = FALSE;
+    emit_region3 = FALSE;
+  }
+
+  if (emit_region1) {
+    int save_loop_shift;
+    int l;
+
+    save_loop_shift = compiler->loop_shift;
+    compiler->vars[align_var].is_aligned = FALSE;
+
+    for (l=0;l<save_loop_shift;l++){
+      compiler->loop_shift = l;
+      ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
+
+      orc_x86_emit_test_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor,counter1), compiler->exec_reg);
+      orc_x86_emit_je (compiler,
+          label_base + LABEL_STEP_UP(compiler->loop_shift));
+      orc_avx_emit_loop (compiler, 0, 1<<compiler->loop_shift);
+      orc_x86_emit_label (compiler,
+          label_base + LABEL_STEP_UP(compiler->loop_shift));
+    }
+
+    compiler->loop_shift = save_loop_shift;
+    compiler->vars[align_var].is_aligned = TRUE;
+  }
+
+  orc_x86_emit_label (compiler, label_base + LABEL_REGION1_SKIP);
+
+  orc_x86_emit_cmp_imm_memoffset (compiler, 4, 0,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2), compiler->exec_reg);
+  orc_x86_emit_je (compiler, label_base + LABEL_REGION2_SKIP);
+
+  if (compiler->loop_counter != ORC_REG_INVALID) {
+    orc_x86_emit_mov_memoffset_reg (compiler, 4,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, counter2), compiler->exec_reg,
+        compiler->loop_counter);
+  }
+
+  ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
+  orc_x86_emit_align (compiler, 4);
+  orc_x86_emit_label (compiler, label_base + LABEL_INNER_LOOP_START);
+  ui_max = 1<<compiler->unroll_shift;
+  for(ui=0;ui<ui_max;ui++) {
+    compiler->offset = ui<<compiler->loop_shift;
+    orc_avx_emit_loop (compiler, compiler->offset,
+        (ui==ui_max-1) << (compiler->loop_shift + compiler->unroll_shift));
+  }
+  compiler->offset = 0;
+  if (compiler->loop_counter != ORC_REG_INVALID) {
+    orc_x86_emit_add_imm_reg (compiler, 4, -1, compiler->loop_counter, TRUE);
+  } else {
+    orc_x86_emit_dec_memoffset (compiler, 4,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2),
+        compiler->exec_reg);
+  }
+  orc_x86_emit_jne (compiler, label_base + LABEL_INNER_LOOP_START);
+  orc_x86_emit_label (compiler, label_base + LABEL_REGION2_SKIP);
+
+  if (emit_region3) {
+    int save_loop_shift;
+    int l;
+
+    /* the versions after this one need the loop shift back */
+    save_loop_shift = compiler->loop_shift;
+    compiler->vars[align_var].is_aligned = FALSE;
+
+    for(l=save_loop_shift + compiler->unroll_shift - 1; l >= 0; l--) {
+      compiler->loop_shift = l;
+      ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
+
+      orc_x86_emit_test_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor,counter3), compiler->exec_reg);
+      orc_x86_emit_je (compiler,
+          label_base + LABEL_STEP_DOWN(compiler->loop_shift));
+      orc_avx_emit_loop (compiler, 0, 1<<compiler->loop_shift);
+      orc_x86_emit_label (compiler,
+          label_base + LABEL_STEP_DOWN(compiler->loop_shift));
+    }
+
+    compiler->loop_shift = save_loop_shift;
+  }
+}
+
+/* Versions of the loop picked by n and the alignment of the arrays,
+ * once per call: a general one, which is the loop above, one for
+ * arrays that are all aligned, which skips the first region and uses
+ * aligned loads and stores for all of them, and one for n below the
+ * vector width, which goes straight to the smaller steps.  Only used
+ * for 1D programs with a variable n, where the loop would otherwise
+ * be split in three regions, and only with ORC_CODE=versions: the code
+ * gets about half again as large, and no win has been measured yet. */
+static int
+avx_use_versions (OrcCompiler *compiler, int is_aligned)
+{
+  if (!orc_avx_versions_enabled) return FALSE;
+  /* the jumps between the versions can be far */
+  if (!compiler->long_jumps) return FALSE;
+  if (compiler->program->is_2d || compiler->program->constant_n > 0) {
+    return FALSE;
+  }
+  if (compiler->loop_shift == 0 || compiler->has_iterator_opcode ||
+      is_aligned) {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Arrays that stay aligned over the whole loop when they start
+ * aligned: those that move one full vector per iteration, and are
+ * only used by plain loads and stores, not at an offset.  This only
+ * looks at the instructions, so that it gives the same answer before
+ * and after the loop is emitted. */
+static int
+avx_var_can_align (OrcCompiler *compiler, int var)
+{
+  int used = FALSE;
+  int j;
+
+  if (compiler->vars[var].size == 0) return FALSE;
+  if ((compiler->vars[var].size << compiler->loop_shift) != AVX_VECTOR_SIZE) {
+    return FALSE;
+  }
+  if (compiler->vars[var].need_offset_reg) return FALSE;
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+    const char *name = insn->opcode->name;
+
+    if (insn->src_args[0] == var &&
+        (insn->opcode->flags & ORC_STATIC_OPCODE_LOAD)) {
+      if (strcmp (name, "loadb") != 0 && strcmp (name, "loadw") != 0 &&
+          strcmp (name, "loadl") != 0 && strcmp (name, "loadq") != 0) {
+        return FALSE;
+      }
+      used = TRUE;
+    }
+    if (insn->dest_args[0] == var &&
+        (insn->opcode->flags & ORC_STATIC_OPCODE_STORE)) {
+      if (strcmp (name, "storeb") != 0 && strcmp (name, "storew") != 0 &&
+          strcmp (name, "storel") != 0 && strcmp (name, "storeq") != 0) {
+        return FALSE;
+      }
+      used = TRUE;
+    }
+  }
+  return used;
+}
+
+/* Jumps to the short version if n is below the vector width, and to
+ * the aligned version if the arrays that can be aligned all are. */
+static void
+avx_emit_dispatch (OrcCompiler *compiler, int n_offset)
+{
+  int n_aligned = 0;
+  int i;
+
+  orc_x86_emit_cmp_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
+      n_offset, compiler->exec_reg);
+  orc_x86_emit_jl (compiler, LABEL_VERSION_SHORT);
+
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    if (!avx_var_can_align (compiler, i)) continue;
+
+    /* the low bits of the pointers are enough */
+    if (n_aligned == 0) {
+      orc_x86_emit_mov_memoffset_reg (compiler, 4,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg,
+          compiler->gp_tmpreg);
+    } else {
+      orc_x86_emit_or_memoffset_reg (compiler, 4,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg,
+          compiler->gp_tmpreg);
+    }
+    n_aligned++;
+  }
+  if (n_aligned > 0) {
+    orc_x86_emit_and_imm_reg (compiler, 4, AVX_VECTOR_SIZE - 1,
+        compiler->gp_tmpreg);
+    orc_x86_emit_je (compiler, LABEL_VERSION_ALIGNED);
+  }
+}
+
+/* The aligned and short versions, after the general one */
+static void
+avx_emit_versions (OrcCompiler *compiler, int align_var, int n_offset)
+{
+  int save_aligned[ORC_VAR_S8 + 1];
+  int save_loop_shift;
+  int n_aligned = 0;
+  int l;
+  int i;
+
+  orc_x86_emit_jmp (compiler, LABEL_VERSIONS_END);
+
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    save_aligned[i] = compiler->vars[i].is_aligned;
+    if (avx_var_can_align (compiler, i)) n_aligned++;
+  }
+  if (n_aligned > 0) {
+    ORC_ASM_CODE(compiler, "# aligned arrays\n");
+    orc_x86_emit_label (compiler, LABEL_VERSION_ALIGNED);
+    orc_emit_split_2_regions (compiler, n_offset);
+    avx_load_constants_inner (compiler);
+    for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+      if (avx_var_can_align (compiler, i)) {
+        compiler->vars[i].is_aligned = TRUE;
+      }
+    }
+    avx_emit_regions (compiler, align_var, FALSE, LABELS_ALIGNED);
+    for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+      compiler->vars[i].is_aligned = save_aligned[i];
+    }
+    orc_x86_emit_jmp (compiler, LABEL_VERSIONS_END);
+  }
+
+  /* n has no bits above these, so they can test it directly */
+  ORC_ASM_CODE(compiler, "# short n\n");
+  orc_x86_emit_label (compiler, LABEL_VERSION_SHORT);
+  avx_load_constants_inner (compiler);
+  save_loop_shift = compiler->loop_shift;
+  for(l=save_loop_shift - 1; l >= 0; l--) {
+    compiler->loop_shift = l;
+    ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
+
+    orc_x86_emit_test_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
+        n_offset, compiler->exec_reg);
+    orc_x86_emit_je (compiler,
+        LABELS_SHORT + LABEL_STEP_DOWN(compiler->loop_shift));
+    orc_avx_emit_loop (compiler, 0, 1<<compiler->loop_shift);
+    orc_x86_emit_label (compiler,
+        LABELS_SHORT + LABEL_STEP_DOWN(compiler->loop_shift));
+  }
+  compiler->loop_shift = save_loop_shift;
+
+  orc_x86_emit_label (compiler, LABEL_VERSIONS_END);
+}
+
+void
+orc_compiler_avx_assemble (OrcCompiler *compiler)
+{
+#ifndef MMX
+  int set_mxcsr = FALSE;
+#endif
+  int align_var;
+  int is_aligned;
+  int tile_width;
+  int n_offset;
+  int use_versions;
+
+  if (0 && orc_x86_assemble_copy_check (compiler)) {
+    /* The rep movs implementation isn't faster most of the time */
+    orc_x86_assemble_copy (compiler);
+    return;
+  }
+
+  align_var = get_align_var (compiler);
+  if (align_var < 0) {
+    orc_x86_assemble_copy (compiler);
+    return;
+  }
+  is_aligned = compiler->vars[align_var].is_aligned;
+  use_versions = avx_use_versions (compiler, is_aligned);
+
+  tile_width = avx_get_tile_width (compiler);
+  if (tile_width > 0) {
+    n_offset = (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C3]);
+  } else {
+    n_offset = (int)ORC_STRUCT_OFFSET(OrcExecutor, n);
+  }
+
+  /* Analysis pass: the rules are run once without producing any
+   * output, to find the constants they need and the temporaries they
+   * use, so that the constants can be loaded into registers outside
+   * the loop.  The code is then emitted in a single pass. */
+  compiler->analysis_pass = TRUE;
+  orc_avx_emit_loop (compiler, 0, 0);
+  compiler->analysis_pass = FALSE;
+
+  compiler->codeptr = compiler->code;
+  memset (compiler->labels, 0, sizeof (compiler->labels));
+  memset (compiler->labels_int, 0, sizeof (compiler->labels_int));
+  compiler->n_fixups = 0;
+
+  if (compiler->error) return;
+
+  orc_x86_emit_prologue (compiler);
+
+#ifndef MMX
+  if (orc_program_has_float (compiler)) {
+    set_mxcsr = TRUE;
+    orc_avx_set_mxcsr (compiler);
+  }
+#endif
+
+  avx_load_constants_outer (compiler);
+
+  if (compiler->program->is_2d) {
+    if (compiler->program->constant_m > 0) {
+      orc_x86_emit_mov_imm_reg (compiler, 4, compiler->program->constant_m,
+          X86_EAX);
+      orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_A2]),
+          compiler->exec_reg);
+    } else {
+      orc_x86_emit_mov_memoffset_reg (compiler, 4,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_A1]),
+          compiler->exec_reg, X86_EAX);
+      orc_x86_emit_test_reg_reg (compiler, 4, X86_EAX, X86_EAX);
+      orc_x86_emit_jle (compiler, LABEL_OUTER_LOOP_SKIP);
+      if (tile_width > 0) {
+        avx_emit_tile_start (compiler, tile_width);
+      }
+      orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_A2]),
+          compiler->exec_reg);
+    }
+
+    orc_x86_emit_label (compiler, LABEL_OUTER_LOOP);
+  }
+
+  if (compiler->program->constant_n > 0 &&
+      compiler->program->constant_n <= ORC_AVX_ALIGNED_DEST_CUTOFF) {
+    /* don't need to load n */
+  } else if (use_versions) {
+    avx_emit_dispatch (compiler, n_offset);
+    orc_emit_split_3_regions (compiler, n_offset);
+  } else if (compiler->loop_shift > 0) {
+    if (compiler->has_iterator_opcode || is_aligned) {
+      orc_emit_split_2_regions (compiler, n_offset);
+    } else {
+      /* split n into three regions, with center region being aligned */
+      orc_emit_split_3_regions (compiler, n_offset);
+    }
+  } else {
+    /* loop shift is 0, no need to split */
+    orc_x86_emit_mov_memoffset_reg (compiler, 4, n_offset, compiler->exec_reg,
+        compiler->gp_tmpreg);
+    orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2), compiler->exec_reg);
+  }
+
+  avx_load_constants_inner (compiler);
+
+  if (compiler->program->constant_n > 0 &&
+      compiler->program->constant_n <= ORC_AVX_ALIGNED_DEST_CUTOFF) {
+    int n_left = compiler->program->constant_n;
+    int save_loop_shift;
+    int loop_shift;
+
+    compiler->offset = 0;
+
+    save_loop_shift = compiler->loop_shift;
+    while (n_left >= (1<<compiler->loop_shift)) {
+      ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
+      orc_avx_emit_loop (compiler, compiler->offset, 0);
+
+      n_left -= 1<<compiler->loop_shift;
+      compiler->offset += 1<<compiler->loop_shift;
+    }
+    for(loop_shift = compiler->loop_shift-1; loop_shift>=0; loop_shift--) {
+      if (n_left >= (1<<loop_shift)) {
+        compiler->loop_shift = loop_shift;
+        ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", loop_shift);
+        orc_avx_emit_loop (compiler, compiler->offset, 0);
+        n_left -= 1<<loop_shift;
+        compiler->offset += 1<<loop_shift;
+      }
+    }
+    compiler->loop_shift = save_loop_shift;
+
+  } else {
+    int emit_region1 = TRUE;
+
+    if (compiler->has_iterator_opcode || is_aligned) {
+      emit_region1 = FALSE;
+    }
+    avx_emit_regions (compiler, align_var, emit_region1, 0);
+
+    if (use_versions) {
+      avx_emit_versions (compiler, align_var, n_offset);
+    }
+  }
+
+  if (compiler->program->is_2d && compiler->program->constant_m != 1) {
+    avx_add_strides (compiler);
+
+    orc_x86_emit_add_imm_memoffset (compiler, 4, -1,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor,params[ORC_VAR_A2]),
+        compiler->exec_reg);
+    orc_x86_emit_jne (compiler, LABEL_OUTER_LOOP);
+    if (tile_width > 0) {
+      avx_emit_tile_end (compiler, tile_width);
+    }
+    orc_x86_emit_label (compiler, LABEL_OUTER_LOOP_SKIP);
+  }
+
+  avx_save_accumulators (compiler);
+
+#ifndef MMX
+  if (set_mxcsr) {
+    orc_avx_restore_mxcsr (compiler);
+  }
+#else
+  orc_x86_emit_emms (compiler);
+#endif
+#ifdef AVX
+  orc_avx_emit_vzeroupper (compiler);
+#endif
+  orc_x86_emit_epilogue (compiler);
+
+  _orc_x86_peephole (compiler);
+  _orc_x86_schedule_insns (compiler);
+  orc_x86_calculate_offsets (compiler);
+  orc_x86_output_insns (compiler);
+
+  orc_x86_do_fixups (compiler);
+}
+
+/* Loads the spilled sources of insn into temporary registers, and
+ * gives its spilled destinations one.  The variables keep these
+ * registers until avx_store_spilled(), so the rule sees them as usual
+ * and doesn't get them as temporaries. */
+static int
+avx_load_spilled (OrcCompiler *compiler, OrcInstruction *insn, int *spilled)
+{
+  OrcStaticOpcode *opcode = insn->opcode;
+  OrcVariable *var;
+  int n_spilled = 0;
+  int k;
+
+  for(k=0;k<ORC_STATIC_OPCODE_N_SRC + ORC_STATIC_OPCODE_N_DEST;k++){
+    int is_src = (k < ORC_STATIC_OPCODE_N_SRC);
+    int i;
+
+    if (is_src) {
+      if (opcode->src_size[k] == 0) continue;
+      i = insn->src_args[k];
+    } else {
+      if (opcode->dest_size[k - ORC_STATIC_OPCODE_N_SRC] == 0) continue;
+      i = insn->dest_args[k - ORC_STATIC_OPCODE_N_SRC];
+    }
+    var = compiler->vars + i;
+    if (compiler->spill_slot[i] == 0 || var->alloc) continue;
+
+    var->alloc = orc_compiler_get_temp_reg (compiler);
+    if (compiler->error) break;
+    spilled[n_spilled++] = i;
+    if (is_src) {
+      orc_x86_emit_mov_memoffset_avx (compiler, compiler->spill_slot_size,
+          (compiler->spill_slot[i] - 1) * compiler->spill_slot_size,
+          X86_ESP, var->alloc, TRUE);
+    }
+  }
+
+  return n_spilled;
+}
+
+static void
+avx_store_spilled (OrcCompiler *compiler, OrcInstruction *insn,
+    const int *spilled, int n_spilled)
+{
+  OrcStaticOpcode *opcode = insn->opcode;
+  int k;
+
+  for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+    int i = insn->dest_args[k];
+
+    if (opcode->dest_size[k] == 0 || compiler->spill_slot[i] == 0) continue;
+    orc_x86_emit_mov_avx_memoffset (compiler, compiler->spill_slot_size,
+        compiler->vars[i].alloc,
+        (compiler->spill_slot[i] - 1) * compiler->spill_slot_size,
+        X86_ESP, TRUE, FALSE);
+  }
+  for(k=0;k<n_spilled;k++){
+    compiler->vars[spilled[k]].alloc = 0;
+  }
+}
+
+/* The rules write the result over the first source, so it is copied
+ * to the destination first if they aren't in the same register */
+static void
+orc_avx_emit_insn (OrcCompiler *compiler, OrcInstruction *insn)
+{
+  OrcRule *rule = insn->rule;
+  int spilled[ORC_STATIC_OPCODE_N_SRC + ORC_STATIC_OPCODE_N_DEST];
+  int n_spilled = 0;
+
+  if (compiler->n_spill_slots > 0) {
+    n_spilled = avx_load_spilled (compiler, insn, spilled);
+  }
+
+  if (rule && rule->emit) {
+    if (!(insn->opcode->flags & (ORC_STATIC_OPCODE_ACCUMULATOR|ORC_STATIC_OPCODE_LOAD|ORC_STATIC_OPCODE_STORE|ORC_STATIC_OPCODE_COPY)) &&
+        compiler->vars[insn->dest_args[0]].alloc !=
+        compiler->vars[insn->src_args[0]].alloc) {
+#ifdef MMX
+      orc_avx_emit_movq (compiler,
+          compiler->vars[insn->src_args[0]].alloc,
+          compiler->vars[insn->dest_args[0]].alloc);
+#else
+      orc_avx_emit_movdqu (compiler,
+          compiler->vars[insn->src_args[0]].alloc,
+          compiler->vars[insn->dest_args[0]].alloc);
+#endif
+    }
+    rule->emit (compiler, rule->emit_user, insn);
+  } else {
+    orc_compiler_error (compiler, "no code generation rule for %s",
+        insn->opcode->name);
+  }
+
+  if (n_spilled > 0) {
+    avx_store_spilled (compiler, insn, spilled, n_spilled);
+  }
+}
+
+void
+orc_avx_emit_loop (OrcCompiler *compiler, int offset, int update)
+{
+  int j;
+  int k;
+  OrcInstruction *insn;
+
+  for(j=0;j<compiler->n_insns;j++){
+    insn = compiler->insn_table + j;
+
+    compiler->insn_index = j;
+
+    if (insn->flags & ORC_INSN_FLAG_INVARIANT) continue;
+
+    ORC_ASM_CODE(compiler,"# %d: %s\n", j, insn->opcode->name);
+
+    compiler->min_temp_reg = ORC_VEC_REG_BASE;
+
+    compiler->insn_shift = compiler->loop_shift;
+    if (insn->flags & ORC_INSTRUCTION_FLAG_X2) {
+      compiler->insn_shift += 1;
+    }
+    if (insn->flags & ORC_INSTRUCTION_FLAG_X4) {
+      compiler->insn_shift += 2;
+    }
+
+    orc_avx_emit_insn (compiler, insn);
+  }
+
+  if (update) {
+    for(k=0;k<ORC_N_COMPILER_VARIABLES;k++){
+      OrcVariable *var = compiler->vars + k;
+
+      if (var->name == NULL) continue;
+      if (var->vartype == ORC_VAR_TYPE_SRC ||
+          var->vartype == ORC_VAR_TYPE_DEST) {
+        int offset;
+        if (var->update_type == 0) {
+          offset = 0;
+        } else if (var->update_type == 1) {
+          offset = (var->size * update) >> 1;
+        } else {
+          offset = var->size * update;
+        }
+
+        if (offset != 0) {
+          if (compiler->vars[k].ptr_register) {
+            orc_x86_emit_add_imm_reg (compiler, compiler->is_64bit ? 8 : 4,
+                offset,
+                compiler->vars[k].ptr_register, FALSE);
+          } else {
+            orc_x86_emit_add_imm_memoffset (compiler, compiler->is_64bit ? 8 : 4,
+                offset,
+                (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[k]),
+                compiler->exec_reg);
+          }
+        }
+      }
+    }
+  }
+}
+
+void
+orc_avx_emit_invariants (OrcCompiler *compiler)
+{
+  int j;
+  OrcInstruction *insn;
+
+  for(j=0;j<compiler->n_insns;j++){
+    insn = compiler->insn_table + j;
+
+    if (!(insn->flags & ORC_INSN_FLAG_INVARIANT)) continue;
+
+    ORC_ASM_CODE(compiler,"# %d: %s\n", j, insn->opcode->name);
+
+    compiler->insn_index = j;
+    compiler->min_temp_reg = ORC_VEC_REG_BASE;
+
+    compiler->insn_shift = compiler->loop_shift;
+    if (insn->flags & ORC_INSTRUCTION_FLAG_X2) {
+      compiler->insn_shift += 1;
+    }
+    if (insn->flags & ORC_INSTRUCTION_FLAG_X4) {
+      compiler->insn_shift += 2;
+    }
+
+    orc_avx_emit_insn (compiler, insn);
+  }
+}
+
@@ -342,7 +342,7 @@ orc_compiler_c_assemble (OrcCompiler *compiler)
 
   ORC_ASM_CODE(compiler,"\n");
   for(j=0;j<compiler->n_insns;j++){
-    insn = compiler->insns + j;
+    insn = compiler->insn_table + j;
     opcode = insn->opcode;
 
     if (!(insn->flags & ORC_INSN_FLAG_INVARIANT)) continue;
@@ -380,7 +380,7 @@ orc_compiler_c_assemble (OrcCompiler *compiler)
 
   /* Emit instructions */
   for(j=0;j<compiler->n_insns;j++){
-    insn = compiler->insns + j;
+    insn = compiler->insn_table + j;
     opcode = insn->opcode;
 
     if (insn->flags & ORC_INSN_FLAG_INVARIANT) continue;
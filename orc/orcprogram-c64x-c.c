@@ -468,7 +468,7 @@ emit_loop (OrcCompiler *compiler, int prefix)
   OrcRule *rule;
 
   for(j=0;j<compiler->n_insns;j++){
-    insn = compiler->insns + j;
+    insn = compiler->insn_table + j;
     opcode = insn->opcode;
 
     ORC_ASM_CODE(compiler,"%*s    /* %d: %s */\n", prefix, "",
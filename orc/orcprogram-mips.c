@@ -157,7 +157,7 @@ orc_compiler_orc_mips_init (OrcCompiler *compiler)
   compiler->unroll_index = 0;
 
   for(i=0;i<compiler->n_insns;i++){
-    OrcInstruction *insn = compiler->insns + i;
+    OrcInstruction *insn = compiler->insn_table + i;
     OrcStaticOpcode *opcode = insn->opcode;
 
     if ((strcmp (opcode->name, "loadupib") == 0)
@@ -286,7 +286,7 @@ orc_mips_load_constants_inner (OrcCompiler *compiler)
 
 
   for(i=0;i<compiler->n_insns;i++){
-    OrcInstruction *insn = compiler->insns + i;
+    OrcInstruction *insn = compiler->insn_table + i;
     OrcStaticOpcode *opcode = insn->opcode;
     OrcRule *rule;
 
@@ -381,8 +381,8 @@ can_raise (OrcCompiler *compiler, int *indexes, int i)
   if (i==0)
     return FALSE;
 
-  insn = compiler->insns + indexes[i];
-  previous_insn = compiler->insns + indexes[i-1];
+  insn = compiler->insn_table + indexes[i];
+  previous_insn = compiler->insn_table + indexes[i-1];
 
   /* Register where the load operation will put the data */
   reg = compiler->vars[insn->dest_args[0]].alloc;
@@ -411,7 +411,7 @@ optimise_order (OrcCompiler *compiler, int *indexes)
 {
   int i;
   for (i=0; i<compiler->n_insns; i++) {
-    OrcInstruction *insn = compiler->insns + indexes[i];
+    OrcInstruction *insn = compiler->insn_table + indexes[i];
     if (insn->opcode->flags & ORC_STATIC_OPCODE_LOAD)
       try_raise (compiler, indexes, i);
   }
@@ -462,7 +462,7 @@ orc_mips_emit_loop (OrcCompiler *compiler, int unroll)
   for (j=0; j<iteration_per_loop; j++) {
     compiler->unroll_index = j;
     for (i=0; i<compiler->n_insns; i++) {
-      insn = compiler->insns + insn_idx[i];
+      insn = compiler->insn_table + insn_idx[i];
       opcode = insn->opcode;
       if (insn->flags & ORC_INSN_FLAG_INVARIANT) continue;
 
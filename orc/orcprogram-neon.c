@@ -296,7 +296,7 @@ orc_neon_load_constants_outer (OrcCompiler *compiler)
   }
 
   for(i=0;i<compiler->n_insns;i++){
-    OrcInstruction *insn = compiler->insns + i;
+    OrcInstruction *insn = compiler->insn_table + i;
     OrcStaticOpcode *opcode = insn->opcode;
     OrcRule *rule;
 
@@ -754,7 +754,7 @@ orc_neon_emit_loop (OrcCompiler *compiler, int unroll_index)
   orc_compiler_append_code(compiler,"# LOOP shift %d\n", compiler->loop_shift);
   for(j=0;j<compiler->n_insns;j++){
     compiler->insn_index = j;
-    insn = compiler->insns + j;
+    insn = compiler->insn_table + j;
     opcode = insn->opcode;
 
     if (insn->flags & ORC_INSN_FLAG_INVARIANT) continue;
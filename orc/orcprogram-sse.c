@@ -12,6 +12,8 @@
 #include <orc/orcsse.h>
 #include <orc/orcutils.h>
 #include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
+#include <orc/orccpu.h>
 
 #undef MMX
 #define SIZE 65536
@@ -58,6 +60,9 @@ static OrcTarget sse_target = {
 extern int orc_x86_sse_flags;
 extern int orc_x86_mmx_flags;
 
+static int orc_sse_tiling_disabled;
+static int orc_sse_versions_enabled;
+
 void
 orc_sse_init (void)
 {
@@ -76,11 +81,19 @@ orc_sse_init (void)
     mmx_target.executable = FALSE;
   }
 #endif
+#endif
+#ifdef AVX
+  if (!(orc_x86_sse_flags & ORC_TARGET_SSE_AVX2)) {
+    sse_target.executable = FALSE;
+  }
 #endif
 
   orc_target_register (&sse_target);
 
   orc_compiler_sse_register_rules (&sse_target);
+
+  orc_sse_tiling_disabled = orc_compiler_flag_check ("-tile");
+  orc_sse_versions_enabled = orc_compiler_flag_check ("versions");
 }
 
 unsigned int
@@ -119,7 +132,10 @@ static const char *
 sse_get_flag_name (int shift)
 {
   static const char *flags[] = {
-#ifndef MMX
+#if defined(AVX)
+    "sse2", "sse3", "ssse3", "sse41", "sse42", "sse4a", "sse5",
+    "frame_pointer", "short_jumps", "64bit", "avx", "avx2"
+#elif !defined(MMX)
     "sse2", "sse3", "ssse3", "sse41", "sse42", "sse4a", "sse5",
     "frame_pointer", "short_jumps", "64bit"
 #else
@@ -237,6 +253,9 @@ orc_compiler_sse_init (OrcCompiler *compiler)
 #ifdef MMX
   compiler->loop_shift--;
 #endif
+#ifdef AVX
+  compiler->loop_shift++;
+#endif
 
   /* This limit is arbitrary, but some large functions run slightly
      slower when unrolled (ginger Core2 6,15,6), and only some small
@@ -244,6 +263,12 @@ orc_compiler_sse_init (OrcCompiler *compiler)
   if (compiler->n_insns <= 10) {
     compiler->unroll_shift = 1;
   }
+  /* ORC_CODE=autotune measures instead */
+  if (compiler->is_tuned) {
+    compiler->unroll_shift = compiler->tune_unroll_shift;
+    compiler->loop_shift -= compiler->tune_loop_shift_down;
+    if (compiler->loop_shift < 0) compiler->loop_shift = 0;
+  }
   if (!compiler->long_jumps) {
     compiler->unroll_shift = 0;
   }
@@ -253,10 +278,18 @@ orc_compiler_sse_init (OrcCompiler *compiler)
   }
   compiler->alloc_loop_counter = TRUE;
   compiler->allow_gp_on_stack = TRUE;
+  compiler->allow_spill = TRUE;
+#if defined(AVX)
+  compiler->spill_slot_size = 32;
+#elif !defined(MMX)
+  compiler->spill_slot_size = 16;
+#else
+  compiler->spill_slot_size = 8;
+#endif
 
   {
     for(i=0;i<compiler->n_insns;i++){
-      OrcInstruction *insn = compiler->insns + i;
+      OrcInstruction *insn = compiler->insn_table + i;
       OrcStaticOpcode *opcode = insn->opcode;
 
       if (strcmp (opcode->name, "ldreslinb") == 0 ||
@@ -267,6 +300,11 @@ orc_compiler_sse_init (OrcCompiler *compiler)
       }
     }
   }
+
+#ifdef AVX
+  compiler->use_vex = TRUE;
+  orc_avx_use_fallback (compiler);
+#endif
 }
 
 void
@@ -285,6 +323,14 @@ sse_save_accumulators (OrcCompiler *compiler)
         src = var->alloc;
         tmp = orc_compiler_get_temp_reg (compiler);
 
+#ifdef AVX
+        orc_avx_emit_vpermq (compiler, ORC_AVX_SHUF(3,2,3,2), src, tmp);
+        if (var->size == 2) {
+          orc_avx_emit_paddw (compiler, tmp, src);
+        } else {
+          orc_avx_emit_paddd (compiler, tmp, src);
+        }
+#endif
 #ifndef MMX
         orc_sse_emit_pshufd (compiler, ORC_SSE_SHUF(3,2,3,2), src, tmp);
 #else
@@ -366,6 +412,9 @@ orc_sse_load_constant (OrcCompiler *compiler, int reg, int size, orc_uint64 valu
         reg, FALSE);
 #ifndef MMX
     orc_sse_emit_pshufd (compiler, ORC_SSE_SHUF(1,0,1,0), reg, reg);
+#endif
+#ifdef AVX
+    orc_avx_emit_vpermq (compiler, ORC_AVX_SHUF(1,0,1,0), reg, reg);
 #endif
     return;
   }
@@ -432,6 +481,9 @@ orc_sse_load_constant (OrcCompiler *compiler, int reg, int size, orc_uint64 valu
   orc_sse_emit_movd_load_register (compiler, compiler->gp_tmpreg, reg);
 #ifndef MMX
   orc_sse_emit_pshufd (compiler, ORC_SSE_SHUF(0,0,0,0), reg, reg);
+#ifdef AVX
+  orc_avx_emit_vpermq (compiler, ORC_AVX_SHUF(1,0,1,0), reg, reg);
+#endif
 #else
   orc_mmx_emit_pshufw (compiler, ORC_MMX_SHUF(1,0,1,0), reg, reg);
 #endif
@@ -458,6 +510,9 @@ sse_load_constant_long (OrcCompiler *compiler, int reg,
   }
   orc_x86_emit_mov_memoffset_sse (compiler, 16, offset, compiler->exec_reg,
       reg, FALSE);
+#ifdef AVX
+  orc_avx_emit_vpermq (compiler, ORC_AVX_SHUF(1,0,1,0), reg, reg);
+#endif
 
 }
 
@@ -491,25 +546,25 @@ sse_load_constants_outer (OrcCompiler *compiler)
 
   /* FIXME move to a better place */
   for(i=0;i<compiler->n_constants;i++){
-    compiler->constants[i].alloc_reg =
+    compiler->constant_table[i].alloc_reg =
       orc_compiler_get_constant_reg (compiler);
   }
 
   for(i=0;i<compiler->n_constants;i++){
-    if (compiler->constants[i].alloc_reg) {
-      if (compiler->constants[i].is_long) {
-        sse_load_constant_long (compiler, compiler->constants[i].alloc_reg,
-            compiler->constants + i);
+    if (compiler->constant_table[i].alloc_reg) {
+      if (compiler->constant_table[i].is_long) {
+        sse_load_constant_long (compiler, compiler->constant_table[i].alloc_reg,
+            compiler->constant_table + i);
       } else {
-        sse_load_constant (compiler, compiler->constants[i].alloc_reg,
-            4, compiler->constants[i].value);
+        sse_load_constant (compiler, compiler->constant_table[i].alloc_reg,
+            4, compiler->constant_table[i].value);
       }
     }
   }
 
   {
     for(i=0;i<compiler->n_insns;i++){
-      OrcInstruction *insn = compiler->insns + i;
+      OrcInstruction *insn = compiler->insn_table + i;
       OrcStaticOpcode *opcode = insn->opcode;
 
       if (strcmp (opcode->name, "ldreslinb") == 0 ||
@@ -597,13 +652,21 @@ sse_add_strides (OrcCompiler *compiler)
   }
 }
 
+#if defined(AVX)
+#define SSE_VECTOR_SIZE 32
+#elif !defined(MMX)
+#define SSE_VECTOR_SIZE 16
+#else
+#define SSE_VECTOR_SIZE 8
+#endif
+
 static int
 get_align_var (OrcCompiler *compiler)
 {
   int i;
   for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
     if (compiler->vars[i].size == 0) continue;
-    if ((compiler->vars[i].size << compiler->loop_shift) >= 16) {
+    if ((compiler->vars[i].size << compiler->loop_shift) >= SSE_VECTOR_SIZE) {
       return i;
     }
   }
@@ -643,7 +706,7 @@ get_shift (int size)
 
 
 static void
-orc_emit_split_3_regions (OrcCompiler *compiler)
+orc_emit_split_3_regions (OrcCompiler *compiler, int n_offset)
 {
   int align_var;
   int align_shift;
@@ -656,7 +719,7 @@ orc_emit_split_3_regions (OrcCompiler *compiler)
   align_shift = var_size_shift + compiler->loop_shift;
 
   /* determine how many iterations until align array is aligned (n1) */
-  orc_x86_emit_mov_imm_reg (compiler, 4, 16, X86_EAX);
+  orc_x86_emit_mov_imm_reg (compiler, 4, SSE_VECTOR_SIZE, X86_EAX);
   orc_x86_emit_sub_memoffset_reg (compiler, 4,
       (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[align_var]),
       compiler->exec_reg, X86_EAX);
@@ -664,8 +727,8 @@ orc_emit_split_3_regions (OrcCompiler *compiler)
   orc_x86_emit_sar_imm_reg (compiler, 4, var_size_shift, X86_EAX);
 
   /* check if n1 is greater than n. */
-  orc_x86_emit_cmp_reg_memoffset (compiler, 4, X86_EAX,
-      (int)ORC_STRUCT_OFFSET(OrcExecutor,n), compiler->exec_reg);
+  orc_x86_emit_cmp_reg_memoffset (compiler, 4, X86_EAX, n_offset,
+      compiler->exec_reg);
 
   orc_x86_emit_jle (compiler, 6);
 
@@ -674,8 +737,7 @@ orc_emit_split_3_regions (OrcCompiler *compiler)
       (int)ORC_STRUCT_OFFSET(OrcExecutor,counter1), compiler->exec_reg);
     
   /* Calculate n2 */
-  orc_x86_emit_mov_memoffset_reg (compiler, 4,
-      (int)ORC_STRUCT_OFFSET(OrcExecutor,n), compiler->exec_reg,
+  orc_x86_emit_mov_memoffset_reg (compiler, 4, n_offset, compiler->exec_reg,
       compiler->gp_tmpreg);
   orc_x86_emit_sub_reg_reg (compiler, 4, X86_EAX, compiler->gp_tmpreg);
 
@@ -698,8 +760,8 @@ orc_emit_split_3_regions (OrcCompiler *compiler)
   /* else, iterations are all unaligned: n1=n, n2=0, n3=0 */
   orc_x86_emit_label (compiler, 6);
 
-  orc_x86_emit_mov_memoffset_reg (compiler, 4,
-      (int)ORC_STRUCT_OFFSET(OrcExecutor,n), compiler->exec_reg, X86_EAX);
+  orc_x86_emit_mov_memoffset_reg (compiler, 4, n_offset, compiler->exec_reg,
+      X86_EAX);
   orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
       (int)ORC_STRUCT_OFFSET(OrcExecutor,counter1), compiler->exec_reg);
   orc_x86_emit_mov_imm_reg (compiler, 4, 0, X86_EAX);
@@ -712,7 +774,7 @@ orc_emit_split_3_regions (OrcCompiler *compiler)
 }
 
 static void
-orc_emit_split_2_regions (OrcCompiler *compiler)
+orc_emit_split_2_regions (OrcCompiler *compiler, int n_offset)
 {
   int align_var;
   int align_shift ORC_GNUC_UNUSED;
@@ -725,8 +787,7 @@ orc_emit_split_2_regions (OrcCompiler *compiler)
   align_shift = var_size_shift + compiler->loop_shift;
 
   /* Calculate n2 */
-  orc_x86_emit_mov_memoffset_reg (compiler, 4,
-      (int)ORC_STRUCT_OFFSET(OrcExecutor,n), compiler->exec_reg,
+  orc_x86_emit_mov_memoffset_reg (compiler, 4, n_offset, compiler->exec_reg,
       compiler->gp_tmpreg);
   orc_x86_emit_mov_reg_reg (compiler, 4, compiler->gp_tmpreg, X86_EAX);
   orc_x86_emit_sar_imm_reg (compiler, 4,
@@ -748,7 +809,7 @@ orc_program_has_float (OrcCompiler *compiler)
 {
   int j;
   for(j=0;j<compiler->n_insns;j++){
-    OrcInstruction *insn = compiler->insns + j;
+    OrcInstruction *insn = compiler->insn_table + j;
     OrcStaticOpcode *opcode = insn->opcode;
     if (opcode->flags & ORC_STATIC_OPCODE_FLOAT) return TRUE;
   }
@@ -756,14 +817,383 @@ orc_program_has_float (OrcCompiler *compiler)
 }
 #endif
 
+/* The labels have to fit in ORC_N_LABELS.  The steps go up to a loop
+ * shift of 5, so LABEL_STEP_DOWN() uses 8 to 13 and LABEL_STEP_UP() 14
+ * to 18.  6 and 7 are used by orc_emit_split_3_regions(). */
 #define LABEL_REGION1_SKIP 1
 #define LABEL_INNER_LOOP_START 2
 #define LABEL_REGION2_SKIP 3
 #define LABEL_OUTER_LOOP 4
 #define LABEL_OUTER_LOOP_SKIP 5
 #define LABEL_STEP_DOWN(x) (8+(x))
-#define LABEL_STEP_UP(x) (13+(x))
+#define LABEL_STEP_UP(x) (14+(x))
+#define LABEL_TILE_LOOP 22
+#define LABEL_TILE_LAST 23
+#define LABEL_VERSIONS_END 24
+#define LABEL_VERSION_ALIGNED 25
+#define LABEL_VERSION_SHORT 37
+/* added to the region labels for the loop of the aligned version, which
+ * has no first region, so it uses 19 to 21 and 26 to 31, and to
+ * LABEL_STEP_DOWN() for the short version, which uses 32 to 36 */
+#define LABELS_ALIGNED 18
+#define LABELS_SHORT 24
+
+/* 2D programs that read more than one source array can run over the
+ * frame in column strips, each strip from the top row to the bottom
+ * row.  The sources are often neighbouring rows of the same picture,
+ * and when a strip is narrow enough for its rows to stay in the L2
+ * cache, the next row finds them there instead of in memory.  The
+ * strips are sized for L2 and not L1: narrow strips start a new page
+ * on every row, which costs more in lost hardware prefetching than L1
+ * hits save.  Rows that already fit are run as one strip.  Returns the
+ * strip width in elements, or 0 to run over whole rows. */
+static int
+sse_get_tile_width (OrcCompiler *compiler)
+{
+  int level2;
+  int row_size = 0;
+  int n_src = 0;
+  int width;
+  int i;
+
+  if (orc_sse_tiling_disabled) return 0;
+  if (!compiler->program->is_2d || compiler->program->constant_m > 0 ||
+      compiler->program->constant_n > 0) return 0;
+  /* upsampling and resampling sources don't move with the strip */
+  if (compiler->has_iterator_opcode) return 0;
+
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    if (compiler->vars[i].size == 0) continue;
+    if (compiler->vars[i].need_offset_reg) return 0;
+    if (compiler->vars[i].vartype == ORC_VAR_TYPE_SRC) n_src++;
+    row_size += compiler->vars[i].size;
+  }
+  if (n_src < 2) return 0;
+
+  orc_get_data_cache_sizes (NULL, &level2, NULL);
+  /* a multiple of 64 keeps the alignment of every array */
+  width = (level2 / 2 / row_size) & ~63;
+  if (width < 256) return 0;
+
+  return width;
+}
+
+/* The columns that are left are kept in params[ORC_VAR_C2] and the
+ * width of the current strip, which is the n of its rows, in
+ * params[ORC_VAR_C3].  Leaves m in EAX, like the code before it. */
+static void
+sse_emit_tile_start (OrcCompiler *compiler, int tile_width)
+{
+  orc_x86_emit_mov_memoffset_reg (compiler, 4,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,n), compiler->exec_reg,
+      compiler->gp_tmpreg);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C2]),
+      compiler->exec_reg);
+
+  orc_x86_emit_label (compiler, LABEL_TILE_LOOP);
+  orc_x86_emit_mov_memoffset_reg (compiler, 4,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C2]),
+      compiler->exec_reg, compiler->gp_tmpreg);
+  orc_x86_emit_cmp_imm_reg (compiler, 4, tile_width, compiler->gp_tmpreg);
+  orc_x86_emit_jle (compiler, LABEL_TILE_LAST);
+  orc_x86_emit_mov_imm_reg (compiler, 4, tile_width, compiler->gp_tmpreg);
+  orc_x86_emit_label (compiler, LABEL_TILE_LAST);
+  orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C3]),
+      compiler->exec_reg);
+  orc_x86_emit_sub_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C2]),
+      compiler->exec_reg);
+
+  /* m, for the row counter */
+  orc_x86_emit_mov_memoffset_reg (compiler, 4,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_A1]),
+      compiler->exec_reg, X86_EAX);
+}
+
+/* Moves the arrays from the bottom of the strip back up to the top of
+ * the next one.  This undoes sse_add_strides() the same way it was
+ * done, on the low half of the pointers. */
+static void
+sse_emit_tile_end (OrcCompiler *compiler, int tile_width)
+{
+  int i;
+
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    if (compiler->vars[i].size == 0) continue;
+
+    orc_x86_emit_mov_memoffset_reg (compiler, 4,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, params[i]), compiler->exec_reg,
+        compiler->gp_tmpreg);
+    orc_x86_emit_imul_memoffset_reg (compiler, 4,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_A1]),
+        compiler->exec_reg, compiler->gp_tmpreg);
+    orc_x86_emit_sub_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg);
+    orc_x86_emit_add_imm_memoffset (compiler, compiler->is_64bit ? 8 : 4,
+        tile_width * compiler->vars[i].size,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg);
+  }
+
+  orc_x86_emit_cmp_imm_memoffset (compiler, 4, 0,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C2]),
+      compiler->exec_reg);
+  orc_x86_emit_jne (compiler, LABEL_TILE_LOOP);
+}
+
+
+/* The loop over a length that isn't known when compiling, in up to
+ * three regions: smaller steps until the alignment variable is
+ * aligned, the unrolled loop over whole vectors, and smaller steps
+ * for what is left.  The counters are set up by one of the split
+ * functions.  label_base is added to the labels, so that the regions
+ * can be emitted more than once. */
+static void
+sse_emit_regions (OrcCompiler *compiler, int align_var, int emit_region1,
+    int label_base)
+{
+  int ui, ui_max;
+  int emit_region3 = TRUE;
+
+  if (compiler->loop_shift == 0) {
+    emit_region1 = FALSE;
+    emit_region3 = FALSE;
+  }
+
+  if (emit_region1) {
+    int save_loop_shift;
+    int l;
+
+    save_loop_shift = compiler->loop_shift;
+    compiler->vars[align_var].is_aligned = FALSE;
+
+    for (l=0;l<save_loop_shift;l++){
+      compiler->loop_shift = l;
+      ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
+
+      orc_x86_emit_test_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor,counter1), compiler->exec_reg);
+      orc_x86_emit_je (compiler,
+          label_base + LABEL_STEP_UP(compiler->loop_shift));
+      orc_sse_emit_loop (compiler, 0, 1<<compiler->loop_shift);
+      orc_x86_emit_label (compiler,
+          label_base + LABEL_STEP_UP(compiler->loop_shift));
+    }
+
+    compiler->loop_shift = save_loop_shift;
+    compiler->vars[align_var].is_aligned = TRUE;
+  }
+
+  orc_x86_emit_label (compiler, label_base + LABEL_REGION1_SKIP);
+
+  orc_x86_emit_cmp_imm_memoffset (compiler, 4, 0,
+      (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2), compiler->exec_reg);
+  orc_x86_emit_je (compiler, label_base + LABEL_REGION2_SKIP);
+
+  if (compiler->loop_counter != ORC_REG_INVALID) {
+    orc_x86_emit_mov_memoffset_reg (compiler, 4,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor, counter2), compiler->exec_reg,
+        compiler->loop_counter);
+  }
+
+  ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
+  orc_x86_emit_align (compiler, 4);
+  orc_x86_emit_label (compiler, label_base + LABEL_INNER_LOOP_START);
+  ui_max = 1<<compiler->unroll_shift;
+  for(ui=0;ui<ui_max;ui++) {
+    compiler->offset = ui<<compiler->loop_shift;
+    orc_sse_emit_loop (compiler, compiler->offset,
+        (ui==ui_max-1) << (compiler->loop_shift + compiler->unroll_shift));
+  }
+  compiler->offset = 0;
+  if (compiler->loop_counter != ORC_REG_INVALID) {
+    orc_x86_emit_add_imm_reg (compiler, 4, -1, compiler->loop_counter, TRUE);
+  } else {
+    orc_x86_emit_dec_memoffset (compiler, 4,
+        (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2),
+        compiler->exec_reg);
+  }
+  orc_x86_emit_jne (compiler, label_base + LABEL_INNER_LOOP_START);
+  orc_x86_emit_label (compiler, label_base + LABEL_REGION2_SKIP);
+
+  if (emit_region3) {
+    int save_loop_shift;
+    int l;
+
+    /* the versions after this one need the loop shift back */
+    save_loop_shift = compiler->loop_shift;
+    compiler->vars[align_var].is_aligned = FALSE;
+
+    for(l=save_loop_shift + compiler->unroll_shift - 1; l >= 0; l--) {
+      compiler->loop_shift = l;
+      ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
+
+      orc_x86_emit_test_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor,counter3), compiler->exec_reg);
+      orc_x86_emit_je (compiler,
+          label_base + LABEL_STEP_DOWN(compiler->loop_shift));
+      orc_sse_emit_loop (compiler, 0, 1<<compiler->loop_shift);
+      orc_x86_emit_label (compiler,
+          label_base + LABEL_STEP_DOWN(compiler->loop_shift));
+    }
+
+    compiler->loop_shift = save_loop_shift;
+  }
+}
+
+/* Versions of the loop picked by n and the alignment of the arrays,
+ * once per call: a general one, which is the loop above, one for
+ * arrays that are all aligned, which skips the first region and uses
+ * aligned loads and stores for all of them, and one for n below the
+ * vector width, which goes straight to the smaller steps.  Only used
+ * for 1D programs with a variable n, where the loop would otherwise
+ * be split in three regions, and only with ORC_CODE=versions: the code
+ * gets about half again as large, and no win has been measured yet. */
+static int
+sse_use_versions (OrcCompiler *compiler, int is_aligned)
+{
+  if (!orc_sse_versions_enabled) return FALSE;
+  /* the jumps between the versions can be far */
+  if (!compiler->long_jumps) return FALSE;
+  if (compiler->program->is_2d || compiler->program->constant_n > 0) {
+    return FALSE;
+  }
+  if (compiler->loop_shift == 0 || compiler->has_iterator_opcode ||
+      is_aligned) {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Arrays that stay aligned over the whole loop when they start
+ * aligned: those that move one full vector per iteration, and are
+ * only used by plain loads and stores, not at an offset.  This only
+ * looks at the instructions, so that it gives the same answer before
+ * and after the loop is emitted. */
+static int
+sse_var_can_align (OrcCompiler *compiler, int var)
+{
+  int used = FALSE;
+  int j;
+
+  if (compiler->vars[var].size == 0) return FALSE;
+  if ((compiler->vars[var].size << compiler->loop_shift) != SSE_VECTOR_SIZE) {
+    return FALSE;
+  }
+  if (compiler->vars[var].need_offset_reg) return FALSE;
+  for(j=0;j<compiler->n_insns;j++){
+    OrcInstruction *insn = compiler->insn_table + j;
+    const char *name = insn->opcode->name;
+
+    if (insn->src_args[0] == var &&
+        (insn->opcode->flags & ORC_STATIC_OPCODE_LOAD)) {
+      if (strcmp (name, "loadb") != 0 && strcmp (name, "loadw") != 0 &&
+          strcmp (name, "loadl") != 0 && strcmp (name, "loadq") != 0) {
+        return FALSE;
+      }
+      used = TRUE;
+    }
+    if (insn->dest_args[0] == var &&
+        (insn->opcode->flags & ORC_STATIC_OPCODE_STORE)) {
+      if (strcmp (name, "storeb") != 0 && strcmp (name, "storew") != 0 &&
+          strcmp (name, "storel") != 0 && strcmp (name, "storeq") != 0) {
+        return FALSE;
+      }
+      used = TRUE;
+    }
+  }
+  return used;
+}
+
+/* Jumps to the short version if n is below the vector width, and to
+ * the aligned version if the arrays that can be aligned all are. */
+static void
+sse_emit_dispatch (OrcCompiler *compiler, int n_offset)
+{
+  int n_aligned = 0;
+  int i;
+
+  orc_x86_emit_cmp_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
+      n_offset, compiler->exec_reg);
+  orc_x86_emit_jl (compiler, LABEL_VERSION_SHORT);
+
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    if (!sse_var_can_align (compiler, i)) continue;
 
+    /* the low bits of the pointers are enough */
+    if (n_aligned == 0) {
+      orc_x86_emit_mov_memoffset_reg (compiler, 4,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg,
+          compiler->gp_tmpreg);
+    } else {
+      orc_x86_emit_or_memoffset_reg (compiler, 4,
+          (int)ORC_STRUCT_OFFSET(OrcExecutor, arrays[i]), compiler->exec_reg,
+          compiler->gp_tmpreg);
+    }
+    n_aligned++;
+  }
+  if (n_aligned > 0) {
+    orc_x86_emit_and_imm_reg (compiler, 4, SSE_VECTOR_SIZE - 1,
+        compiler->gp_tmpreg);
+    orc_x86_emit_je (compiler, LABEL_VERSION_ALIGNED);
+  }
+}
+
+/* The aligned and short versions, after the general one */
+static void
+sse_emit_versions (OrcCompiler *compiler, int align_var, int n_offset)
+{
+  int save_aligned[ORC_VAR_S8 + 1];
+  int save_loop_shift;
+  int n_aligned = 0;
+  int l;
+  int i;
+
+  orc_x86_emit_jmp (compiler, LABEL_VERSIONS_END);
+
+  for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+    save_aligned[i] = compiler->vars[i].is_aligned;
+    if (sse_var_can_align (compiler, i)) n_aligned++;
+  }
+  if (n_aligned > 0) {
+    ORC_ASM_CODE(compiler, "# aligned arrays\n");
+    orc_x86_emit_label (compiler, LABEL_VERSION_ALIGNED);
+    orc_emit_split_2_regions (compiler, n_offset);
+    sse_load_constants_inner (compiler);
+    for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+      if (sse_var_can_align (compiler, i)) {
+        compiler->vars[i].is_aligned = TRUE;
+      }
+    }
+    sse_emit_regions (compiler, align_var, FALSE, LABELS_ALIGNED);
+    for(i=ORC_VAR_D1;i<=ORC_VAR_S8;i++){
+      compiler->vars[i].is_aligned = save_aligned[i];
+    }
+    orc_x86_emit_jmp (compiler, LABEL_VERSIONS_END);
+  }
+
+  /* n has no bits above these, so they can test it directly */
+  ORC_ASM_CODE(compiler, "# short n\n");
+  orc_x86_emit_label (compiler, LABEL_VERSION_SHORT);
+  sse_load_constants_inner (compiler);
+  save_loop_shift = compiler->loop_shift;
+  for(l=save_loop_shift - 1; l >= 0; l--) {
+    compiler->loop_shift = l;
+    ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
+
+    orc_x86_emit_test_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
+        n_offset, compiler->exec_reg);
+    orc_x86_emit_je (compiler,
+        LABELS_SHORT + LABEL_STEP_DOWN(compiler->loop_shift));
+    orc_sse_emit_loop (compiler, 0, 1<<compiler->loop_shift);
+    orc_x86_emit_label (compiler,
+        LABELS_SHORT + LABEL_STEP_DOWN(compiler->loop_shift));
+  }
+  compiler->loop_shift = save_loop_shift;
+
+  orc_x86_emit_label (compiler, LABEL_VERSIONS_END);
+}
 
 void
 orc_compiler_sse_assemble (OrcCompiler *compiler)
@@ -773,6 +1203,9 @@ orc_compiler_sse_assemble (OrcCompiler *compiler)
 #endif
   int align_var;
   int is_aligned;
+  int tile_width;
+  int n_offset;
+  int use_versions;
 
   if (0 && orc_x86_assemble_copy_check (compiler)) {
     /* The rep movs implementation isn't faster most of the time */
@@ -786,20 +1219,28 @@ orc_compiler_sse_assemble (OrcCompiler *compiler)
     return;
   }
   is_aligned = compiler->vars[align_var].is_aligned;
+  use_versions = sse_use_versions (compiler, is_aligned);
 
-  {
-    orc_sse_emit_loop (compiler, 0, 0);
-
-    compiler->codeptr = compiler->code;
-    free (compiler->asm_code);
-    compiler->asm_code = NULL;
-    compiler->asm_code_len = 0;
-    memset (compiler->labels, 0, sizeof (compiler->labels));
-    memset (compiler->labels_int, 0, sizeof (compiler->labels_int));
-    compiler->n_fixups = 0;
-    compiler->n_output_insns = 0;
+  tile_width = sse_get_tile_width (compiler);
+  if (tile_width > 0) {
+    n_offset = (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_C3]);
+  } else {
+    n_offset = (int)ORC_STRUCT_OFFSET(OrcExecutor, n);
   }
 
+  /* Analysis pass: the rules are run once without producing any
+   * output, to find the constants they need and the temporaries they
+   * use, so that the constants can be loaded into registers outside
+   * the loop.  The code is then emitted in a single pass. */
+  compiler->analysis_pass = TRUE;
+  orc_sse_emit_loop (compiler, 0, 0);
+  compiler->analysis_pass = FALSE;
+
+  compiler->codeptr = compiler->code;
+  memset (compiler->labels, 0, sizeof (compiler->labels));
+  memset (compiler->labels_int, 0, sizeof (compiler->labels_int));
+  compiler->n_fixups = 0;
+
   if (compiler->error) return;
 
   orc_x86_emit_prologue (compiler);
@@ -826,6 +1267,9 @@ orc_compiler_sse_assemble (OrcCompiler *compiler)
           compiler->exec_reg, X86_EAX);
       orc_x86_emit_test_reg_reg (compiler, 4, X86_EAX, X86_EAX);
       orc_x86_emit_jle (compiler, LABEL_OUTER_LOOP_SKIP);
+      if (tile_width > 0) {
+        sse_emit_tile_start (compiler, tile_width);
+      }
       orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
           (int)ORC_STRUCT_OFFSET(OrcExecutor, params[ORC_VAR_A2]),
           compiler->exec_reg);
@@ -837,17 +1281,19 @@ orc_compiler_sse_assemble (OrcCompiler *compiler)
   if (compiler->program->constant_n > 0 &&
       compiler->program->constant_n <= ORC_SSE_ALIGNED_DEST_CUTOFF) {
     /* don't need to load n */
+  } else if (use_versions) {
+    sse_emit_dispatch (compiler, n_offset);
+    orc_emit_split_3_regions (compiler, n_offset);
   } else if (compiler->loop_shift > 0) {
     if (compiler->has_iterator_opcode || is_aligned) {
-      orc_emit_split_2_regions (compiler);
+      orc_emit_split_2_regions (compiler, n_offset);
     } else {
       /* split n into three regions, with center region being aligned */
-      orc_emit_split_3_regions (compiler);
+      orc_emit_split_3_regions (compiler, n_offset);
     }
   } else {
     /* loop shift is 0, no need to split */
-    orc_x86_emit_mov_memoffset_reg (compiler, 4,
-        (int)ORC_STRUCT_OFFSET(OrcExecutor,n), compiler->exec_reg,
+    orc_x86_emit_mov_memoffset_reg (compiler, 4, n_offset, compiler->exec_reg,
         compiler->gp_tmpreg);
     orc_x86_emit_mov_reg_memoffset (compiler, 4, compiler->gp_tmpreg,
         (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2), compiler->exec_reg);
@@ -883,91 +1329,15 @@ orc_compiler_sse_assemble (OrcCompiler *compiler)
     compiler->loop_shift = save_loop_shift;
 
   } else {
-    int ui, ui_max;
     int emit_region1 = TRUE;
-    int emit_region3 = TRUE;
 
     if (compiler->has_iterator_opcode || is_aligned) {
       emit_region1 = FALSE;
     }
-    if (compiler->loop_shift == 0) {
-      emit_region1 = FALSE;
-      emit_region3 = FALSE;
-    }
-
-    if (emit_region1) {
-      int save_loop_shift;
-      int l;
-
-      save_loop_shift = compiler->loop_shift;
-      compiler->vars[align_var].is_aligned = FALSE;
-
-      for (l=0;l<save_loop_shift;l++){
-        compiler->loop_shift = l;
-        ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
-
-        orc_x86_emit_test_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
-            (int)ORC_STRUCT_OFFSET(OrcExecutor,counter1), compiler->exec_reg);
-        orc_x86_emit_je (compiler, LABEL_STEP_UP(compiler->loop_shift));
-        orc_sse_emit_loop (compiler, 0, 1<<compiler->loop_shift);
-        orc_x86_emit_label (compiler, LABEL_STEP_UP(compiler->loop_shift));
-      }
-
-      compiler->loop_shift = save_loop_shift;
-      compiler->vars[align_var].is_aligned = TRUE;
-    }
+    sse_emit_regions (compiler, align_var, emit_region1, 0);
 
-    orc_x86_emit_label (compiler, LABEL_REGION1_SKIP);
-
-    orc_x86_emit_cmp_imm_memoffset (compiler, 4, 0,
-        (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2), compiler->exec_reg);
-    orc_x86_emit_je (compiler, LABEL_REGION2_SKIP);
-
-    if (compiler->loop_counter != ORC_REG_INVALID) {
-      orc_x86_emit_mov_memoffset_reg (compiler, 4,
-          (int)ORC_STRUCT_OFFSET(OrcExecutor, counter2), compiler->exec_reg,
-          compiler->loop_counter);
-    }
-
-    ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
-    orc_x86_emit_align (compiler, 4);
-    orc_x86_emit_label (compiler, LABEL_INNER_LOOP_START);
-    ui_max = 1<<compiler->unroll_shift;
-    for(ui=0;ui<ui_max;ui++) {
-      compiler->offset = ui<<compiler->loop_shift;
-      orc_sse_emit_loop (compiler, compiler->offset,
-          (ui==ui_max-1) << (compiler->loop_shift + compiler->unroll_shift));
-    }
-    compiler->offset = 0;
-    if (compiler->loop_counter != ORC_REG_INVALID) {
-      orc_x86_emit_add_imm_reg (compiler, 4, -1, compiler->loop_counter, TRUE);
-    } else {
-      orc_x86_emit_dec_memoffset (compiler, 4,
-          (int)ORC_STRUCT_OFFSET(OrcExecutor,counter2),
-          compiler->exec_reg);
-    }
-    orc_x86_emit_jne (compiler, LABEL_INNER_LOOP_START);
-    orc_x86_emit_label (compiler, LABEL_REGION2_SKIP);
-
-    if (emit_region3) {
-      int save_loop_shift;
-      int l;
-
-      save_loop_shift = compiler->loop_shift + compiler->unroll_shift;
-      compiler->vars[align_var].is_aligned = FALSE;
-
-      for(l=save_loop_shift - 1; l >= 0; l--) {
-        compiler->loop_shift = l;
-        ORC_ASM_CODE(compiler, "# LOOP SHIFT %d\n", compiler->loop_shift);
-
-        orc_x86_emit_test_imm_memoffset (compiler, 4, 1<<compiler->loop_shift,
-            (int)ORC_STRUCT_OFFSET(OrcExecutor,counter3), compiler->exec_reg);
-        orc_x86_emit_je (compiler, LABEL_STEP_DOWN(compiler->loop_shift));
-        orc_sse_emit_loop (compiler, 0, 1<<compiler->loop_shift);
-        orc_x86_emit_label (compiler, LABEL_STEP_DOWN(compiler->loop_shift));
-      }
-
-      compiler->loop_shift = save_loop_shift;
+    if (use_versions) {
+      sse_emit_versions (compiler, align_var, n_offset);
     }
   }
 
@@ -978,6 +1348,9 @@ orc_compiler_sse_assemble (OrcCompiler *compiler)
         (int)ORC_STRUCT_OFFSET(OrcExecutor,params[ORC_VAR_A2]),
         compiler->exec_reg);
     orc_x86_emit_jne (compiler, LABEL_OUTER_LOOP);
+    if (tile_width > 0) {
+      sse_emit_tile_end (compiler, tile_width);
+    }
     orc_x86_emit_label (compiler, LABEL_OUTER_LOOP_SKIP);
   }
 
@@ -989,27 +1362,127 @@ orc_compiler_sse_assemble (OrcCompiler *compiler)
   }
 #else
   orc_x86_emit_emms (compiler);
+#endif
+#ifdef AVX
+  orc_avx_emit_vzeroupper (compiler);
 #endif
   orc_x86_emit_epilogue (compiler);
 
+  _orc_x86_peephole (compiler);
+  _orc_x86_schedule_insns (compiler);
   orc_x86_calculate_offsets (compiler);
   orc_x86_output_insns (compiler);
 
   orc_x86_do_fixups (compiler);
 }
 
+/* Loads the spilled sources of insn into temporary registers, and
+ * gives its spilled destinations one.  The variables keep these
+ * registers until sse_store_spilled(), so the rule sees them as usual
+ * and doesn't get them as temporaries. */
+static int
+sse_load_spilled (OrcCompiler *compiler, OrcInstruction *insn, int *spilled)
+{
+  OrcStaticOpcode *opcode = insn->opcode;
+  OrcVariable *var;
+  int n_spilled = 0;
+  int k;
+
+  for(k=0;k<ORC_STATIC_OPCODE_N_SRC + ORC_STATIC_OPCODE_N_DEST;k++){
+    int is_src = (k < ORC_STATIC_OPCODE_N_SRC);
+    int i;
+
+    if (is_src) {
+      if (opcode->src_size[k] == 0) continue;
+      i = insn->src_args[k];
+    } else {
+      if (opcode->dest_size[k - ORC_STATIC_OPCODE_N_SRC] == 0) continue;
+      i = insn->dest_args[k - ORC_STATIC_OPCODE_N_SRC];
+    }
+    var = compiler->vars + i;
+    if (compiler->spill_slot[i] == 0 || var->alloc) continue;
+
+    var->alloc = orc_compiler_get_temp_reg (compiler);
+    if (compiler->error) break;
+    spilled[n_spilled++] = i;
+    if (is_src) {
+      orc_x86_emit_mov_memoffset_sse (compiler, compiler->spill_slot_size,
+          (compiler->spill_slot[i] - 1) * compiler->spill_slot_size,
+          X86_ESP, var->alloc, TRUE);
+    }
+  }
+
+  return n_spilled;
+}
+
+static void
+sse_store_spilled (OrcCompiler *compiler, OrcInstruction *insn,
+    const int *spilled, int n_spilled)
+{
+  OrcStaticOpcode *opcode = insn->opcode;
+  int k;
+
+  for(k=0;k<ORC_STATIC_OPCODE_N_DEST;k++){
+    int i = insn->dest_args[k];
+
+    if (opcode->dest_size[k] == 0 || compiler->spill_slot[i] == 0) continue;
+    orc_x86_emit_mov_sse_memoffset (compiler, compiler->spill_slot_size,
+        compiler->vars[i].alloc,
+        (compiler->spill_slot[i] - 1) * compiler->spill_slot_size,
+        X86_ESP, TRUE, FALSE);
+  }
+  for(k=0;k<n_spilled;k++){
+    compiler->vars[spilled[k]].alloc = 0;
+  }
+}
+
+/* The rules write the result over the first source, so it is copied
+ * to the destination first if they aren't in the same register */
+static void
+orc_sse_emit_insn (OrcCompiler *compiler, OrcInstruction *insn)
+{
+  OrcRule *rule = insn->rule;
+  int spilled[ORC_STATIC_OPCODE_N_SRC + ORC_STATIC_OPCODE_N_DEST];
+  int n_spilled = 0;
+
+  if (compiler->n_spill_slots > 0) {
+    n_spilled = sse_load_spilled (compiler, insn, spilled);
+  }
+
+  if (rule && rule->emit) {
+    if (!(insn->opcode->flags & (ORC_STATIC_OPCODE_ACCUMULATOR|ORC_STATIC_OPCODE_LOAD|ORC_STATIC_OPCODE_STORE|ORC_STATIC_OPCODE_COPY)) &&
+        compiler->vars[insn->dest_args[0]].alloc !=
+        compiler->vars[insn->src_args[0]].alloc) {
+#ifdef MMX
+      orc_sse_emit_movq (compiler,
+          compiler->vars[insn->src_args[0]].alloc,
+          compiler->vars[insn->dest_args[0]].alloc);
+#else
+      orc_sse_emit_movdqu (compiler,
+          compiler->vars[insn->src_args[0]].alloc,
+          compiler->vars[insn->dest_args[0]].alloc);
+#endif
+    }
+    rule->emit (compiler, rule->emit_user, insn);
+  } else {
+    orc_compiler_error (compiler, "no code generation rule for %s",
+        insn->opcode->name);
+  }
+
+  if (n_spilled > 0) {
+    sse_store_spilled (compiler, insn, spilled, n_spilled);
+  }
+}
+
 void
 orc_sse_emit_loop (OrcCompiler *compiler, int offset, int update)
 {
   int j;
   int k;
   OrcInstruction *insn;
-  OrcStaticOpcode *opcode;
-  OrcRule *rule;
 
   for(j=0;j<compiler->n_insns;j++){
-    insn = compiler->insns + j;
-    opcode = insn->opcode;
+    insn = compiler->insn_table + j;
 
     compiler->insn_index = j;
 
@@ -1027,26 +1500,7 @@ orc_sse_emit_loop (OrcCompiler *compiler, int offset, int update)
       compiler->insn_shift += 2;
     }
 
-    rule = insn->rule;
-    if (rule && rule->emit) {
-      if (!(insn->opcode->flags & (ORC_STATIC_OPCODE_ACCUMULATOR|ORC_STATIC_OPCODE_LOAD|ORC_STATIC_OPCODE_STORE|ORC_STATIC_OPCODE_COPY)) &&
-          compiler->vars[insn->dest_args[0]].alloc !=
-          compiler->vars[insn->src_args[0]].alloc) {
-#ifdef MMX
-        orc_sse_emit_movq (compiler,
-            compiler->vars[insn->src_args[0]].alloc,
-            compiler->vars[insn->dest_args[0]].alloc);
-#else
-        orc_sse_emit_movdqu (compiler,
-            compiler->vars[insn->src_args[0]].alloc,
-            compiler->vars[insn->dest_args[0]].alloc);
-#endif
-      }
-      rule->emit (compiler, rule->emit_user, insn);
-    } else {
-      orc_compiler_error (compiler, "no code generation rule for %s",
-          opcode->name);
-    }
+    orc_sse_emit_insn (compiler, insn);
   }
 
   if (update) {
@@ -1087,17 +1541,17 @@ orc_sse_emit_invariants (OrcCompiler *compiler)
 {
   int j;
   OrcInstruction *insn;
-  OrcStaticOpcode *opcode;
-  OrcRule *rule;
 
   for(j=0;j<compiler->n_insns;j++){
-    insn = compiler->insns + j;
-    opcode = insn->opcode;
+    insn = compiler->insn_table + j;
 
     if (!(insn->flags & ORC_INSN_FLAG_INVARIANT)) continue;
 
     ORC_ASM_CODE(compiler,"# %d: %s\n", j, insn->opcode->name);
 
+    compiler->insn_index = j;
+    compiler->min_temp_reg = ORC_VEC_REG_BASE;
+
     compiler->insn_shift = compiler->loop_shift;
     if (insn->flags & ORC_INSTRUCTION_FLAG_X2) {
       compiler->insn_shift += 1;
@@ -1106,13 +1560,7 @@ orc_sse_emit_invariants (OrcCompiler *compiler)
       compiler->insn_shift += 2;
     }
 
-    rule = insn->rule;
-    if (rule && rule->emit) {
-      rule->emit (compiler, rule->emit_user, insn);
-    } else {
-      orc_compiler_error (compiler, "no code generation rule for %s",
-          opcode->name);
-    }
+    orc_sse_emit_insn (compiler, insn);
   }
 }
 
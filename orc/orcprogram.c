@@ -8,6 +8,7 @@
 
 #include <orc/orcprogram.h>
 #include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
 
 /**
  * SECTION:orcprogram
@@ -33,6 +34,8 @@ orc_program_new (void)
 
   p = malloc(sizeof(OrcProgram));
   memset (p, 0, sizeof(OrcProgram));
+  p->insn_table = p->insns;
+  p->n_insns_alloc = ORC_N_INSNS;
 
   p->name = malloc (40);
   sprintf(p->name, "func_%p", p);
@@ -157,6 +160,9 @@ void
 orc_program_free (OrcProgram *program)
 {
   int i;
+
+  _orc_async_finish (program);
+  _orc_program_free_specializations (program);
   for(i=0;i<ORC_N_VARIABLES;i++){
     if (program->vars[i].name) {
       free (program->vars[i].name);
@@ -191,6 +197,9 @@ orc_program_free (OrcProgram *program)
     free (program->error_msg);
     program->error_msg = NULL;
   }
+  if (program->insn_table != program->insns) {
+    free (program->insn_table);
+  }
   free (program);
 }
 
@@ -746,6 +755,72 @@ orc_program_set_sampling_type (OrcProgram *program, int var,
   /* This doesn't do anything yet */
 }
 
+/* Returns the instruction after the last one, making room for it if
+ * the table is full.  The caller fills it in and increments n_insns. */
+OrcInstruction *
+_orc_program_next_insn (OrcProgram *program)
+{
+  if (program->n_insns >= program->n_insns_alloc) {
+    OrcInstruction *table;
+    int n_alloc = 2 * program->n_insns_alloc;
+
+    table = malloc (sizeof(OrcInstruction) * n_alloc);
+    memcpy (table, program->insn_table,
+        sizeof(OrcInstruction) * program->n_insns);
+    memset (table + program->n_insns, 0,
+        sizeof(OrcInstruction) * (n_alloc - program->n_insns));
+    if (program->insn_table != program->insns) free (program->insn_table);
+    program->insn_table = table;
+    program->n_insns_alloc = n_alloc;
+  }
+
+  return program->insn_table + program->n_insns;
+}
+
+/* Returns a copy of program that owns all of its data.  It doesn't get
+ * the compiled code, the listing, the backup function or the
+ * specializations of program. */
+OrcProgram *
+_orc_program_copy (OrcProgram *program)
+{
+  OrcProgram *p;
+  int i;
+
+  p = orc_program_new ();
+  orc_program_set_name (p, program->name);
+  p->is_2d = program->is_2d;
+  p->constant_n = program->constant_n;
+  p->constant_m = program->constant_m;
+  p->n_multiple = program->n_multiple;
+  p->n_minimum = program->n_minimum;
+  p->n_maximum = program->n_maximum;
+  p->static_assembly = program->static_assembly;
+
+  for(i=0;i<ORC_N_VARIABLES;i++){
+    OrcVariable *var = p->vars + i;
+
+    if (program->vars[i].size == 0) continue;
+    memcpy (var, program->vars + i, sizeof(OrcVariable));
+    if (var->name) var->name = strdup (var->name);
+    if (var->type_name) var->type_name = strdup (var->type_name);
+  }
+  p->n_src_vars = program->n_src_vars;
+  p->n_dest_vars = program->n_dest_vars;
+  p->n_param_vars = program->n_param_vars;
+  p->n_const_vars = program->n_const_vars;
+  p->n_temp_vars = program->n_temp_vars;
+  p->n_accum_vars = program->n_accum_vars;
+
+  for(i=0;i<program->n_insns;i++){
+    OrcInstruction *insn = _orc_program_next_insn (p);
+
+    memcpy (insn, program->insn_table + i, sizeof(OrcInstruction));
+    p->n_insns++;
+  }
+
+  return p;
+}
+
 /**
  * orc_program_append_ds:
  * @program: a pointer to an OrcProgram structure
@@ -762,7 +837,7 @@ orc_program_append_ds (OrcProgram *program, const char *name, int arg0,
 {
   OrcInstruction *insn;
 
-  insn = program->insns + program->n_insns;
+  insn = _orc_program_next_insn (program);
 
   insn->opcode = orc_opcode_find_by_name (name);
   if (!insn->opcode) {
@@ -791,7 +866,7 @@ orc_program_append (OrcProgram *program, const char *name, int arg0,
 {
   OrcInstruction *insn;
 
-  insn = program->insns + program->n_insns;
+  insn = _orc_program_next_insn (program);
 
   insn->opcode = orc_opcode_find_by_name (name);
   if (!insn->opcode) {
@@ -824,7 +899,7 @@ orc_program_append_2 (OrcProgram *program, const char *name, unsigned int flags,
   int args[4];
   int i;
 
-  insn = program->insns + program->n_insns;
+  insn = _orc_program_next_insn (program);
 
   insn->opcode = orc_opcode_find_by_name (name);
   if (!insn->opcode) {
@@ -898,7 +973,7 @@ orc_program_append_str (OrcProgram *program, const char *name,
 {
   OrcInstruction *insn;
 
-  insn = program->insns + program->n_insns;
+  insn = _orc_program_next_insn (program);
 
   insn->opcode = orc_opcode_find_by_name (name);
   if (!insn->opcode) {
@@ -939,7 +1014,7 @@ orc_program_append_str_2 (OrcProgram *program, const char *name,
   int args[4];
   int i;
 
-  insn = program->insns + program->n_insns;
+  insn = _orc_program_next_insn (program);
 
   insn->line = program->current_line;
   insn->opcode = orc_opcode_find_by_name (name);
@@ -986,7 +1061,7 @@ orc_program_append_ds_str (OrcProgram *program, const char *name,
 {
   OrcInstruction *insn;
 
-  insn = program->insns + program->n_insns;
+  insn = _orc_program_next_insn (program);
 
   insn->opcode = orc_opcode_find_by_name (name);
   if (!insn->opcode) {
@@ -1004,7 +1079,7 @@ orc_program_append_dds_str (OrcProgram *program, const char *name,
 {
   OrcInstruction *insn;
 
-  insn = program->insns + program->n_insns;
+  insn = _orc_program_next_insn (program);
 
   insn->opcode = orc_opcode_find_by_name (name);
   if (!insn->opcode) {
@@ -1024,12 +1099,20 @@ orc_program_append_dds_str (OrcProgram *program, const char *name,
  * Returns a character string containing the assembly code created
  * by compiling the program.  This string is valid until the program
  * is compiled again or the program is freed.
+ *
+ * If the "nolisting" flag is set in the ORC_CODE environment variable,
+ * code compiled to run on this machine has no assembly code until the
+ * first call to this function, which compiles the program again to
+ * produce it.  The program's asm_code field is NULL until then.
  * 
  * Returns: a character string
  */
 const char *
 orc_program_get_asm_code (OrcProgram *program)
 {
+  if (program->asm_code == NULL) {
+    _orc_compiler_make_asm_code (program);
+  }
   return program->asm_code;
 }
 
@@ -1167,6 +1250,7 @@ orc_get_cpu_name (void)
 void
 orc_program_reset (OrcProgram *program)
 {
+  _orc_async_finish (program);
   if (program->orccode) {
     orc_code_free (program->orccode);
     program->orccode = NULL;
@@ -1193,7 +1277,10 @@ orc_program_reset_error (OrcProgram *program)
 OrcCode *
 orc_program_take_code (OrcProgram *program)
 {
-  OrcCode *code = program->orccode;
+  OrcCode *code;
+
+  _orc_async_finish (program);
+  code = program->orccode;
   program->orccode = NULL;
   return code;
 }
@@ -97,6 +97,17 @@ struct _OrcProgram {
   char *init_function;
   char *error_msg;
   unsigned int current_line;
+
+  /* set by orc_program_compile_async() */
+  void *compile_job;
+
+  /* The instructions in use.  This is insns until a program has more
+   * than ORC_N_INSNS of them. */
+  OrcInstruction *insn_table;
+  int n_insns_alloc;
+
+  /* set by orc_program_specialize() */
+  void *specializations;
 };
 
 #define ORC_SRC_ARG(p,i,n) ((p)->vars[(i)->src_args[(n)]].alloc)
@@ -145,6 +156,16 @@ OrcCompileResult orc_program_compile (OrcProgram *p);
 OrcCompileResult orc_program_compile_for_target (OrcProgram *p, OrcTarget *target);
 OrcCompileResult orc_program_compile_full (OrcProgram *p, OrcTarget *target,
     unsigned int flags);
+void orc_program_compile_async (OrcProgram *p);
+OrcCompileResult orc_program_compile_wait (OrcProgram *p);
+orc_bool orc_program_compile_finished (OrcProgram *p);
+void orc_program_compile_many (OrcProgram **programs, int n_programs,
+    OrcCompileResult *results);
+OrcProgram * orc_program_fuse (OrcProgram *producer, OrcProgram *consumer,
+    const char *dest_name, const char *src_name);
+OrcProgram * orc_program_specialize (OrcProgram *program, const int *params,
+    const orc_int64 *values, int n_params);
+void orc_program_unspecialize (OrcProgram *program, OrcProgram *specialized);
 void orc_program_set_backup_function (OrcProgram *p, OrcExecutorFunc func);
 void orc_program_set_backup_name (OrcProgram *p, const char *name);
 void orc_program_free (OrcProgram *program);
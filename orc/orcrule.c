@@ -7,6 +7,7 @@
 
 #include <orc/orcprogram.h>
 #include <orc/orcdebug.h>
+#include <orc/orconce.h>
 
 /**
  * SECTION:orcrule
@@ -31,7 +32,10 @@ orc_rule_register (OrcRuleSet *rule_set,
     return;
   }
 
-  rule_set->rules[i].emit = emit;
+  /* emit is set last, since a non-NULL emit makes the rule visible to
+   * orc_target_get_rule() in other threads */
   rule_set->rules[i].emit_user = emit_user;
+  orc_atomic_pointer_set ((void * volatile *)&rule_set->rules[i].emit,
+      (void *)emit);
 }
 
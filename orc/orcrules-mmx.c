@@ -1692,14 +1692,12 @@ mmx_rule_select0ql (OrcCompiler *p, void *user, OrcInstruction *insn)
 static void
 mmx_rule_select1ql (OrcCompiler *p, void *user, OrcInstruction *insn)
 {
-  int src = p->vars[insn->src_args[0]].alloc;
+  /* int src = p->vars[insn->src_args[0]].alloc; */
   int dest = p->vars[insn->dest_args[0]].alloc;
 
   orc_mmx_emit_psrlq_imm (p, 32, dest);
 #ifndef MMX
-  orc_mmx_emit_pshufd (p, ORC_MMX_SHUF(2,0,2,0), src, dest);
-#else
-  orc_mmx_emit_movq (p, src, dest);
+  orc_mmx_emit_pshufd (p, ORC_MMX_SHUF(2,0,2,0), dest, dest);
 #endif
 }
 
@@ -1937,7 +1935,7 @@ mmx_rule_swapwl_ssse3 (OrcCompiler *p, void *user, OrcInstruction *insn)
   if (tmp != ORC_REG_INVALID) {
     orc_mmx_emit_pshufb (p, tmp, dest);
   } else {
-    mmx_rule_swapl (p, user, insn);
+    mmx_rule_swapwl (p, user, insn);
   }
 }
 
@@ -2390,20 +2388,22 @@ mmx_rule_subusl_slow (OrcCompiler *p, void *user, OrcInstruction *insn)
   int tmp = orc_compiler_get_temp_reg (p);
   int tmp2 = orc_compiler_get_temp_reg (p);
 
-  orc_mmx_emit_movq (p, src, tmp2);
+  /* the carry out of ~dest + src, as in addusl, is the borrow */
+  orc_mmx_emit_pcmpeqd (p, tmp, tmp);
+  orc_mmx_emit_pxor (p, dest, tmp);
+  orc_mmx_emit_movq (p, tmp, tmp2);
+  orc_mmx_emit_pand (p, src, tmp);
+  orc_mmx_emit_pxor (p, src, tmp2);
   orc_mmx_emit_psrld_imm (p, 1, tmp2);
+  orc_mmx_emit_paddd (p, tmp2, tmp);
 
-  orc_mmx_emit_movq (p, dest, tmp);
-  orc_mmx_emit_psrld_imm (p, 1, tmp);
-  orc_mmx_emit_psubd (p, tmp, tmp2);
-
-  /* turn overflow bit into mask */
-  orc_mmx_emit_psrad_imm (p, 31, tmp2);
+  /* turn the borrow bit into mask */
+  orc_mmx_emit_psrad_imm (p, 31, tmp);
 
-  /* compute the difference, then and over the mask */
+  /* compute the difference, then clear it where it borrowed */
   orc_mmx_emit_psubd (p, src, dest);
-  orc_mmx_emit_pand (p, tmp2, dest);
-
+  orc_mmx_emit_pandn (p, dest, tmp);
+  orc_mmx_emit_movq (p, tmp, dest);
 }
 
 #ifndef MMX
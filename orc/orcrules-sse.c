@@ -14,6 +14,42 @@
 #undef MMX
 #define SIZE 65536
 
+/* Width of a vector register, for instructions emitted directly */
+#ifdef AVX
+#define SSE_REG_SIZE 32
+#else
+#define SSE_REG_SIZE 16
+#endif
+
+#ifdef AVX
+/* The 256-bit unpacks and packs work on each 128-bit lane separately.
+ * Before an unpack, this moves the second quarter of reg to the upper
+ * lane, and after a pack, it moves the upper lane's half back, so the
+ * elements stay in order.  size is the size of the wider elements.
+ * Nothing is needed when they fit in the lower lane. */
+static void
+avx_fix_lanes (OrcCompiler *p, int size, int reg)
+{
+  if ((size << p->insn_shift) > 16) {
+    orc_avx_emit_vpermq (p, ORC_AVX_SHUF(3,1,2,0), reg, reg);
+  }
+}
+
+/* Same, for a source that has to be kept.  Returns the register with
+ * the moved copy. */
+static int
+avx_fix_lanes_src (OrcCompiler *p, int size, int reg)
+{
+  int tmp;
+
+  if ((size << p->insn_shift) <= 16) return reg;
+
+  tmp = orc_compiler_get_temp_reg (p);
+  orc_avx_emit_vpermq (p, ORC_AVX_SHUF(3,1,2,0), reg, tmp);
+  return tmp;
+}
+#endif
+
 /* sse rules */
 
 static void
@@ -77,6 +113,9 @@ sse_rule_loadpX (OrcCompiler *compiler, void *user, OrcInstruction *insn)
 #endif
       }
     }
+#ifdef AVX
+    orc_avx_emit_vpermq (compiler, ORC_AVX_SHUF(1,0,1,0), reg, reg);
+#endif
   } else if (src->vartype == ORC_VAR_TYPE_CONST) {
     orc_sse_load_constant (compiler, dest->alloc, size, src->value.i);
   } else {
@@ -124,6 +163,12 @@ sse_rule_loadX (OrcCompiler *compiler, void *user, OrcInstruction *insn)
       orc_x86_emit_mov_memoffset_sse (compiler, 16, offset, ptr_reg,
           dest->alloc, src->is_aligned);
       break;
+#ifdef AVX
+    case 32:
+      orc_x86_emit_mov_memoffset_sse (compiler, 32, offset, ptr_reg,
+          dest->alloc, src->is_aligned);
+      break;
+#endif
     default:
       orc_compiler_error (compiler, "bad load size %d",
           src->size << compiler->loop_shift);
@@ -180,6 +225,12 @@ sse_rule_loadoffX (OrcCompiler *compiler, void *user, OrcInstruction *insn)
       orc_x86_emit_mov_memoffset_sse (compiler, 16, offset, ptr_reg,
           dest->alloc, src->is_aligned);
       break;
+#ifdef AVX
+    case 32:
+      orc_x86_emit_mov_memoffset_sse (compiler, 32, offset, ptr_reg,
+          dest->alloc, src->is_aligned);
+      break;
+#endif
     default:
       orc_compiler_error (compiler,"bad load size %d",
           src->size << compiler->loop_shift);
@@ -244,6 +295,10 @@ sse_rule_loadupib (OrcCompiler *compiler, void *user, OrcInstruction *insn)
   }
 
   orc_sse_emit_pavgb (compiler, dest->alloc, tmp);
+#ifdef AVX
+  avx_fix_lanes (compiler, 1, dest->alloc);
+  avx_fix_lanes (compiler, 1, tmp);
+#endif
   orc_sse_emit_punpcklbw (compiler, tmp, dest->alloc);
 
   src->update_type = 1;
@@ -294,6 +349,9 @@ sse_rule_loadupdb (OrcCompiler *compiler, void *user, OrcInstruction *insn)
           src->size << compiler->loop_shift);
       break;
   }
+#ifdef AVX
+  avx_fix_lanes (compiler, src->size, dest->alloc);
+#endif
   switch (src->size) {
     case 1:
       orc_sse_emit_punpcklbw (compiler, dest->alloc, dest->alloc);
@@ -363,6 +421,12 @@ sse_rule_storeX (OrcCompiler *compiler, void *user, OrcInstruction *insn)
       orc_x86_emit_mov_sse_memoffset (compiler, 16, src->alloc, offset, ptr_reg,
           dest->is_aligned, dest->is_uncached);
       break;
+#ifdef AVX
+    case 32:
+      orc_x86_emit_mov_sse_memoffset (compiler, 32, src->alloc, offset, ptr_reg,
+          dest->is_aligned, dest->is_uncached);
+      break;
+#endif
     default:
       orc_compiler_error (compiler, "bad size");
       break;
@@ -424,6 +488,9 @@ sse_rule_ldresnearl (OrcCompiler *compiler, void *user, OrcInstruction *insn)
 }
 #endif
 
+#ifndef AVX
+/* The resampling loads put single elements together with movd and
+ * pinsrw, so they only have 128-bit versions */
 static void
 sse_rule_ldresnearl (OrcCompiler *compiler, void *user, OrcInstruction *insn)
 {
@@ -665,6 +732,7 @@ mmx_rule_ldreslinl (OrcCompiler *compiler, void *user, OrcInstruction *insn)
   src->update_type = 0;
 }
 #endif
+#endif
 
 static void
 sse_rule_copyx (OrcCompiler *p, void *user, OrcInstruction *insn)
@@ -784,6 +852,12 @@ sse_rule_accw (OrcCompiler *p, void *user, OrcInstruction *insn)
   int src = p->vars[insn->src_args[0]].alloc;
   int dest = p->vars[insn->dest_args[0]].alloc;
 
+#ifdef AVX
+  /* the 128-bit move clears the unused upper lane */
+  if ((2<<p->loop_shift) <= 16) {
+    orc_x86_emit_cpuinsn_size (p, ORC_X86_movdqa, 16, src, src);
+  }
+#endif
   orc_sse_emit_paddw (p, src, dest);
 }
 
@@ -797,6 +871,11 @@ sse_rule_accl (OrcCompiler *p, void *user, OrcInstruction *insn)
   if (p->loop_shift == 0) {
     orc_sse_emit_pslldq_imm (p, 12, src);
   }
+#endif
+#ifdef AVX
+  if ((4<<p->loop_shift) <= 16) {
+    orc_x86_emit_cpuinsn_size (p, ORC_X86_movdqa, 16, src, src);
+  }
 #endif
   orc_sse_emit_paddd (p, src, dest);
 }
@@ -836,6 +915,11 @@ sse_rule_accsadubl (OrcCompiler *p, void *user, OrcInstruction *insn)
     orc_sse_emit_movdqa (p, src1, tmp);
     orc_sse_emit_psadbw (p, src2, tmp);
   }
+#endif
+#ifdef AVX
+  if ((1<<p->loop_shift) <= 16) {
+    orc_x86_emit_cpuinsn_size (p, ORC_X86_movdqa, 16, tmp, tmp);
+  }
 #endif
   orc_sse_emit_paddd (p, tmp, dest);
 }
@@ -852,12 +936,12 @@ sse_rule_signX_ssse3 (OrcCompiler *p, void *user, OrcInstruction *insn)
 
   tmpc = orc_compiler_get_temp_constant (p, 1<<type, 1);
   if (src == dest) {
-    orc_x86_emit_cpuinsn_size (p, opcodes[type], 16, src, tmpc);
+    orc_x86_emit_cpuinsn_size (p, opcodes[type], SSE_REG_SIZE, src, tmpc);
     orc_sse_emit_movdqa (p, tmpc, dest);
   } else {
     /* FIXME this would be a good opportunity to not chain src to dest */
     orc_sse_emit_movdqa (p, tmpc, dest);
-    orc_x86_emit_cpuinsn_size (p, opcodes[type], 16, src, dest);
+    orc_x86_emit_cpuinsn_size (p, opcodes[type], SSE_REG_SIZE, src, dest);
   }
 }
 #endif
@@ -944,9 +1028,15 @@ sse_rule_shift (OrcCompiler *p, void *user, OrcInstruction *insn)
     ORC_X86_psrad_imm, ORC_X86_psllq_imm, ORC_X86_psrlq_imm };
 
   if (p->vars[insn->src_args[1]].vartype == ORC_VAR_TYPE_CONST) {
+#ifdef AVX
+    orc_x86_emit_cpuinsn_imm_size (p, opcodes_imm[type], SSE_REG_SIZE,
+        p->vars[insn->src_args[1]].value.i, 0,
+        p->vars[insn->dest_args[0]].alloc);
+#else
     orc_x86_emit_cpuinsn_imm (p, opcodes_imm[type],
         p->vars[insn->src_args[1]].value.i, 16,
         p->vars[insn->dest_args[0]].alloc);
+#endif
   } else if (p->vars[insn->src_args[1]].vartype == ORC_VAR_TYPE_PARAM) {
     int tmp = orc_compiler_get_temp_reg (p);
 
@@ -956,7 +1046,7 @@ sse_rule_shift (OrcCompiler *p, void *user, OrcInstruction *insn)
         (int)ORC_STRUCT_OFFSET(OrcExecutor, params[insn->src_args[1]]),
         p->exec_reg, tmp, FALSE);
 
-    orc_x86_emit_cpuinsn_size (p, opcodes[type], 16, tmp,
+    orc_x86_emit_cpuinsn_size (p, opcodes[type], SSE_REG_SIZE, tmp,
         p->vars[insn->dest_args[0]].alloc);
   } else {
     orc_compiler_error (p, "code generation rule for %s only works with "
@@ -1056,6 +1146,10 @@ sse_rule_convsbw (OrcCompiler *p, void *user, OrcInstruction *insn)
   int src = p->vars[insn->src_args[0]].alloc;
   int dest = p->vars[insn->dest_args[0]].alloc;
 
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+  src = dest;
+#endif
   orc_sse_emit_punpcklbw (p, src, dest);
   orc_sse_emit_psraw_imm (p, 8, dest);
 }
@@ -1073,6 +1167,9 @@ sse_rule_convubw (OrcCompiler *p, void *user, OrcInstruction *insn)
     orc_sse_emit_psrlw_imm (p, 8, dest);
   } else {
     orc_sse_emit_pxor(p, tmp, tmp);
+#ifdef AVX
+    avx_fix_lanes (p, 2, dest);
+#endif
     orc_sse_emit_punpcklbw (p, tmp, dest);
   }
 }
@@ -1084,6 +1181,9 @@ sse_rule_convssswb (OrcCompiler *p, void *user, OrcInstruction *insn)
   int dest = p->vars[insn->dest_args[0]].alloc;
 
   orc_sse_emit_packsswb (p, src, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+#endif
 }
 
 static void
@@ -1093,6 +1193,9 @@ sse_rule_convsuswb (OrcCompiler *p, void *user, OrcInstruction *insn)
   int dest = p->vars[insn->dest_args[0]].alloc;
 
   orc_sse_emit_packuswb (p, src, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+#endif
 }
 
 static void
@@ -1110,6 +1213,9 @@ sse_rule_convuuswb (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_psllw_imm (p, 1, tmp);
   orc_sse_emit_pxor (p, tmp, dest);
   orc_sse_emit_packuswb (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+#endif
 }
 
 static void
@@ -1120,6 +1226,9 @@ sse_rule_convwb (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_psllw_imm (p, 8, dest);
   orc_sse_emit_psrlw_imm (p, 8, dest);
   orc_sse_emit_packuswb (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+#endif
 }
 
 static void
@@ -1129,6 +1238,9 @@ sse_rule_convhwb (OrcCompiler *p, void *user, OrcInstruction *insn)
 
   orc_sse_emit_psrlw_imm (p, 8, dest);
   orc_sse_emit_packuswb (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+#endif
 }
 
 static void
@@ -1137,6 +1249,10 @@ sse_rule_convswl (OrcCompiler *p, void *user, OrcInstruction *insn)
   int src = p->vars[insn->src_args[0]].alloc;
   int dest = p->vars[insn->dest_args[0]].alloc;
 
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest);
+  src = dest;
+#endif
   orc_sse_emit_punpcklwd (p, src, dest);
   orc_sse_emit_psrad_imm (p, 16, dest);
 }
@@ -1154,6 +1270,9 @@ sse_rule_convuwl (OrcCompiler *p, void *user, OrcInstruction *insn)
     orc_sse_emit_psrld_imm (p, 16, dest);
   } else {
     orc_sse_emit_pxor(p, tmp, tmp);
+#ifdef AVX
+    avx_fix_lanes (p, 4, dest);
+#endif
     orc_sse_emit_punpcklwd (p, tmp, dest);
   }
 }
@@ -1166,6 +1285,9 @@ sse_rule_convlw (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_pslld_imm (p, 16, dest);
   orc_sse_emit_psrad_imm (p, 16, dest);
   orc_sse_emit_packssdw (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest);
+#endif
 }
 
 static void
@@ -1175,6 +1297,9 @@ sse_rule_convhlw (OrcCompiler *p, void *user, OrcInstruction *insn)
 
   orc_sse_emit_psrad_imm (p, 16, dest);
   orc_sse_emit_packssdw (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest);
+#endif
 }
 
 static void
@@ -1184,6 +1309,9 @@ sse_rule_convssslw (OrcCompiler *p, void *user, OrcInstruction *insn)
   int dest = p->vars[insn->dest_args[0]].alloc;
 
   orc_sse_emit_packssdw (p, src, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest);
+#endif
 }
 
 static void
@@ -1193,6 +1321,9 @@ sse_rule_convsuslw (OrcCompiler *p, void *user, OrcInstruction *insn)
   int dest = p->vars[insn->dest_args[0]].alloc;
 
   orc_sse_emit_packusdw (p, src, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest);
+#endif
 }
 
 static void
@@ -1202,6 +1333,10 @@ sse_rule_convslq (OrcCompiler *p, void *user, OrcInstruction *insn)
   int dest = p->vars[insn->dest_args[0]].alloc;
   int tmp = orc_compiler_get_temp_reg (p);
 
+#ifdef AVX
+  avx_fix_lanes (p, 8, dest);
+  src = dest;
+#endif
   orc_sse_emit_movdqa (p, src, tmp);
   orc_sse_emit_psrad_imm (p, 31, tmp);
   orc_sse_emit_punpckldq (p, tmp, dest);
@@ -1214,6 +1349,9 @@ sse_rule_convulq (OrcCompiler *p, void *user, OrcInstruction *insn)
   int tmp;
 
   tmp = orc_compiler_get_constant (p, 4, 0);
+#ifdef AVX
+  avx_fix_lanes (p, 8, dest);
+#endif
   orc_sse_emit_punpckldq (p, tmp, dest);
 }
 
@@ -1228,6 +1366,9 @@ sse_rule_convql (OrcCompiler *p, void *user, OrcInstruction *insn)
 #else
   orc_sse_emit_movdqa (p, src, dest);
 #endif
+#ifdef AVX
+  avx_fix_lanes (p, 8, dest);
+#endif
 }
 
 static void
@@ -1248,6 +1389,9 @@ sse_rule_splatbw (OrcCompiler *p, void *user, OrcInstruction *insn)
 {
   int dest = p->vars[insn->dest_args[0]].alloc;
 
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+#endif
   orc_sse_emit_punpcklbw (p, dest, dest);
 }
 
@@ -1256,7 +1400,13 @@ sse_rule_splatbl (OrcCompiler *p, void *user, OrcInstruction *insn)
 {
   int dest = p->vars[insn->dest_args[0]].alloc;
 
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+#endif
   orc_sse_emit_punpcklbw (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest);
+#endif
   orc_sse_emit_punpcklwd (p, dest, dest);
 }
 
@@ -1370,6 +1520,10 @@ sse_rule_mulsbw (OrcCompiler *p, void *user, OrcInstruction *insn)
   int dest = p->vars[insn->dest_args[0]].alloc;
   int tmp = orc_compiler_get_temp_reg (p);
 
+#ifdef AVX
+  src = avx_fix_lanes_src (p, 2, src);
+  avx_fix_lanes (p, 2, dest);
+#endif
   orc_sse_emit_punpcklbw (p, src, tmp);
   orc_sse_emit_psraw_imm (p, 8, tmp);
   orc_sse_emit_punpcklbw (p, dest, dest);
@@ -1384,6 +1538,10 @@ sse_rule_mulubw (OrcCompiler *p, void *user, OrcInstruction *insn)
   int dest = p->vars[insn->dest_args[0]].alloc;
   int tmp = orc_compiler_get_temp_reg (p);
 
+#ifdef AVX
+  src = avx_fix_lanes_src (p, 2, src);
+  avx_fix_lanes (p, 2, dest);
+#endif
   orc_sse_emit_punpcklbw (p, src, tmp);
   orc_sse_emit_psrlw_imm (p, 8, tmp);
   orc_sse_emit_punpcklbw (p, dest, dest);
@@ -1480,6 +1638,10 @@ sse_rule_mulswl (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_movdqa (p, dest, tmp);
   orc_sse_emit_pmulhw (p, src, tmp);
   orc_sse_emit_pmullw (p, src, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 4, tmp);
+  avx_fix_lanes (p, 4, dest);
+#endif
   orc_sse_emit_punpcklwd (p, tmp, dest);
 }
 
@@ -1493,9 +1655,14 @@ sse_rule_muluwl (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_movdqa (p, dest, tmp);
   orc_sse_emit_pmulhuw (p, src, tmp);
   orc_sse_emit_pmullw (p, src, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 4, tmp);
+  avx_fix_lanes (p, 4, dest);
+#endif
   orc_sse_emit_punpcklwd (p, tmp, dest);
 }
 
+#ifndef AVX
 static void
 sse_rule_mulll_slow (OrcCompiler *p, void *user, OrcInstruction *insn)
 {
@@ -1519,6 +1686,7 @@ sse_rule_mulll_slow (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_x86_emit_mov_memoffset_sse (p, 16, offset, p->exec_reg,
       p->vars[insn->dest_args[0]].alloc, FALSE);
 }
+#endif
 
 #ifndef MMX
 static void
@@ -1539,7 +1707,7 @@ sse_rule_mulhsl (OrcCompiler *p, void *user, OrcInstruction *insn)
 }
 #endif
 
-#ifndef MMX
+#if !defined(MMX) && !defined(AVX)
 static void
 sse_rule_mulhsl_slow (OrcCompiler *p, void *user, OrcInstruction *insn)
 {
@@ -1597,12 +1765,16 @@ sse_rule_mulslq (OrcCompiler *p, void *user, OrcInstruction *insn)
   int tmp = orc_compiler_get_temp_reg (p);
 
   orc_sse_emit_movdqa (p, src, tmp);
+#ifdef AVX
+  avx_fix_lanes (p, 8, tmp);
+  avx_fix_lanes (p, 8, dest);
+#endif
   orc_sse_emit_punpckldq (p, dest, dest);
   orc_sse_emit_punpckldq (p, tmp, tmp);
   orc_sse_emit_pmuldq (p, tmp, dest);
 }
 
-#ifndef MMX
+#if !defined(MMX) && !defined(AVX)
 static void
 sse_rule_mulslq_slow (OrcCompiler *p, void *user, OrcInstruction *insn)
 {
@@ -1643,6 +1815,10 @@ sse_rule_mululq (OrcCompiler *p, void *user, OrcInstruction *insn)
   int tmp = orc_compiler_get_temp_reg (p);
 
   orc_sse_emit_movdqa (p, src, tmp);
+#ifdef AVX
+  avx_fix_lanes (p, 8, tmp);
+  avx_fix_lanes (p, 8, dest);
+#endif
   orc_sse_emit_punpckldq (p, dest, dest);
   orc_sse_emit_punpckldq (p, tmp, tmp);
   orc_sse_emit_pmuludq (p, tmp, dest);
@@ -1661,6 +1837,9 @@ sse_rule_select0lw (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_pslld_imm (p, 16, dest);
   orc_sse_emit_psrad_imm (p, 16, dest);
   orc_sse_emit_packssdw (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest);
+#endif
 }
 
 static void
@@ -1673,6 +1852,9 @@ sse_rule_select1lw (OrcCompiler *p, void *user, OrcInstruction *insn)
 
   orc_sse_emit_psrad_imm (p, 16, dest);
   orc_sse_emit_packssdw (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest);
+#endif
 }
 
 static void
@@ -1687,19 +1869,23 @@ sse_rule_select0ql (OrcCompiler *p, void *user, OrcInstruction *insn)
 #else
   orc_sse_emit_movdqa (p, src, dest);
 #endif
+#ifdef AVX
+  avx_fix_lanes (p, 8, dest);
+#endif
 }
 
 static void
 sse_rule_select1ql (OrcCompiler *p, void *user, OrcInstruction *insn)
 {
-  int src = p->vars[insn->src_args[0]].alloc;
+  /* int src = p->vars[insn->src_args[0]].alloc; */
   int dest = p->vars[insn->dest_args[0]].alloc;
 
   orc_sse_emit_psrlq_imm (p, 32, dest);
 #ifndef MMX
-  orc_sse_emit_pshufd (p, ORC_SSE_SHUF(2,0,2,0), src, dest);
-#else
-  orc_sse_emit_movdqa (p, src, dest);
+  orc_sse_emit_pshufd (p, ORC_SSE_SHUF(2,0,2,0), dest, dest);
+#endif
+#ifdef AVX
+  avx_fix_lanes (p, 8, dest);
 #endif
 }
 
@@ -1715,6 +1901,9 @@ sse_rule_select0wb (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_psllw_imm (p, 8, dest);
   orc_sse_emit_psraw_imm (p, 8, dest);
   orc_sse_emit_packsswb (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+#endif
 }
 
 static void
@@ -1727,6 +1916,9 @@ sse_rule_select1wb (OrcCompiler *p, void *user, OrcInstruction *insn)
 
   orc_sse_emit_psraw_imm (p, 8, dest);
   orc_sse_emit_packsswb (p, dest, dest);
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest);
+#endif
 }
 
 static void
@@ -1743,6 +1935,12 @@ sse_rule_splitql (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_movdqa (p, src, dest2);
   orc_sse_emit_pshufw (p, ORC_SSE_SHUF(3,2,3,2), src, dest1);
 #endif
+#ifdef AVX
+  avx_fix_lanes (p, 8, dest1);
+#endif
+#ifdef AVX
+  avx_fix_lanes (p, 8, dest2);
+#endif
 }
 
 static void
@@ -1756,12 +1954,18 @@ sse_rule_splitlw (OrcCompiler *p, void *user, OrcInstruction *insn)
 
   orc_sse_emit_psrad_imm (p, 16, dest1);
   orc_sse_emit_packssdw (p, dest1, dest1);
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest1);
+#endif
 
   if (dest2 != src)
     orc_sse_emit_movdqa (p, src, dest2);
   orc_sse_emit_pslld_imm (p, 16, dest2);
   orc_sse_emit_psrad_imm (p, 16, dest2);
   orc_sse_emit_packssdw (p, dest2, dest2);
+#ifdef AVX
+  avx_fix_lanes (p, 4, dest2);
+#endif
 
 }
 
@@ -1778,6 +1982,9 @@ sse_rule_splitwb (OrcCompiler *p, void *user, OrcInstruction *insn)
 
   orc_sse_emit_psraw_imm (p, 8, dest1);
   orc_sse_emit_packsswb (p, dest1, dest1);
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest1);
+#endif
 
   if (dest2 != src)
     orc_sse_emit_movdqa (p, src, dest2);
@@ -1790,6 +1997,9 @@ sse_rule_splitwb (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_pand (p, tmp, dest2);
   orc_sse_emit_packuswb (p, dest2, dest2);
 #endif
+#ifdef AVX
+  avx_fix_lanes (p, 2, dest2);
+#endif
 }
 
 static void
@@ -1798,6 +2008,10 @@ sse_rule_mergebw (OrcCompiler *p, void *user, OrcInstruction *insn)
   int src = p->vars[insn->src_args[1]].alloc;
   int dest = p->vars[insn->dest_args[0]].alloc;
 
+#ifdef AVX
+  src = avx_fix_lanes_src (p, 2, src);
+  avx_fix_lanes (p, 2, dest);
+#endif
   orc_sse_emit_punpcklbw (p, src, dest);
 }
 
@@ -1807,6 +2021,10 @@ sse_rule_mergewl (OrcCompiler *p, void *user, OrcInstruction *insn)
   int src = p->vars[insn->src_args[1]].alloc;
   int dest = p->vars[insn->dest_args[0]].alloc;
 
+#ifdef AVX
+  src = avx_fix_lanes_src (p, 4, src);
+  avx_fix_lanes (p, 4, dest);
+#endif
   orc_sse_emit_punpcklwd (p, src, dest);
 }
 
@@ -1816,6 +2034,10 @@ sse_rule_mergelq (OrcCompiler *p, void *user, OrcInstruction *insn)
   int src = p->vars[insn->src_args[1]].alloc;
   int dest = p->vars[insn->dest_args[0]].alloc;
 
+#ifdef AVX
+  src = avx_fix_lanes_src (p, 8, src);
+  avx_fix_lanes (p, 8, dest);
+#endif
   orc_sse_emit_punpckldq (p, src, dest);
 }
 
@@ -1937,7 +2159,7 @@ sse_rule_swapwl_ssse3 (OrcCompiler *p, void *user, OrcInstruction *insn)
   if (tmp != ORC_REG_INVALID) {
     orc_sse_emit_pshufb (p, tmp, dest);
   } else {
-    sse_rule_swapl (p, user, insn);
+    sse_rule_swapwl (p, user, insn);
   }
 }
 
@@ -1973,6 +2195,10 @@ sse_rule_splitlw_ssse3 (OrcCompiler *p, void *user, OrcInstruction *insn)
     if (dest2 != src)
       orc_sse_emit_movdqa (p, src, dest2);
     orc_sse_emit_pshufb (p, tmp2, dest2);
+#ifdef AVX
+    avx_fix_lanes (p, 4, dest1);
+    avx_fix_lanes (p, 4, dest2);
+#endif
   } else {
     sse_rule_splitlw (p, user, insn);
   }
@@ -1996,6 +2222,10 @@ sse_rule_splitwb_ssse3 (OrcCompiler *p, void *user, OrcInstruction *insn)
     if (dest2 != src)
       orc_sse_emit_movdqa (p, src, dest2);
     orc_sse_emit_pshufb (p, tmp2, dest2);
+#ifdef AVX
+    avx_fix_lanes (p, 2, dest1);
+    avx_fix_lanes (p, 2, dest2);
+#endif
   } else {
     sse_rule_splitwb (p, user, insn);
   }
@@ -2011,6 +2241,9 @@ sse_rule_select0lw_ssse3 (OrcCompiler *p, void *user, OrcInstruction *insn)
       0x05040100, 0x0d0c0908, 0x05040100, 0x0d0c0908);
   if (tmp != ORC_REG_INVALID) {
     orc_sse_emit_pshufb (p, tmp, dest);
+#ifdef AVX
+    avx_fix_lanes (p, 4, dest);
+#endif
   } else {
     sse_rule_select0lw (p, user, insn);
   }
@@ -2026,6 +2259,9 @@ sse_rule_select1lw_ssse3 (OrcCompiler *p, void *user, OrcInstruction *insn)
       0x07060302, 0x0f0e0b0a, 0x07060302, 0x0f0e0b0a);
   if (tmp != ORC_REG_INVALID) {
     orc_sse_emit_pshufb (p, tmp, dest);
+#ifdef AVX
+    avx_fix_lanes (p, 4, dest);
+#endif
   } else {
     sse_rule_select1lw (p, user, insn);
   }
@@ -2041,6 +2277,9 @@ sse_rule_select0wb_ssse3 (OrcCompiler *p, void *user, OrcInstruction *insn)
       0x06040200, 0x0e0c0a08, 0x06040200, 0x0e0c0a08);
   if (tmp != ORC_REG_INVALID) {
     orc_sse_emit_pshufb (p, tmp, dest);
+#ifdef AVX
+    avx_fix_lanes (p, 2, dest);
+#endif
   } else {
     sse_rule_select0wb (p, user, insn);
   }
@@ -2056,6 +2295,9 @@ sse_rule_select1wb_ssse3 (OrcCompiler *p, void *user, OrcInstruction *insn)
       0x07050301, 0x0f0d0b09, 0x07050301, 0x0f0d0b09);
   if (tmp != ORC_REG_INVALID) {
     orc_sse_emit_pshufb (p, tmp, dest);
+#ifdef AVX
+    avx_fix_lanes (p, 2, dest);
+#endif
   } else {
     sse_rule_select1wb (p, user, insn);
   }
@@ -2435,20 +2677,22 @@ sse_rule_subusl_slow (OrcCompiler *p, void *user, OrcInstruction *insn)
   int tmp = orc_compiler_get_temp_reg (p);
   int tmp2 = orc_compiler_get_temp_reg (p);
 
-  orc_sse_emit_movdqa (p, src, tmp2);
+  /* the carry out of ~dest + src, as in addusl, is the borrow */
+  orc_sse_emit_pcmpeqd (p, tmp, tmp);
+  orc_sse_emit_pxor (p, dest, tmp);
+  orc_sse_emit_movdqa (p, tmp, tmp2);
+  orc_sse_emit_pand (p, src, tmp);
+  orc_sse_emit_pxor (p, src, tmp2);
   orc_sse_emit_psrld_imm (p, 1, tmp2);
+  orc_sse_emit_paddd (p, tmp2, tmp);
 
-  orc_sse_emit_movdqa (p, dest, tmp);
-  orc_sse_emit_psrld_imm (p, 1, tmp);
-  orc_sse_emit_psubd (p, tmp, tmp2);
-
-  /* turn overflow bit into mask */
-  orc_sse_emit_psrad_imm (p, 31, tmp2);
+  /* turn the borrow bit into mask */
+  orc_sse_emit_psrad_imm (p, 31, tmp);
 
-  /* compute the difference, then and over the mask */
+  /* compute the difference, then clear it where it borrowed */
   orc_sse_emit_psubd (p, src, dest);
-  orc_sse_emit_pand (p, tmp2, dest);
-
+  orc_sse_emit_pandn (p, dest, tmp);
+  orc_sse_emit_movdqa (p, tmp, dest);
 }
 
 #ifndef MMX
@@ -2667,6 +2911,7 @@ sse_rule_convfl (OrcCompiler *p, void *user, OrcInstruction *insn)
 
 }
 
+#ifndef AVX
 static void
 sse_rule_convdl (OrcCompiler *p, void *user, OrcInstruction *insn)
 {
@@ -2683,6 +2928,7 @@ sse_rule_convdl (OrcCompiler *p, void *user, OrcInstruction *insn)
   orc_sse_emit_pandn (p, tmpc, tmp);
   orc_sse_emit_paddd (p, tmp, dest);
 }
+#endif
 
 static void
 sse_rule_convlf (OrcCompiler *p, void *user, OrcInstruction *insn)
@@ -2692,6 +2938,7 @@ sse_rule_convlf (OrcCompiler *p, void *user, OrcInstruction *insn)
       p->vars[insn->dest_args[0]].alloc);
 }
 
+#ifndef AVX
 static void
 sse_rule_convld (OrcCompiler *p, void *user, OrcInstruction *insn)
 {
@@ -2716,6 +2963,7 @@ sse_rule_convdf (OrcCompiler *p, void *user, OrcInstruction *insn)
       p->vars[insn->dest_args[0]].alloc);
 }
 #endif
+#endif
 
 #define UNARY_SSE41(opcode,insn_name) \
 static void \
@@ -2764,8 +3012,10 @@ orc_compiler_sse_register_rules (OrcTarget *target)
   orc_rule_register (rule_set, "loadpw", sse_rule_loadpX, (void *)2);
   orc_rule_register (rule_set, "loadpl", sse_rule_loadpX, (void *)4);
   orc_rule_register (rule_set, "loadpq", sse_rule_loadpX, (void *)8);
+#ifndef AVX
   orc_rule_register (rule_set, "ldresnearl", sse_rule_ldresnearl, NULL);
   orc_rule_register (rule_set, "ldreslinl", sse_rule_ldreslinl, NULL);
+#endif
 
   orc_rule_register (rule_set, "storeb", sse_rule_storeX, NULL);
   orc_rule_register (rule_set, "storew", sse_rule_storeX, NULL);
@@ -2901,11 +3151,14 @@ orc_compiler_sse_register_rules (OrcTarget *target)
   orc_rule_register (rule_set, "cmpeqd", sse_rule_cmpeqd, NULL);
   orc_rule_register (rule_set, "cmpltd", sse_rule_cmpltd, NULL);
   orc_rule_register (rule_set, "cmpled", sse_rule_cmpled, NULL);
+#ifndef AVX
+  /* these change the element count per register */
   orc_rule_register (rule_set, "convdl", sse_rule_convdl, NULL);
   orc_rule_register (rule_set, "convld", sse_rule_convld, NULL);
 
   orc_rule_register (rule_set, "convfd", sse_rule_convfd, NULL);
   orc_rule_register (rule_set, "convdf", sse_rule_convdf, NULL);
+#endif
 #endif
 
   /* slow rules */
@@ -2937,11 +3190,18 @@ orc_compiler_sse_register_rules (OrcTarget *target)
   orc_rule_register (rule_set, "shlb", sse_rule_shlb, NULL);
   orc_rule_register (rule_set, "shrsb", sse_rule_shrsb, NULL);
   orc_rule_register (rule_set, "shrub", sse_rule_shrub, NULL);
+#ifndef AVX
+  /* these go through 16 bytes of memory */
   orc_rule_register (rule_set, "mulll", sse_rule_mulll_slow, NULL);
+#endif
 #ifndef MMX
+#ifndef AVX
   orc_rule_register (rule_set, "mulhsl", sse_rule_mulhsl_slow, NULL);
+#endif
   orc_rule_register (rule_set, "mulhul", sse_rule_mulhul, NULL);
+#ifndef AVX
   orc_rule_register (rule_set, "mulslq", sse_rule_mulslq_slow, NULL);
+#endif
 #endif
   orc_rule_register (rule_set, "mullb", sse_rule_mullb, NULL);
   orc_rule_register (rule_set, "mulhsb", sse_rule_mulhsb, NULL);
@@ -0,0 +1,319 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include <orc/orcprogram.h>
+#include <orc/orcdebug.h>
+#include <orc/orcinternal.h>
+#include <orc/orclock.h>
+
+/*
+ * Parameter specialization
+ *
+ * orc_program_specialize() makes a copy of a program where some of the
+ * parameters are constants with the given values.  The rules can then
+ * use the forms that only work with constants, such as shifts by an
+ * immediate, and the optimization passes fold them like any other
+ * constant, which turns multiplications by a power of two into shifts.
+ *
+ * The copies are kept with the program they were made from, keyed by
+ * the values, so asking again for the same values is cheap.  There are
+ * at most ORC_N_SPECIALIZATIONS of them per program.  Each one counts
+ * the callers that hold it, until they give it back with
+ * orc_program_unspecialize().  When a new one is needed, the one that
+ * was asked for least recently and isn't held is freed.  If all of
+ * them are held, the new one isn't kept, and is freed when it is given
+ * back.  Copies with the same values that are made from different programs
+ * with the same instructions still share their code, through the code
+ * cache.
+ */
+
+typedef struct _OrcSpecialization OrcSpecialization;
+typedef struct _OrcSpecializations OrcSpecializations;
+
+struct _OrcSpecialization {
+  OrcProgram *program;
+  /* bit i is set for ORC_VAR_P1 + i */
+  unsigned int params;
+  orc_int64 values[ORC_MAX_PARAM_VARS];
+  unsigned long last_use;
+  int refcount;
+};
+
+struct _OrcSpecializations {
+  OrcSpecialization entries[ORC_N_SPECIALIZATIONS];
+  int n_entries;
+  unsigned long n_uses;
+};
+
+/* Protects program->specializations of all programs */
+static OrcLock orc_specialize_lock = ORC_LOCK_INIT;
+
+/* The value a parameter of this size has in the program */
+static orc_int64
+orc_specialize_value (OrcVariable *var, orc_int64 value)
+{
+  if (var->size <= 4) return (orc_int32)value;
+  return value;
+}
+
+static OrcSpecialization *
+orc_specialize_find (OrcSpecializations *list, unsigned int params,
+    const orc_int64 *values)
+{
+  int i, j;
+
+  for(i=0;i<list->n_entries;i++){
+    OrcSpecialization *entry = list->entries + i;
+
+    if (entry->params != params) continue;
+    for(j=0;j<ORC_MAX_PARAM_VARS;j++){
+      if ((params & (1U << j)) && entry->values[j] != values[j]) break;
+    }
+    if (j == ORC_MAX_PARAM_VARS) return entry;
+  }
+  return NULL;
+}
+
+/* Returns a constant of @program with the size and value, adding one
+ * with @name if there is none, or -1 if there is no room */
+static int
+orc_specialize_get_constant (OrcProgram *program, int size,
+    orc_int64 value, const char *name)
+{
+  int free_var = -1;
+  int i;
+
+  for(i=ORC_VAR_C1;i<ORC_VAR_C1+ORC_MAX_CONST_VARS;i++){
+    OrcVariable *var = program->vars + i;
+
+    if (var->size == 0) {
+      if (free_var == -1) free_var = i;
+      continue;
+    }
+    if (var->size == size && var->value.i == value) return i;
+  }
+  if (free_var == -1) return -1;
+
+  program->vars[free_var].vartype = ORC_VAR_TYPE_CONST;
+  program->vars[free_var].size = size;
+  program->vars[free_var].value.i = value;
+  program->vars[free_var].name = strdup (name);
+  program->n_const_vars = MAX (program->n_const_vars,
+      free_var - ORC_VAR_C1 + 1);
+
+  return free_var;
+}
+
+/* Copies @program with the parameters in @params replaced by
+ * constants.  The other parameters keep their index, so an executor
+ * sets them the same way for both programs.  Returns NULL if there is
+ * no room for one of the constants. */
+static OrcProgram *
+orc_specialize_new_program (OrcProgram *program, unsigned int params,
+    const orc_int64 *values)
+{
+  OrcProgram *p;
+  int map[ORC_N_VARIABLES];
+  int i, k;
+
+  p = _orc_program_copy (program);
+  for(i=0;i<ORC_N_VARIABLES;i++){
+    map[i] = i;
+  }
+
+  for(i=0;i<ORC_MAX_PARAM_VARS;i++){
+    OrcVariable *var = p->vars + ORC_VAR_P1 + i;
+    int c;
+
+    if (!(params & (1U << i))) continue;
+    c = orc_specialize_get_constant (p, var->size, values[i], var->name);
+    if (c == -1) {
+      ORC_WARNING ("can't specialize %s, no room for a constant for %s",
+          program->name, var->name);
+      orc_program_free (p);
+      return NULL;
+    }
+    map[ORC_VAR_P1 + i] = c;
+    free (var->name);
+    free (var->type_name);
+    memset (var, 0, sizeof(OrcVariable));
+  }
+
+  for(i=0;i<p->n_insns;i++){
+    OrcInstruction *insn = p->insn_table + i;
+
+    for(k=0;k<ORC_STATIC_OPCODE_N_SRC;k++){
+      if (insn->opcode->src_size[k] == 0) continue;
+      insn->src_args[k] = map[insn->src_args[k]];
+    }
+  }
+
+  return p;
+}
+
+/**
+ * orc_program_specialize:
+ * @program: a pointer to an OrcProgram structure
+ * @params: the parameters to replace, such as ORC_VAR_P1
+ * @values: the values of the parameters
+ * @n_params: the number of parameters in @params and @values
+ *
+ * Returns a compiled copy of @program where the parameters in @params
+ * are constants with the values in @values.  This is worth it for
+ * parameters that stay the same over many calls, such as a volume or a
+ * shift: a shift by a constant uses an immediate, and a multiplication
+ * by a power of two becomes a shift.
+ *
+ * Values are given as for orc_executor_set_param_int64(), and for
+ * float and double parameters, as their bits.  The other parameters
+ * keep their index, and are set on the executor as for @program.  The
+ * copy doesn't have the backup function of @program.
+ *
+ * The copy has to be given back with orc_program_unspecialize() when
+ * the caller is done with it, and at the latest, it is freed with
+ * @program.  Asking again for the same values returns the same copy.
+ * At most ORC_N_SPECIALIZATIONS copies are kept: when another one is
+ * needed, the one that was asked for least recently, of those that
+ * were given back, is freed.
+ *
+ * Returns: a program, or NULL if @params has something that isn't a
+ * parameter of @program, or if @program has no constants left for the
+ * values
+ */
+OrcProgram *
+orc_program_specialize (OrcProgram *program, const int *params,
+    const orc_int64 *values, int n_params)
+{
+  OrcSpecializations *list;
+  OrcSpecialization *entry;
+  OrcProgram *p;
+  OrcProgram *old = NULL;
+  orc_int64 key_values[ORC_MAX_PARAM_VARS];
+  unsigned int key = 0;
+  int i;
+
+  memset (key_values, 0, sizeof(key_values));
+  for(i=0;i<n_params;i++){
+    int var = params[i];
+
+    if (var < ORC_VAR_P1 || var >= ORC_VAR_P1 + ORC_MAX_PARAM_VARS ||
+        program->vars[var].vartype != ORC_VAR_TYPE_PARAM ||
+        program->vars[var].size == 0) {
+      ORC_WARNING ("can't specialize %s, variable %d is not a parameter",
+          program->name, var);
+      return NULL;
+    }
+    key |= 1U << (var - ORC_VAR_P1);
+    key_values[var - ORC_VAR_P1] =
+      orc_specialize_value (program->vars + var, values[i]);
+  }
+
+  ORC_LOCK (&orc_specialize_lock);
+  list = program->specializations;
+  if (list) {
+    entry = orc_specialize_find (list, key, key_values);
+    if (entry) {
+      entry->last_use = ++list->n_uses;
+      entry->refcount++;
+      ORC_UNLOCK (&orc_specialize_lock);
+      return entry->program;
+    }
+  }
+  ORC_UNLOCK (&orc_specialize_lock);
+
+  /* compiling can take a while, so it's done without the lock */
+  p = orc_specialize_new_program (program, key, key_values);
+  if (p == NULL) return NULL;
+  orc_program_compile (p);
+
+  ORC_LOCK (&orc_specialize_lock);
+  list = program->specializations;
+  if (list == NULL) {
+    list = malloc (sizeof(OrcSpecializations));
+    memset (list, 0, sizeof(OrcSpecializations));
+    program->specializations = list;
+  }
+  entry = orc_specialize_find (list, key, key_values);
+  if (entry) {
+    /* another thread made it in the meantime */
+    old = p;
+  } else if (list->n_entries < ORC_N_SPECIALIZATIONS) {
+    entry = list->entries + list->n_entries;
+    list->n_entries++;
+  } else {
+    for(i=0;i<list->n_entries;i++){
+      if (list->entries[i].refcount > 0) continue;
+      if (entry == NULL || list->entries[i].last_use < entry->last_use) {
+        entry = list->entries + i;
+      }
+    }
+    if (entry == NULL) {
+      /* all of them are held, the caller gets one of its own */
+      ORC_UNLOCK (&orc_specialize_lock);
+      return p;
+    }
+    old = entry->program;
+  }
+  if (old != p) {
+    entry->program = p;
+    entry->params = key;
+    memcpy (entry->values, key_values, sizeof(key_values));
+  }
+  entry->last_use = ++list->n_uses;
+  entry->refcount++;
+  p = entry->program;
+  ORC_UNLOCK (&orc_specialize_lock);
+
+  if (old) orc_program_free (old);
+
+  return p;
+}
+
+/**
+ * orc_program_unspecialize:
+ * @program: a pointer to an OrcProgram structure
+ * @specialized: a program returned by orc_program_specialize() for
+ * @program
+ *
+ * Gives back a copy returned by orc_program_specialize().  It stays with
+ * @program for the next call with the same values, until the room is
+ * needed for another one.
+ */
+void
+orc_program_unspecialize (OrcProgram *program, OrcProgram *specialized)
+{
+  OrcSpecializations *list;
+  int i;
+
+  ORC_LOCK (&orc_specialize_lock);
+  list = program->specializations;
+  for(i=0;list && i<list->n_entries;i++){
+    if (list->entries[i].program == specialized) {
+      list->entries[i].refcount--;
+      ORC_UNLOCK (&orc_specialize_lock);
+      return;
+    }
+  }
+  ORC_UNLOCK (&orc_specialize_lock);
+
+  /* made when all the others were held */
+  orc_program_free (specialized);
+}
+
+/* Called from orc_program_free() */
+void
+_orc_program_free_specializations (OrcProgram *program)
+{
+  OrcSpecializations *list = program->specializations;
+  int i;
+
+  if (list == NULL) return;
+  for(i=0;i<list->n_entries;i++){
+    orc_program_free (list->entries[i].program);
+  }
+  free (list);
+  program->specializations = NULL;
+}
@@ -60,6 +60,21 @@ typedef enum {
   ORC_TARGET_SSE_64BIT = (1<<9)
 }OrcTargetSSEFlags;
 
+typedef enum {
+  ORC_TARGET_AVX_SSE2 = (1<<0),
+  ORC_TARGET_AVX_SSE3 = (1<<1),
+  ORC_TARGET_AVX_SSSE3 = (1<<2),
+  ORC_TARGET_AVX_SSE4_1 = (1<<3),
+  ORC_TARGET_AVX_SSE4_2 = (1<<4),
+  ORC_TARGET_AVX_SSE4A = (1<<5),
+  ORC_TARGET_AVX_SSE5 = (1<<6),
+  ORC_TARGET_AVX_FRAME_POINTER = (1<<7),
+  ORC_TARGET_AVX_SHORT_JUMPS = (1<<8),
+  ORC_TARGET_AVX_64BIT = (1<<9),
+  ORC_TARGET_AVX_AVX = (1<<10),
+  ORC_TARGET_AVX_AVX2 = (1<<11)
+}OrcTargetAVXFlags;
+
 
 /**
  * OrcTarget:
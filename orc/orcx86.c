@@ -169,8 +169,10 @@ orc_x86_emit_modrm_memoffset_old (OrcCompiler *compiler, int reg1, int offset, i
 void
 orc_x86_emit_modrm_memoffset (OrcCompiler *compiler, int offset, int src, int dest)
 {
-  if (offset == 0 && src != compiler->exec_reg) {
-    if (src == X86_ESP) {
+  /* rbp and r13 can't be used without a displacement, and rsp and r12
+   * need a SIB byte */
+  if (offset == 0 && src != compiler->exec_reg && (src&7) != 5) {
+    if ((src&7) == 4) {
       *compiler->codeptr++ = X86_MODRM(0, 4, dest);
       *compiler->codeptr++ = X86_SIB(0, 4, src);
     } else {
@@ -178,13 +180,13 @@ orc_x86_emit_modrm_memoffset (OrcCompiler *compiler, int offset, int src, int de
     }
   } else if (offset >= -128 && offset < 128) {
     *compiler->codeptr++ = X86_MODRM(1, src, dest);
-    if (src == X86_ESP) {
+    if ((src&7) == 4) {
       *compiler->codeptr++ = X86_SIB(0, 4, src);
     }
     *compiler->codeptr++ = (offset & 0xff);
   } else {
     *compiler->codeptr++ = X86_MODRM(2, src, dest);
-    if (src == X86_ESP) {
+    if ((src&7) == 4) {
       *compiler->codeptr++ = X86_SIB(0, 4, src);
     }
     *compiler->codeptr++ = (offset & 0xff);
@@ -197,7 +199,7 @@ orc_x86_emit_modrm_memoffset (OrcCompiler *compiler, int offset, int src, int de
 void orc_x86_emit_modrm_memindex (OrcCompiler *compiler, int reg1, int offset,
     int reg2, int regindex, int shift)
 {
-  if (offset == 0) {
+  if (offset == 0 && (reg2&7) != 5) {
     *compiler->codeptr++ = X86_MODRM(0, 4, reg1);
     *compiler->codeptr++ = X86_SIB(shift, regindex, reg2);
   } else if (offset >= -128 && offset < 128) {
@@ -217,7 +219,7 @@ void orc_x86_emit_modrm_memindex (OrcCompiler *compiler, int reg1, int offset,
 void orc_x86_emit_modrm_memindex2 (OrcCompiler *compiler, int offset,
     int src, int src_index, int shift, int dest)
 {
-  if (offset == 0) {
+  if (offset == 0 && (src&7) != 5) {
     *compiler->codeptr++ = X86_MODRM(0, 4, dest);
     *compiler->codeptr++ = X86_SIB(shift, src_index, src);
   } else if (offset >= -128 && offset < 128) {
@@ -399,21 +401,24 @@ void orc_x86_emit_rep_movs (OrcCompiler *compiler, int size)
 void
 x86_add_fixup (OrcCompiler *compiler, unsigned char *ptr, int label, int type)
 {
-  compiler->fixups[compiler->n_fixups].ptr = ptr;
-  compiler->fixups[compiler->n_fixups].label = label;
-  compiler->fixups[compiler->n_fixups].type = type;
-  compiler->n_fixups++;
+  OrcFixup *fixup = orc_compiler_new_fixup (compiler);
+
+  fixup->ptr = ptr;
+  fixup->label = label;
+  fixup->type = type;
 }
 
 void
 x86_add_label (OrcCompiler *compiler, unsigned char *ptr, int label)
 {
+  ORC_ASSERT (label < ORC_N_LABELS);
   compiler->labels[label] = ptr;
 }
 
 void
 x86_add_label2 (OrcCompiler *compiler, int index, int label)
 {
+  ORC_ASSERT (label < ORC_N_LABELS);
   compiler->labels_int[label] = index;
 }
 
@@ -422,9 +427,9 @@ orc_x86_do_fixups (OrcCompiler *compiler)
 {
   int i;
   for(i=0;i<compiler->n_fixups;i++){
-    if (compiler->fixups[i].type == 0) {
-      unsigned char *label = compiler->labels[compiler->fixups[i].label];
-      unsigned char *ptr = compiler->fixups[i].ptr;
+    if (compiler->fixup_table[i].type == 0) {
+      unsigned char *label = compiler->labels[compiler->fixup_table[i].label];
+      unsigned char *ptr = compiler->fixup_table[i].ptr;
       int diff;
 
       diff = ((orc_int8)ptr[0]) + (label - ptr);
@@ -433,9 +438,9 @@ orc_x86_do_fixups (OrcCompiler *compiler)
       }
 
       ptr[0] = diff;
-    } else if (compiler->fixups[i].type == 1) {
-      unsigned char *label = compiler->labels[compiler->fixups[i].label];
-      unsigned char *ptr = compiler->fixups[i].ptr;
+    } else if (compiler->fixup_table[i].type == 1) {
+      unsigned char *label = compiler->labels[compiler->fixup_table[i].label];
+      unsigned char *ptr = compiler->fixup_table[i].ptr;
       int diff;
 
       diff = ORC_READ_UINT32_LE (ptr) + (label - ptr);
@@ -475,6 +480,21 @@ orc_x86_emit_prologue (OrcCompiler *compiler)
     }
   }
 
+  if (compiler->n_spill_slots > 0) {
+    int ptr_size = compiler->is_64bit ? 8 : 4;
+    int size = compiler->n_spill_slots * compiler->spill_slot_size;
+
+    /* stack area for the spilled variables, aligned to 16 bytes, with
+     * the old stack pointer stored after the slots */
+    orc_x86_emit_mov_reg_reg (compiler, ptr_size, X86_ESP,
+        compiler->gp_tmpreg);
+    orc_x86_emit_add_imm_reg (compiler, ptr_size, -(size + 16), X86_ESP,
+        FALSE);
+    orc_x86_emit_and_imm_reg (compiler, ptr_size, -16, X86_ESP);
+    orc_x86_emit_mov_reg_memoffset (compiler, ptr_size, compiler->gp_tmpreg,
+        size, X86_ESP);
+  }
+
 #if 0
   orc_x86_emit_rdtsc(compiler);
   orc_x86_emit_mov_reg_memoffset (compiler, 4, X86_EAX,
@@ -491,6 +511,12 @@ orc_x86_emit_epilogue (OrcCompiler *compiler)
       ORC_STRUCT_OFFSET(OrcExecutor,params[ORC_VAR_A4]), compiler->exec_reg);
 #endif
 
+  if (compiler->n_spill_slots > 0) {
+    orc_x86_emit_mov_memoffset_reg (compiler, compiler->is_64bit ? 8 : 4,
+        compiler->n_spill_slots * compiler->spill_slot_size, X86_ESP,
+        X86_ESP);
+  }
+
   if (compiler->is_64bit) {
     int i;
     for(i=15;i>=0;i--){
@@ -521,9 +547,9 @@ orc_x86_assemble_copy_check (OrcCompiler *compiler)
 {
   if (compiler->program->n_insns == 1 &&
       compiler->program->is_2d == FALSE &&
-      (strcmp (compiler->program->insns[0].opcode->name, "copyb") == 0 ||
-      strcmp (compiler->program->insns[0].opcode->name, "copyw") == 0 ||
-      strcmp (compiler->program->insns[0].opcode->name, "copyl") == 0)) {
+      (strcmp (compiler->program->insn_table[0].opcode->name, "copyb") == 0 ||
+      strcmp (compiler->program->insn_table[0].opcode->name, "copyw") == 0 ||
+      strcmp (compiler->program->insn_table[0].opcode->name, "copyl") == 0)) {
     return TRUE;
   }
 
@@ -536,7 +562,7 @@ orc_x86_assemble_copy (OrcCompiler *compiler)
   OrcInstruction *insn;
   int shift = 0;
 
-  insn = compiler->program->insns + 0;
+  insn = compiler->program->insn_table + 0;
 
   if (strcmp (insn->opcode->name, "copyw") == 0) {
     shift = 1;
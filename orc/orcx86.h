@@ -92,12 +92,16 @@ void orc_x86_emit_pop (OrcCompiler *compiler, int size, int reg);
   orc_x86_emit_cpuinsn_size(p, ORC_X86_add_r_rm, size, src, dest)
 #define orc_x86_emit_add_memoffset_reg(p,size,offset,src,dest) \
   orc_x86_emit_cpuinsn_memoffset_reg(p, ORC_X86_add_rm_r, size, offset, src, dest)
+#define orc_x86_emit_sub_reg_memoffset(p,size,src,offset,dest) \
+  orc_x86_emit_cpuinsn_reg_memoffset(p, ORC_X86_sub_r_rm, src, offset, dest)
 #define orc_x86_emit_sub_reg_reg(p,size,src,dest) \
   orc_x86_emit_cpuinsn_size(p, ORC_X86_sub_r_rm, size, src, dest)
 #define orc_x86_emit_sub_memoffset_reg(p,size,offset,src,dest) \
   orc_x86_emit_cpuinsn_memoffset_reg(p, ORC_X86_sub_rm_r, size, offset, src, dest)
 #define orc_x86_emit_imul_memoffset_reg(p,size,offset,src,dest) \
   orc_x86_emit_cpuinsn_memoffset_reg(p, ORC_X86_imul_rm_r, size, offset, src, dest)
+#define orc_x86_emit_or_memoffset_reg(p,size,offset,src,dest) \
+  orc_x86_emit_cpuinsn_memoffset_reg(p, ORC_X86_or_rm_r, size, offset, src, dest)
 
 #define orc_x86_emit_cmp_reg_memoffset(p,size,src,offset,dest) \
   orc_x86_emit_cpuinsn_reg_memoffset(p, ORC_X86_cmp_r_rm, src, offset, dest)
@@ -106,6 +110,8 @@ void orc_x86_emit_pop (OrcCompiler *compiler, int size, int reg);
   orc_x86_emit_cpuinsn_branch (p, ORC_X86_jmp, label)
 #define orc_x86_emit_jg(p,label) \
   orc_x86_emit_cpuinsn_branch (p, ORC_X86_jg, label)
+#define orc_x86_emit_jl(p,label) \
+  orc_x86_emit_cpuinsn_branch (p, ORC_X86_jl, label)
 #define orc_x86_emit_jle(p,label) \
   orc_x86_emit_cpuinsn_branch (p, ORC_X86_jle, label)
 #define orc_x86_emit_je(p,label) \
@@ -162,6 +168,8 @@ void orc_x86_emit_cpuinsn_size (OrcCompiler *p, int opcode, int size,
     int src, int dest);
 void orc_x86_emit_cpuinsn_imm (OrcCompiler *p, int opcode, int imm,
     int src, int dest);
+void orc_x86_emit_cpuinsn_imm_size (OrcCompiler *p, int opcode, int size,
+    int imm, int src, int dest);
 void orc_x86_emit_cpuinsn_load_memoffset (OrcCompiler *p, int size, int index,
     int offset, int src, int dest, int imm);
 void orc_x86_emit_cpuinsn_store_memoffset (OrcCompiler *p, int size, int index,
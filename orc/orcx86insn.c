@@ -7,7 +7,9 @@
 #include <orc/orccpuinsn.h>
 #include <orc/orcx86.h>
 #include <orc/orcsse.h>
+#include <orc/orcavx.h>
 #include <orc/orcmmx.h>
+#include <orc/orcinternal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -28,7 +30,7 @@ static const OrcSysOpcode orc_x86_opcodes[] = {
   { "packssdw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f6b },
   { "punpcklqdq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f6c },
   { "punpckhqdq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f6d },
-  { "movdqa", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f6f },
+  { "movdqa", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f6f },
   { "psraw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0fe1 },
   { "psrlw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0fd1 },
   { "psllw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0ff1 },
@@ -87,26 +89,26 @@ static const OrcSysOpcode orc_x86_opcodes[] = {
   { "psignw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3809 },
   { "psignd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f380a },
   { "pmulhrsw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f380b },
-  { "pabsb", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f381c },
-  { "pabsw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f381d },
-  { "pabsd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f381e },
-  { "pmovsxbw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3820 },
-  { "pmovsxbd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3821 },
-  { "pmovsxbq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3822 },
-  { "pmovsxwd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3823 },
-  { "pmovsxwq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3824 },
-  { "pmovsxdq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3825 },
+  { "pabsb", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f381c },
+  { "pabsw", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f381d },
+  { "pabsd", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f381e },
+  { "pmovsxbw", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3820 },
+  { "pmovsxbd", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3821 },
+  { "pmovsxbq", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3822 },
+  { "pmovsxwd", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3823 },
+  { "pmovsxwq", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3824 },
+  { "pmovsxdq", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3825 },
   { "pmuldq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3828 },
   { "pcmpeqq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3829 },
   { "packusdw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f382b },
-  { "pmovzxbw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3830 },
-  { "pmovzxbd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3831 },
-  { "pmovzxbq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3832 },
-  { "pmovzxwd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3833 },
-  { "pmovzxwq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3834 },
-  { "pmovzxdq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3835 },
+  { "pmovzxbw", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3830 },
+  { "pmovzxbd", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3831 },
+  { "pmovzxbq", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3832 },
+  { "pmovzxwd", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3833 },
+  { "pmovzxwq", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3834 },
+  { "pmovzxdq", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3835 },
   { "pmulld", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3840 },
-  { "phminposuw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3841 },
+  { "phminposuw", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f3841 },
   { "pminsb", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3838 },
   { "pminsd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f3839 },
   { "pminuw", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x01, 0x0f383a },
@@ -120,24 +122,24 @@ static const OrcSysOpcode orc_x86_opcodes[] = {
   { "subps", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f5c },
   { "mulps", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f59 },
   { "divps", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f5e },
-  { "sqrtps", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f51 },
+  { "sqrtps", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x00, 0x0f51 },
   { "addpd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x66, 0x0f58 },
   { "subpd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x66, 0x0f5c },
   { "mulpd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x66, 0x0f59 },
   { "divpd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x66, 0x0f5e },
-  { "sqrtpd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x66, 0x0f51 },
+  { "sqrtpd", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x66, 0x0f51 },
   { "cmpeqps", ORC_X86_INSN_TYPE_SSEM_SSE, 0, 0x00, 0x0fc2, 0 },
   { "cmpeqpd", ORC_X86_INSN_TYPE_SSEM_SSE, 0, 0x66, 0x0fc2, 0 },
   { "cmpltps", ORC_X86_INSN_TYPE_SSEM_SSE, 0, 0x00, 0x0fc2, 1 },
   { "cmpltpd", ORC_X86_INSN_TYPE_SSEM_SSE, 0, 0x66, 0x0fc2, 1 },
   { "cmpleps", ORC_X86_INSN_TYPE_SSEM_SSE, 0, 0x00, 0x0fc2, 2 },
   { "cmplepd", ORC_X86_INSN_TYPE_SSEM_SSE, 0, 0x66, 0x0fc2, 2 },
-  { "cvttps2dq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0xf3, 0x0f5b },
-  { "cvttpd2dq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x66, 0x0fe6 },
-  { "cvtdq2ps", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f5b },
-  { "cvtdq2pd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0xf3, 0x0fe6 },
-  { "cvtps2pd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f5a },
-  { "cvtpd2ps", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x66, 0x0f5a },
+  { "cvttps2dq", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0xf3, 0x0f5b },
+  { "cvttpd2dq", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x66, 0x0fe6 },
+  { "cvtdq2ps", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x00, 0x0f5b },
+  { "cvtdq2pd", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0xf3, 0x0fe6 },
+  { "cvtps2pd", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x00, 0x0f5a },
+  { "cvtpd2ps", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x66, 0x0f5a },
   { "minps", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f5d },
   { "minpd", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x66, 0x0f5d },
   { "maxps", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f5f },
@@ -152,15 +154,15 @@ static const OrcSysOpcode orc_x86_opcodes[] = {
   { "psllq", ORC_X86_INSN_TYPE_IMM8_MMX_SHIFT, 0, 0x01, 0x0f73, 6 },
   { "psrldq", ORC_X86_INSN_TYPE_IMM8_MMX_SHIFT, 0, 0x01, 0x0f73, 3 },
   { "pslldq", ORC_X86_INSN_TYPE_IMM8_MMX_SHIFT, 0, 0x01, 0x0f73, 7 },
-  { "pshufd", ORC_X86_INSN_TYPE_IMM8_MMXM_MMX, 0, 0x66, 0x0f70 },
-  { "pshuflw", ORC_X86_INSN_TYPE_IMM8_MMXM_MMX, 0, 0xf2, 0x0f70 },
-  { "pshufhw", ORC_X86_INSN_TYPE_IMM8_MMXM_MMX, 0, 0xf3, 0x0f70 },
+  { "pshufd", ORC_X86_INSN_TYPE_IMM8_MMXM_MMX, ORC_X86_VEX_UNARY, 0x66, 0x0f70 },
+  { "pshuflw", ORC_X86_INSN_TYPE_IMM8_MMXM_MMX, ORC_X86_VEX_UNARY, 0xf2, 0x0f70 },
+  { "pshufhw", ORC_X86_INSN_TYPE_IMM8_MMXM_MMX, ORC_X86_VEX_UNARY, 0xf3, 0x0f70 },
   { "palignr", ORC_X86_INSN_TYPE_IMM8_MMXM_MMX, 0, 0x66, 0x0f3a0f },
   { "pinsrw", ORC_X86_INSN_TYPE_IMM8_REGM_MMX, 0, 0x01, 0x0fc4 },
-  { "movd", ORC_X86_INSN_TYPE_REGM_MMX, 0, 0x01, 0x0f6e },
-  { "movq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0xf3, 0x0f7e },
-  { "movdqa", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x66, 0x0f6f },
-  { "movdqu", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0xf3, 0x0f6f },
+  { "movd", ORC_X86_INSN_TYPE_REGM_MMX, ORC_X86_VEX_UNARY, 0x01, 0x0f6e },
+  { "movq", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0xf3, 0x0f7e },
+  { "movdqa", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0x66, 0x0f6f },
+  { "movdqu", ORC_X86_INSN_TYPE_MMXM_MMX, ORC_X86_VEX_UNARY, 0xf3, 0x0f6f },
   { "movhps", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f16 },
   { "pextrw", ORC_X86_INSN_TYPE_IMM8_MMX_REG_REV, 0, 0x01, 0x0f3a15 },
   { "movd", ORC_X86_INSN_TYPE_MMX_REGM_REV, 0, 0x01, 0x0f7e },
@@ -254,6 +256,9 @@ static const OrcSysOpcode orc_x86_opcodes[] = {
   { "pshufw", ORC_X86_INSN_TYPE_IMM8_MMXM_MMX, 0, 0x00, 0x0f70 },
   { "movq", ORC_X86_INSN_TYPE_MMXM_MMX, 0, 0x00, 0x0f6f },
   { "movq", ORC_X86_INSN_TYPE_MMXM_MMX_REV, 0, 0x00, 0x0f7f },
+  { "vpermq", ORC_X86_INSN_TYPE_IMM8_MMXM_MMX,
+    ORC_X86_VEX_ONLY|ORC_X86_VEX_UNARY|ORC_X86_VEX_W1, 0x66, 0x0f3a00 },
+  { "vzeroupper", ORC_X86_INSN_TYPE_NONE, ORC_X86_VEX_ONLY, 0x00, 0x0f77 },
 };
 
 static void
@@ -281,6 +286,65 @@ output_opcode (OrcCompiler *p, const OrcSysOpcode *opcode, int size,
   *p->codeptr++ = (opcode->code >> 0) & 0xff;
 }
 
+/* VEX prefix, in place of the legacy prefix, REX and escape bytes.
+ * rm and index are the registers in the ModRM and SIB bytes, and reg
+ * the one in the reg field.  vvvv is the first source of the three
+ * operand forms, which is always the destination, so that they work
+ * in place like the legacy ones. */
+static void
+output_vex (OrcCompiler *p, const OrcSysOpcode *opcode, int size,
+    int rm, int reg, int index, int vvvv)
+{
+  int pp;
+  int map;
+  int r, x, b, w, l;
+
+  switch (opcode->prefix) {
+    case 0x01:
+    case 0x66:
+      pp = 1;
+      break;
+    case 0xf3:
+      pp = 2;
+      break;
+    case 0xf2:
+      pp = 3;
+      break;
+    default:
+      pp = 0;
+      break;
+  }
+  if ((opcode->code & 0xffff00) == 0x0f3800) {
+    map = 2;
+  } else if ((opcode->code & 0xffff00) == 0x0f3a00) {
+    map = 3;
+  } else {
+    map = 1;
+  }
+  r = !(reg & 8);
+  x = !(index & 8);
+  b = !(rm & 8);
+  w = (opcode->flags & ORC_X86_VEX_W1) ? 1 : 0;
+  l = (size == 32);
+
+  if (x && b && !w && map == 1) {
+    *p->codeptr++ = 0xc5;
+    *p->codeptr++ = (r<<7) | ((~vvvv & 0xf)<<3) | (l<<2) | pp;
+  } else {
+    *p->codeptr++ = 0xc4;
+    *p->codeptr++ = (r<<7) | (x<<6) | (b<<5) | map;
+    *p->codeptr++ = (w<<7) | ((~vvvv & 0xf)<<3) | (l<<2) | pp;
+  }
+  *p->codeptr++ = opcode->code & 0xff;
+}
+
+static int
+use_vex (OrcCompiler *p, OrcX86Insn *xinsn, int is_sse)
+{
+  if (xinsn->opcode->flags & ORC_X86_VEX_ONLY) return TRUE;
+  return p->use_vex && is_sse;
+}
+
 const char *
 orc_x86_get_regname_mmxsse (int reg, int is_sse)
 {
@@ -297,13 +361,62 @@ is_sse_reg (int reg)
   return (reg >= X86_XMM0) && (reg <= X86_XMM15);
 }
 
+/* The VEX forms of size 32 use ymm registers, except for the shift
+ * counts and the sources of the sign and zero extensions */
+static const char *
+get_regname_vex (OrcX86Insn *xinsn, int reg, int is_src)
+{
+  if (xinsn->size != 32) return orc_x86_get_regname_sse (reg);
+  if (is_src) {
+    switch (xinsn->opcode_index) {
+      case ORC_X86_psraw:
+      case ORC_X86_psrlw:
+      case ORC_X86_psllw:
+      case ORC_X86_psrad:
+      case ORC_X86_psrld:
+      case ORC_X86_pslld:
+      case ORC_X86_psrlq:
+      case ORC_X86_psllq:
+      case ORC_X86_psrlq_reg:
+      case ORC_X86_pmovsxbw:
+      case ORC_X86_pmovsxbd:
+      case ORC_X86_pmovsxbq:
+      case ORC_X86_pmovsxwd:
+      case ORC_X86_pmovsxwq:
+      case ORC_X86_pmovsxdq:
+      case ORC_X86_pmovzxbw:
+      case ORC_X86_pmovzxbd:
+      case ORC_X86_pmovzxbq:
+      case ORC_X86_pmovzxwd:
+      case ORC_X86_pmovzxwq:
+      case ORC_X86_pmovzxdq:
+      case ORC_X86_cvtdq2pd:
+      case ORC_X86_cvtps2pd:
+        return orc_x86_get_regname_sse (reg);
+      default:
+        break;
+    }
+  }
+  return orc_x86_get_regname_avx (reg);
+}
+
+static const char *
+get_regname_vec (OrcX86Insn *xinsn, int reg, int is_sse, int is_vex,
+    int is_src)
+{
+  if (is_vex) return get_regname_vex (xinsn, reg, is_src);
+  return orc_x86_get_regname_mmxsse (reg, is_sse);
+}
+
 void
 orc_x86_insn_output_asm (OrcCompiler *p, OrcX86Insn *xinsn)
 {
   char imm_str[40] = { 0 };
   char op1_str[40] = { 0 };
   char op2_str[40] = { 0 };
+  char vvvv_str[40] = { 0 };
   int is_sse;
+  int is_vex;
 
   if (xinsn->opcode->type == ORC_X86_INSN_TYPE_ALIGN) {
     if (xinsn->size > 0) ORC_ASM_CODE(p,".p2align %d\n", xinsn->size);
@@ -318,6 +431,7 @@ orc_x86_insn_output_asm (OrcCompiler *p, OrcX86Insn *xinsn)
   if (is_sse_reg (xinsn->src) || is_sse_reg (xinsn->dest)) {
     is_sse = TRUE;
   }
+  is_vex = use_vex (p, xinsn, is_sse);
 
   switch (xinsn->opcode->type) {
     case ORC_X86_INSN_TYPE_MMXM_MMX:
@@ -361,7 +475,7 @@ orc_x86_insn_output_asm (OrcCompiler *p, OrcX86Insn *xinsn)
     case ORC_X86_INSN_TYPE_IMM8_MMXM_MMX:
       if (xinsn->type == ORC_X86_RM_REG) {
         sprintf(op1_str, "%%%s, ",
-            orc_x86_get_regname_mmxsse (xinsn->src, is_sse));
+            get_regname_vec (xinsn, xinsn->src, is_sse, is_vex, TRUE));
       } else if (xinsn->type == ORC_X86_RM_MEMOFFSET) {
         sprintf(op1_str, "%d(%%%s), ", xinsn->offset,
             orc_x86_get_regname_ptr (p, xinsn->src));
@@ -379,7 +493,7 @@ orc_x86_insn_output_asm (OrcCompiler *p, OrcX86Insn *xinsn)
     case ORC_X86_INSN_TYPE_MMX_REGM_REV:
     case ORC_X86_INSN_TYPE_IMM8_MMX_REG_REV:
       sprintf(op1_str, "%%%s, ",
-            orc_x86_get_regname_mmxsse (xinsn->src, is_sse));
+            get_regname_vec (xinsn, xinsn->src, is_sse, is_vex, TRUE));
       break;
     case ORC_X86_INSN_TYPE_REGM_MMX:
     case ORC_X86_INSN_TYPE_REGM_REG:
@@ -436,13 +550,13 @@ orc_x86_insn_output_asm (OrcCompiler *p, OrcX86Insn *xinsn)
     case ORC_X86_INSN_TYPE_REGM_MMX:
     case ORC_X86_INSN_TYPE_IMM8_MMX_SHIFT:
       sprintf(op2_str, "%%%s",
-            orc_x86_get_regname_mmxsse (xinsn->dest, is_sse));
+            get_regname_vec (xinsn, xinsn->dest, is_sse, is_vex, FALSE));
       break;
     case ORC_X86_INSN_TYPE_MMXM_MMX_REV:
     case ORC_X86_INSN_TYPE_SSEM_SSE_REV:
       if (xinsn->type == ORC_X86_RM_REG) {
         sprintf(op2_str, "%%%s",
-            orc_x86_get_regname_mmxsse (xinsn->dest, is_sse));
+            get_regname_vec (xinsn, xinsn->dest, is_sse, is_vex, FALSE));
       } else if (xinsn->type == ORC_X86_RM_MEMOFFSET) {
         sprintf(op2_str, "%d(%%%s)", xinsn->offset,
             orc_x86_get_regname_ptr (p, xinsn->dest));
@@ -514,6 +628,29 @@ orc_x86_insn_output_asm (OrcCompiler *p, OrcX86Insn *xinsn)
       break;
   }
 
+  if (is_vex) {
+    /* the three operand forms also name the destination as the first
+     * source */
+    if (!(xinsn->opcode->flags & ORC_X86_VEX_UNARY)) {
+      switch (xinsn->opcode->type) {
+        case ORC_X86_INSN_TYPE_IMM8_MMX_SHIFT:
+        case ORC_X86_INSN_TYPE_MMXM_MMX:
+        case ORC_X86_INSN_TYPE_SSEM_SSE:
+        case ORC_X86_INSN_TYPE_IMM8_MMXM_MMX:
+        case ORC_X86_INSN_TYPE_IMM8_REGM_MMX:
+          sprintf(vvvv_str, "%%%s, ",
+              get_regname_vex (xinsn, xinsn->dest, FALSE));
+          break;
+        default:
+          break;
+      }
+    }
+    ORC_ASM_CODE(p,"  %s%s %s%s%s%s\n",
+        (xinsn->opcode->flags & ORC_X86_VEX_ONLY) ? "" : "v",
+        xinsn->opcode->name, imm_str, op1_str, vvvv_str, op2_str);
+    return;
+  }
+
   ORC_ASM_CODE(p,"  %s %s%s%s\n", xinsn->opcode->name,
       imm_str, op1_str, op2_str);
 
@@ -571,6 +708,43 @@ orc_x86_insn_output_opcode (OrcCompiler *p, OrcX86Insn *xinsn)
     is_sse = TRUE;
   }
 
+  if (use_vex (p, xinsn, is_sse)) {
+    int index = 0;
+    int vvvv = 0;
+
+    if (xinsn->type == ORC_X86_RM_MEMINDEX) index = xinsn->index_reg;
+    switch (xinsn->opcode->type) {
+      case ORC_X86_INSN_TYPE_IMM8_MMX_SHIFT:
+        output_vex (p, xinsn->opcode, xinsn->size, xinsn->dest, 0, index,
+            xinsn->dest);
+        break;
+      case ORC_X86_INSN_TYPE_MMX_REGM_REV:
+      case ORC_X86_INSN_TYPE_MMXM_MMX_REV:
+      case ORC_X86_INSN_TYPE_SSEM_SSE_REV:
+      case ORC_X86_INSN_TYPE_IMM8_MMX_REG_REV:
+        output_vex (p, xinsn->opcode, xinsn->size, xinsn->dest, xinsn->src,
+            index, 0);
+        break;
+      case ORC_X86_INSN_TYPE_IMM8_MMXM_MMX:
+      case ORC_X86_INSN_TYPE_MMXM_MMX:
+      case ORC_X86_INSN_TYPE_SSEM_SSE:
+      case ORC_X86_INSN_TYPE_REGM_MMX:
+      case ORC_X86_INSN_TYPE_IMM8_REGM_MMX:
+        if (!(xinsn->opcode->flags & ORC_X86_VEX_UNARY)) vvvv = xinsn->dest;
+        output_vex (p, xinsn->opcode, xinsn->size, xinsn->src, xinsn->dest,
+            index, vvvv);
+        break;
+      case ORC_X86_INSN_TYPE_NONE:
+        output_vex (p, xinsn->opcode, xinsn->size, 0, 0, 0, 0);
+        break;
+      default:
+        ORC_ERROR("%d", xinsn->opcode->type);
+        ORC_ASSERT(0);
+        break;
+    }
+    return;
+  }
+
   switch (xinsn->opcode->type) {
     case ORC_X86_INSN_TYPE_IMM8_MMX_SHIFT:
       output_opcode (p, xinsn->opcode, 4, xinsn->dest, 0, is_sse);
@@ -628,9 +802,12 @@ orc_x86_insn_output_opcode (OrcCompiler *p, OrcX86Insn *xinsn)
         }
       }
       break;
+    case ORC_X86_INSN_TYPE_STACK:
+      /* r8-r15 */
+      orc_x86_emit_rex (p, 4, 0, 0, xinsn->dest);
+      break;
     case ORC_X86_INSN_TYPE_LABEL:
     case ORC_X86_INSN_TYPE_BRANCH:
-    case ORC_X86_INSN_TYPE_STACK:
       break;
     default:
       ORC_ERROR("%d", xinsn->opcode->type);
@@ -813,17 +990,23 @@ orc_x86_get_output_insn (OrcCompiler *p)
 {
   OrcX86Insn *xinsn;
   if (p->n_output_insns >= p->n_output_insns_alloc) {
-    p->n_output_insns_alloc += 10;
+    p->n_output_insns_alloc = p->n_output_insns_alloc ?
+      2 * p->n_output_insns_alloc : 256;
     p->output_insns = realloc (p->output_insns,
         sizeof(OrcX86Insn) * p->n_output_insns_alloc);
   }
 
   xinsn = ((OrcX86Insn *)p->output_insns) + p->n_output_insns;
   memset (xinsn, 0, sizeof(OrcX86Insn));
-  p->n_output_insns++;
+  /* during the analysis pass the same slot is reused, and nothing is
+   * added to the output */
+  if (!p->analysis_pass) p->n_output_insns++;
   return xinsn;
 }
 
+/* Encodes all the instructions to find their offsets.  The encoding
+ * is left in place: once no branch changes size, it is the final code,
+ * and orc_x86_output_insns() doesn't need to encode it again. */
 void
 orc_x86_recalc_offsets (OrcCompiler *p)
 {
@@ -831,8 +1014,15 @@ orc_x86_recalc_offsets (OrcCompiler *p)
   int i;
   unsigned char *minptr;
 
+  /* no instruction, or alignment padding, is longer than 15 bytes */
+  if (!_orc_compiler_grow_code (p, p->n_output_insns * 15)) {
+    /* the compile failed, so there is nothing to encode */
+    p->n_output_insns = 0;
+  }
+
   minptr = p->code;
   p->codeptr = p->code;
+  p->n_fixups = 0;
   for(i=0;i<p->n_output_insns;i++){
     unsigned char *ptr;
 
@@ -857,9 +1047,6 @@ orc_x86_recalc_offsets (OrcCompiler *p)
     }
 
   }
-
-  p->codeptr = p->code;
-  p->n_fixups = 0;
 }
 
 void
@@ -915,16 +1102,25 @@ void
 orc_x86_output_insns (OrcCompiler *p)
 {
   OrcX86Insn *xinsn;
+  int encoded;
   int i;
 
+  /* already done by orc_x86_calculate_offsets() */
+  encoded = (p->codeptr != p->code);
+  if (encoded && p->defer_asm_code) return;
+
   for(i=0;i<p->n_output_insns;i++){
     xinsn = ((OrcX86Insn *)p->output_insns) + i;
 
-    orc_x86_insn_output_asm (p, xinsn);
+    if (!p->defer_asm_code) {
+      orc_x86_insn_output_asm (p, xinsn);
+    }
 
-    orc_x86_insn_output_opcode (p, xinsn);
-    orc_x86_insn_output_modrm (p, xinsn);
-    orc_x86_insn_output_immediate (p, xinsn);
+    if (!encoded) {
+      orc_x86_insn_output_opcode (p, xinsn);
+      orc_x86_insn_output_modrm (p, xinsn);
+      orc_x86_insn_output_immediate (p, xinsn);
+    }
   }
 }
 
@@ -957,6 +1153,22 @@ orc_x86_emit_cpuinsn_imm (OrcCompiler *p, int index, int imm, int src, int dest)
   xinsn->size = 4;
 }
 
+void
+orc_x86_emit_cpuinsn_imm_size (OrcCompiler *p, int index, int size, int imm,
+    int src, int dest)
+{
+  OrcX86Insn *xinsn = orc_x86_get_output_insn (p);
+  const OrcSysOpcode *opcode = orc_x86_opcodes + index;
+
+  xinsn->opcode_index = index;
+  xinsn->opcode = opcode;
+  xinsn->imm = imm;
+  xinsn->src = src;
+  xinsn->dest = dest;
+  xinsn->type = ORC_X86_RM_REG;
+  xinsn->size = size;
+}
+
 void
 orc_x86_emit_cpuinsn_load_memoffset (OrcCompiler *p, int index, int size,
     int imm, int offset, int src, int dest)
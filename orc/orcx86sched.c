@@ -0,0 +1,1379 @@
+
+#include "config.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <orc/orcprogram.h>
+#include <orc/orcdebug.h>
+#include <orc/orcx86.h>
+#include <orc/orcx86insn.h>
+#include <orc/orcsse.h>
+#include <orc/orcinternal.h>
+
+/*
+ * Instruction scheduling for the x86 backends
+ *
+ * The MMX and SSE backends keep the whole function as a list of
+ * OrcX86Insn in compiler->output_insns until it is encoded.  Before
+ * that, each run of instructions between labels, branches and the
+ * instructions that are not modelled here (anything that touches the
+ * flags or the stack, or uses registers that are not in its operands)
+ * is reordered by a list scheduler.  The rules emit long dependent
+ * chains, and the unrolled copies of the loop body follow each other,
+ * so there is usually something independent to fill the gaps with.
+ *
+ * The unrolled copies use the same registers, which would keep them in
+ * order.  So first, a value that is written in full and overwritten
+ * again in the same run is moved to a vector register that is not used
+ * anywhere in the function, if there are any.  Registers that the
+ * function would have to save are not used, because the prologue is
+ * already written.
+ *
+ * Memory accesses stay in order, except for loads among themselves,
+ * accesses through the same base register that don't overlap, and
+ * accesses to a source array and to a destination array, which don't
+ * overlap as everywhere else in Orc.
+ *
+ * The latencies and throughputs are rough figures for the main x86
+ * families, picked by orc_x86_microarchitecture.  The scheduler is
+ * turned off with ORC_CODE=-sched, or ORC_CODE=-opt.
+ *
+ * The same operand model drives a peephole stage that runs before the
+ * scheduler, on the same loops.  Within each run it drops
+ * instructions that write a value the register already holds (self
+ * moves, moves back and forth, zeroing or constant loads that are
+ * repeated), folds a load into the one instruction that uses it, and
+ * drops instructions whose result is overwritten before it is read.
+ * Registers are assumed live at the end of a run.  It is turned off
+ * with ORC_CODE=-peephole, or ORC_CODE=-opt.
+ */
+
+/* longest run that is scheduled at once, which bounds the quadratic
+ * parts below */
+#define ORC_X86_SCHED_WINDOW 128
+
+/* Most edges a run can have.  Each instruction gets at most 4 edges
+ * from the writers of what it reads and 1 from the last writer of what
+ * it writes, and each of the 4 reads of an instruction leads to at most
+ * 1 edge to the next writer of the register.  Memory accesses can
+ * depend on every earlier one. */
+#define ORC_X86_SCHED_MAX_EDGES \
+  (ORC_X86_SCHED_WINDOW * (ORC_X86_SCHED_WINDOW - 1) / 2 + \
+   9 * ORC_X86_SCHED_WINDOW)
+
+enum {
+  ORC_X86_SCHED_ALU,
+  ORC_X86_SCHED_SHIFT,
+  ORC_X86_SCHED_SHUFFLE,
+  ORC_X86_SCHED_MUL,
+  ORC_X86_SCHED_MULD,
+  ORC_X86_SCHED_SAD,
+  ORC_X86_SCHED_FADD,
+  ORC_X86_SCHED_FMUL,
+  ORC_X86_SCHED_FDIV,
+  ORC_X86_SCHED_LOAD,
+  ORC_X86_SCHED_STORE,
+  ORC_X86_SCHED_GP,
+  ORC_X86_SCHED_N_CLASSES
+};
+
+enum {
+  ORC_X86_SCHED_MEM_NONE = 0,
+  ORC_X86_SCHED_MEM_READ,
+  ORC_X86_SCHED_MEM_WRITE
+};
+
+typedef struct _OrcX86SchedModel OrcX86SchedModel;
+struct _OrcX86SchedModel {
+  const char *name;
+  int issue_width;
+  /* cycles until the result can be used */
+  int latency[ORC_X86_SCHED_N_CLASSES];
+  /* cycles until the next instruction of the same class can start, or
+   * 0 if only issue_width limits it */
+  int interval[ORC_X86_SCHED_N_CLASSES];
+};
+
+static const OrcX86SchedModel orc_x86_sched_models[] = {
+  /* Core 2 and later, K10 and later */
+  { "generic", 3,
+    { 1, 1, 1, 3, 5, 3, 3, 4, 14, 4, 1, 1 },
+    { 0, 1, 1, 1, 2, 1, 1, 1, 10, 0, 1, 0 } },
+  /* Atom, in order */
+  { "bonnell", 2,
+    { 1, 1, 1, 5, 5, 5, 5, 5, 70, 3, 1, 1 },
+    { 0, 1, 1, 2, 2, 2, 1, 2, 70, 1, 1, 0 } },
+  /* Pentium 4 */
+  { "netburst", 3,
+    { 2, 2, 2, 8, 8, 4, 4, 6, 40, 6, 1, 1 },
+    { 2, 2, 2, 2, 2, 2, 2, 2, 40, 1, 1, 0 } },
+  /* K7 and K8, which split 128-bit operations in two */
+  { "k8", 3,
+    { 2, 2, 2, 3, 3, 4, 4, 4, 18, 3, 1, 1 },
+    { 1, 1, 1, 2, 2, 2, 2, 2, 18, 1, 1, 0 } },
+};
+
+typedef struct _OrcX86SchedInsn OrcX86SchedInsn;
+struct _OrcX86SchedInsn {
+  /* register operands, as pointers to the fields of the OrcX86Insn so
+   * that they can be renamed */
+  int *read_fields[2];
+  int n_read_fields;
+  int *write_fields[2];
+  int n_write_fields;
+  /* the register written doesn't depend on its old value */
+  int full_write;
+
+  int mem;
+  int *base_field;
+  int index_reg;
+  int width;
+
+  int class;
+  int latency;
+
+  /* for renaming */
+  int read_range[2];
+  int write_range;
+
+  /* for scheduling */
+  int priority;
+  int n_preds;
+  int ready;
+  int first_succ;
+};
+
+typedef struct _OrcX86SchedEdge OrcX86SchedEdge;
+struct _OrcX86SchedEdge {
+  unsigned char to;
+  unsigned char latency;
+  short next;
+};
+
+typedef struct _OrcX86SchedRange OrcX86SchedRange;
+struct _OrcX86SchedRange {
+  int reg;
+  int start;
+  int end;
+  int killed;
+  int new_reg;
+};
+
+static int orc_x86_sched_disabled;
+static int orc_x86_peephole_disabled;
+
+/* Called from orc_init() */
+void
+_orc_x86_schedule_init (void)
+{
+  orc_x86_sched_disabled = orc_compiler_flag_check ("-opt") ||
+    orc_compiler_flag_check ("-sched");
+  orc_x86_peephole_disabled = orc_compiler_flag_check ("-opt") ||
+    orc_compiler_flag_check ("-peephole");
+}
+
+static const OrcX86SchedModel *
+orc_x86_sched_get_model (void)
+{
+#if defined(HAVE_AMD64) || defined(HAVE_I386)
+  switch (orc_x86_microarchitecture) {
+    case ORC_X86_BONNELL:
+      return orc_x86_sched_models + 1;
+    case ORC_X86_NETBURST:
+      return orc_x86_sched_models + 2;
+    case ORC_X86_K7:
+    case ORC_X86_K8:
+      return orc_x86_sched_models + 3;
+    default:
+      break;
+  }
+#endif
+  return orc_x86_sched_models + 0;
+}
+
+static int
+is_vector_reg (int reg)
+{
+  return reg >= ORC_VEC_REG_BASE && reg < ORC_VEC_REG_BASE + 32;
+}
+
+static int
+orc_x86_sched_get_class (int opcode_index)
+{
+  switch (opcode_index) {
+    case ORC_X86_psraw:
+    case ORC_X86_psrlw:
+    case ORC_X86_psllw:
+    case ORC_X86_psrad:
+    case ORC_X86_psrld:
+    case ORC_X86_pslld:
+    case ORC_X86_psrlq:
+    case ORC_X86_psllq:
+    case ORC_X86_psrldq:
+    case ORC_X86_pslldq:
+    case ORC_X86_psrlq_reg:
+    case ORC_X86_psraw_imm:
+    case ORC_X86_psrlw_imm:
+    case ORC_X86_psllw_imm:
+    case ORC_X86_psrad_imm:
+    case ORC_X86_psrld_imm:
+    case ORC_X86_pslld_imm:
+    case ORC_X86_psrlq_imm:
+    case ORC_X86_psllq_imm:
+      return ORC_X86_SCHED_SHIFT;
+    case ORC_X86_punpcklbw:
+    case ORC_X86_punpcklwd:
+    case ORC_X86_punpckldq:
+    case ORC_X86_punpckhbw:
+    case ORC_X86_punpckhwd:
+    case ORC_X86_punpckhdq:
+    case ORC_X86_punpcklqdq:
+    case ORC_X86_punpckhqdq:
+    case ORC_X86_packsswb:
+    case ORC_X86_packuswb:
+    case ORC_X86_packssdw:
+    case ORC_X86_packusdw:
+    case ORC_X86_pshufb:
+    case ORC_X86_pshufd:
+    case ORC_X86_pshuflw:
+    case ORC_X86_pshufhw:
+    case ORC_X86_pshufw:
+    case ORC_X86_palignr:
+    case ORC_X86_psrldq_imm:
+    case ORC_X86_pslldq_imm:
+    case ORC_X86_phaddw:
+    case ORC_X86_phaddd:
+    case ORC_X86_phaddsw:
+    case ORC_X86_phsubw:
+    case ORC_X86_phsubd:
+    case ORC_X86_phsubsw:
+    case ORC_X86_pmovsxbw:
+    case ORC_X86_pmovsxbd:
+    case ORC_X86_pmovsxbq:
+    case ORC_X86_pmovsxwd:
+    case ORC_X86_pmovsxwq:
+    case ORC_X86_pmovsxdq:
+    case ORC_X86_pmovzxbw:
+    case ORC_X86_pmovzxbd:
+    case ORC_X86_pmovzxbq:
+    case ORC_X86_pmovzxwd:
+    case ORC_X86_pmovzxwq:
+    case ORC_X86_pmovzxdq:
+    case ORC_X86_pinsrw:
+    case ORC_X86_pextrw:
+    case ORC_X86_movhps_load:
+    case ORC_X86_movd_load:
+    case ORC_X86_movd_store:
+    case ORC_X86_vpermq:
+      return ORC_X86_SCHED_SHUFFLE;
+    case ORC_X86_pmullw:
+    case ORC_X86_pmulhw:
+    case ORC_X86_pmulhuw:
+    case ORC_X86_pmuludq:
+    case ORC_X86_pmuldq:
+    case ORC_X86_pmaddwd:
+    case ORC_X86_pmaddubsw:
+    case ORC_X86_pmulhrsw:
+      return ORC_X86_SCHED_MUL;
+    case ORC_X86_pmulld:
+      return ORC_X86_SCHED_MULD;
+    case ORC_X86_psadbw:
+    case ORC_X86_phminposuw:
+      return ORC_X86_SCHED_SAD;
+    case ORC_X86_addps:
+    case ORC_X86_subps:
+    case ORC_X86_addpd:
+    case ORC_X86_subpd:
+    case ORC_X86_minps:
+    case ORC_X86_minpd:
+    case ORC_X86_maxps:
+    case ORC_X86_maxpd:
+    case ORC_X86_cmpeqps:
+    case ORC_X86_cmpeqpd:
+    case ORC_X86_cmpltps:
+    case ORC_X86_cmpltpd:
+    case ORC_X86_cmpleps:
+    case ORC_X86_cmplepd:
+    case ORC_X86_cvttps2dq:
+    case ORC_X86_cvttpd2dq:
+    case ORC_X86_cvtdq2ps:
+    case ORC_X86_cvtdq2pd:
+    case ORC_X86_cvtps2pd:
+    case ORC_X86_cvtpd2ps:
+      return ORC_X86_SCHED_FADD;
+    case ORC_X86_mulps:
+    case ORC_X86_mulpd:
+      return ORC_X86_SCHED_FMUL;
+    case ORC_X86_divps:
+    case ORC_X86_divpd:
+    case ORC_X86_sqrtps:
+    case ORC_X86_sqrtpd:
+      return ORC_X86_SCHED_FDIV;
+    case ORC_X86_movzx_rm_r:
+    case ORC_X86_movw_rm_r:
+    case ORC_X86_movl_rm_r:
+    case ORC_X86_mov_rm_r:
+    case ORC_X86_mov_imm32_r:
+    case ORC_X86_movb_r_rm:
+    case ORC_X86_movw_r_rm:
+    case ORC_X86_movl_r_rm:
+    case ORC_X86_mov_r_rm:
+    case ORC_X86_leal:
+    case ORC_X86_leaq:
+      return ORC_X86_SCHED_GP;
+    default:
+      return ORC_X86_SCHED_ALU;
+  }
+}
+
+/* Instructions whose register destination doesn't depend on its old
+ * value */
+static int
+orc_x86_sched_is_full_write (OrcX86Insn *xinsn)
+{
+  switch (xinsn->opcode_index) {
+    case ORC_X86_movdqa:
+    case ORC_X86_movdqa_load:
+    case ORC_X86_movdqu_load:
+    case ORC_X86_movq_sse_load:
+    case ORC_X86_movq_mmx_load:
+    case ORC_X86_movd_load:
+    case ORC_X86_movd_store:
+    case ORC_X86_movq_sse_store:
+    case ORC_X86_movq_mmx_store:
+    case ORC_X86_movdqa_store:
+    case ORC_X86_movdqu_store:
+    case ORC_X86_pextrw:
+    case ORC_X86_pshufd:
+    case ORC_X86_pshuflw:
+    case ORC_X86_pshufhw:
+    case ORC_X86_pshufw:
+    case ORC_X86_vpermq:
+    case ORC_X86_pabsb:
+    case ORC_X86_pabsw:
+    case ORC_X86_pabsd:
+    case ORC_X86_pmovsxbw:
+    case ORC_X86_pmovsxbd:
+    case ORC_X86_pmovsxbq:
+    case ORC_X86_pmovsxwd:
+    case ORC_X86_pmovsxwq:
+    case ORC_X86_pmovsxdq:
+    case ORC_X86_pmovzxbw:
+    case ORC_X86_pmovzxbd:
+    case ORC_X86_pmovzxbq:
+    case ORC_X86_pmovzxwd:
+    case ORC_X86_pmovzxwq:
+    case ORC_X86_pmovzxdq:
+    case ORC_X86_phminposuw:
+    case ORC_X86_sqrtps:
+    case ORC_X86_sqrtpd:
+    case ORC_X86_cvttps2dq:
+    case ORC_X86_cvttpd2dq:
+    case ORC_X86_cvtdq2ps:
+    case ORC_X86_cvtdq2pd:
+    case ORC_X86_cvtps2pd:
+    case ORC_X86_cvtpd2ps:
+    case ORC_X86_movzx_rm_r:
+    case ORC_X86_movl_rm_r:
+    case ORC_X86_mov_rm_r:
+    case ORC_X86_mov_imm32_r:
+    case ORC_X86_movl_r_rm:
+    case ORC_X86_mov_r_rm:
+    case ORC_X86_leal:
+    case ORC_X86_leaq:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+/* Instructions that give the same result for any value when both
+ * operands are the same register, such as pxor %xmm0, %xmm0 */
+static int
+orc_x86_sched_is_zero_idiom (OrcX86Insn *xinsn)
+{
+  if (xinsn->type != ORC_X86_RM_REG || xinsn->src != xinsn->dest) {
+    return FALSE;
+  }
+  switch (xinsn->opcode_index) {
+    case ORC_X86_pxor:
+    case ORC_X86_psubb:
+    case ORC_X86_psubw:
+    case ORC_X86_psubd:
+    case ORC_X86_psubq:
+    case ORC_X86_pcmpeqb:
+    case ORC_X86_pcmpeqw:
+    case ORC_X86_pcmpeqd:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static int
+orc_x86_sched_get_width (OrcX86Insn *xinsn)
+{
+  switch (xinsn->opcode_index) {
+    case ORC_X86_movzx_rm_r:
+    case ORC_X86_movb_r_rm:
+      return 1;
+    case ORC_X86_movw_rm_r:
+    case ORC_X86_movw_r_rm:
+    case ORC_X86_pinsrw:
+    case ORC_X86_pextrw:
+      return 2;
+    case ORC_X86_movl_rm_r:
+    case ORC_X86_movl_r_rm:
+    case ORC_X86_movd_load:
+    case ORC_X86_movd_store:
+      return 4;
+    case ORC_X86_mov_rm_r:
+    case ORC_X86_mov_r_rm:
+      return xinsn->size;
+    case ORC_X86_movq_sse_load:
+    case ORC_X86_movq_mmx_load:
+    case ORC_X86_movq_sse_store:
+    case ORC_X86_movq_mmx_store:
+    case ORC_X86_movhps_load:
+      return 8;
+    default:
+      return (xinsn->size == 32) ? 32 : 16;
+  }
+}
+
+/* Fills in the operands of an instruction.  Returns FALSE for the
+ * instructions that must stay where they are. */
+static int
+orc_x86_sched_get_operands (OrcX86Insn *xinsn, OrcX86SchedInsn *s)
+{
+  int *rm_field;
+  int rm_written;
+  int *reg_field;
+  int reg_read;
+
+  s->n_read_fields = 0;
+  s->n_write_fields = 0;
+  s->full_write = FALSE;
+  s->mem = ORC_X86_SCHED_MEM_NONE;
+  s->base_field = NULL;
+  s->index_reg = -1;
+  s->width = 0;
+
+  switch (xinsn->opcode->type) {
+    case ORC_X86_INSN_TYPE_MMXM_MMX:
+    case ORC_X86_INSN_TYPE_SSEM_SSE:
+    case ORC_X86_INSN_TYPE_IMM8_MMXM_MMX:
+    case ORC_X86_INSN_TYPE_IMM8_REGM_MMX:
+    case ORC_X86_INSN_TYPE_REGM_MMX:
+      rm_field = &xinsn->src;
+      rm_written = FALSE;
+      reg_field = &xinsn->dest;
+      reg_read = !orc_x86_sched_is_full_write (xinsn);
+      break;
+    case ORC_X86_INSN_TYPE_MMXM_MMX_REV:
+    case ORC_X86_INSN_TYPE_SSEM_SSE_REV:
+    case ORC_X86_INSN_TYPE_MMX_REGM_REV:
+    case ORC_X86_INSN_TYPE_IMM8_MMX_REG_REV:
+      rm_field = &xinsn->dest;
+      rm_written = TRUE;
+      reg_field = &xinsn->src;
+      reg_read = TRUE;
+      break;
+    case ORC_X86_INSN_TYPE_IMM8_MMX_SHIFT:
+      rm_field = NULL;
+      rm_written = FALSE;
+      reg_field = &xinsn->dest;
+      reg_read = TRUE;
+      break;
+    case ORC_X86_INSN_TYPE_REGM_REG:
+      if (orc_x86_sched_get_class (xinsn->opcode_index) != ORC_X86_SCHED_GP) {
+        return FALSE;
+      }
+      rm_field = &xinsn->src;
+      rm_written = FALSE;
+      reg_field = &xinsn->dest;
+      reg_read = !orc_x86_sched_is_full_write (xinsn);
+      break;
+    case ORC_X86_INSN_TYPE_REG_REGM:
+    case ORC_X86_INSN_TYPE_REG8_REGM:
+    case ORC_X86_INSN_TYPE_REG16_REGM:
+      if (orc_x86_sched_get_class (xinsn->opcode_index) != ORC_X86_SCHED_GP) {
+        return FALSE;
+      }
+      rm_field = &xinsn->dest;
+      rm_written = TRUE;
+      reg_field = &xinsn->src;
+      reg_read = TRUE;
+      break;
+    case ORC_X86_INSN_TYPE_IMM32_REGM_MOV:
+      s->write_fields[s->n_write_fields++] = &xinsn->dest;
+      s->full_write = TRUE;
+      s->class = ORC_X86_SCHED_GP;
+      return TRUE;
+    default:
+      return FALSE;
+  }
+
+  s->class = orc_x86_sched_get_class (xinsn->opcode_index);
+
+  if (rm_written) {
+    /* register source, register or memory destination */
+    s->read_fields[s->n_read_fields++] = reg_field;
+    if (xinsn->type == ORC_X86_RM_REG) {
+      s->write_fields[s->n_write_fields++] = rm_field;
+      s->full_write = orc_x86_sched_is_full_write (xinsn);
+      if (!s->full_write) {
+        s->read_fields[s->n_read_fields++] = rm_field;
+      }
+    } else {
+      s->mem = ORC_X86_SCHED_MEM_WRITE;
+      s->base_field = rm_field;
+      s->class = ORC_X86_SCHED_STORE;
+    }
+  } else {
+    /* register or memory source, register destination */
+    if (orc_x86_sched_is_zero_idiom (xinsn)) {
+      s->write_fields[s->n_write_fields++] = rm_field;
+      s->write_fields[s->n_write_fields++] = reg_field;
+      s->full_write = TRUE;
+      return TRUE;
+    }
+    if (rm_field && xinsn->type == ORC_X86_RM_REG) {
+      s->read_fields[s->n_read_fields++] = rm_field;
+    } else if (rm_field) {
+      s->base_field = rm_field;
+      if (xinsn->opcode_index != ORC_X86_leal &&
+          xinsn->opcode_index != ORC_X86_leaq) {
+        s->mem = ORC_X86_SCHED_MEM_READ;
+      }
+    }
+    if (reg_read) {
+      s->read_fields[s->n_read_fields++] = reg_field;
+    }
+    s->write_fields[s->n_write_fields++] = reg_field;
+    s->full_write = !reg_read;
+  }
+
+  if (s->base_field && xinsn->type == ORC_X86_RM_MEMINDEX) {
+    s->index_reg = xinsn->index_reg;
+  }
+  s->width = orc_x86_sched_get_width (xinsn);
+
+  return TRUE;
+}
+
+/* Whether two memory accesses, at least one of them a write, may
+ * touch the same bytes */
+static int
+orc_x86_sched_mem_conflict (OrcX86Insn *xa, OrcX86SchedInsn *a, OrcX86Insn *xb, OrcX86SchedInsn *b,
+    const int *array_type)
+{
+  int base_a = *a->base_field;
+  int base_b = *b->base_field;
+
+  if (base_a == base_b) {
+    if (xa->type != xb->type || a->index_reg != b->index_reg ||
+        (xa->type == ORC_X86_RM_MEMINDEX && xa->shift != xb->shift)) {
+      return TRUE;
+    }
+    return xa->offset < xb->offset + b->width &&
+      xb->offset < xa->offset + a->width;
+  }
+
+  /* sources don't overlap destinations */
+  if (array_type[base_a] && array_type[base_b] &&
+      array_type[base_a] != array_type[base_b]) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Moves the values that are written in full and overwritten again in
+ * the run to the free registers.  A free register can take several
+ * values as long as they are not live at the same time. */
+static int
+orc_x86_sched_rename (OrcX86SchedInsn *sinsns, int n,
+    const int *free_regs, int n_free_regs, int *next_free)
+{
+  OrcX86SchedRange ranges[ORC_X86_SCHED_WINDOW];
+  int cur_range[ORC_N_REGS];
+  int busy_until[32];
+  int n_ranges = 0;
+  int n_renamed = 0;
+  int i, j, k;
+
+  for(i=0;i<ORC_N_REGS;i++){
+    cur_range[i] = -1;
+  }
+
+  for(i=0;i<n;i++){
+    OrcX86SchedInsn *s = sinsns + i;
+    int reg;
+
+    for(k=0;k<s->n_read_fields;k++){
+      reg = *s->read_fields[k];
+      s->read_range[k] = is_vector_reg (reg) ? cur_range[reg] : -1;
+      if (s->read_range[k] >= 0) ranges[s->read_range[k]].end = i;
+    }
+
+    s->write_range = -1;
+    if (s->n_write_fields == 0) continue;
+    reg = *s->write_fields[0];
+    if (!is_vector_reg (reg)) continue;
+
+    if (s->full_write) {
+      if (cur_range[reg] >= 0) {
+        ranges[cur_range[reg]].killed = TRUE;
+      }
+      ranges[n_ranges].reg = reg;
+      ranges[n_ranges].start = i;
+      ranges[n_ranges].end = i;
+      ranges[n_ranges].killed = FALSE;
+      ranges[n_ranges].new_reg = reg;
+      cur_range[reg] = n_ranges;
+      n_ranges++;
+    }
+    s->write_range = cur_range[reg];
+    if (s->write_range >= 0) ranges[s->write_range].end = i;
+  }
+
+  /* the ranges are in the order they start */
+  for(j=0;j<n_free_regs;j++){
+    busy_until[j] = -1;
+  }
+  for(i=0;i<n_ranges;i++){
+    if (!ranges[i].killed) continue;
+    for(j=0;j<n_free_regs;j++){
+      k = (*next_free + j) % n_free_regs;
+      if (busy_until[k] <= ranges[i].start) break;
+    }
+    if (j == n_free_regs) continue;
+
+    ranges[i].new_reg = free_regs[k];
+    busy_until[k] = ranges[i].end;
+    *next_free = (k + 1) % n_free_regs;
+    n_renamed++;
+  }
+
+  for(i=0;i<n;i++){
+    OrcX86SchedInsn *s = sinsns + i;
+
+    for(k=0;k<s->n_read_fields;k++){
+      if (s->read_range[k] >= 0) {
+        *s->read_fields[k] = ranges[s->read_range[k]].new_reg;
+      }
+    }
+    if (s->write_range >= 0) {
+      for(k=0;k<s->n_write_fields;k++){
+        *s->write_fields[k] = ranges[s->write_range].new_reg;
+      }
+    }
+  }
+
+  return n_renamed;
+}
+
+static int
+orc_x86_sched_get_reads (OrcX86SchedInsn *s, int *regs)
+{
+  int n = 0;
+  int k;
+
+  for(k=0;k<s->n_read_fields;k++){
+    regs[n++] = *s->read_fields[k];
+  }
+  if (s->base_field) regs[n++] = *s->base_field;
+  if (s->index_reg >= 0) regs[n++] = s->index_reg;
+
+  return n;
+}
+
+/* The edges into an instruction are all added while it is looked at,
+ * so a repeated edge is the last one added to its source. */
+static void
+orc_x86_sched_add_dep (OrcX86SchedInsn *sinsns, OrcX86SchedEdge *edges,
+    int *n_edges, int from, int to, int latency)
+{
+  OrcX86SchedInsn *s = sinsns + from;
+  OrcX86SchedEdge *e;
+
+  if (s->first_succ >= 0 && edges[s->first_succ].to == to) {
+    e = edges + s->first_succ;
+    if (latency > e->latency) e->latency = latency;
+    return;
+  }
+
+  ORC_ASSERT (*n_edges < ORC_X86_SCHED_MAX_EDGES);
+  e = edges + *n_edges;
+  e->to = to;
+  e->latency = latency;
+  e->next = s->first_succ;
+  s->first_succ = (*n_edges)++;
+  sinsns[to].n_preds++;
+}
+
+static void
+orc_x86_sched_window (OrcX86Insn *xinsns,
+    OrcX86SchedInsn *sinsns, int n, const OrcX86SchedModel *model,
+    OrcX86SchedEdge *edges, const int *array_type)
+{
+  OrcX86Insn tmp[ORC_X86_SCHED_WINDOW];
+  int order[ORC_X86_SCHED_WINDOW];
+  int ready_list[ORC_X86_SCHED_WINDOW];
+  int mems[ORC_X86_SCHED_WINDOW];
+  int last_write[ORC_N_REGS];
+  int reader_head[ORC_N_REGS];
+  int reader_next[4*ORC_X86_SCHED_WINDOW];
+  int unit_free[ORC_X86_SCHED_N_CLASSES];
+  int n_edges;
+  int n_ready;
+  int n_mems;
+  int n_done;
+  int cycle;
+  int i, j, k;
+
+  /* dependencies, as edges to the later instruction with the number
+   * of cycles it has to wait */
+  for(i=0;i<ORC_N_REGS;i++){
+    last_write[i] = -1;
+    reader_head[i] = -1;
+  }
+  n_edges = 0;
+  n_mems = 0;
+  for(i=0;i<n;i++){
+    OrcX86SchedInsn *si = sinsns + i;
+    int reads[4];
+    int n_reads;
+    int write;
+
+    si->first_succ = -1;
+    si->n_preds = 0;
+    si->ready = 0;
+    si->latency = model->latency[si->class];
+    if (si->mem == ORC_X86_SCHED_MEM_READ && si->class != ORC_X86_SCHED_GP) {
+      si->latency += model->latency[ORC_X86_SCHED_LOAD];
+    }
+    n_reads = orc_x86_sched_get_reads (si, reads);
+    write = si->n_write_fields ? *si->write_fields[0] : -1;
+
+    for(k=0;k<n_reads;k++){
+      j = last_write[reads[k]];
+      if (j >= 0) {
+        orc_x86_sched_add_dep (sinsns, edges, &n_edges, j, i, sinsns[j].latency);
+      }
+    }
+    if (write >= 0) {
+      if (last_write[write] >= 0) {
+        orc_x86_sched_add_dep (sinsns, edges, &n_edges, last_write[write], i, 0);
+      }
+      for(j=reader_head[write];j>=0;j=reader_next[j]){
+        orc_x86_sched_add_dep (sinsns, edges, &n_edges, j/4, i, 0);
+      }
+      reader_head[write] = -1;
+      last_write[write] = i;
+    }
+    for(k=0;k<n_reads;k++){
+      reader_next[i*4+k] = reader_head[reads[k]];
+      reader_head[reads[k]] = i*4+k;
+    }
+
+    if (si->mem) {
+      for(k=0;k<n_mems;k++){
+        OrcX86SchedInsn *sj = sinsns + mems[k];
+
+        if (si->mem == ORC_X86_SCHED_MEM_READ &&
+            sj->mem == ORC_X86_SCHED_MEM_READ) continue;
+        if (orc_x86_sched_mem_conflict (xinsns + mems[k], sj, xinsns + i, si,
+              array_type)) {
+          orc_x86_sched_add_dep (sinsns, edges, &n_edges, mems[k], i,
+              (sj->mem == ORC_X86_SCHED_MEM_WRITE) ? sj->latency : 0);
+        }
+      }
+      mems[n_mems++] = i;
+    }
+  }
+
+  /* priority is the longest path to the end of the run */
+  for(i=n-1;i>=0;i--){
+    OrcX86SchedInsn *si = sinsns + i;
+
+    si->priority = si->latency;
+    for(j=si->first_succ;j>=0;j=edges[j].next){
+      k = edges[j].latency + sinsns[edges[j].to].priority;
+      if (k > si->priority) si->priority = k;
+    }
+  }
+
+  n_ready = 0;
+  for(i=0;i<n;i++){
+    if (sinsns[i].n_preds == 0) ready_list[n_ready++] = i;
+  }
+  for(k=0;k<ORC_X86_SCHED_N_CLASSES;k++){
+    unit_free[k] = 0;
+  }
+  n_done = 0;
+  cycle = 0;
+  while (n_done < n) {
+    int n_issued = 0;
+
+    while (n_issued < model->issue_width) {
+      OrcX86SchedInsn *sb;
+      int best = -1;
+
+      for(k=0;k<n_ready;k++){
+        OrcX86SchedInsn *si = sinsns + ready_list[k];
+
+        if (si->ready > cycle) continue;
+        if (unit_free[si->class] > cycle) continue;
+        if (si->mem == ORC_X86_SCHED_MEM_READ &&
+            unit_free[ORC_X86_SCHED_LOAD] > cycle) continue;
+        if (best < 0 || si->priority > sinsns[ready_list[best]].priority) {
+          best = k;
+        }
+      }
+      if (best < 0) break;
+
+      i = ready_list[best];
+      ready_list[best] = ready_list[--n_ready];
+      sb = sinsns + i;
+      order[n_done++] = i;
+      n_issued++;
+      if (model->interval[sb->class]) {
+        unit_free[sb->class] = cycle + model->interval[sb->class];
+      }
+      if (sb->mem == ORC_X86_SCHED_MEM_READ &&
+          model->interval[ORC_X86_SCHED_LOAD]) {
+        unit_free[ORC_X86_SCHED_LOAD] = cycle +
+          model->interval[ORC_X86_SCHED_LOAD];
+      }
+      for(j=sb->first_succ;j>=0;j=edges[j].next){
+        OrcX86SchedInsn *sj = sinsns + edges[j].to;
+
+        if (cycle + edges[j].latency > sj->ready) {
+          sj->ready = cycle + edges[j].latency;
+        }
+        if (--sj->n_preds == 0) ready_list[n_ready++] = edges[j].to;
+      }
+    }
+    cycle++;
+  }
+
+  ORC_DEBUG("scheduled %d instructions in %d cycles", n, cycle);
+
+  memcpy (tmp, xinsns, n * sizeof(OrcX86Insn));
+  for(i=0;i<n;i++){
+    xinsns[i] = tmp[order[i]];
+  }
+}
+
+static int
+orc_x86_sched_loop (OrcX86Insn *xinsns, int start, int end,
+    OrcX86SchedInsn *sinsns, OrcX86SchedEdge *edges,
+    const OrcX86SchedModel *model, const int *free_regs, int n_free_regs,
+    const int *array_type)
+{
+  int next_free = 0;
+  int n_renamed = 0;
+
+  while (start < end) {
+    int n = 0;
+
+    while (start + n < end && n < ORC_X86_SCHED_WINDOW &&
+        orc_x86_sched_get_operands (xinsns + start + n, sinsns + n)) {
+      n++;
+    }
+
+    if (n > 1) {
+      if (n_free_regs > 0) {
+        n_renamed += orc_x86_sched_rename (sinsns, n, free_regs, n_free_regs,
+            &next_free);
+      }
+      orc_x86_sched_window (xinsns + start, sinsns, n, model, edges,
+          array_type);
+    }
+
+    /* the instruction that ended the run stays where it is */
+    start += (n == ORC_X86_SCHED_WINDOW) ? n : n + 1;
+  }
+
+  return n_renamed;
+}
+
+/* Returns the index of the label at the start of the loop that the
+ * branch xinsns[i] closes, if it is an innermost loop, or -1 */
+static int
+orc_x86_sched_get_loop_start (OrcCompiler *compiler, int i)
+{
+  OrcX86Insn *xinsns = (OrcX86Insn *)compiler->output_insns;
+  int start;
+  int j;
+
+  if (xinsns[i].opcode->type != ORC_X86_INSN_TYPE_BRANCH) return -1;
+  start = compiler->labels_int[xinsns[i].label];
+  if (start >= i) return -1;
+  for(j=start+1;j<i;j++){
+    if (xinsns[j].opcode->type == ORC_X86_INSN_TYPE_LABEL) return -1;
+  }
+
+  return start;
+}
+
+/* Reorders the instructions of the innermost loops in
+ * compiler->output_insns, before orc_x86_calculate_offsets().  The
+ * rest of the function runs once per call, and isn't worth the time. */
+void
+_orc_x86_schedule_insns (OrcCompiler *compiler)
+{
+  OrcX86Insn *xinsns = (OrcX86Insn *)compiler->output_insns;
+  OrcX86SchedInsn *sinsns = NULL;
+  const OrcX86SchedModel *model;
+  OrcX86SchedEdge *edges = NULL;
+  int used[ORC_N_REGS];
+  int array_type[ORC_N_REGS];
+  int free_regs[32];
+  int n_free_regs = 0;
+  int n_renamed = 0;
+  int n_loops = 0;
+  int i, j;
+
+  if (orc_x86_sched_disabled) return;
+  if (compiler->error) return;
+
+  model = orc_x86_sched_get_model ();
+
+  for(i=0;i<compiler->n_output_insns;i++){
+    int start;
+
+    start = orc_x86_sched_get_loop_start (compiler, i);
+    if (start < 0) continue;
+
+    if (sinsns == NULL) {
+      memset (used, 0, sizeof(used));
+      for(j=0;j<compiler->n_output_insns;j++){
+        if (xinsns[j].src >= 0 && xinsns[j].src < ORC_N_REGS) {
+          used[xinsns[j].src] = TRUE;
+        }
+        if (xinsns[j].dest >= 0 && xinsns[j].dest < ORC_N_REGS) {
+          used[xinsns[j].dest] = TRUE;
+        }
+      }
+      for(j=ORC_VEC_REG_BASE;j<ORC_VEC_REG_BASE+32;j++){
+        if (compiler->valid_regs[j] && !compiler->save_regs[j] && !used[j]) {
+          free_regs[n_free_regs++] = j;
+        }
+      }
+
+      memset (array_type, 0, sizeof(array_type));
+      for(j=0;j<ORC_N_COMPILER_VARIABLES;j++){
+        OrcVariable *var = compiler->vars + j;
+
+        if (var->name == NULL || var->ptr_register == 0) continue;
+        if (var->vartype == ORC_VAR_TYPE_SRC) {
+          array_type[var->ptr_register] = ORC_VAR_TYPE_SRC;
+        } else if (var->vartype == ORC_VAR_TYPE_DEST) {
+          array_type[var->ptr_register] = ORC_VAR_TYPE_DEST;
+        }
+      }
+
+      sinsns = malloc (sizeof(OrcX86SchedInsn) * ORC_X86_SCHED_WINDOW);
+      edges = malloc (sizeof(OrcX86SchedEdge) * ORC_X86_SCHED_MAX_EDGES);
+    }
+
+    n_renamed += orc_x86_sched_loop (xinsns, start + 1, i, sinsns, edges,
+        model, free_regs, n_free_regs, array_type);
+    n_loops++;
+  }
+
+  free (sinsns);
+  free (edges);
+
+  ORC_INFO("scheduled %d loops for %s, renamed %d registers", n_loops,
+      model->name, n_renamed);
+}
+
+
+/* Peephole stage */
+
+#define ORC_X86_PEEPHOLE_N_VALUES 64
+
+typedef struct _OrcX86PeepholeKey OrcX86PeepholeKey;
+struct _OrcX86PeepholeKey {
+  int opcode_index;
+  int imm;
+  int size;
+  int type;
+  int offset;
+  int shift;
+  int args[4];
+};
+
+/* Register to register copies, which give the value of their source.
+ * The 128-bit VEX moves clear the upper half, so they aren't. */
+static int
+orc_x86_peephole_is_copy (OrcX86Insn *xinsn, OrcX86SchedInsn *s,
+    int is_64bit, int use_vex)
+{
+  if (xinsn->type != ORC_X86_RM_REG || s->n_read_fields != 1) return FALSE;
+  if (use_vex && xinsn->size == 16) return FALSE;
+
+  switch (xinsn->opcode_index) {
+    case ORC_X86_movdqa:
+    case ORC_X86_movdqa_load:
+    case ORC_X86_movdqu_load:
+    case ORC_X86_movdqa_store:
+    case ORC_X86_movdqu_store:
+    case ORC_X86_movq_mmx_load:
+    case ORC_X86_movq_mmx_store:
+      return TRUE;
+    case ORC_X86_mov_rm_r:
+    case ORC_X86_mov_r_rm:
+      return xinsn->size == (is_64bit ? 8 : 4);
+    default:
+      return FALSE;
+  }
+}
+
+/* Number of bytes the memory form of an instruction reads */
+static int
+orc_x86_peephole_get_read_size (OrcX86Insn *xinsn)
+{
+  int size;
+
+  switch (xinsn->opcode_index) {
+    case ORC_X86_movq_sse_load:
+      return 8;
+    case ORC_X86_pmovsxbw:
+    case ORC_X86_pmovsxwd:
+    case ORC_X86_pmovsxdq:
+    case ORC_X86_pmovzxbw:
+    case ORC_X86_pmovzxwd:
+    case ORC_X86_pmovzxdq:
+    case ORC_X86_cvtdq2pd:
+    case ORC_X86_cvtps2pd:
+      size = 8;
+      break;
+    case ORC_X86_pmovsxbd:
+    case ORC_X86_pmovsxwq:
+    case ORC_X86_pmovzxbd:
+    case ORC_X86_pmovzxwq:
+      size = 4;
+      break;
+    case ORC_X86_pmovsxbq:
+    case ORC_X86_pmovzxbq:
+      size = 2;
+      break;
+    default:
+      size = is_vector_reg (xinsn->dest) &&
+        xinsn->dest < X86_XMM0 ? 8 : 16;
+      break;
+  }
+  /* the 256-bit forms read twice as much */
+  if (xinsn->size == 32) size *= 2;
+
+  return size;
+}
+
+/* Removes the instructions that leave their destination as it was,
+ * using value numbers: two values are the same if they come from the
+ * same register operation on the same values. */
+static int
+orc_x86_peephole_values (OrcX86Insn *xinsns, OrcX86SchedInsn *sinsns,
+    int start, int end, int is_64bit, int use_vex, char *removed)
+{
+  OrcX86PeepholeKey keys[ORC_X86_PEEPHOLE_N_VALUES];
+  int key_values[ORC_X86_PEEPHOLE_N_VALUES];
+  signed char hash[2*ORC_X86_PEEPHOLE_N_VALUES];
+  int value[ORC_N_REGS];
+  int n_keys = 0;
+  int next_value = 1;
+  int n_removed = 0;
+  int i, k;
+
+  memset (value, 0, sizeof(value));
+  memset (hash, -1, sizeof(hash));
+  for(i=start;i<end;i++){
+    OrcX86Insn *xinsn = xinsns + i;
+    OrcX86SchedInsn *s = sinsns + i;
+    OrcX86PeepholeKey key;
+    unsigned int h;
+    int reads[4];
+    int n_reads;
+    int dest;
+    int result;
+
+    n_reads = orc_x86_sched_get_reads (s, reads);
+    for(k=0;k<n_reads;k++){
+      if (value[reads[k]] == 0) value[reads[k]] = next_value++;
+    }
+    if (s->n_write_fields == 0) continue;
+    dest = *s->write_fields[0];
+
+    if (s->mem == ORC_X86_SCHED_MEM_READ) {
+      result = next_value++;
+    } else if (orc_x86_peephole_is_copy (xinsn, s, is_64bit, use_vex)) {
+      result = value[reads[0]];
+    } else {
+      memset (&key, 0, sizeof(key));
+      key.opcode_index = xinsn->opcode_index;
+      key.imm = xinsn->imm;
+      key.size = xinsn->size;
+      key.type = xinsn->type;
+      key.offset = xinsn->offset;
+      key.shift = xinsn->shift;
+      h = key.opcode_index * 7 + key.imm;
+      for(k=0;k<n_reads;k++){
+        key.args[k] = value[reads[k]];
+        h = h * 31 + key.args[k];
+      }
+
+      result = 0;
+      for(h=h%(2*ORC_X86_PEEPHOLE_N_VALUES);hash[h]>=0;
+          h=(h+1)%(2*ORC_X86_PEEPHOLE_N_VALUES)){
+        if (memcmp (keys + hash[h], &key, sizeof(key)) == 0) {
+          result = key_values[hash[h]];
+          break;
+        }
+      }
+      if (result == 0) {
+        result = next_value++;
+        if (n_keys < ORC_X86_PEEPHOLE_N_VALUES) {
+          keys[n_keys] = key;
+          key_values[n_keys] = result;
+          hash[h] = n_keys;
+          n_keys++;
+        }
+      }
+    }
+
+    if (result == value[dest]) {
+      removed[i] = TRUE;
+      n_removed++;
+      continue;
+    }
+    value[dest] = result;
+  }
+
+  return n_removed;
+}
+
+static int
+orc_x86_peephole_is_dead (OrcX86SchedInsn *sinsns, const char *removed,
+    int start, int end, int reg)
+{
+  int reads[4];
+  int n_reads;
+  int i, k;
+
+  for(i=start;i<end;i++){
+    OrcX86SchedInsn *s = sinsns + i;
+
+    if (removed[i]) continue;
+    n_reads = orc_x86_sched_get_reads (s, reads);
+    for(k=0;k<n_reads;k++){
+      if (reads[k] == reg) return FALSE;
+    }
+    if (s->full_write && s->n_write_fields > 0 &&
+        *s->write_fields[0] == reg) return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Folds a vector load into the instruction that reads the loaded
+ * register, if that is the last use of the value.  Legacy SSE
+ * instructions need aligned 16-byte memory operands, so only movdqa
+ * loads go into those.  The VEX forms don't, except for vmovdqa. */
+static int
+orc_x86_peephole_fold_loads (OrcX86Insn *xinsns, OrcX86SchedInsn *sinsns,
+    int start, int end, int use_vex, char *removed)
+{
+  int n_folded = 0;
+  int i, j, k;
+
+  for(i=start;i<end;i++){
+    OrcX86Insn *xload = xinsns + i;
+    OrcX86SchedInsn *sload = sinsns + i;
+    OrcX86Insn *xinsn;
+    int reads[4];
+    int n_reads;
+    int reg;
+    int size;
+
+    if (removed[i] || sload->mem != ORC_X86_SCHED_MEM_READ) continue;
+    switch (xload->opcode_index) {
+      case ORC_X86_movd_load:
+      case ORC_X86_movq_sse_load:
+      case ORC_X86_movq_mmx_load:
+      case ORC_X86_movdqa_load:
+      case ORC_X86_movdqu_load:
+        break;
+      default:
+        continue;
+    }
+    reg = *sload->write_fields[0];
+
+    /* the first instruction that reads the register */
+    for(j=i+1;j<end;j++){
+      OrcX86SchedInsn *s = sinsns + j;
+
+      if (removed[j]) continue;
+      n_reads = orc_x86_sched_get_reads (s, reads);
+      for(k=0;k<n_reads;k++){
+        if (reads[k] == reg) break;
+      }
+      if (k < n_reads) break;
+      if (s->mem == ORC_X86_SCHED_MEM_WRITE) break;
+      for(k=0;k<s->n_write_fields;k++){
+        int w = *s->write_fields[k];
+        if (w == reg || w == *sload->base_field || w == sload->index_reg) {
+          break;
+        }
+      }
+      if (k < s->n_write_fields) break;
+    }
+    if (j == end || sinsns[j].mem != ORC_X86_SCHED_MEM_NONE) continue;
+
+    xinsn = xinsns + j;
+    if (xinsn->type != ORC_X86_RM_REG || xinsn->src != reg) continue;
+    if (xinsn->opcode->type != ORC_X86_INSN_TYPE_MMXM_MMX &&
+        xinsn->opcode->type != ORC_X86_INSN_TYPE_SSEM_SSE &&
+        xinsn->opcode->type != ORC_X86_INSN_TYPE_IMM8_MMXM_MMX) continue;
+    if (xinsn->dest == reg) {
+      if (!sinsns[j].full_write) continue;
+    } else {
+      if (!orc_x86_peephole_is_dead (sinsns, removed, j + 1, end, reg)) {
+        continue;
+      }
+    }
+
+    size = orc_x86_peephole_get_read_size (xinsn);
+    if (size > orc_x86_sched_get_width (xload)) continue;
+    if (size == 16 && !use_vex &&
+        xload->opcode_index != ORC_X86_movdqa_load &&
+        xinsn->opcode_index != ORC_X86_movdqu_load) continue;
+    /* vmovdqa still faults on unaligned memory */
+    if (size >= 16 && xinsn->opcode_index == ORC_X86_movdqa &&
+        xload->opcode_index != ORC_X86_movdqa_load) continue;
+
+    xinsn->type = xload->type;
+    xinsn->src = xload->src;
+    xinsn->offset = xload->offset;
+    xinsn->index_reg = xload->index_reg;
+    xinsn->shift = xload->shift;
+    orc_x86_sched_get_operands (xinsn, sinsns + j);
+    removed[i] = TRUE;
+    n_folded++;
+  }
+
+  return n_folded;
+}
+
+/* Removes the instructions whose result is overwritten before it is
+ * read */
+static int
+orc_x86_peephole_dead_code (OrcX86SchedInsn *sinsns, int start, int end,
+    char *removed)
+{
+  char live[ORC_N_REGS];
+  int reads[4];
+  int n_reads;
+  int n_removed = 0;
+  int i, k;
+
+  memset (live, 1, sizeof(live));
+  for(i=end-1;i>=start;i--){
+    OrcX86SchedInsn *s = sinsns + i;
+
+    if (removed[i]) continue;
+    if (s->n_write_fields > 0 && s->mem != ORC_X86_SCHED_MEM_WRITE) {
+      for(k=0;k<s->n_write_fields;k++){
+        if (live[*s->write_fields[k]]) break;
+      }
+      if (k == s->n_write_fields) {
+        removed[i] = TRUE;
+        n_removed++;
+        continue;
+      }
+    }
+
+    if (s->full_write) {
+      for(k=0;k<s->n_write_fields;k++){
+        live[*s->write_fields[k]] = FALSE;
+      }
+    }
+    n_reads = orc_x86_sched_get_reads (s, reads);
+    for(k=0;k<n_reads;k++){
+      live[reads[k]] = TRUE;
+    }
+  }
+
+  return n_removed;
+}
+
+/* Cleans up the innermost loops in compiler->output_insns, before the
+ * scheduler and orc_x86_calculate_offsets() */
+void
+_orc_x86_peephole (OrcCompiler *compiler)
+{
+  OrcX86Insn *xinsns = (OrcX86Insn *)compiler->output_insns;
+  OrcX86SchedInsn *sinsns;
+  char *removed;
+  int n = compiler->n_output_insns;
+  int n_loop_insns = 0;
+  int n_removed = 0;
+  int n_folded = 0;
+  int i, j;
+
+  if (orc_x86_peephole_disabled) return;
+  if (compiler->error || n == 0) return;
+
+  sinsns = malloc (sizeof(OrcX86SchedInsn) * n);
+  removed = malloc (n);
+  memset (removed, 0, n);
+
+  for(i=0;i<n;i++){
+    int start;
+    int end;
+
+    start = orc_x86_sched_get_loop_start (compiler, i);
+    if (start < 0) continue;
+    n_loop_insns += i - start - 1;
+
+    for(j=start+1;j<i;j++){
+      end = j;
+      while (end < i && orc_x86_sched_get_operands (xinsns + end,
+            sinsns + end)) {
+        end++;
+      }
+      if (end == j) continue;
+
+      n_removed += orc_x86_peephole_values (xinsns, sinsns, j, end,
+          compiler->is_64bit, compiler->use_vex, removed);
+      n_folded += orc_x86_peephole_fold_loads (xinsns, sinsns, j, end,
+          compiler->use_vex, removed);
+      n_removed += orc_x86_peephole_dead_code (sinsns, j, end, removed);
+      j = end;
+    }
+  }
+
+  for(j=0;j<n;j++){
+    if (removed[j]) break;
+  }
+  for(i=j;i<n;i++){
+    if (removed[i]) continue;
+    xinsns[j] = xinsns[i];
+    if (xinsns[j].opcode->type == ORC_X86_INSN_TYPE_LABEL) {
+      compiler->labels_int[xinsns[j].label] = j;
+    }
+    j++;
+  }
+  compiler->n_output_insns = j;
+
+  free (sinsns);
+  free (removed);
+
+  ORC_INFO("peephole removed %d and folded %d loads of %d loop instructions",
+      n_removed, n_folded, n_loop_insns);
+}
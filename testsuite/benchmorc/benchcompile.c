@@ -0,0 +1,234 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <orc/orc.h>
+#include <orc-test/orctest.h>
+#include <orc/orcparse.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_THREAD_PTHREAD
+#include <pthread.h>
+#endif
+
+/* Measures JIT compile throughput over all the functions in an .orc
+ * file (bench10.orc by default), with an increasing number of threads
+ * compiling concurrently, and then the time to compile the whole file
+ * one program after another and with orc_program_compile_many().  Set
+ * ORC_CODE=-cache to measure full compiles rather than code cache
+ * hits. */
+
+#define MAX_THREADS 16
+#define N_ITERATIONS 4
+
+static char * read_file (const char *filename);
+
+static const char *code;
+static int n_compiles[MAX_THREADS];
+
+static double
+get_time (void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+static void *
+compile_thread (void *data)
+{
+  int thread = (int)(orc_intptr)data;
+  OrcProgram **programs;
+  int n;
+  int i;
+  int j;
+
+  n = orc_parse (code, &programs);
+
+  for(j=0;j<N_ITERATIONS;j++){
+    for(i=0;i<n;i++){
+      orc_program_compile (programs[i]);
+      n_compiles[thread]++;
+    }
+  }
+
+  for(i=0;i<n;i++){
+    orc_program_free (programs[i]);
+  }
+  free (programs);
+
+  return NULL;
+}
+
+static double
+run (int n_threads)
+{
+#ifdef HAVE_THREAD_PTHREAD
+  pthread_t threads[MAX_THREADS];
+#endif
+  double start, elapsed;
+  int total;
+  int i;
+
+  memset (n_compiles, 0, sizeof(n_compiles));
+
+  start = get_time ();
+#ifdef HAVE_THREAD_PTHREAD
+  for(i=0;i<n_threads;i++){
+    pthread_create (&threads[i], NULL, compile_thread, (void *)(orc_intptr)i);
+  }
+  for(i=0;i<n_threads;i++){
+    pthread_join (threads[i], NULL);
+  }
+#else
+  for(i=0;i<n_threads;i++){
+    compile_thread ((void *)(orc_intptr)i);
+  }
+#endif
+  elapsed = get_time () - start;
+
+  total = 0;
+  for(i=0;i<n_threads;i++){
+    total += n_compiles[i];
+  }
+
+  return total / elapsed;
+}
+
+/* Returns the time it takes to compile all programs of the file */
+static double
+run_module (int many)
+{
+  OrcProgram **programs;
+  double start, elapsed;
+  int n;
+  int i;
+
+  n = orc_parse (code, &programs);
+
+  start = get_time ();
+  if (many) {
+    orc_program_compile_many (programs, n, NULL);
+  } else {
+    for(i=0;i<n;i++){
+      orc_program_compile (programs[i]);
+    }
+  }
+  elapsed = get_time () - start;
+
+  for(i=0;i<n;i++){
+    orc_program_free (programs[i]);
+  }
+  free (programs);
+
+  return elapsed;
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *filename = "bench10.orc";
+  char *contents;
+  double base = 0;
+  int max_threads = 8;
+  int n_threads;
+  double one_by_one = 1e9;
+  double many = 1e9;
+  int i;
+
+  orc_init ();
+  orc_test_init ();
+
+  if (argc > 1) {
+    filename = argv[1];
+  }
+  if (argc > 2) {
+    max_threads = strtol (argv[2], NULL, 0);
+    if (max_threads > MAX_THREADS) max_threads = MAX_THREADS;
+  }
+
+  contents = read_file (filename);
+  if (!contents) {
+    printf("benchcompile needs %s file in current directory\n", filename);
+    exit(1);
+  }
+  code = contents;
+
+  /* warm up, so the first measurement doesn't include code region setup */
+  run (1);
+
+  for(n_threads=1;n_threads<=max_threads;n_threads*=2){
+    double rate;
+
+    rate = run (n_threads);
+    if (n_threads == 1) base = rate;
+    printf("threads %2d: %10.0f compiles/s  speedup %5.2f\n", n_threads,
+        rate, rate / base);
+  }
+
+  for(i=0;i<N_ITERATIONS;i++){
+    double elapsed;
+
+    elapsed = run_module (FALSE);
+    if (elapsed < one_by_one) one_by_one = elapsed;
+    elapsed = run_module (TRUE);
+    if (elapsed < many) many = elapsed;
+  }
+  printf("whole file: %.1f ms one by one, %.1f ms with "
+      "orc_program_compile_many  speedup %5.2f\n", 1000 * one_by_one,
+      1000 * many, one_by_one / many);
+
+  free (contents);
+
+  return 0;
+}
+
+static char *
+read_file (const char *filename)
+{
+  FILE *file = NULL;
+  char *contents = NULL;
+  long size;
+  int ret;
+
+  file = fopen (filename, "r");
+  if (file == NULL) return NULL;
+
+  ret = fseek (file, 0, SEEK_END);
+  if (ret < 0) goto bail;
+
+  size = ftell (file);
+  if (size < 0) goto bail;
+
+  ret = fseek (file, 0, SEEK_SET);
+  if (ret < 0) goto bail;
+
+  contents = malloc (size + 1);
+  if (contents == NULL) goto bail;
+
+  ret = fread (contents, size, 1, file);
+  if (ret < 0) goto bail;
+
+  contents[size] = 0;
+
+  fclose (file);
+  return contents;
+bail:
+  /* something failed */
+  if (file) fclose (file);
+  if (contents) free (contents);
+
+  return NULL;
+}
+
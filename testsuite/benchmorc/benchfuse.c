@@ -0,0 +1,203 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+/* Runs a chain of four kernels over a 1080p frame, unpack, convert,
+ * scale and pack, once as separate programs that pass the frame on
+ * in memory, and once fused into one program with orc_program_fuse().
+ * Prints the time per frame and the bytes each version reads and
+ * writes. */
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define N_STAGES 4
+#define N_FRAMES 200
+
+static double
+get_time (void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+static OrcProgram *
+make_stage (int stage)
+{
+  OrcProgram *p;
+
+  switch (stage) {
+    case 0:
+      p = orc_program_new_ds (2, 1);
+      orc_program_set_name (p, "unpack");
+      orc_program_append_ds_str (p, "convubw", "d1", "s1");
+      break;
+    case 1:
+      p = orc_program_new_ds (2, 2);
+      orc_program_set_name (p, "convert");
+      orc_program_add_constant (p, 2, 16, "c1");
+      orc_program_add_parameter (p, 2, "p1");
+      orc_program_add_temporary (p, 2, "t1");
+      orc_program_append_str (p, "subw", "t1", "s1", "c1");
+      orc_program_append_str (p, "mullw", "d1", "t1", "p1");
+      break;
+    case 2:
+      p = orc_program_new_ds (2, 2);
+      orc_program_set_name (p, "scale");
+      orc_program_add_constant (p, 2, 128, "c1");
+      orc_program_add_constant (p, 2, 8, "c2");
+      orc_program_add_temporary (p, 2, "t1");
+      orc_program_append_str (p, "addw", "t1", "s1", "c1");
+      orc_program_append_str (p, "shrsw", "d1", "t1", "c2");
+      break;
+    default:
+      p = orc_program_new_ds (1, 2);
+      orc_program_set_name (p, "pack");
+      orc_program_append_ds_str (p, "convsuswb", "d1", "s1");
+      break;
+  }
+  orc_program_set_2d (p);
+
+  return p;
+}
+
+static void
+run (OrcExecutor *ex, OrcProgram *p, void *dest, void *src)
+{
+  orc_executor_set_n (ex, WIDTH);
+  orc_executor_set_m (ex, HEIGHT);
+  orc_executor_set_array (ex, ORC_VAR_D1, dest);
+  orc_executor_set_stride (ex, ORC_VAR_D1, WIDTH * p->vars[ORC_VAR_D1].size);
+  orc_executor_set_array (ex, ORC_VAR_S1, src);
+  orc_executor_set_stride (ex, ORC_VAR_S1, WIDTH * p->vars[ORC_VAR_S1].size);
+  if (orc_program_find_var_by_name (p, "p1") >= 0) {
+    orc_executor_set_param (ex, orc_program_find_var_by_name (p, "p1"), 77);
+  }
+  orc_executor_run (ex);
+}
+
+static long
+frame_traffic (OrcProgram *p)
+{
+  return (long)WIDTH * HEIGHT *
+    (p->vars[ORC_VAR_S1].size + p->vars[ORC_VAR_D1].size);
+}
+
+int
+main (int argc, char *argv[])
+{
+  OrcProgram *stages[N_STAGES];
+  OrcExecutor *executors[N_STAGES];
+  OrcProgram *fused;
+  OrcProgram *p;
+  OrcExecutor *fused_ex;
+  void *frames[N_STAGES + 1];
+  orc_uint8 *dest_fused;
+  double start, separate_time, fused_time;
+  long separate_bytes, fused_bytes;
+  int i, j;
+
+  orc_init ();
+
+  separate_bytes = 0;
+  fused = NULL;
+  for(i=0;i<N_STAGES;i++){
+    stages[i] = make_stage (i);
+    separate_bytes += frame_traffic (stages[i]);
+    if (i == 0) {
+      fused = make_stage (i);
+    } else {
+      p = orc_program_fuse (fused, stages[i], "d1", "s1");
+      orc_program_free (fused);
+      fused = p;
+      if (fused == NULL) {
+        printf("failed to fuse %s\n", stages[i]->name);
+        exit(1);
+      }
+    }
+  }
+  fused_bytes = frame_traffic (fused);
+
+  for(i=0;i<N_STAGES;i++){
+    orc_program_compile (stages[i]);
+    executors[i] = orc_executor_new (stages[i]);
+  }
+  orc_program_compile (fused);
+  fused_ex = orc_executor_new (fused);
+
+  for(i=0;i<N_STAGES+1;i++){
+    frames[i] = malloc (WIDTH * HEIGHT * 2);
+    memset (frames[i], 0, WIDTH * HEIGHT * 2);
+  }
+  for(i=0;i<WIDTH*HEIGHT;i++){
+    ((orc_uint8 *)frames[0])[i] = i * 7;
+  }
+  dest_fused = malloc (WIDTH * HEIGHT);
+
+  /* warm up, and check that both give the same frame */
+  for(i=0;i<N_STAGES;i++){
+    run (executors[i], stages[i], frames[i+1], frames[i]);
+  }
+  run (fused_ex, fused, dest_fused, frames[0]);
+  if (memcmp (dest_fused, frames[N_STAGES], WIDTH * HEIGHT) != 0) {
+    printf("fused program gives a different frame\n");
+    exit(1);
+  }
+
+  start = get_time ();
+  for(j=0;j<N_FRAMES;j++){
+    for(i=0;i<N_STAGES;i++){
+      run (executors[i], stages[i], frames[i+1], frames[i]);
+    }
+  }
+  separate_time = (get_time () - start) / N_FRAMES;
+
+  start = get_time ();
+  for(j=0;j<N_FRAMES;j++){
+    run (fused_ex, fused, dest_fused, frames[0]);
+  }
+  fused_time = (get_time () - start) / N_FRAMES;
+
+  printf("%dx%d frame, %d stages, %d frames\n", WIDTH, HEIGHT, N_STAGES,
+      N_FRAMES);
+  printf("separate: %6.3f ms/frame, %5.1f MB/frame\n", 1000 * separate_time,
+      separate_bytes / 1e6);
+  printf("fused:    %6.3f ms/frame, %5.1f MB/frame\n", 1000 * fused_time,
+      fused_bytes / 1e6);
+  if (fused_time > 0) {
+    printf("speedup %5.2f, memory traffic %5.2f of separate\n",
+        separate_time / fused_time,
+        (double)fused_bytes / separate_bytes);
+  }
+
+  for(i=0;i<N_STAGES;i++){
+    orc_executor_free (executors[i]);
+    orc_program_free (stages[i]);
+  }
+  for(i=0;i<N_STAGES+1;i++){
+    free (frames[i]);
+  }
+  orc_executor_free (fused_ex);
+  orc_program_free (fused);
+  free (dest_fused);
+
+  return 0;
+}
+
@@ -0,0 +1,174 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <orc/orc.h>
+#include <orc/orcparse.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+/* Measures the JIT latency of each function in an .orc file
+ * (bench10.orc by default), that is the time orc_program_compile()
+ * takes for one kernel, as the best of N_TRIALS.  The in-memory code
+ * cache and the assembly listing are turned off, unless ORC_CODE is
+ * already set.  The latency including the listing, which
+ * orc_program_get_asm_code() then produces on request, is shown for
+ * comparison.  Pass -v to list every kernel. */
+
+#define N_TRIALS 20
+
+static char * read_file (const char *filename);
+
+static double
+get_time (void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+static double
+compile_latency (OrcProgram *program, int listing)
+{
+  double best = 1e9;
+  double start, elapsed;
+  int i;
+
+  for(i=0;i<N_TRIALS;i++){
+    start = get_time ();
+    orc_program_compile (program);
+    if (listing) orc_program_get_asm_code (program);
+    elapsed = get_time () - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  return best;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *filename = "bench10.orc";
+  OrcProgram **programs;
+  double *latency, *latency_listing;
+  double total = 0, total_listing = 0;
+  char *contents;
+  int verbose = FALSE;
+  int n;
+  int i;
+
+  for(i=1;i<argc;i++){
+    if (strcmp (argv[i], "-v") == 0) {
+      verbose = TRUE;
+    } else {
+      filename = argv[i];
+    }
+  }
+
+  setenv ("ORC_CODE", "-cache,nolisting", 0);
+  orc_init ();
+
+  contents = read_file (filename);
+  if (!contents) {
+    printf("benchlatency needs %s file in current directory\n", filename);
+    exit(1);
+  }
+
+  n = orc_parse (contents, &programs);
+  if (n == 0) {
+    printf("no functions in %s\n", filename);
+    exit(1);
+  }
+  latency = malloc (sizeof(double) * n);
+  latency_listing = malloc (sizeof(double) * n);
+
+  for(i=0;i<n;i++){
+    latency[i] = compile_latency (programs[i], FALSE);
+    latency_listing[i] = compile_latency (programs[i], TRUE);
+    total += latency[i];
+    total_listing += latency_listing[i];
+    if (verbose) {
+      printf("%-30s %8.1f us  %8.1f us with listing\n", programs[i]->name,
+          1e6 * latency[i], 1e6 * latency_listing[i]);
+    }
+  }
+
+  printf("%d kernels\n", n);
+  printf("mean    %8.1f us  %8.1f us with listing\n",
+      1e6 * total / n, 1e6 * total_listing / n);
+  qsort (latency, n, sizeof(double), compare_double);
+  qsort (latency_listing, n, sizeof(double), compare_double);
+  printf("median  %8.1f us  %8.1f us with listing\n",
+      1e6 * latency[n/2], 1e6 * latency_listing[n/2]);
+  printf("max     %8.1f us  %8.1f us with listing\n",
+      1e6 * latency[n-1], 1e6 * latency_listing[n-1]);
+
+  for(i=0;i<n;i++){
+    orc_program_free (programs[i]);
+  }
+  free (programs);
+  free (latency);
+  free (latency_listing);
+  free (contents);
+
+  return 0;
+}
+
+static char *
+read_file (const char *filename)
+{
+  FILE *file = NULL;
+  char *contents = NULL;
+  long size;
+  int ret;
+
+  file = fopen (filename, "r");
+  if (file == NULL) return NULL;
+
+  ret = fseek (file, 0, SEEK_END);
+  if (ret < 0) goto bail;
+
+  size = ftell (file);
+  if (size < 0) goto bail;
+
+  ret = fseek (file, 0, SEEK_SET);
+  if (ret < 0) goto bail;
+
+  contents = malloc (size + 1);
+  if (contents == NULL) goto bail;
+
+  ret = fread (contents, size, 1, file);
+  if (ret < 0) goto bail;
+
+  contents[size] = 0;
+
+  fclose (file);
+  return contents;
+bail:
+  /* something failed */
+  if (file) fclose (file);
+  if (contents) free (contents);
+
+  return NULL;
+}
+
@@ -0,0 +1,279 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+#include <orc-test/orctest.h>
+#include <orc/orcparse.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/* Compiles all the functions in an .orc file (bench10.orc by default),
+ * reporting the number of code regions and new memory mappings this
+ * takes, and then runs all of them round-robin while counting iTLB
+ * misses.  Finally it measures how long it takes to set up and tear
+ * down a code region.  Run it with different ORC_CODE_REGION_SIZE and
+ * ORC_CODE=hugepages,-memfd settings to compare. */
+
+#define N 64
+/* enough rows for the programs with a constant m */
+#define M 16
+#define N_ROUNDS 2000
+#define N_REGIONS 1000
+
+static char * read_file (const char *filename);
+
+static double
+get_time (void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+static int
+count_mappings (void)
+{
+  FILE *file;
+  int n = 0;
+  int c;
+
+  file = fopen ("/proc/self/maps", "r");
+  if (file == NULL) return -1;
+  while ((c = fgetc (file)) != EOF) {
+    if (c == '\n') n++;
+  }
+  fclose (file);
+  return n;
+}
+
+static int
+itlb_counter_open (void)
+{
+#if defined(__linux__) && defined(__NR_perf_event_open)
+  struct perf_event_attr attr;
+
+  memset (&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.config = PERF_COUNT_HW_CACHE_ITLB |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+/* 2D code advances the array pointers in the executor, so they need
+ * to be set again before every run */
+static void
+setup_executor (OrcExecutor *ex, OrcProgram *program, void **arrays)
+{
+  int j;
+
+  orc_executor_set_n (ex, N);
+  orc_executor_set_m (ex, 1);
+  for(j=0;j<ORC_N_VARIABLES;j++){
+    switch (program->vars[j].vartype) {
+      case ORC_VAR_TYPE_SRC:
+      case ORC_VAR_TYPE_DEST:
+        orc_executor_set_array (ex, j, arrays[j]);
+        orc_executor_set_stride (ex, j, N * 8);
+        break;
+      case ORC_VAR_TYPE_PARAM:
+        orc_executor_set_param (ex, j, 2);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  const char *filename = "bench10.orc";
+  char *contents;
+  OrcProgram **programs;
+  OrcExecutor **executors;
+  void *arrays[ORC_N_VARIABLES];
+  double start, elapsed;
+  long region_bytes, chunk_bytes;
+  int n_regions;
+  int n_maps;
+  int n_programs;
+  int n_compiled;
+  int fd;
+  int i, j;
+
+  orc_init ();
+  orc_test_init ();
+
+  if (argc > 1) {
+    filename = argv[1];
+  }
+
+  contents = read_file (filename);
+  if (!contents) {
+    printf("benchregions needs %s file in current directory\n", filename);
+    exit(1);
+  }
+
+  n_programs = orc_parse (contents, &programs);
+  executors = malloc (sizeof(OrcExecutor *) * n_programs);
+
+  for(i=0;i<ORC_N_VARIABLES;i++){
+    arrays[i] = malloc (N * 8 * M);
+    memset (arrays[i], 0, N * 8 * M);
+  }
+
+  n_maps = count_mappings ();
+  start = get_time ();
+  n_compiled = 0;
+  for(i=0;i<n_programs;i++){
+    OrcCompileResult result;
+
+    result = orc_program_compile (programs[i]);
+    executors[i] = NULL;
+    if (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (result)) continue;
+
+    n_compiled++;
+    executors[i] = orc_executor_new (programs[i]);
+  }
+  elapsed = get_time () - start;
+  if (n_maps >= 0) n_maps = count_mappings () - n_maps;
+
+  orc_code_get_memory_usage (&n_regions, &region_bytes, &chunk_bytes);
+  printf("region size %d, huge pages %s\n", orc_code_get_region_size (),
+      orc_compiler_flag_check ("hugepages") ? "requested" : "off");
+  printf("compiled %d of %d programs in %.1f ms\n", n_compiled, n_programs,
+      1000 * elapsed);
+  printf("%d regions, %ld bytes mapped, %ld bytes in chunks, "
+      "%d new mappings\n", n_regions, region_bytes, chunk_bytes, n_maps);
+
+  fd = itlb_counter_open ();
+#ifdef __linux__
+  if (fd >= 0) {
+    ioctl (fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl (fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+#endif
+  start = get_time ();
+  for(j=0;j<N_ROUNDS;j++){
+    for(i=0;i<n_programs;i++){
+      if (executors[i] == NULL) continue;
+      setup_executor (executors[i], programs[i], arrays);
+      orc_executor_run (executors[i]);
+    }
+  }
+  elapsed = get_time () - start;
+#ifdef __linux__
+  if (fd >= 0) {
+    long long misses = 0;
+
+    ioctl (fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read (fd, &misses, sizeof(misses)) == sizeof(misses)) {
+      printf("%d rounds in %.1f ms, %lld iTLB misses (%.3f per call)\n",
+          N_ROUNDS, 1000 * elapsed, misses,
+          (double)misses / ((double)N_ROUNDS * n_compiled));
+    }
+    close (fd);
+    fd = 0;
+  }
+#endif
+  if (fd < 0) {
+    printf("%d rounds in %.1f ms, iTLB misses n/a\n", N_ROUNDS,
+        1000 * elapsed);
+  }
+
+  /* Chunks bigger than a span get a region of their own, which is
+   * unmapped again when the chunk is freed. */
+  start = get_time ();
+  for(i=0;i<N_REGIONS;i++){
+    OrcCode *code;
+
+    code = orc_code_new ();
+    orc_code_allocate_codemem (code, orc_code_get_region_size () + 1);
+    code->code[0] = 0xc3;
+    orc_code_free (code);
+  }
+  elapsed = get_time () - start;
+  printf("region setup and teardown: %.1f us per region\n",
+      1e6 * elapsed / N_REGIONS);
+
+  for(i=0;i<n_programs;i++){
+    if (executors[i]) orc_executor_free (executors[i]);
+    orc_program_free (programs[i]);
+  }
+  for(i=0;i<ORC_N_VARIABLES;i++){
+    free (arrays[i]);
+  }
+  free (executors);
+  free (programs);
+  free (contents);
+
+  return 0;
+}
+
+static char *
+read_file (const char *filename)
+{
+  FILE *file = NULL;
+  char *contents = NULL;
+  long size;
+  int ret;
+
+  file = fopen (filename, "r");
+  if (file == NULL) return NULL;
+
+  ret = fseek (file, 0, SEEK_END);
+  if (ret < 0) goto bail;
+
+  size = ftell (file);
+  if (size < 0) goto bail;
+
+  ret = fseek (file, 0, SEEK_SET);
+  if (ret < 0) goto bail;
+
+  contents = malloc (size + 1);
+  if (contents == NULL) goto bail;
+
+  ret = fread (contents, size, 1, file);
+  if (ret < 0) goto bail;
+
+  contents[size] = 0;
+
+  fclose (file);
+  return contents;
+bail:
+  /* something failed */
+  if (file) fclose (file);
+  if (contents) free (contents);
+
+  return NULL;
+}
+
@@ -0,0 +1,159 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <orc/orc.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+/* Measures the time of one call for the short lengths of per-packet
+ * audio code, n below 64, with a 16-bit volume kernel and a float
+ * mixing kernel.  The arrays are either all aligned to 16 bytes or all
+ * one element off.  Prints nanoseconds per call, as the best of
+ * N_TRIALS runs of N_CALLS calls.  Running with ORC_CODE=versions
+ * turns on the separate versions for short and aligned arrays. */
+
+#define N_TRIALS 10
+#define N_CALLS 100000
+#define MAX_N 64
+
+static const int lengths[] = { 1, 3, 4, 7, 8, 15, 16, 24, 31, 32, 48, 63 };
+#define N_LENGTHS ((int)(sizeof(lengths)/sizeof(lengths[0])))
+
+static double
+get_time (void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+static OrcProgram *
+make_volume (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (2, 2);
+  orc_program_set_name (p, "volume_s16");
+  orc_program_add_parameter (p, 2, "p1");
+  orc_program_add_constant (p, 4, 12, "c1");
+  orc_program_add_temporary (p, 4, "t1");
+
+  orc_program_append_str (p, "mulswl", "t1", "s1", "p1");
+  orc_program_append_str (p, "shrsl", "t1", "t1", "c1");
+  orc_program_append_ds_str (p, "convssslw", "d1", "t1");
+
+  return p;
+}
+
+static OrcProgram *
+make_mix (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_dss (4, 4, 4);
+  orc_program_set_name (p, "mix_f32");
+  orc_program_add_parameter_float (p, 4, "p1");
+  orc_program_add_temporary (p, 4, "t1");
+
+  orc_program_append_str (p, "mulf", "t1", "s2", "p1");
+  orc_program_append_str (p, "addf", "d1", "s1", "t1");
+
+  return p;
+}
+
+static double
+time_calls (OrcExecutor *ex, orc_uint8 *dest, orc_uint8 *src1,
+    orc_uint8 *src2, int n)
+{
+  double best = 1e9;
+  double start, elapsed;
+  int i, j;
+
+  for(i=0;i<N_TRIALS;i++){
+    start = get_time ();
+    for(j=0;j<N_CALLS;j++){
+      orc_executor_set_n (ex, n);
+      orc_executor_set_array (ex, ORC_VAR_D1, dest);
+      orc_executor_set_array (ex, ORC_VAR_S1, src1);
+      orc_executor_set_array (ex, ORC_VAR_S2, src2);
+      orc_executor_run (ex);
+    }
+    elapsed = get_time () - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  return 1e9 * best / N_CALLS;
+}
+
+static void
+bench_program (OrcProgram *p, int size)
+{
+  OrcExecutor *ex;
+  orc_uint8 *mem[3];
+  orc_uint8 *dest, *src1, *src2;
+  int i;
+
+  orc_program_compile (p);
+  ex = orc_executor_new (p);
+  /* 0.5 as a float, or 3/4 in 4.12 fixed point */
+  orc_executor_set_param (ex, ORC_VAR_P1, (size == 4) ? 0x3f000000 : 3072);
+
+  /* 16 bytes of room for the misaligned case, and 15 for aligning */
+  for(i=0;i<3;i++){
+    mem[i] = malloc (MAX_N * size + 16 + 15);
+  }
+  dest = (orc_uint8 *)(((size_t)mem[0] + 15) & ~(size_t)15);
+  src1 = (orc_uint8 *)(((size_t)mem[1] + 15) & ~(size_t)15);
+  src2 = (orc_uint8 *)(((size_t)mem[2] + 15) & ~(size_t)15);
+  for(i=0;i<MAX_N*size+16;i++){
+    src1[i] = 0x38 + (i * 7) % 8;
+    src2[i] = 0x38 + (i * 5) % 8;
+  }
+
+  printf("%s\n", p->name);
+  printf("   n   aligned  misaligned  (ns/call)\n");
+  for(i=0;i<N_LENGTHS;i++){
+    double aligned, misaligned;
+
+    aligned = time_calls (ex, dest, src1, src2, lengths[i]);
+    misaligned = time_calls (ex, dest + size, src1 + size, src2 + size,
+        lengths[i]);
+    printf("%4d  %8.2f  %10.2f\n", lengths[i], aligned, misaligned);
+  }
+
+  orc_executor_free (ex);
+  for(i=0;i<3;i++){
+    free (mem[i]);
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  OrcProgram *p;
+
+  orc_init ();
+
+  p = make_volume ();
+  bench_program (p, 2);
+  orc_program_free (p);
+
+  p = make_mix ();
+  bench_program (p, 4);
+  orc_program_free (p);
+
+  return 0;
+}
+
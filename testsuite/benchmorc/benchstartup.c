@@ -0,0 +1,194 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+#include <orc/orcparse.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#endif
+
+/* Measures process startup time, that is orc_init() plus compiling all
+ * the functions in an .orc file (bench10.orc by default), without the
+ * on-disk code cache, with an empty cache directory, and with the
+ * cache directory filled by the previous run.  Each measurement runs
+ * in a new process. */
+
+#define N_RUNS 5
+
+static char * read_file (const char *filename);
+
+static double
+get_time (void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+static void
+startup (const char *code, const char *cache_dir)
+{
+  OrcProgram **programs;
+  unsigned long hits, misses;
+  double start, elapsed;
+  int n;
+  int i;
+
+  if (cache_dir) {
+    setenv ("ORC_CACHE_DIR", cache_dir, 1);
+  } else {
+    unsetenv ("ORC_CACHE_DIR");
+  }
+
+  start = get_time ();
+  orc_init ();
+  n = orc_parse (code, &programs);
+  for(i=0;i<n;i++){
+    orc_program_compile (programs[i]);
+  }
+  elapsed = get_time () - start;
+
+  orc_code_cache_get_disk_stats (&hits, &misses);
+  printf("%6.1f ms  (%d programs, %lu loaded from disk, %lu not found)\n",
+      1000 * elapsed, n, hits, misses);
+}
+
+#ifdef HAVE_UNISTD_H
+static void
+run (const char *name, const char *code, const char *cache_dir)
+{
+  pid_t pid;
+
+  printf("%-10s ", name);
+  fflush (stdout);
+
+  pid = fork ();
+  if (pid == 0) {
+    startup (code, cache_dir);
+    exit (0);
+  }
+  waitpid (pid, NULL, 0);
+}
+
+static void
+clear_dir (const char *dirname)
+{
+  DIR *dir;
+  struct dirent *entry;
+  char path[1024];
+
+  dir = opendir (dirname);
+  if (dir == NULL) return;
+  while ((entry = readdir (dir))) {
+    if (strstr (entry->d_name, ".orccode") == NULL) continue;
+    snprintf (path, sizeof(path), "%s/%s", dirname, entry->d_name);
+    remove (path);
+  }
+  closedir (dir);
+}
+#endif
+
+int
+main (int argc, char *argv[])
+{
+  const char *filename = "bench10.orc";
+  char *contents;
+#ifdef HAVE_UNISTD_H
+  char cache_dir[] = "/tmp/orc-cache-XXXXXX";
+  int i;
+#endif
+
+  if (argc > 1) {
+    filename = argv[1];
+  }
+
+  contents = read_file (filename);
+  if (!contents) {
+    printf("benchstartup needs %s file in current directory\n", filename);
+    exit(1);
+  }
+
+#ifdef HAVE_UNISTD_H
+  if (mkdtemp (cache_dir) == NULL) {
+    printf("failed to create cache directory\n");
+    exit(1);
+  }
+
+  for(i=0;i<N_RUNS;i++){
+    run ("no cache", contents, NULL);
+  }
+  for(i=0;i<N_RUNS;i++){
+    clear_dir (cache_dir);
+    run ("cold", contents, cache_dir);
+  }
+  for(i=0;i<N_RUNS;i++){
+    run ("warm", contents, cache_dir);
+  }
+
+  clear_dir (cache_dir);
+  rmdir (cache_dir);
+#else
+  startup (contents, getenv ("ORC_CACHE_DIR"));
+#endif
+
+  free (contents);
+
+  return 0;
+}
+
+static char *
+read_file (const char *filename)
+{
+  FILE *file = NULL;
+  char *contents = NULL;
+  long size;
+  int ret;
+
+  file = fopen (filename, "r");
+  if (file == NULL) return NULL;
+
+  ret = fseek (file, 0, SEEK_END);
+  if (ret < 0) goto bail;
+
+  size = ftell (file);
+  if (size < 0) goto bail;
+
+  ret = fseek (file, 0, SEEK_SET);
+  if (ret < 0) goto bail;
+
+  contents = malloc (size + 1);
+  if (contents == NULL) goto bail;
+
+  ret = fread (contents, size, 1, file);
+  if (ret < 0) goto bail;
+
+  contents[size] = 0;
+
+  fclose (file);
+  return contents;
+bail:
+  /* something failed */
+  if (file) fclose (file);
+  if (contents) free (contents);
+
+  return NULL;
+}
+
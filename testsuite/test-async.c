@@ -0,0 +1,178 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+
+/* Checks that a program compiled with orc_program_compile_async() runs
+ * correctly before and after the compiled code is published, and that
+ * the first run doesn't wait for the compile.  The latencies compared
+ * are the best of N_TRIALS, each with a fresh program so that nothing
+ * comes from the in-memory code cache.  A warm ORC_CACHE_DIR makes
+ * compiling as fast as emulating, so the latencies are only compared
+ * without one.  Also checks orc_program_compile_many(). */
+
+#define N 64
+#define N_TRIALS 5
+#define N_OPS 24
+#define N_PROGRAMS 40
+
+int error = FALSE;
+
+static double
+get_time (void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+static OrcProgram *
+make_program (int value)
+{
+  OrcProgram *p;
+  int i;
+
+  p = orc_program_new_ds (2, 2);
+  orc_program_set_name (p, "test_async");
+  orc_program_add_constant (p, 2, value, "c1");
+  orc_program_add_constant (p, 2, 3, "c2");
+  orc_program_add_temporary (p, 2, "t1");
+
+  orc_program_append_ds_str (p, "copyw", "t1", "s1");
+  for(i=0;i<N_OPS;i++){
+    orc_program_append_str (p, "addw", "t1", "t1", "c1");
+    orc_program_append_str (p, "xorw", "t1", "t1", "c2");
+  }
+  orc_program_append_ds_str (p, "copyw", "d1", "t1");
+
+  return p;
+}
+
+static void
+run_program (OrcProgram *p)
+{
+  OrcExecutor *ex;
+  orc_int16 src[N], dest[N];
+  int i, j;
+
+  for(i=0;i<N;i++) src[i] = i * 17;
+
+  ex = orc_executor_new (p);
+  orc_executor_set_n (ex, N);
+  orc_executor_set_array (ex, ORC_VAR_S1, src);
+  orc_executor_set_array (ex, ORC_VAR_D1, dest);
+  orc_executor_run (ex);
+  orc_executor_free (ex);
+
+  for(i=0;i<N;i++){
+    orc_int16 x = src[i];
+
+    for(j=0;j<N_OPS;j++){
+      x = (x + p->vars[ORC_VAR_C1].value.i) ^ 3;
+    }
+    if (dest[i] != x) {
+      printf("wrong result at %d: %d, expected %d\n", i, dest[i], x);
+      error = TRUE;
+      return;
+    }
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  OrcProgram *p;
+  OrcProgram *programs[N_PROGRAMS];
+  OrcCompileResult results[N_PROGRAMS];
+  double start, elapsed;
+  double sync_latency = 1e9;
+  double async_latency = 1e9;
+  unsigned long disk_hits;
+  int compiled = FALSE;
+  int i;
+
+  orc_init ();
+
+  for(i=0;i<N_TRIALS;i++){
+    p = make_program (1 + i);
+    start = get_time ();
+    orc_program_compile (p);
+    run_program (p);
+    elapsed = get_time () - start;
+    if (elapsed < sync_latency) sync_latency = elapsed;
+    if (p->code_exec != (void *)orc_executor_emulate) compiled = TRUE;
+    orc_program_free (p);
+  }
+
+  for(i=0;i<N_TRIALS;i++){
+    OrcCompileResult result;
+
+    p = make_program (100 + i);
+    start = get_time ();
+    orc_program_compile_async (p);
+    run_program (p);
+    elapsed = get_time () - start;
+    if (elapsed < async_latency) async_latency = elapsed;
+
+    result = orc_program_compile_wait (p);
+    if (!orc_program_compile_finished (p)) {
+      printf("compile not finished after waiting\n");
+      error = TRUE;
+    }
+    if (compiled && (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (result) ||
+          p->code_exec == (void *)orc_executor_emulate)) {
+      printf("compiled code was not published\n");
+      error = TRUE;
+    }
+    run_program (p);
+    orc_program_free (p);
+  }
+
+  /* freeing has to wait for the compile */
+  p = make_program (200);
+  orc_program_compile_async (p);
+  orc_program_free (p);
+
+  printf("first run: %.1f us compiling, %.1f us in the background\n",
+      1e6 * sync_latency, 1e6 * async_latency);
+  orc_code_cache_get_disk_stats (&disk_hits, NULL);
+  if (compiled && disk_hits == 0 && async_latency > sync_latency) {
+    printf("first run waited for the compile\n");
+    error = TRUE;
+  }
+
+  /* the last one is still compiling when the batch starts */
+  for(i=0;i<N_PROGRAMS;i++){
+    programs[i] = make_program (300 + i % (N_PROGRAMS / 2));
+  }
+  orc_program_compile_async (programs[N_PROGRAMS - 1]);
+  orc_program_compile_many (programs, N_PROGRAMS - 1, results);
+  for(i=0;i<N_PROGRAMS;i++){
+    if (i < N_PROGRAMS - 1 && compiled &&
+        !ORC_COMPILE_RESULT_IS_SUCCESSFUL (results[i])) {
+      printf("program %d failed to compile\n", i);
+      error = TRUE;
+    }
+    run_program (programs[i]);
+    orc_program_free (programs[i]);
+  }
+
+  if (error) return 1;
+  return 0;
+}
+
@@ -0,0 +1,124 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <orc/orc.h>
+#include <orc-test/orctest.h>
+
+/* Checks programs compiled with ORC_CODE=autotune against the emulator,
+ * for lengths that don't fill a loop iteration, and that their assembly
+ * listing can still be produced.  The first program has enough pointers
+ * that the x86 targets need the registers saved by the caller, which
+ * the timing runs have to leave alone. */
+
+#define MAX_N 1027
+#define M 5
+
+int error = FALSE;
+
+static OrcProgram *
+make_sum (void)
+{
+  static const char *srcs[] = { "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+    "s8" };
+  OrcProgram *p;
+  int i;
+
+  p = orc_program_new ();
+  orc_program_set_name (p, "test_autotune_sum");
+  orc_program_add_destination (p, 2, "d1");
+  for(i=0;i<8;i++){
+    orc_program_add_source (p, 2, srcs[i]);
+  }
+  orc_program_add_temporary (p, 2, "t1");
+
+  orc_program_append_str (p, "addw", "t1", "s1", "s2");
+  for(i=2;i<8;i++){
+    orc_program_append_str (p, "addw", "t1", "t1", srcs[i]);
+  }
+  orc_program_append_ds_str (p, "copyw", "d1", "t1");
+
+  return p;
+}
+
+static OrcProgram *
+make_float (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_dss (4, 4, 4);
+  orc_program_set_name (p, "test_autotune_float");
+  orc_program_add_temporary (p, 4, "t1");
+
+  orc_program_append_str (p, "mulf", "t1", "s1", "s2");
+  orc_program_append_str (p, "addf", "d1", "t1", "s1");
+
+  return p;
+}
+
+static OrcProgram *
+make_2d (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_dss (1, 1, 1);
+  orc_program_set_name (p, "test_autotune_2d");
+  orc_program_set_2d (p);
+
+  orc_program_append_str (p, "avgub", "d1", "s1", "s2");
+
+  return p;
+}
+
+static void
+test_program (OrcProgram *p, int flags)
+{
+  static const int lengths[] = { 1, 15, 100, MAX_N };
+  OrcCompileResult result;
+  const char *asm_code;
+  int i;
+
+  result = orc_program_compile (p);
+  if (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (result)) {
+    /* nothing to check for targets without a compiler */
+    orc_program_free (p);
+    return;
+  }
+
+  for(i=0;i<(int)(sizeof(lengths)/sizeof(lengths[0]));i++){
+    if (orc_test_compare_output_n (p, lengths[i], M, 0,
+          flags | ORC_TEST_FLAGS_COMPILED) == ORC_TEST_FAILED) {
+      printf("%s: n=%d differs from the emulator\n", p->name, lengths[i]);
+      error = TRUE;
+    }
+  }
+
+  asm_code = orc_program_get_asm_code (p);
+  if (asm_code == NULL || strstr (asm_code, p->name) == NULL) {
+    printf("%s: no assembly listing\n", p->name);
+    error = TRUE;
+  }
+
+  orc_program_free (p);
+}
+
+int
+main (int argc, char *argv[])
+{
+  setenv ("ORC_CODE", "autotune", 1);
+  orc_init ();
+  orc_test_init ();
+
+  test_program (make_sum (), 0);
+  test_program (make_float (), ORC_TEST_FLAGS_FLOAT);
+  test_program (make_2d (), 0);
+
+  if (error) return 1;
+  return 0;
+}
+
@@ -0,0 +1,153 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+#include <orc/orcdebug.h>
+
+/* Checks that identical programs share compiled code, that different
+ * ones don't, that shared code stays usable until the last program
+ * using it is freed, and that its assembly listing can be produced.
+ * Programs with a constant n the bytecode can't encode aren't cached. */
+
+int error = FALSE;
+
+static OrcProgram *
+make_program (int value)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (2, 2);
+  orc_program_set_name (p, "test_codecache");
+  orc_program_add_constant (p, 2, value, "c1");
+  orc_program_append_str (p, "addw", "d1", "s1", "c1");
+  orc_program_compile (p);
+
+  return p;
+}
+
+static void
+check_program (OrcProgram *p, int value)
+{
+  OrcExecutor *ex;
+  orc_int16 src[100], dest[100];
+  int i;
+
+  for(i=0;i<100;i++) src[i] = i;
+
+  ex = orc_executor_new (p);
+  orc_executor_set_n (ex, 100);
+  orc_executor_set_array (ex, ORC_VAR_S1, src);
+  orc_executor_set_array (ex, ORC_VAR_D1, dest);
+  orc_executor_run (ex);
+  orc_executor_free (ex);
+
+  for(i=0;i<100;i++){
+    if (dest[i] != src[i] + value) {
+      printf("wrong result at %d: %d\n", i, dest[i]);
+      error = TRUE;
+      return;
+    }
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  OrcProgram *p1, *p2, *p3;
+  unsigned long hits, misses;
+  const char *asm_code;
+  int n_entries;
+
+  orc_init ();
+
+  if (orc_compiler_flag_check ("-cache") ||
+      orc_compiler_flag_check ("emulate") ||
+      orc_compiler_flag_check ("debug") ||
+      orc_compiler_flag_check ("randomize")) {
+    printf("code cache disabled\n");
+    return 0;
+  }
+
+  p1 = make_program (1);
+  if (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (p1->orccode->result) ||
+      p1->orccode->code_size == 0) {
+    /* nothing to cache without a code generating target */
+    orc_program_free (p1);
+    return 0;
+  }
+  p2 = make_program (1);
+  p3 = make_program (2);
+
+  orc_code_cache_get_stats (&hits, &misses, &n_entries);
+  printf("hits %lu misses %lu entries %d\n", hits, misses, n_entries);
+  if (hits != 1 || misses != 2 || n_entries != 2) error = TRUE;
+
+  if (p1->orccode != p2->orccode) {
+    printf("identical programs don't share code\n");
+    error = TRUE;
+  }
+  if (p1->orccode == p3->orccode) {
+    printf("different programs share code\n");
+    error = TRUE;
+  }
+
+  /* the listing is kept with the shared code, unless ORC_CODE has
+   * "nolisting", when it is produced on request without touching the
+   * cache */
+  if (!orc_compiler_flag_check ("nolisting") &&
+      (p1->asm_code == NULL || p2->asm_code == NULL)) {
+    printf("no assembly code after compiling\n");
+    error = TRUE;
+  }
+  asm_code = orc_program_get_asm_code (p2);
+  if (asm_code == NULL || asm_code[0] == 0) {
+    printf("no assembly code for shared code\n");
+    error = TRUE;
+  }
+  orc_code_cache_get_stats (&hits, &misses, &n_entries);
+  if (hits != 1 || misses != 2 || n_entries != 2) {
+    printf("producing the listing used the cache\n");
+    error = TRUE;
+  }
+
+  orc_program_free (p1);
+  check_program (p2, 1);
+  check_program (p3, 2);
+
+  orc_program_free (p2);
+  orc_program_free (p3);
+
+  orc_code_cache_get_stats (NULL, NULL, &n_entries);
+  if (n_entries != 0) {
+    printf("%d entries left after freeing all programs\n", n_entries);
+    error = TRUE;
+  }
+
+  /* a constant n that the bytecode can't encode keeps the program out
+   * of the cache, instead of aborting the compile */
+  p1 = orc_program_new_ds (2, 2);
+  orc_program_set_name (p1, "test_codecache_big_n");
+  orc_program_set_constant_n (p1, 70000);
+  orc_program_append_ds_str (p1, "copyw", "d1", "s1");
+  if (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (orc_program_compile (p1))) {
+    printf("program with n=70000 failed to compile\n");
+    error = TRUE;
+  }
+  orc_code_cache_get_stats (NULL, NULL, &n_entries);
+  if (n_entries != 0) {
+    printf("program with n=70000 was cached\n");
+    error = TRUE;
+  }
+  orc_program_free (p1);
+
+  if (error) return 1;
+  return 0;
+}
+
@@ -0,0 +1,192 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+#include <orc/orcdebug.h>
+
+/* Allocates and frees lots of code chunks of random size, checking that
+ * live chunks never overlap, and reports the time per operation and the
+ * fragmentation of code memory afterwards.  Then checks that freed
+ * regions are returned, and that compacted programs still work. */
+
+#define N_ALLOCATIONS 100000
+#define N_LIVE 2048
+#define N_PROGRAMS 64
+
+int error = FALSE;
+
+static OrcCode *live[N_LIVE];
+
+static double
+get_time (void)
+{
+#ifdef HAVE_GETTIMEOFDAY
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return tv.tv_sec + 1e-6 * tv.tv_usec;
+#else
+  return 0;
+#endif
+}
+
+static int
+random_size (void)
+{
+  /* mostly typical kernel sizes, sometimes a big one */
+  if ((rand () & 63) == 0) {
+    return 8192 + (rand () % 16384);
+  }
+  return 32 + (rand () % 3000);
+}
+
+static void
+fill (OrcCode *code, int i)
+{
+  memset (code->code, i & 0xff, code->code_size);
+}
+
+static void
+check (OrcCode *code, int i)
+{
+  unsigned char *ptr = (unsigned char *)code->exec;
+  int j;
+
+  for(j=0;j<code->code_size;j++){
+    if (ptr[j] != (i & 0xff)) {
+      printf("chunk %p overwritten at offset %d\n", code->exec, j);
+      error = TRUE;
+      return;
+    }
+  }
+}
+
+static void
+test_compact (void)
+{
+  OrcProgram *programs[N_PROGRAMS];
+  OrcCode *filler[N_PROGRAMS];
+  OrcExecutor *ex;
+  orc_int16 src[64], dest[64];
+  int before, after;
+  int i, j;
+
+  for(i=0;i<N_PROGRAMS;i++){
+    programs[i] = orc_program_new_ds (2, 2);
+    orc_program_add_constant (programs[i], 2, i, "c1");
+    orc_program_append_str (programs[i], "addw", "d1", "s1", "c1");
+    orc_program_compile (programs[i]);
+
+    /* spread the programs out over many spans */
+    filler[i] = orc_code_new ();
+    orc_code_allocate_codemem (filler[i], 1000);
+  }
+  for(i=0;i<N_PROGRAMS;i++){
+    orc_code_free (filler[i]);
+  }
+  orc_code_release_unused ();
+  orc_code_get_memory_usage (&before, NULL, NULL);
+
+  orc_code_compact (programs, N_PROGRAMS);
+  orc_code_release_unused ();
+  orc_code_get_memory_usage (&after, NULL, NULL);
+  printf("compacting %d programs: %d regions before, %d after\n",
+      N_PROGRAMS, before, after);
+  if (after > before) error = TRUE;
+
+  for(j=0;j<64;j++) src[j] = j * 100;
+
+  for(i=0;i<N_PROGRAMS;i++){
+    ex = orc_executor_new (programs[i]);
+    orc_executor_set_n (ex, 64);
+    orc_executor_set_array (ex, ORC_VAR_S1, src);
+    orc_executor_set_array (ex, ORC_VAR_D1, dest);
+    orc_executor_run (ex);
+    for(j=0;j<64;j++){
+      if (dest[j] != src[j] + i) {
+        printf("program %d gives wrong result after compacting\n", i);
+        error = TRUE;
+        break;
+      }
+    }
+    orc_executor_free (ex);
+  }
+
+  for(i=0;i<N_PROGRAMS;i++){
+    orc_program_free (programs[i]);
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  double start, elapsed;
+  long region_bytes, chunk_bytes, requested;
+  int n_regions;
+  int i, j;
+
+  orc_init ();
+
+  srand (1);
+
+  start = get_time ();
+  for(i=0;i<N_ALLOCATIONS;i++){
+    j = rand () % N_LIVE;
+
+    if (live[j]) {
+      orc_code_free (live[j]);
+    }
+    live[j] = orc_code_new ();
+    orc_code_allocate_codemem (live[j], random_size ());
+  }
+  elapsed = get_time () - start;
+
+  printf("%d alloc/free pairs: %g ns per pair\n", N_ALLOCATIONS,
+      1e9 * elapsed / N_ALLOCATIONS);
+
+  for(j=0;j<N_LIVE;j++){
+    if (live[j]) fill (live[j], j);
+  }
+  for(j=0;j<N_LIVE;j++){
+    if (live[j]) check (live[j], j);
+  }
+
+  requested = 0;
+  for(j=0;j<N_LIVE;j++){
+    if (live[j]) requested += live[j]->code_size;
+  }
+  orc_code_get_memory_usage (&n_regions, &region_bytes, &chunk_bytes);
+  printf("%d regions, %ld bytes mapped, %ld bytes in chunks, "
+      "%ld bytes requested\n", n_regions, region_bytes, chunk_bytes,
+      requested);
+  printf("rounding waste %.1f%%, unused mapped memory %.1f%%\n",
+      100.0 * (chunk_bytes - requested) / chunk_bytes,
+      100.0 * (region_bytes - chunk_bytes) / region_bytes);
+
+  for(j=0;j<N_LIVE;j++){
+    if (live[j]) orc_code_free (live[j]);
+  }
+
+  orc_code_release_unused ();
+  orc_code_get_memory_usage (&n_regions, &region_bytes, &chunk_bytes);
+  printf("after freeing everything: %d regions, %ld bytes mapped\n",
+      n_regions, region_bytes);
+  if (n_regions != 0) error = TRUE;
+
+  test_compact ();
+
+  if (error) return 1;
+  return 0;
+}
+
@@ -0,0 +1,177 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_THREAD_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <orc/orc.h>
+
+/* Compiles every integer opcode in the "sys" opcode set from N_THREADS
+ * threads at once, and checks the output of each compiled program
+ * against the emulator.  The in-memory code cache is turned off (unless
+ * ORC_CODE is already set), so that every thread really runs the
+ * compiler instead of picking up code compiled by another thread. */
+
+#define N_THREADS 32
+#define N_ROUNDS 2
+#define N 80
+
+volatile int error = FALSE;
+
+static OrcProgram *
+make_program (OrcStaticOpcode *opcode)
+{
+  OrcProgram *p;
+  char s[40];
+
+  p = orc_program_new ();
+  if (opcode->flags & ORC_STATIC_OPCODE_ACCUMULATOR) {
+    orc_program_add_accumulator (p, opcode->dest_size[0], "d1");
+  } else {
+    orc_program_add_destination (p, opcode->dest_size[0], "d1");
+  }
+  if (opcode->dest_size[1] != 0) {
+    orc_program_add_destination (p, opcode->dest_size[1], "d2");
+  }
+  orc_program_add_source (p, opcode->src_size[0], "s1");
+  if (opcode->src_size[1] != 0) {
+    orc_program_add_source (p, opcode->src_size[1], "s2");
+  }
+
+  sprintf(s, "test_%s", opcode->name);
+  orc_program_set_name (p, s);
+
+  if (opcode->dest_size[1] != 0) {
+    orc_program_append_dds_str (p, opcode->name, "d1", "d2", "s1");
+  } else {
+    orc_program_append_str (p, opcode->name, "d1", "s1",
+        opcode->src_size[1] ? "s2" : NULL);
+  }
+
+  return p;
+}
+
+static int
+test_opcode (OrcStaticOpcode *opcode, int seed)
+{
+  OrcProgram *p;
+  OrcExecutor *ex;
+  OrcCompileResult result;
+  unsigned char src[2][N * 8];
+  unsigned char dest_exec[2][N * 8];
+  unsigned char dest_emul[2][N * 8];
+  int acc_exec = 0;
+  int acc_emul = 0;
+  int ret = TRUE;
+  int i;
+
+  p = make_program (opcode);
+  result = orc_program_compile (p);
+  if (ORC_COMPILE_RESULT_IS_FATAL (result)) {
+    printf("%s: compile failed: %s\n", opcode->name,
+        orc_program_get_error (p));
+    orc_program_free (p);
+    return FALSE;
+  }
+
+  for(i=0;i<N*8;i++){
+    src[0][i] = (i * 37 + seed) & 0xff;
+    src[1][i] = (i * 91 + seed * 7) & 0xff;
+  }
+  memset (dest_exec, 0, sizeof(dest_exec));
+  memset (dest_emul, 0, sizeof(dest_emul));
+
+  ex = orc_executor_new (p);
+  orc_executor_set_n (ex, N - (seed & 0xf));
+  orc_executor_set_array (ex, ORC_VAR_S1, src[0]);
+  orc_executor_set_array (ex, ORC_VAR_S2, src[1]);
+
+  orc_executor_set_array (ex, ORC_VAR_D1, dest_exec[0]);
+  orc_executor_set_array (ex, ORC_VAR_D2, dest_exec[1]);
+  orc_executor_run (ex);
+  acc_exec = ex->accumulators[0];
+
+  orc_executor_set_array (ex, ORC_VAR_D1, dest_emul[0]);
+  orc_executor_set_array (ex, ORC_VAR_D2, dest_emul[1]);
+  orc_executor_emulate (ex);
+  acc_emul = ex->accumulators[0];
+
+  if (opcode->flags & ORC_STATIC_OPCODE_ACCUMULATOR) {
+    if (acc_exec != acc_emul) {
+      printf("%s: accumulator %d, expected %d\n", opcode->name,
+          acc_exec, acc_emul);
+      ret = FALSE;
+    }
+  } else if (memcmp (dest_exec, dest_emul, sizeof(dest_exec)) != 0) {
+    printf("%s: output differs from the emulator\n", opcode->name);
+    ret = FALSE;
+  }
+
+  orc_executor_free (ex);
+  orc_program_free (p);
+
+  return ret;
+}
+
+static void *
+test_thread (void *data)
+{
+  OrcOpcodeSet *opcode_set;
+  int seed = (int)(size_t)data;
+  int round;
+  int i;
+
+  opcode_set = orc_opcode_set_get ("sys");
+
+  for(round=0;round<N_ROUNDS;round++){
+    for(i=0;i<opcode_set->n_opcodes;i++){
+      OrcStaticOpcode *opcode = opcode_set->opcodes + i;
+
+      if (opcode->flags & (ORC_STATIC_OPCODE_SCALAR |
+            ORC_STATIC_OPCODE_FLOAT | ORC_STATIC_OPCODE_LOAD |
+            ORC_STATIC_OPCODE_STORE | ORC_STATIC_OPCODE_INVARIANT |
+            ORC_STATIC_OPCODE_ITERATOR)) {
+        continue;
+      }
+      if (!test_opcode (opcode, seed + round)) {
+        error = TRUE;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+#ifdef HAVE_THREAD_PTHREAD
+  pthread_t threads[N_THREADS];
+  int i;
+
+  setenv ("ORC_CODE", "-cache", 0);
+
+  orc_init ();
+
+  for(i=0;i<N_THREADS;i++){
+    if (pthread_create (&threads[i], NULL, test_thread,
+          (void *)(size_t)i) != 0) {
+      printf("failed to create thread %d\n", i);
+      return 1;
+    }
+  }
+  for(i=0;i<N_THREADS;i++){
+    pthread_join (threads[i], NULL);
+  }
+#endif
+
+  if (error) return 1;
+  return 0;
+}
+
@@ -0,0 +1,208 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+#include <orc-test/orctest.h>
+
+/* Checks orc_program_fuse(): three programs that unpack bytes to
+ * words, scale them and pack them again are fused into one, which must
+ * give the same output as running them one after another, without
+ * arrays for the intermediate values, and its code the same as the
+ * emulator.  Then checks that programs that
+ * can't be fused give NULL. */
+
+#define N 100
+
+int error = FALSE;
+
+static OrcProgram *
+make_unpack (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (2, 1);
+  orc_program_set_name (p, "unpack");
+  orc_program_append_ds_str (p, "convubw", "d1", "s1");
+
+  return p;
+}
+
+static OrcProgram *
+make_scale (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (2, 2);
+  orc_program_set_name (p, "scale");
+  orc_program_add_parameter (p, 2, "p1");
+  orc_program_add_constant (p, 2, 4, "c1");
+  orc_program_add_constant (p, 2, 16, "c2");
+  orc_program_add_temporary (p, 2, "t1");
+  orc_program_append_ds_str (p, "loadw", "t1", "s1");
+  orc_program_append_str (p, "mullw", "t1", "t1", "p1");
+  orc_program_append_str (p, "shruw", "t1", "t1", "c1");
+  orc_program_append_str (p, "subw", "t1", "t1", "c2");
+  orc_program_append_ds_str (p, "storew", "d1", "t1");
+
+  return p;
+}
+
+static OrcProgram *
+make_pack (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (1, 2);
+  orc_program_set_name (p, "pack");
+  orc_program_add_constant (p, 2, 16, "c1");
+  orc_program_add_temporary (p, 2, "t1");
+  orc_program_append_str (p, "addw", "t1", "s1", "c1");
+  orc_program_append_ds_str (p, "convsuswb", "d1", "t1");
+
+  return p;
+}
+
+static void
+emulate (OrcProgram *p, void *dest, void *src)
+{
+  OrcExecutor *ex;
+  int var;
+
+  ex = orc_executor_new (p);
+  orc_executor_set_n (ex, N);
+  orc_executor_set_array (ex, ORC_VAR_D1, dest);
+  orc_executor_set_array (ex, ORC_VAR_S1, src);
+  var = orc_program_find_var_by_name (p, "p1");
+  if (var >= 0) {
+    orc_executor_set_param (ex, var, 23);
+  }
+  orc_executor_emulate (ex);
+  orc_executor_free (ex);
+}
+
+static void
+test_chain (void)
+{
+  OrcProgram *unpack, *scale, *pack;
+  OrcProgram *p, *fused;
+  orc_uint8 src[N];
+  orc_int16 tmp1[N], tmp2[N];
+  orc_uint8 dest[N], dest_fused[N];
+  int i;
+
+  unpack = make_unpack ();
+  scale = make_scale ();
+  pack = make_pack ();
+
+  p = orc_program_fuse (unpack, scale, "d1", "s1");
+  if (p == NULL) {
+    printf("unpack and scale didn't fuse\n");
+    error = TRUE;
+    return;
+  }
+  fused = orc_program_fuse (p, pack, "d1", "s1");
+  orc_program_free (p);
+  if (fused == NULL) {
+    printf("pack didn't fuse\n");
+    error = TRUE;
+    return;
+  }
+
+  if (fused->n_src_vars != 1 || fused->n_dest_vars != 1 ||
+      fused->n_const_vars != 2 || fused->n_param_vars != 1) {
+    printf("fused program has %d sources, %d destinations, "
+        "%d constants and %d parameters\n", fused->n_src_vars,
+        fused->n_dest_vars, fused->n_const_vars, fused->n_param_vars);
+    error = TRUE;
+  }
+
+  orc_program_compile (unpack);
+  orc_program_compile (scale);
+  orc_program_compile (pack);
+  orc_program_compile (fused);
+
+  for(i=0;i<N;i++){
+    src[i] = i * 37;
+  }
+  emulate (unpack, tmp1, src);
+  emulate (scale, tmp2, tmp1);
+  emulate (pack, dest, tmp2);
+
+  memset (dest_fused, 0, N);
+  emulate (fused, dest_fused, src);
+  if (memcmp (dest, dest_fused, N) != 0) {
+    printf("emulated fused program differs\n");
+    error = TRUE;
+  }
+
+  if (orc_test_compare_output (fused) == ORC_TEST_FAILED) {
+    printf("compiled fused program differs\n");
+    error = TRUE;
+  }
+
+  orc_program_free (fused);
+  orc_program_free (unpack);
+  orc_program_free (scale);
+  orc_program_free (pack);
+}
+
+static void
+expect_no_fuse (const char *what, OrcProgram *producer,
+    OrcProgram *consumer, const char *dest_name, const char *src_name)
+{
+  OrcProgram *p;
+
+  p = orc_program_fuse (producer, consumer, dest_name, src_name);
+  if (p) {
+    printf("%s fused\n", what);
+    error = TRUE;
+    orc_program_free (p);
+  }
+  orc_program_free (producer);
+  orc_program_free (consumer);
+}
+
+int
+main (int argc, char *argv[])
+{
+  OrcProgram *p;
+  char name[10];
+  int i;
+
+  orc_init ();
+  orc_test_init ();
+
+  test_chain ();
+
+  expect_no_fuse ("different sizes", make_scale (), make_unpack (),
+      "d1", "s1");
+  expect_no_fuse ("source as destination", make_unpack (), make_scale (),
+      "s1", "s1");
+
+  p = orc_program_new_ds (2, 2);
+  orc_program_add_constant (p, 4, 1, "c1");
+  orc_program_add_temporary (p, 2, "t1");
+  orc_program_append_str (p, "loadoffw", "t1", "s1", "c1");
+  orc_program_append_ds_str (p, "copyw", "d1", "t1");
+  expect_no_fuse ("loadoffw", make_unpack (), p, "d1", "s1");
+
+  p = orc_program_new_ds (2, 2);
+  for(i=0;i<16;i++){
+    sprintf(name, "t%d", i + 1);
+    orc_program_add_temporary (p, 2, name);
+    orc_program_append_ds_str (p, "copyw", name, "s1");
+  }
+  orc_program_append_ds_str (p, "copyw", "d1", "t16");
+  expect_no_fuse ("too many temporaries", make_unpack (), p, "d1", "s1");
+
+  if (error) return 1;
+  return 0;
+}
+
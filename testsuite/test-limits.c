@@ -53,6 +53,65 @@ add_constant (OrcProgram *program, int size, const char *name)
   return orc_program_add_constant (program, size, 0, name);
 }
 
+#define N 100
+
+/* A program with n_ops times two instructions that all rewrite the same
+ * temporary and load a source.  Large ones have more instructions than
+ * ORC_N_INSNS and need more temporaries than there are variables. */
+static OrcCompileResult
+test_large (int n_ops)
+{
+  OrcProgram *p;
+  OrcExecutor *ex;
+  OrcCompileResult result;
+  orc_int16 src1[N], src2[N], dest[N];
+  int i, j;
+
+  p = orc_program_new_dss (2, 2, 2);
+  orc_program_add_constant (p, 2, 3, "c1");
+  orc_program_add_temporary (p, 2, "t1");
+
+  orc_program_append_ds_str (p, "copyw", "t1", "s1");
+  for(i=0;i<n_ops;i++){
+    orc_program_append_str (p, "addw", "t1", "t1", "s2");
+    orc_program_append_str (p, "xorw", "t1", "t1", "c1");
+  }
+  orc_program_append_ds_str (p, "copyw", "d1", "t1");
+
+  result = orc_program_compile (p);
+
+  for(i=0;i<N;i++){
+    src1[i] = i * 17;
+    src2[i] = i * 5 + 1;
+  }
+
+  ex = orc_executor_new (p);
+  orc_executor_set_n (ex, N);
+  orc_executor_set_array (ex, ORC_VAR_S1, src1);
+  orc_executor_set_array (ex, ORC_VAR_S2, src2);
+  orc_executor_set_array (ex, ORC_VAR_D1, dest);
+  orc_executor_run (ex);
+  orc_executor_free (ex);
+
+  for(i=0;i<N;i++){
+    orc_int16 x = src1[i];
+
+    for(j=0;j<n_ops;j++){
+      x = (x + src2[i]) ^ 3;
+    }
+    if (dest[i] != x) {
+      printf("%d ops: wrong result at %d: %d, expected %d\n", n_ops, i,
+          dest[i], x);
+      error = TRUE;
+      break;
+    }
+  }
+
+  orc_program_free (p);
+
+  return result;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -66,6 +125,14 @@ main (int argc, char *argv[])
   test_simple (ORC_MAX_PARAM_VARS, orc_program_add_parameter);
   test_simple (ORC_MAX_ACCUM_VARS, orc_program_add_accumulator);
 
+  if (ORC_COMPILE_RESULT_IS_SUCCESSFUL (test_large (1))) {
+    if (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (test_large (ORC_N_INSNS))) {
+      printf("program with %d instructions failed to compile\n",
+          2 * ORC_N_INSNS + 2);
+      error = TRUE;
+    }
+  }
+
   if (error) return 1;
   return 0;
 }
@@ -0,0 +1,499 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+#include <orc-test/orctest.h>
+
+/* Checks the optimization passes that run before the register
+ * allocation: the second load of each source, the repeated addw, the
+ * mullw whose result isn't read and the copy before the store of d2
+ * are removed, and the output is still that of the program as
+ * written.  The output is compared with C code and with the emulator,
+ * which runs the instructions as written.  The instruction counts are
+ * only checked if no pass is turned off in ORC_CODE.
+ *
+ * Then checks that the simplifier removes operations with an identity
+ * constant and conversions that cancel out, that every integer opcode
+ * with one constant source, which the simplifier may rewrite, gives
+ * what the emulator gives for the instruction as written, and that it
+ * gives what the emulator gives for the same values in arrays when it
+ * is computed at compile time from constant sources, and when it is
+ * computed before the loop from parameters. */
+
+#define N 100
+
+/* loads, addw, loadpw, xorw, addw and two stores */
+#define N_OPTIMIZED_INSNS 8
+
+/* load, convubw, loadpw, addw, store */
+#define N_SIMPLIFIED_INSNS 5
+
+int error = FALSE;
+
+static const orc_int64 values[] = {
+  0, 1, -1, 3, 0x12345678, -300, (orc_int64)ORC_UINT64_C(0x123456789abcdef0)
+};
+#define N_VALUES (int)(sizeof(values) / sizeof(values[0]))
+
+/* identities, powers of two and masks */
+static const orc_int64 simplify_values[] = {
+  0, 1, -1, 2, 8, 0xff, 0xffff
+};
+#define N_SIMPLIFY_VALUES \
+  (int)(sizeof(simplify_values) / sizeof(simplify_values[0]))
+
+static OrcProgram *
+make_program (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new ();
+  orc_program_set_name (p, "test_optimize");
+  orc_program_add_destination (p, 2, "d1");
+  orc_program_add_destination (p, 2, "d2");
+  orc_program_add_source (p, 2, "s1");
+  orc_program_add_source (p, 2, "s2");
+  orc_program_add_constant (p, 2, 0x1234, "c1");
+  orc_program_add_temporary (p, 2, "t1");
+  orc_program_add_temporary (p, 2, "t2");
+  orc_program_add_temporary (p, 2, "t3");
+  orc_program_add_temporary (p, 2, "t4");
+
+  orc_program_append_str (p, "addw", "t1", "s1", "s2");
+  orc_program_append_str (p, "addw", "t2", "s1", "s2");
+  orc_program_append_str (p, "xorw", "t3", "t1", "c1");
+  orc_program_append_str (p, "mullw", "t4", "t2", "s1");
+  orc_program_append_str (p, "addw", "d1", "t3", "t2");
+  orc_program_append_ds_str (p, "copyw", "d2", "t2");
+
+  return p;
+}
+
+static int
+passes_disabled (void)
+{
+  return orc_compiler_flag_check ("-opt") ||
+    orc_compiler_flag_check ("-simplify") ||
+    orc_compiler_flag_check ("-rle") ||
+    orc_compiler_flag_check ("-cse") ||
+    orc_compiler_flag_check ("-dce") ||
+    orc_compiler_flag_check ("-licm");
+}
+
+/* Every instruction but the convubw and the last addw is an identity */
+static OrcProgram *
+make_simplify_program (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (2, 1);
+  orc_program_set_name (p, "test_simplify");
+  orc_program_add_constant (p, 2, 0, "c1");
+  orc_program_add_constant (p, 2, 1, "c2");
+  orc_program_add_constant (p, 2, 0xffff, "c3");
+  orc_program_add_constant (p, 2, 5, "c4");
+  orc_program_add_temporary (p, 2, "t1");
+  orc_program_add_temporary (p, 1, "t2");
+  orc_program_add_temporary (p, 2, "t3");
+  orc_program_add_temporary (p, 2, "t4");
+  orc_program_add_temporary (p, 2, "t5");
+  orc_program_add_temporary (p, 2, "t6");
+  orc_program_add_temporary (p, 2, "t7");
+  orc_program_add_temporary (p, 2, "t8");
+  orc_program_add_temporary (p, 2, "t9");
+
+  orc_program_append_ds_str (p, "convsbw", "t1", "s1");
+  orc_program_append_ds_str (p, "convwb", "t2", "t1");
+  orc_program_append_ds_str (p, "convubw", "t3", "t2");
+  orc_program_append_str (p, "shlw", "t4", "t3", "c1");
+  orc_program_append_str (p, "mullw", "t5", "c2", "t4");
+  orc_program_append_str (p, "andw", "t6", "t5", "c3");
+  orc_program_append_str (p, "subw", "t7", "t6", "c1");
+  orc_program_append_ds_str (p, "swapw", "t8", "t7");
+  orc_program_append_ds_str (p, "swapw", "t9", "t8");
+  orc_program_append_str (p, "addw", "d1", "t9", "c4");
+
+  return p;
+}
+
+static void
+test_simplify (void)
+{
+  OrcProgram *p;
+  OrcExecutor *ex;
+  OrcCompileResult result;
+  orc_uint8 src[N];
+  orc_int16 dest[N];
+  int i;
+
+  p = make_simplify_program ();
+  result = orc_program_compile (p);
+  if (ORC_COMPILE_RESULT_IS_FATAL (result)) {
+    printf("compile failed: %s\n", orc_program_get_error (p));
+    error = TRUE;
+    orc_program_free (p);
+    return;
+  }
+
+  if (!passes_disabled () &&
+      p->orccode->n_compiled_insns != N_SIMPLIFIED_INSNS) {
+    printf("%d instructions after simplifying, expected %d\n",
+        p->orccode->n_compiled_insns, N_SIMPLIFIED_INSNS);
+    error = TRUE;
+  }
+
+  for(i=0;i<N;i++){
+    src[i] = i * 7;
+  }
+
+  ex = orc_executor_new (p);
+  orc_executor_set_n (ex, N);
+  orc_executor_set_array (ex, ORC_VAR_S1, src);
+  orc_executor_set_array (ex, ORC_VAR_D1, dest);
+  orc_executor_run (ex);
+  orc_executor_free (ex);
+
+  for(i=0;i<N;i++){
+    if (dest[i] != src[i] + 5) {
+      printf("simplify: wrong result at %d: %d, expected %d\n", i,
+          dest[i], src[i] + 5);
+      error = TRUE;
+      break;
+    }
+  }
+
+  if (p->orccode->n_insns <= N_SIMPLIFIED_INSNS) {
+    printf("the emulator runs the simplified instructions\n");
+    error = TRUE;
+  }
+  if (orc_test_compare_output_full (p, ORC_TEST_FLAGS_COMPILED) ==
+      ORC_TEST_FAILED) {
+    printf("simplified code differs from the emulator\n");
+    error = TRUE;
+  }
+
+  orc_program_free (p);
+}
+
+static void
+add_constant (OrcProgram *p, int size, orc_int64 value, const char *name)
+{
+  if (size == 8) {
+    orc_program_add_constant_int64 (p, size, value, name);
+  } else {
+    orc_program_add_constant (p, size, (int)value, name);
+  }
+}
+
+static void
+set_element (void *array, int size, int i, orc_int64 value)
+{
+  switch (size) {
+    case 1:
+      ((orc_int8 *)array)[i] = value;
+      break;
+    case 2:
+      ((orc_int16 *)array)[i] = value;
+      break;
+    case 4:
+      ((orc_int32 *)array)[i] = value;
+      break;
+    default:
+      ((orc_int64 *)array)[i] = value;
+      break;
+  }
+}
+
+static void
+add_source_value (OrcProgram *p, int size, orc_int64 value, const char *name,
+    int use_params)
+{
+  if (!use_params) {
+    add_constant (p, size, value, name);
+  } else if (size == 8) {
+    orc_program_add_parameter_int64 (p, size, name);
+  } else {
+    orc_program_add_parameter (p, size, name);
+  }
+}
+
+static void
+set_param (OrcExecutor *ex, int var, int size, orc_int64 value)
+{
+  if (size == 8) {
+    orc_executor_set_param_int64 (ex, var, value);
+  } else {
+    orc_executor_set_param (ex, var, (int)value);
+  }
+}
+
+/* Compiles opcode with a constant as the source at index constant and
+ * an array as the other one, and compares it with the emulator */
+static int
+test_simplify_opcode (OrcStaticOpcode *opcode, orc_int64 value,
+    int constant)
+{
+  OrcProgram *p;
+  int ret = TRUE;
+
+  p = orc_program_new ();
+  orc_program_set_name (p, "test_simplify_opcode");
+  orc_program_add_destination (p, opcode->dest_size[0], "d1");
+  orc_program_add_source (p, opcode->src_size[1 - constant], "s1");
+  add_constant (p, opcode->src_size[constant], value, "c1");
+  if (constant == 0) {
+    orc_program_append_str (p, opcode->name, "d1", "c1", "s1");
+  } else {
+    orc_program_append_str (p, opcode->name, "d1", "s1", "c1");
+  }
+
+  if (orc_test_compare_output (p) == ORC_TEST_FAILED) {
+    printf("%s with %s constant 0x%08x%08x differs from the emulator\n",
+        opcode->name, constant ? "right" : "left",
+        (orc_uint32)(value >> 32), (orc_uint32)value);
+    ret = FALSE;
+  }
+
+  orc_program_free (p);
+
+  return ret;
+}
+
+static void
+test_simplify_opcodes (void)
+{
+  OrcOpcodeSet *opcode_set;
+  int i, j, k;
+
+  opcode_set = orc_opcode_set_get ("sys");
+
+  for(i=0;i<opcode_set->n_opcodes;i++){
+    OrcStaticOpcode *opcode = opcode_set->opcodes + i;
+
+    if (opcode->flags & (ORC_STATIC_OPCODE_FLOAT | ORC_STATIC_OPCODE_LOAD |
+          ORC_STATIC_OPCODE_STORE | ORC_STATIC_OPCODE_ACCUMULATOR |
+          ORC_STATIC_OPCODE_ITERATOR | ORC_STATIC_OPCODE_INVARIANT)) {
+      continue;
+    }
+    if (opcode->dest_size[1] != 0 || opcode->src_size[1] == 0 ||
+        opcode->src_size[2] != 0) continue;
+
+    for(j=0;j<N_SIMPLIFY_VALUES;j++){
+      for(k=0;k<2;k++){
+        orc_int64 value = simplify_values[j];
+
+        /* shift counts are scalars, which can't be arrays */
+        if (opcode->flags & ORC_STATIC_OPCODE_SCALAR) {
+          if (k == 0) continue;
+          value &= opcode->src_size[0] * 8 - 1;
+        }
+        if (!test_simplify_opcode (opcode, value, k)) {
+          error = TRUE;
+        }
+      }
+    }
+  }
+}
+
+/* Compiles opcode with constant or parameter sources, and runs it on
+ * arrays filled with the same values in the emulator */
+static int
+test_invariant_opcode (OrcStaticOpcode *opcode, orc_int64 value1,
+    orc_int64 value2, int use_params)
+{
+  OrcProgram *p_const;
+  OrcProgram *p_array;
+  OrcExecutor *ex;
+  orc_int64 src[2][N];
+  orc_int64 dest_const[N];
+  orc_int64 dest_array[N];
+  const char *src2 = NULL;
+  int ret = TRUE;
+  int i;
+
+  p_const = orc_program_new ();
+  orc_program_set_name (p_const, "test_invariant");
+  orc_program_add_destination (p_const, opcode->dest_size[0], "d1");
+  add_source_value (p_const, opcode->src_size[0], value1, "c1", use_params);
+
+  p_array = orc_program_new ();
+  orc_program_set_name (p_array, "test_invariant_array");
+  orc_program_add_destination (p_array, opcode->dest_size[0], "d1");
+  orc_program_add_source (p_array, opcode->src_size[0], "s1");
+
+  if (opcode->src_size[1] != 0) {
+    add_source_value (p_const, opcode->src_size[1], value2, "c2",
+        use_params);
+    if (opcode->flags & ORC_STATIC_OPCODE_SCALAR) {
+      add_constant (p_array, opcode->src_size[1], value2, "c2");
+      src2 = "c2";
+    } else {
+      orc_program_add_source (p_array, opcode->src_size[1], "s2");
+      src2 = "s2";
+    }
+  }
+  orc_program_append_str (p_const, opcode->name, "d1", "c1",
+      opcode->src_size[1] ? "c2" : NULL);
+  orc_program_append_str (p_array, opcode->name, "d1", "s1", src2);
+
+  for(i=0;i<N;i++){
+    set_element (src[0], opcode->src_size[0], i, value1);
+    set_element (src[1], opcode->src_size[1], i, value2);
+  }
+  memset (dest_const, 0, sizeof(dest_const));
+  memset (dest_array, 0, sizeof(dest_array));
+
+  orc_program_compile (p_const);
+  ex = orc_executor_new (p_const);
+  orc_executor_set_n (ex, N);
+  orc_executor_set_array (ex, ORC_VAR_D1, dest_const);
+  if (use_params) {
+    set_param (ex, ORC_VAR_P1, opcode->src_size[0], value1);
+    set_param (ex, ORC_VAR_P2, opcode->src_size[1], value2);
+  }
+  orc_executor_run (ex);
+  orc_executor_free (ex);
+
+  orc_program_compile (p_array);
+  ex = orc_executor_new (p_array);
+  orc_executor_set_n (ex, N);
+  orc_executor_set_array (ex, ORC_VAR_S1, src[0]);
+  orc_executor_set_array (ex, ORC_VAR_S2, src[1]);
+  orc_executor_set_array (ex, ORC_VAR_D1, dest_array);
+  orc_executor_emulate (ex);
+  orc_executor_free (ex);
+
+  if (memcmp (dest_const, dest_array, sizeof(dest_const)) != 0) {
+    printf("%s 0x%08x%08x 0x%08x%08x: %s result differs from the "
+        "emulator\n", opcode->name,
+        (orc_uint32)(value1 >> 32), (orc_uint32)value1,
+        (orc_uint32)(value2 >> 32), (orc_uint32)value2,
+        use_params ? "parameter" : "constant");
+    ret = FALSE;
+  }
+
+  orc_program_free (p_const);
+  orc_program_free (p_array);
+
+  return ret;
+}
+
+/* With constants, the simplifier computes the result at compile time.
+ * With parameters, the instruction is moved out of the loop. */
+static void
+test_invariant (int use_params)
+{
+  OrcOpcodeSet *opcode_set;
+  int i, j, k;
+
+  opcode_set = orc_opcode_set_get ("sys");
+
+  for(i=0;i<opcode_set->n_opcodes;i++){
+    OrcStaticOpcode *opcode = opcode_set->opcodes + i;
+
+    if (opcode->flags & (ORC_STATIC_OPCODE_FLOAT | ORC_STATIC_OPCODE_LOAD |
+          ORC_STATIC_OPCODE_STORE | ORC_STATIC_OPCODE_ACCUMULATOR |
+          ORC_STATIC_OPCODE_ITERATOR | ORC_STATIC_OPCODE_INVARIANT)) {
+      continue;
+    }
+    if (opcode->dest_size[1] != 0 || opcode->src_size[2] != 0) continue;
+
+    for(j=0;j<N_VALUES;j++){
+      for(k=0;k<N_VALUES;k++){
+        orc_int64 value2 = values[k];
+
+        /* shift counts */
+        if (opcode->flags & ORC_STATIC_OPCODE_SCALAR) {
+          value2 &= opcode->src_size[0] * 8 - 1;
+        }
+        if (!test_invariant_opcode (opcode, values[j], value2, use_params)) {
+          error = TRUE;
+        }
+        if (opcode->src_size[1] == 0) break;
+      }
+    }
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  OrcProgram *p;
+  OrcExecutor *ex;
+  OrcCompileResult result;
+  orc_int16 src1[N], src2[N];
+  orc_int16 dest1[N], dest2[N];
+  int i;
+
+  orc_init ();
+  orc_test_init ();
+
+  p = make_program ();
+  result = orc_program_compile (p);
+  if (ORC_COMPILE_RESULT_IS_FATAL (result)) {
+    printf("compile failed: %s\n", orc_program_get_error (p));
+    return 1;
+  }
+
+  if (!passes_disabled () &&
+      p->orccode->n_compiled_insns != N_OPTIMIZED_INSNS) {
+    printf("%d instructions after optimizing, expected %d\n",
+        p->orccode->n_compiled_insns, N_OPTIMIZED_INSNS);
+    error = TRUE;
+  }
+  if (p->orccode->n_insns <= N_OPTIMIZED_INSNS) {
+    printf("the emulator runs the optimized instructions\n");
+    error = TRUE;
+  }
+
+  for(i=0;i<N;i++){
+    src1[i] = i * 1031;
+    src2[i] = i * 77 + 5;
+  }
+
+  ex = orc_executor_new (p);
+  orc_executor_set_n (ex, N);
+  orc_executor_set_array (ex, ORC_VAR_S1, src1);
+  orc_executor_set_array (ex, ORC_VAR_S2, src2);
+  orc_executor_set_array (ex, ORC_VAR_D1, dest1);
+  orc_executor_set_array (ex, ORC_VAR_D2, dest2);
+  orc_executor_run (ex);
+  orc_executor_free (ex);
+
+  for(i=0;i<N;i++){
+    orc_int16 sum = src1[i] + src2[i];
+    orc_int16 x = (sum ^ 0x1234) + sum;
+
+    if (dest1[i] != x || dest2[i] != sum) {
+      printf("wrong result at %d: %d %d, expected %d %d\n", i,
+          dest1[i], dest2[i], x, sum);
+      error = TRUE;
+      break;
+    }
+  }
+
+  if (orc_test_compare_output_full (p, ORC_TEST_FLAGS_COMPILED) ==
+      ORC_TEST_FAILED) {
+    printf("optimized code differs from the emulator\n");
+    error = TRUE;
+  }
+
+  orc_program_free (p);
+
+  test_simplify ();
+  test_simplify_opcodes ();
+  test_invariant (FALSE);
+  test_invariant (TRUE);
+
+  if (error) return 1;
+  return 0;
+}
+
@@ -0,0 +1,300 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+#include <orc-test/orctest.h>
+
+/* Checks programs specialized with orc_program_specialize() against
+ * the emulator, and against the original program for the parameter
+ * values orc-test uses.  Checks that the copies are reused for the
+ * same values, and that one that is held survives more than
+ * ORC_N_SPECIALIZATIONS others being asked for, and that a program
+ * with no constants left for the values isn't specialized.  On sse, a
+ * multiplication by a power of two has to become a shift, unless the
+ * optimization passes are disabled. */
+
+int error = FALSE;
+
+static OrcProgram *
+make_shift (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (2, 2);
+  orc_program_set_name (p, "test_specialize_shift");
+  orc_program_add_parameter (p, 2, "p1");
+
+  orc_program_append_str (p, "shrsw", "d1", "s1", "p1");
+
+  return p;
+}
+
+static OrcProgram *
+make_mul (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (2, 2);
+  orc_program_set_name (p, "test_specialize_mul");
+  orc_program_add_parameter (p, 2, "p1");
+  orc_program_add_parameter (p, 2, "p2");
+  orc_program_add_temporary (p, 2, "t1");
+
+  orc_program_append_str (p, "mullw", "t1", "s1", "p1");
+  orc_program_append_str (p, "addw", "d1", "t1", "p2");
+
+  return p;
+}
+
+/* Uses every constant, none of them with the value 5 */
+static OrcProgram *
+make_full (void)
+{
+  OrcProgram *p;
+  char name[10];
+  int i;
+
+  p = orc_program_new_ds (2, 2);
+  orc_program_set_name (p, "test_specialize_full");
+  orc_program_add_parameter (p, 2, "p1");
+  orc_program_add_temporary (p, 2, "t1");
+
+  orc_program_append_str (p, "addw", "t1", "s1", "p1");
+  for(i=0;i<ORC_MAX_CONST_VARS;i++){
+    sprintf(name, "c%d", i + 1);
+    orc_program_add_constant (p, 2, 100 + i, name);
+    orc_program_append_str (p, "addw", "t1", "t1", name);
+  }
+  orc_program_append_ds_str (p, "copyw", "d1", "t1");
+
+  return p;
+}
+
+static OrcProgram *
+make_float (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (4, 4);
+  orc_program_set_name (p, "test_specialize_float");
+  orc_program_add_parameter_float (p, 4, "p1");
+
+  orc_program_append_str (p, "mulf", "d1", "s1", "p1");
+
+  return p;
+}
+
+static int
+compare_flags (OrcProgram *p, int var)
+{
+  if (p->vars[var].param_type == ORC_PARAM_TYPE_FLOAT) {
+    return ORC_TEST_FLAGS_COMPILED | ORC_TEST_FLAGS_FLOAT;
+  }
+  return ORC_TEST_FLAGS_COMPILED;
+}
+
+/* Specializes the parameters in vars to their values in params, and
+ * compares the result with the emulator.  The result is held until it
+ * is given back with orc_program_unspecialize(). */
+static OrcProgram *
+check (OrcProgram *p, const int *vars, int n_vars, const int *params)
+{
+  OrcProgram *s;
+  orc_int64 values[2];
+  int i;
+
+  for(i=0;i<n_vars;i++){
+    values[i] = params[vars[i] - ORC_VAR_P1];
+  }
+  s = orc_program_specialize (p, vars, values, n_vars);
+  if (s == NULL) {
+    printf("%s: not specialized\n", p->name);
+    error = TRUE;
+    return NULL;
+  }
+
+  if (orc_test_compare_output_full (s, compare_flags (p, vars[0])) ==
+      ORC_TEST_FAILED) {
+    printf("%s: specialized to %d differs from the emulator\n", p->name,
+        params[vars[0] - ORC_VAR_P1]);
+    error = TRUE;
+  }
+
+  return s;
+}
+
+static void
+check_once (OrcProgram *p, const int *vars, int n_vars, const int *params)
+{
+  OrcProgram *s;
+
+  s = check (p, vars, n_vars, params);
+  if (s) orc_program_unspecialize (p, s);
+}
+
+/* The same with every parameter in vars set to 2, which is what the
+ * original program is run with */
+static void
+check_reference (OrcProgram *p, const int *vars, int n_vars, int two)
+{
+  OrcProgram *s;
+  int params[2];
+
+  params[0] = two;
+  params[1] = two;
+  s = check (p, vars, n_vars, params);
+  if (s == NULL) return;
+
+  if (orc_test_compare_output_reference (s, p, compare_flags (p, vars[0])) ==
+      ORC_TEST_FAILED) {
+    printf("%s: specialized to 2 differs from the original\n", p->name);
+    error = TRUE;
+  }
+  orc_program_unspecialize (p, s);
+}
+
+/* The simplify pass makes the shift */
+static int
+passes_disabled (void)
+{
+  return orc_compiler_flag_check ("-opt") ||
+    orc_compiler_flag_check ("-simplify");
+}
+
+static int
+is_sse (void)
+{
+  OrcTarget *target = orc_target_get_default ();
+
+  return target && (strcmp (orc_target_get_name (target), "sse") == 0 ||
+      strcmp (orc_target_get_name (target), "avx2") == 0);
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const int p1[] = { ORC_VAR_P1 };
+  static const int p2[] = { ORC_VAR_P2 };
+  static const int p1_p2[] = { ORC_VAR_P1, ORC_VAR_P2 };
+  static const int s1[] = { ORC_VAR_S1 };
+  OrcProgram *p;
+  OrcProgram *s;
+  OrcProgram *t;
+  OrcProgram *held[ORC_N_SPECIALIZATIONS];
+  orc_int64 value = 1;
+  int params[2];
+  int i;
+
+  orc_init ();
+  orc_test_init ();
+
+  p = make_shift ();
+  orc_program_compile (p);
+  for(i=0;i<16;i++){
+    params[0] = i;
+    params[1] = 0;
+    check_once (p, p1, 1, params);
+  }
+  check_reference (p, p1, 1, 2);
+  orc_program_free (p);
+
+  p = make_mul ();
+  orc_program_compile (p);
+  params[0] = 8;
+  params[1] = 1000;
+  s = check (p, p1_p2, 2, params);
+  if (s && is_sse () && !passes_disabled ()) {
+    const char *asm_code = orc_program_get_asm_code (s);
+
+    if (asm_code == NULL || strstr (asm_code, "pmullw") != NULL ||
+        strstr (asm_code, "psllw") == NULL) {
+      printf("%s: multiplication by 8 is not a shift\n", p->name);
+      error = TRUE;
+    }
+  }
+  /* p1 stays a parameter, at the same index */
+  params[0] = -3;
+  check_once (p, p2, 1, params);
+  params[0] = 0x4000;
+  check_once (p, p1, 1, params);
+  check_reference (p, p1_p2, 2, 2);
+
+  /* the same values give the same program, and one that is held is
+   * kept when more than ORC_N_SPECIALIZATIONS others are asked for */
+  params[0] = 8;
+  params[1] = 1000;
+  t = check (p, p1_p2, 2, params);
+  if (t != s) {
+    printf("%s: not reused\n", p->name);
+    error = TRUE;
+  }
+  if (t) orc_program_unspecialize (p, t);
+  for(i=0;i<ORC_N_SPECIALIZATIONS;i++){
+    params[0] = 100 + i;
+    held[i] = check (p, p1_p2, 2, params);
+    t = check (p, p1_p2, 2, params);
+    if (t != held[i]) {
+      printf("%s: not reused\n", p->name);
+      error = TRUE;
+    }
+    if (t) orc_program_unspecialize (p, t);
+    if (held[i]) orc_program_unspecialize (p, held[i]);
+  }
+  params[0] = 8;
+  t = check (p, p1_p2, 2, params);
+  if (t != s) {
+    printf("%s: a held program was freed\n", p->name);
+    error = TRUE;
+  }
+  if (t) orc_program_unspecialize (p, t);
+  if (s) orc_program_unspecialize (p, s);
+
+  /* when all of them are held, the next one is the caller's own */
+  for(i=0;i<ORC_N_SPECIALIZATIONS;i++){
+    params[0] = 200 + i;
+    held[i] = check (p, p1_p2, 2, params);
+  }
+  params[0] = 300;
+  check_once (p, p1_p2, 2, params);
+  for(i=0;i<ORC_N_SPECIALIZATIONS;i++){
+    if (held[i]) orc_program_unspecialize (p, held[i]);
+  }
+
+  if (orc_program_specialize (p, s1, &value, 1) != NULL) {
+    printf("%s: specialized a source\n", p->name);
+    error = TRUE;
+  }
+  orc_program_free (p);
+
+  p = make_full ();
+  orc_program_compile (p);
+  value = 5;
+  if (orc_program_specialize (p, p1, &value, 1) != NULL) {
+    printf("%s: specialized without a constant for p1\n", p->name);
+    error = TRUE;
+  }
+  /* a constant with the same value is used for it */
+  params[0] = 100;
+  check_once (p, p1, 1, params);
+  orc_program_free (p);
+
+  p = make_float ();
+  orc_program_compile (p);
+  params[0] = 0x3f400000;
+  check_once (p, p1, 1, params);
+  /* 2.0 */
+  check_reference (p, p1, 1, 0x40000000);
+  orc_program_free (p);
+
+  if (error) return 1;
+  return 0;
+}
+
@@ -0,0 +1,190 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ORC_ENABLE_UNSTABLE_API
+
+#include <orc/orc.h>
+#include <orc-test/orctest.h>
+
+/* Checks programs that need more vector registers than the x86
+ * targets have.  They used to fail to compile, and now keep some of
+ * their variables on the stack.  The output of the compiled code is
+ * compared with the emulator, for the sse and the mmx target, which
+ * only has 8 registers. */
+
+#define N_PARAMS 8
+#define N_TEMPS 16
+
+int error = FALSE;
+
+static const char *temp_names[N_TEMPS] = {
+  "t1", "t2", "t3", "t4", "t5", "t6", "t7", "t8",
+  "t9", "t10", "t11", "t12", "t13", "t14", "t15", "t16"
+};
+
+/* Each parameter is loaded into a register before the loop, and all
+ * 16 temporaries are live when the sum starts */
+static OrcProgram *
+make_param_program (void)
+{
+  static const char *ops[] = {
+    "addw", "subw", "mullw", "xorw", "addw", "andw", "orw", "maxsw"
+  };
+  static const char *srcs[] = { "s1", "s2", "s3", "s4" };
+  static const char *param_names[N_PARAMS] = {
+    "p1", "p2", "p3", "p4", "p5", "p6", "p7", "p8"
+  };
+  OrcProgram *p;
+  int i;
+
+  p = orc_program_new ();
+  orc_program_set_name (p, "test_spill_params");
+  orc_program_add_destination (p, 2, "d1");
+  orc_program_add_source (p, 2, "s1");
+  orc_program_add_source (p, 2, "s2");
+  orc_program_add_source (p, 2, "s3");
+  orc_program_add_source (p, 2, "s4");
+  for(i=0;i<N_PARAMS;i++){
+    orc_program_add_parameter (p, 2, param_names[i]);
+  }
+  for(i=0;i<N_TEMPS;i++){
+    orc_program_add_temporary (p, 2, temp_names[i]);
+  }
+
+  for(i=0;i<N_PARAMS;i++){
+    orc_program_append_str (p, ops[i], temp_names[i], srcs[i%4],
+        param_names[i]);
+  }
+  orc_program_append_str (p, "minsw", "t9", "t1", "t2");
+  orc_program_append_str (p, "avguw", "t10", "t3", "t4");
+  orc_program_append_str (p, "subw", "t11", "t5", "t6");
+  orc_program_append_str (p, "mullw", "t12", "t7", "t8");
+  orc_program_append_str (p, "addw", "t13", "t9", "t10");
+  orc_program_append_str (p, "xorw", "t14", "t11", "t12");
+  orc_program_append_str (p, "mulhsw", "t15", "t1", "t8");
+  orc_program_append_str (p, "addssw", "t16", "t2", "t7");
+  for(i=1;i<N_TEMPS;i++){
+    orc_program_append_str (p, (i & 1) ? "addw" : "xorw", "t1", "t1",
+        temp_names[i]);
+  }
+  orc_program_append_ds_str (p, "copyw", "d1", "t1");
+
+  return p;
+}
+
+/* Bytes widened to words, kept live together with the constants */
+static OrcProgram *
+make_temp_program (void)
+{
+  OrcProgram *p;
+  int i;
+
+  p = orc_program_new ();
+  orc_program_set_name (p, "test_spill_temps");
+  orc_program_add_destination (p, 1, "d1");
+  orc_program_add_destination (p, 2, "d2");
+  orc_program_add_source (p, 1, "s1");
+  orc_program_add_source (p, 1, "s2");
+  orc_program_add_constant (p, 2, 3, "c1");
+  orc_program_add_constant (p, 2, 0x0101, "c2");
+  orc_program_add_constant (p, 2, 128, "c3");
+  for(i=0;i<N_TEMPS;i++){
+    orc_program_add_temporary (p, 2, temp_names[i]);
+  }
+
+  orc_program_append_ds_str (p, "convubw", "t1", "s1");
+  orc_program_append_ds_str (p, "convsbw", "t2", "s2");
+  for(i=2;i<N_TEMPS;i++){
+    switch (i % 4) {
+      case 0:
+        orc_program_append_str (p, "addw", temp_names[i],
+            temp_names[i-1], temp_names[i-2]);
+        break;
+      case 1:
+        orc_program_append_str (p, "shlw", temp_names[i],
+            temp_names[i-2], "c1");
+        break;
+      case 2:
+        orc_program_append_str (p, "mullw", temp_names[i],
+            temp_names[i-1], "c2");
+        break;
+      default:
+        orc_program_append_str (p, "subw", temp_names[i],
+            temp_names[i-3], "c3");
+        break;
+    }
+  }
+  for(i=N_TEMPS-2;i>=0;i--){
+    orc_program_append_str (p, (i & 1) ? "xorw" : "subw",
+        temp_names[N_TEMPS-1], temp_names[N_TEMPS-1], temp_names[i]);
+  }
+  orc_program_append_ds_str (p, "convwb", "d1", temp_names[N_TEMPS-1]);
+  orc_program_append_ds_str (p, "copyw", "d2", temp_names[N_TEMPS-1]);
+
+  return p;
+}
+
+static void
+test_program (OrcProgram *p, const char *target_name)
+{
+  static const int sizes[] = { 1, 15, 100 };
+  OrcTarget *target;
+  OrcCompileResult result;
+  unsigned int flags;
+  int i;
+
+  target = orc_target_get_by_name (target_name);
+  if (target == NULL || !target->executable) return;
+
+  flags = orc_target_get_default_flags (target);
+  if (strcmp (target_name, "mmx") == 0) {
+    /* SSE4.1 has no MMX forms */
+    flags &= ~ORC_TARGET_MMX_SSE4_1;
+  }
+  result = orc_program_compile_full (p, target, flags);
+  if (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (result)) {
+    printf("%s: failed to compile for %s: %s\n", p->name, target_name,
+        orc_program_get_error (p));
+    error = TRUE;
+    return;
+  }
+
+  for(i=0;i<(int)(sizeof(sizes)/sizeof(sizes[0]));i++){
+    if (orc_test_compare_output_n (p, sizes[i], 1, 0,
+          ORC_TEST_FLAGS_COMPILED) == ORC_TEST_FAILED) {
+      printf("%s: %s result differs from the emulator for n=%d\n",
+          p->name, target_name, sizes[i]);
+      error = TRUE;
+    }
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  OrcProgram *p;
+
+  orc_init ();
+  orc_test_init ();
+
+  p = make_param_program ();
+  test_program (p, "sse");
+  test_program (p, "mmx");
+  test_program (p, "avx2");
+  orc_program_free (p);
+
+  p = make_temp_program ();
+  test_program (p, "sse");
+  test_program (p, "mmx");
+  test_program (p, "avx2");
+  orc_program_free (p);
+
+  if (error) return 1;
+  return 0;
+}
+
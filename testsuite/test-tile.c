@@ -0,0 +1,109 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <orc/orc.h>
+#include <orc-test/orctest.h>
+
+/* Checks 2D programs with rows wide enough to be run in column strips
+ * that fit in the L2 cache, shaped like a vertical filter.  The output
+ * of the compiled code is compared with the emulator for row widths
+ * that don't divide into strips, and for misaligned pictures. */
+
+#define N_WIDTHS 6
+#define MAX_M 6
+
+int error = FALSE;
+
+static OrcProgram *
+make_filter (int size)
+{
+  OrcProgram *p;
+  const char *add = (size == 4) ? "addl" : "addw";
+  const char *shift = (size == 4) ? "shrsl" : "shrsw";
+
+  p = orc_program_new ();
+  orc_program_set_name (p, (size == 4) ? "test_tile_l" : "test_tile_w");
+  orc_program_set_2d (p);
+  orc_program_add_destination (p, size, "d1");
+  orc_program_add_source (p, size, "s1");
+  orc_program_add_source (p, size, "s2");
+  orc_program_add_source (p, size, "s3");
+  orc_program_add_constant (p, size, 2, "c1");
+  orc_program_add_temporary (p, size, "t1");
+  orc_program_add_temporary (p, size, "t2");
+
+  orc_program_append_str (p, add, "t1", "s1", "s3");
+  orc_program_append_str (p, add, "t2", "s2", "s2");
+  orc_program_append_str (p, add, "t1", "t1", "t2");
+  orc_program_append_str (p, shift, "d1", "t1", "c1");
+
+  return p;
+}
+
+static void
+test_filter (int size)
+{
+  OrcProgram *p;
+  OrcCompileResult result;
+  int widths[N_WIDTHS];
+  int level2;
+  int strip;
+  int i, j, k;
+
+  p = make_filter (size);
+  result = orc_program_compile (p);
+  if (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (result)) {
+    /* nothing to check for targets without a compiler */
+    orc_program_free (p);
+    return;
+  }
+
+  /* the strip width the compiler picks for one destination and three
+   * sources, which the row widths go around */
+  orc_get_data_cache_sizes (NULL, &level2, NULL);
+  strip = (level2 / 2 / (4 * size)) & ~63;
+  if (strip < 256) strip = 256;
+  widths[0] = 1;
+  widths[1] = 100;
+  widths[2] = strip - 1;
+  widths[3] = strip;
+  widths[4] = strip + 1;
+  widths[5] = 2 * strip + 100;
+
+  for(i=0;i<N_WIDTHS;i++){
+    for(j=0;j<2;j++){
+      for(k=0;k<2;k++){
+        int n = widths[i];
+        int m = k ? MAX_M : 1;
+
+        if (orc_test_compare_output_n (p, n, m, j,
+              ORC_TEST_FLAGS_COMPILED) == ORC_TEST_FAILED) {
+          printf("%s: n=%d m=%d misalignment=%d differs from the "
+              "emulator\n", p->name, n, m, j);
+          error = TRUE;
+        }
+      }
+    }
+  }
+
+  orc_program_free (p);
+}
+
+int
+main (int argc, char *argv[])
+{
+  orc_init ();
+  orc_test_init ();
+
+  test_filter (2);
+  test_filter (4);
+
+  if (error) return 1;
+  return 0;
+}
+
@@ -0,0 +1,148 @@
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <orc/orc.h>
+#include <orc-test/orctest.h>
+
+/* Checks the loop versions that ORC_CODE=versions adds, picked when
+ * the program is called for short n and for aligned arrays, against
+ * the emulator.  Each program runs for every n below a few vector
+ * widths, with the arrays moved off their alignment by 0 to 15
+ * elements, both all by the same amount and by different amounts. */
+
+#define MAX_N 70
+
+int error = FALSE;
+
+static OrcProgram *
+make_u8 (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_dss (1, 1, 1);
+  orc_program_set_name (p, "test_versions_u8");
+
+  orc_program_append_str (p, "addusb", "d1", "s1", "s2");
+
+  return p;
+}
+
+static OrcProgram *
+make_s16 (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_ds (2, 2);
+  orc_program_set_name (p, "test_versions_s16");
+  orc_program_add_parameter (p, 2, "p1");
+  orc_program_add_constant (p, 4, 1, "c1");
+  orc_program_add_temporary (p, 4, "t1");
+
+  orc_program_append_str (p, "mulswl", "t1", "s1", "p1");
+  orc_program_append_str (p, "shrsl", "t1", "t1", "c1");
+  orc_program_append_ds_str (p, "convssslw", "d1", "t1");
+
+  return p;
+}
+
+static OrcProgram *
+make_f32 (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_dss (4, 4, 4);
+  orc_program_set_name (p, "test_versions_f32");
+  orc_program_add_parameter_float (p, 4, "p1");
+  orc_program_add_temporary (p, 4, "t1");
+
+  orc_program_append_str (p, "mulf", "t1", "s2", "p1");
+  orc_program_append_str (p, "addf", "d1", "s1", "t1");
+
+  return p;
+}
+
+/* s1 is read one element ahead, so it can't be given aligned loads */
+static OrcProgram *
+make_offset (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new_dss (2, 2, 2);
+  orc_program_set_name (p, "test_versions_offset");
+  orc_program_add_constant (p, 4, 1, "c1");
+  orc_program_add_temporary (p, 2, "t1");
+
+  orc_program_append_str (p, "loadoffw", "t1", "s1", "c1");
+  orc_program_append_str (p, "addw", "d1", "t1", "s2");
+
+  return p;
+}
+
+static OrcProgram *
+make_acc (void)
+{
+  OrcProgram *p;
+
+  p = orc_program_new ();
+  orc_program_set_name (p, "test_versions_acc");
+  orc_program_add_source (p, 2, "s1");
+  orc_program_add_accumulator (p, 2, "a1");
+
+  orc_program_append_str (p, "accw", "a1", "s1", NULL);
+
+  return p;
+}
+
+static void
+test_program (OrcProgram *p, int flags)
+{
+  OrcCompileResult result;
+  int n, j, k;
+
+  result = orc_program_compile (p);
+  if (!ORC_COMPILE_RESULT_IS_SUCCESSFUL (result)) {
+    /* nothing to check for targets without a compiler */
+    orc_program_free (p);
+    return;
+  }
+
+  for(n=0;n<=MAX_N;n++){
+    for(k=0;k<2;k++){
+      for(j=0;j<16;j++){
+        if (orc_test_compare_output_n (p, n, 1, j, flags |
+              ORC_TEST_FLAGS_COMPILED |
+              (k ? 0 : ORC_TEST_FLAGS_SAME_ALIGNMENT)) == ORC_TEST_FAILED) {
+          printf("%s: n=%d misalignment %d%s differs from the emulator\n",
+              p->name, n, j, k ? " and up" : "");
+          error = TRUE;
+        }
+      }
+    }
+  }
+
+  orc_program_free (p);
+}
+
+int
+main (int argc, char *argv[])
+{
+  setenv ("ORC_CODE", "versions", 1);
+  orc_init ();
+  orc_test_init ();
+
+  test_program (make_u8 (), 0);
+  test_program (make_s16 (), 0);
+  test_program (make_f32 (), ORC_TEST_FLAGS_FLOAT);
+  test_program (make_offset (), 0);
+  test_program (make_acc (), 0);
+
+  if (error) return 1;
+  return 0;
+}
+
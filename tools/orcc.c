@@ -35,6 +35,7 @@ OrcProgram **programs;
 int use_inline = FALSE;
 int use_code = FALSE;
 int use_lazy_init = FALSE;
+int use_async_init = FALSE;
 int use_backup = TRUE;
 int use_internal = FALSE;
 int use_static = FALSE;
@@ -84,6 +85,7 @@ void help (void)
   printf("  --no-internal           Do not mark functions in header for internal visibility\n");
   printf("  --init-function FUNCTION  Generate initialization function\n");
   printf("  --lazy-init             Do Orc compile at function execution\n");
+  printf("  --async-init            Like --lazy-init, but compile in the background\n");
   printf("  --no-backup             Do not generate backup functions\n");
   printf("  --static-implementation Produce statically compiled code\n");
   printf("  --outputasm FILE        Write assembly output to FILE\n");
@@ -183,6 +185,9 @@ main (int argc, char *argv[])
       }
     } else if (strcmp(argv[i], "--lazy-init") == 0) {
       use_lazy_init = TRUE;
+    } else if (strcmp(argv[i], "--async-init") == 0) {
+      use_lazy_init = TRUE;
+      use_async_init = TRUE;
     } else if (strcmp(argv[i], "--no-backup") == 0) {
       use_backup = FALSE;
     } else if (strncmp(argv[i], "-", 1) == 0) {
@@ -229,6 +234,14 @@ main (int argc, char *argv[])
   if (compat >= ORC_VERSION(0,4,11,1)) {
     use_code = TRUE;
   }
+  if (use_async_init) {
+    if (compat < ORC_VERSION(0,4,23,1)) {
+      printf("--async-init requires compatibility version 0.4.24 or later\n");
+      exit (1);
+    }
+    /* the code can't be taken from a program that is still compiling */
+    use_code = FALSE;
+  }
 
   if (output_file == NULL) {
     switch (mode) {
@@ -993,7 +1006,11 @@ output_code_execute (OrcProgram *p, FILE *output, int is_inline, FILE *output_as
     fprintf(output, "\n");
     output_program_generation (p, output, is_inline);
     fprintf(output, "\n");
-    fprintf(output, "      orc_program_compile (p);\n");
+    if (use_async_init) {
+      fprintf(output, "      orc_program_compile_async (p);\n");
+    } else {
+      fprintf(output, "      orc_program_compile (p);\n");
+    }
     if (use_code) {
       fprintf(output, "      c = orc_program_take_code (p);\n");
       fprintf(output, "      orc_program_free (p);\n");
@@ -1293,7 +1310,7 @@ output_program_generation (OrcProgram *p, FILE *output, int is_inline)
   fprintf(output, "\n");
 
   for(i=0;i<p->n_insns;i++){
-    OrcInstruction *insn = p->insns + i;
+    OrcInstruction *insn = p->insn_table + i;
 
     if (compat < ORC_VERSION(0,4,6,1)) {
       if (insn->flags) {
@@ -1477,7 +1494,7 @@ output_code_test (OrcProgram *p, FILE *output)
   fprintf(output, "\n");
 
   for(i=0;i<p->n_insns;i++){
-    OrcInstruction *insn = p->insns + i;
+    OrcInstruction *insn = p->insn_table + i;
     if (compat < ORC_VERSION(0,4,6,1)) {
       if (insn->flags) {
         REQUIRE(0,4,6,1);